@@ -0,0 +1,522 @@
+/*
+ * Microphone capture pipeline
+ * The source (DMIC driver or the emulated DMA timer) fills slab blocks in
+ * interrupt context and only queues them; all processing runs in the
+ * capture thread, and the SD write is handed off to the storage writer,
+ * so nothing on the capture path ever waits for the card.
+ */
+
+#include "capture.h"
+#include "storage_writer.h"
+#include "audio_pool.h"
+#include "omi_threads.h"
+#include "sd_card.h"
+#include "cycle_counter.h"
+#if defined(CONFIG_OMI_CAPTURE_CODEC_ADPCM)
+#include "adpcm.h"
+#endif
+#if defined(CONFIG_OMI_CAPTURE_AEC)
+#include "aec.h"
+#include "pwm_audio.h"
+#endif
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(CONFIG_OMI_CAPTURE_EMUL)
+#include <zephyr/audio/dmic.h>
+#endif
+
+LOG_MODULE_REGISTER(capture, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define DECIMATION            CONFIG_OMI_CAPTURE_DECIMATION
+#define SOURCE_RATE           (CAPTURE_SAMPLE_RATE * DECIMATION)
+#define SOURCE_BLOCK_SAMPLES  (AUDIO_BLOCK_SAMPLES * DECIMATION)
+#define SOURCE_BLOCK_BYTES    (SOURCE_BLOCK_SAMPLES * sizeof(int16_t))
+#define SOURCE_BLOCK_US       ((AUDIO_BLOCK_SAMPLES * 1000000U) / CAPTURE_SAMPLE_RATE)
+
+/* VAD: speech is a block level this far above the tracked noise floor */
+#define VAD_RATIO             3
+#define VAD_MIN_LEVEL         200
+
+/* DMA target blocks, owned by the source until the capture thread frees them */
+K_MEM_SLAB_DEFINE_STATIC(capture_slab, SOURCE_BLOCK_BYTES, CONFIG_OMI_CAPTURE_DMA_BLOCKS, 4);
+
+static K_SEM_DEFINE(capture_run, 0, 1);
+static K_SEM_DEFINE(capture_idle, 0, 1);
+static K_MUTEX_DEFINE(capture_lock);
+
+static atomic_t running;
+static uint16_t gain_q8 = CAPTURE_GAIN_UNITY;
+static bool vad_enabled;
+static struct capture_stats stats;
+
+/* Stage state, reset on every start */
+static int16_t decim_hist[2];
+static uint32_t noise_floor;
+static uint32_t vad_hang;
+#if defined(CONFIG_OMI_CAPTURE_CODEC_ADPCM)
+static struct adpcm_state codec_state;
+#endif
+#if defined(CONFIG_OMI_CAPTURE_AEC)
+static struct aec aec;
+static uint32_t ref_pos;
+static uint32_t ref_epoch;
+static bool ref_aligned;
+#endif
+
+/* Sources */
+
+#if defined(CONFIG_OMI_CAPTURE_EMUL)
+/* Emulated DMIC: a timer plays the role of the PDM DMA-complete interrupt */
+K_MSGQ_DEFINE(emul_msgq, sizeof(void *), CONFIG_OMI_CAPTURE_DMA_BLOCKS, 4);
+static uint32_t emul_index;
+
+static void emul_timer_fn(struct k_timer *timer)
+{
+    void *buf;
+
+    ARG_UNUSED(timer);
+
+    if (k_mem_slab_alloc(&capture_slab, &buf, K_NO_WAIT) != 0) {
+        /* Capture thread fell behind: the "DMA" has nowhere to go */
+        stats.source_overruns++;
+        emul_index += SOURCE_BLOCK_SAMPLES;
+        return;
+    }
+
+    int16_t *s = buf;
+    for (size_t i = 0; i < SOURCE_BLOCK_SAMPLES; i++) {
+        s[i] = CAPTURE_EMUL_SAMPLE(emul_index++);
+    }
+    /* Cannot fail: the queue is as deep as the slab */
+    k_msgq_put(&emul_msgq, &buf, K_NO_WAIT);
+}
+
+K_TIMER_DEFINE(emul_timer, emul_timer_fn, NULL);
+
+static int source_start(void)
+{
+    emul_index = 0;
+    k_timer_start(&emul_timer, K_USEC(SOURCE_BLOCK_US), K_USEC(SOURCE_BLOCK_US));
+    return 0;
+}
+
+static int source_read(void **buf, int32_t timeout_ms)
+{
+    return k_msgq_get(&emul_msgq, buf, K_MSEC(timeout_ms));
+}
+
+static void source_stop(void)
+{
+    void *buf;
+
+    k_timer_stop(&emul_timer);
+    while (k_msgq_get(&emul_msgq, &buf, K_NO_WAIT) == 0) {
+        k_mem_slab_free(&capture_slab, buf);
+    }
+}
+#else
+static const struct device *const dmic = DEVICE_DT_GET(DT_NODELABEL(dmic_dev));
+
+static int source_start(void)
+{
+    static struct pcm_stream_cfg stream = {
+        .pcm_rate = SOURCE_RATE,
+        .pcm_width = 16,
+        .block_size = SOURCE_BLOCK_BYTES,
+        .mem_slab = &capture_slab,
+    };
+    struct dmic_cfg cfg = {
+        .io = {
+            .min_pdm_clk_freq = 1000000,
+            .max_pdm_clk_freq = 3500000,
+            .min_pdm_clk_dc = 40,
+            .max_pdm_clk_dc = 60,
+        },
+        .streams = &stream,
+        .channel = {
+            .req_num_chan = 1,
+            .req_num_streams = 1,
+            .req_chan_map_lo = dmic_build_channel_map(0, 0, PDM_CHAN_LEFT),
+        },
+    };
+    int ret;
+
+    if (!device_is_ready(dmic)) {
+        LOG_ERR("DMIC device is not ready");
+        return -ENODEV;
+    }
+
+    ret = dmic_configure(dmic, &cfg);
+    if (ret != 0) {
+        LOG_ERR("Failed to configure DMIC: %d", ret);
+        return ret;
+    }
+
+    return dmic_trigger(dmic, DMIC_TRIGGER_START);
+}
+
+static int source_read(void **buf, int32_t timeout_ms)
+{
+    size_t size;
+
+    return dmic_read(dmic, 0, buf, &size, timeout_ms);
+}
+
+static void source_stop(void)
+{
+    void *buf;
+
+    dmic_trigger(dmic, DMIC_TRIGGER_STOP);
+    while (source_read(&buf, 0) == 0) {
+        k_mem_slab_free(&capture_slab, buf);
+    }
+}
+#endif /* CONFIG_OMI_CAPTURE_EMUL */
+
+/* Stages */
+
+/* 2:1 decimation through a [1 3 3 1]/8 low-pass, history carried across blocks */
+static size_t stage_decimate(const int16_t *in, int16_t *out)
+{
+    if (DECIMATION == 1) {
+        memcpy(out, in, AUDIO_BLOCK_BYTES);
+        return AUDIO_BLOCK_SAMPLES;
+    }
+
+    for (size_t i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+        int32_t x0 = in[2 * i + 1];
+        int32_t x1 = in[2 * i];
+
+        out[i] = (int16_t)((x0 + 3 * x1 + 3 * decim_hist[0] + decim_hist[1]) / 8);
+        decim_hist[1] = (int16_t)x1;
+        decim_hist[0] = (int16_t)x0;
+    }
+    return AUDIO_BLOCK_SAMPLES;
+}
+
+#if defined(CONFIG_OMI_CAPTURE_AEC)
+/*
+ * Remove our own playback. Both clocks run at 16 kHz from the same
+ * oscillator, so the reference position is anchored once, when a mic
+ * block has just completed, and then advances a block at a time.
+ */
+static void stage_aec(int16_t *s, size_t n)
+{
+    static int16_t ref[AUDIO_BLOCK_SAMPLES];
+
+    /* The busy-wait engine's clock stops between streams */
+    uint32_t epoch = pwm_audio_ref_epoch();
+
+    if (!ref_aligned || epoch != ref_epoch) {
+        ref_pos = pwm_audio_ref_position() - n - CONFIG_OMI_AEC_BULK_DELAY;
+        ref_epoch = epoch;
+        ref_aligned = true;
+    }
+
+    int ret = pwm_audio_ref_read(ref_pos, ref, n);
+    ref_pos += n;
+    if (ret == -ERANGE) {
+        /* Capture fell too far behind the speaker: re-anchor next block */
+        ref_aligned = false;
+        return;
+    } else if (ret != 0) {
+        /* Engine not clocking (no sample timer and idle): nothing played */
+        return;
+    }
+
+    aec_process(&aec, s, ref, n);
+}
+#else
+static inline void stage_aec(int16_t *s, size_t n)
+{
+    ARG_UNUSED(s);
+    ARG_UNUSED(n);
+}
+#endif
+
+static void stage_gain(int16_t *s, size_t n)
+{
+    if (gain_q8 == CAPTURE_GAIN_UNITY) {
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        int32_t v = ((int32_t)s[i] * gain_q8) >> 8;
+        s[i] = (int16_t)CLAMP(v, INT16_MIN, INT16_MAX);
+    }
+}
+
+/* Energy VAD with a fast-falling, slow-rising noise floor and a hangover */
+static bool stage_vad(const int16_t *s, size_t n)
+{
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        sum += abs(s[i]);
+    }
+    uint32_t level = sum / n;
+
+    if (level < noise_floor) {
+        noise_floor = level;
+    } else {
+        noise_floor += ((level - noise_floor) >> 6) + 1;
+    }
+
+    if (level > VAD_MIN_LEVEL && level > noise_floor * VAD_RATIO) {
+        vad_hang = CONFIG_OMI_CAPTURE_VAD_HANGOVER_BLOCKS;
+    } else if (vad_hang > 0) {
+        vad_hang--;
+    }
+    return vad_hang > 0;
+}
+
+/* Returns the payload length in 16-bit words */
+static size_t stage_codec(int16_t *s, size_t n)
+{
+#if defined(CONFIG_OMI_CAPTURE_CODEC_ADPCM)
+    uint8_t enc[ADPCM_BLOCK_BYTES(AUDIO_BLOCK_SAMPLES)];
+    size_t bytes = adpcm_encode_block(&codec_state, s, n, enc);
+
+    memcpy(s, enc, bytes);
+    return (bytes + 1) / 2;
+#else
+    return n;
+#endif
+}
+
+static void process_block(int16_t *src)
+{
+    struct audio_block *block = audio_pool_alloc(K_NO_WAIT);
+    if (block == NULL) {
+        stats.pool_drops++;
+        return;
+    }
+
+    size_t n = stage_decimate(src, block->data);
+
+    stage_aec(block->data, n);
+    stage_gain(block->data, n);
+    if (vad_enabled && !stage_vad(block->data, n)) {
+        stats.vad_skipped++;
+        audio_pool_free(block);
+        return;
+    }
+
+    block->samples = stage_codec(block->data, n);
+    storage_writer_submit(block);
+    stats.blocks_stored++;
+}
+
+static void capture_thread_fn(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    while (1) {
+        k_sem_take(&capture_run, K_FOREVER);
+
+        while (atomic_get(&running)) {
+            void *buf;
+
+            if (source_read(&buf, 2 * SOURCE_BLOCK_US / 1000) != 0) {
+                stats.source_errors++;
+                continue;
+            }
+
+            uint32_t start = cycle_counter_get();
+
+            stats.blocks_captured++;
+            process_block(buf);
+            k_mem_slab_free(&capture_slab, buf);
+
+            uint32_t us = cycle_counter_to_ns(cycle_counter_get() - start) / 1000U;
+            stats.max_process_us = MAX(stats.max_process_us, us);
+        }
+
+        k_sem_give(&capture_idle);
+    }
+}
+
+K_THREAD_DEFINE(capture, OMI_STACK_CAPTURE, capture_thread_fn, NULL, NULL, NULL,
+                OMI_PRIO_CAPTURE, 0, 0);
+
+/* Public API */
+
+static int capture_begin(const char *filename, uint8_t first)
+{
+    int ret;
+
+    k_mutex_lock(&capture_lock, K_FOREVER);
+    if (atomic_get(&running)) {
+        k_mutex_unlock(&capture_lock);
+        return -EBUSY;
+    }
+
+    if (filename != NULL) {
+        ret = storage_writer_open(filename);
+    } else {
+        ret = storage_writer_open_segments(first);
+    }
+    if (ret != 0) {
+        k_mutex_unlock(&capture_lock);
+        return ret;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    memset(decim_hist, 0, sizeof(decim_hist));
+    noise_floor = VAD_MIN_LEVEL;
+    vad_hang = 0;
+#if defined(CONFIG_OMI_CAPTURE_CODEC_ADPCM)
+    adpcm_init(&codec_state);
+#endif
+#if defined(CONFIG_OMI_CAPTURE_AEC)
+    aec_init(&aec);
+    ref_aligned = false;
+#endif
+
+    atomic_set(&running, 1);
+    ret = source_start();
+    if (ret != 0) {
+        atomic_set(&running, 0);
+        storage_writer_close();
+        k_mutex_unlock(&capture_lock);
+        return ret;
+    }
+
+    k_sem_give(&capture_run);
+    k_mutex_unlock(&capture_lock);
+    return 0;
+}
+
+int capture_start(const char *filename)
+{
+    return capture_begin(filename, 0);
+}
+
+int capture_start_segments(uint8_t first)
+{
+    return capture_begin(NULL, first);
+}
+
+int capture_stop(void)
+{
+    k_mutex_lock(&capture_lock, K_FOREVER);
+    if (!atomic_get(&running)) {
+        k_mutex_unlock(&capture_lock);
+        return -EALREADY;
+    }
+
+    /* The thread notices within one read timeout */
+    atomic_set(&running, 0);
+    k_sem_take(&capture_idle, K_FOREVER);
+    source_stop();
+
+    int ret = storage_writer_close();
+    k_mutex_unlock(&capture_lock);
+
+    LOG_INF("Capture stopped: %u blocks, %u stored, %u overruns, %u pool drops",
+            stats.blocks_captured, stats.blocks_stored, stats.source_overruns,
+            stats.pool_drops);
+    return ret;
+}
+
+bool capture_is_running(void)
+{
+    return atomic_get(&running);
+}
+
+void capture_set_gain(uint16_t gain)
+{
+    gain_q8 = gain;
+}
+
+void capture_set_vad(bool enable)
+{
+    vad_enabled = enable;
+}
+
+void capture_get_stats(struct capture_stats *out)
+{
+    *out = stats;
+#if defined(CONFIG_OMI_CAPTURE_AEC)
+    out->aec_erle_db = aec.stats.erle_db;
+    out->aec_double_talk = aec.stats.double_talk_blocks;
+    out->aec_max_us = aec.stats.max_block_us;
+    out->aec_over_budget = aec.stats.over_budget;
+#endif
+}
+
+int capture_verify(const char *filename, uint32_t *samples, uint32_t *errors)
+{
+    static int16_t buf[AUDIO_BLOCK_SAMPLES];
+    struct sd_card_stream stream;
+    int16_t expected = 0;
+    bool first = true;
+    int ret;
+
+    if (DECIMATION != 1 || gain_q8 != CAPTURE_GAIN_UNITY ||
+        IS_ENABLED(CONFIG_OMI_CAPTURE_CODEC_ADPCM)) {
+        return -ENOTSUP;
+    }
+
+    ret = sd_card_stream_open(&stream, filename);
+    if (ret != 0) {
+        return ret;
+    }
+
+    *samples = 0;
+    *errors = 0;
+    while ((ret = sd_card_stream_read(&stream, buf, sizeof(buf))) > 0) {
+        for (int i = 0; i < ret / (int)sizeof(int16_t); i++) {
+            if (!first && buf[i] != expected) {
+                (*errors)++;
+            }
+            expected = (int16_t)(buf[i] + CAPTURE_EMUL_STEP);
+            first = false;
+        }
+        *samples += ret / sizeof(int16_t);
+    }
+    sd_card_stream_close(&stream);
+
+    return (ret < 0) ? ret : 0;
+}
+
+#if defined(CONFIG_OMI_CAPTURE_SELFTEST)
+/* End-to-end capture -> SD check, run once at boot (twister) */
+static void capture_selftest_fn(void *p1, void *p2, void *p3)
+{
+    struct storage_writer_stats writer;
+    uint32_t samples = 0;
+    uint32_t errors = 0;
+
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    k_sleep(K_SECONDS(1));
+    if (capture_start("capture.raw") != 0) {
+        printk("CAPTURE_FAILED\n");
+        return;
+    }
+    k_sleep(K_SECONDS(CONFIG_OMI_CAPTURE_SELFTEST_SECONDS));
+    capture_stop();
+    storage_writer_get_stats(&writer);
+
+    int ret = capture_verify("capture.raw", &samples, &errors);
+
+    printk("capture: %u blocks, %u stored, %u overruns, %u pool drops, max %u us/block\n",
+           stats.blocks_captured, stats.blocks_stored, stats.source_overruns,
+           stats.pool_drops, stats.max_process_us);
+    printk("storage: %u bytes (%u B/s), %u errors, max write %u us, max queue %u\n",
+           writer.bytes_written, writer.bytes_written / CONFIG_OMI_CAPTURE_SELFTEST_SECONDS,
+           writer.write_errors, writer.max_write_us, writer.max_queued);
+    printk("CAPTURE_DONE verify=%d samples=%u errors=%u\n", ret, samples, errors);
+}
+
+K_THREAD_DEFINE(capture_selftest, OMI_STACK_BENCH, capture_selftest_fn, NULL, NULL, NULL,
+                OMI_PRIO_BENCH, 0, 0);
+#endif
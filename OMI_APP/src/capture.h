@@ -0,0 +1,88 @@
+/*
+ * Microphone capture pipeline
+ * DMIC (PDM) blocks filled by DMA -> decimation -> echo suppression ->
+ * gain -> VAD -> codec -> storage writer. On boards without a DMIC an emulated source feeds a
+ * known waveform so the whole path can be checked end to end.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CAPTURE_SAMPLE_RATE   16000
+
+/* Emulated source waveform: a 16-bit ramp, so every lost sample shows up */
+#define CAPTURE_EMUL_STEP     7
+#define CAPTURE_EMUL_SAMPLE(n) ((int16_t)((uint32_t)(n) * CAPTURE_EMUL_STEP))
+
+#define CAPTURE_GAIN_UNITY    256     // Q8
+
+struct capture_stats {
+    uint32_t blocks_captured;   /* source blocks received */
+    uint32_t blocks_stored;     /* blocks handed to the storage writer */
+    uint32_t source_overruns;   /* source blocks lost before the capture thread saw them */
+    uint32_t source_errors;     /* failed or timed-out source reads */
+    uint32_t pool_drops;        /* blocks dropped for lack of a pool block */
+    uint32_t vad_skipped;       /* blocks discarded as silence */
+    uint32_t max_process_us;    /* worst per-block processing time */
+    int32_t aec_erle_db;        /* echo suppression achieved on the last block */
+    uint32_t aec_double_talk;   /* blocks with echo-path adaptation held */
+    uint32_t aec_max_us;        /* worst echo suppression time per block */
+    uint32_t aec_over_budget;   /* blocks over CONFIG_OMI_AEC_BUDGET_US */
+};
+
+/**
+ * @brief Start recording to a file on the SD card
+ * @param filename File name relative to the SD mount point
+ * @return 0 on success, negative error code on failure
+ */
+int capture_start(const char *filename);
+
+/**
+ * @brief Start recording to the OMI audio segments, rolling over as they fill
+ * @param first Audio file number of the first segment
+ * @return 0 on success, negative error code on failure
+ */
+int capture_start_segments(uint8_t first);
+
+/**
+ * @brief Stop recording and close the file once everything is written
+ * @return 0 on success, negative error code on failure
+ */
+int capture_stop(void);
+
+/**
+ * @brief Whether a recording is in progress
+ */
+bool capture_is_running(void);
+
+/**
+ * @brief Set the digital gain applied after decimation
+ * @param gain_q8 Gain in Q8 (CAPTURE_GAIN_UNITY = 0 dB)
+ */
+void capture_set_gain(uint16_t gain_q8);
+
+/**
+ * @brief Enable or disable dropping of silent blocks
+ */
+void capture_set_vad(bool enable);
+
+/**
+ * @brief Get statistics for the current or last recording
+ */
+void capture_get_stats(struct capture_stats *stats);
+
+/**
+ * @brief Check a recording of the emulated source for lost samples
+ *
+ * Only meaningful for raw recordings at unity gain without decimation.
+ * @param filename File name relative to the SD mount point
+ * @param samples Number of samples in the file
+ * @param errors Number of discontinuities in the ramp
+ * @return 0 on success, -ENOTSUP if the pipeline alters samples, negative error code on failure
+ */
+int capture_verify(const char *filename, uint32_t *samples, uint32_t *errors);
+
+#endif /* CAPTURE_H */
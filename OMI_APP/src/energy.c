@@ -0,0 +1,119 @@
+/*
+ * Per-subsystem energy accounting
+ */
+
+#include "energy.h"
+#include "pwm_audio.h"
+#include "sd_card.h"
+
+#include <zephyr/kernel.h>
+#include <string.h>
+
+struct subsys_model {
+    const char *name;
+    const char *states[ENERGY_STATES_MAX];
+    uint32_t ua[ENERGY_STATES_MAX];
+};
+
+static const struct subsys_model model[ENERGY_SUBSYS_COUNT] = {
+    [ENERGY_CPU] = { "cpu", { "idle", "active" },
+                     { CONFIG_OMI_ENERGY_CPU_IDLE_UA, CONFIG_OMI_ENERGY_CPU_ACTIVE_UA } },
+    [ENERGY_AMP] = { "amp", { "shutdown", "awake" },
+                     { CONFIG_OMI_ENERGY_AMP_SHUTDOWN_UA, CONFIG_OMI_ENERGY_AMP_AWAKE_UA } },
+    [ENERGY_PWM] = { "pwm", { "idle", "streaming" },
+                     { CONFIG_OMI_ENERGY_PWM_IDLE_UA, CONFIG_OMI_ENERGY_PWM_STREAM_UA } },
+    [ENERGY_SD] = { "sd", { "suspended", "idle", "busy" },
+                    { CONFIG_OMI_ENERGY_SD_OFF_UA, CONFIG_OMI_ENERGY_SD_IDLE_UA,
+                      CONFIG_OMI_ENERGY_SD_BUSY_UA } },
+};
+
+/* Cumulative residency since boot */
+struct residency {
+    uint32_t uptime_ms;
+    uint32_t ms[ENERGY_SUBSYS_COUNT][ENERGY_STATES_MAX];
+};
+
+static K_MUTEX_DEFINE(energy_lock);
+static struct residency baseline;
+
+static void sample(struct residency *r)
+{
+    k_thread_runtime_stats_t cpu;
+    struct pwm_audio_power_stats audio;
+    struct sd_card_pm_stats sd;
+
+    memset(r, 0, sizeof(*r));
+    r->uptime_ms = k_uptime_get_32();
+
+    if (k_thread_runtime_stats_all_get(&cpu) == 0) {
+        uint32_t total = (uint32_t)k_cyc_to_ms_floor64(cpu.execution_cycles);
+        uint32_t idle = (uint32_t)k_cyc_to_ms_floor64(cpu.idle_cycles);
+
+        r->ms[ENERGY_CPU][0] = idle;
+        r->ms[ENERGY_CPU][1] = total - MIN(idle, total);
+    }
+
+    pwm_audio_get_power_stats(&audio);
+    r->ms[ENERGY_AMP][0] = audio.amp_shutdown_ms;
+    r->ms[ENERGY_AMP][1] = audio.amp_awake_ms;
+    r->ms[ENERGY_PWM][0] = audio.pwm_idle_ms;
+    r->ms[ENERGY_PWM][1] = audio.pwm_stream_ms;
+
+    sd_card_get_pm_stats(&sd);
+    r->ms[ENERGY_SD][0] = sd.off_ms;
+    r->ms[ENERGY_SD][1] = sd.on_ms - MIN(sd.busy_ms, sd.on_ms);
+    r->ms[ENERGY_SD][2] = MIN(sd.busy_ms, sd.on_ms);
+}
+
+/* uA * ms to uAh */
+#define UA_MS_PER_UAH (3600U * 1000U)
+
+void energy_get_report(struct energy_report *out, bool since_boot)
+{
+    struct residency now, base;
+    uint64_t total_ua_ms = 0;
+
+    k_mutex_lock(&energy_lock, K_FOREVER);
+    sample(&now);
+    if (since_boot) {
+        memset(&base, 0, sizeof(base));
+    } else {
+        base = baseline;
+    }
+    k_mutex_unlock(&energy_lock);
+
+    memset(out, 0, sizeof(*out));
+    out->window_ms = now.uptime_ms - base.uptime_ms;
+
+    for (int i = 0; i < ENERGY_SUBSYS_COUNT; i++) {
+        struct energy_subsys_report *s = &out->subsys[i];
+        uint64_t ua_ms = 0;
+
+        for (int j = 0; j < ENERGY_STATES_MAX && model[i].states[j] != NULL; j++) {
+            s->state_ms[j] = now.ms[i][j] - base.ms[i][j];
+            ua_ms += (uint64_t)s->state_ms[j] * model[i].ua[j];
+        }
+        s->charge_uah = (uint32_t)(ua_ms / UA_MS_PER_UAH);
+        s->avg_ua = out->window_ms ? (uint32_t)(ua_ms / out->window_ms) : 0;
+        total_ua_ms += ua_ms;
+    }
+    out->charge_uah = (uint32_t)(total_ua_ms / UA_MS_PER_UAH);
+    out->avg_ua = out->window_ms ? (uint32_t)(total_ua_ms / out->window_ms) : 0;
+}
+
+void energy_reset(void)
+{
+    k_mutex_lock(&energy_lock, K_FOREVER);
+    sample(&baseline);
+    k_mutex_unlock(&energy_lock);
+}
+
+const char *energy_subsys_name(enum energy_subsys subsys)
+{
+    return model[subsys].name;
+}
+
+const char *energy_state_name(enum energy_subsys subsys, int state)
+{
+    return (state < ENERGY_STATES_MAX) ? model[subsys].states[state] : NULL;
+}
@@ -0,0 +1,62 @@
+/*
+ * Per-subsystem energy accounting
+ * Time spent in each power state of the CPU, the PAM8403, the PWM
+ * peripherals and the SD card, multiplied by per-state currents from
+ * Kconfig (CONFIG_OMI_ENERGY_*_UA), gives an estimated charge per
+ * subsystem. Residency comes from counters the subsystems already keep,
+ * so nothing is sampled and the accounting costs nothing while idle.
+ *
+ * Reports cover either the time since boot or a measurement window
+ * started with energy_reset(), which is how a power-saving change is
+ * compared against a baseline. avg_ua is the average current over the
+ * period in uA (the charge divided by the elapsed time).
+ */
+
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum energy_subsys {
+    ENERGY_CPU,                 /* idle, active */
+    ENERGY_AMP,                 /* shutdown, awake */
+    ENERGY_PWM,                 /* idle (mid-scale carrier), streaming */
+    ENERGY_SD,                  /* suspended, idle, busy */
+    ENERGY_SUBSYS_COUNT,
+};
+
+#define ENERGY_STATES_MAX 3
+
+struct energy_subsys_report {
+    uint32_t state_ms[ENERGY_STATES_MAX];
+    uint32_t charge_uah;
+    uint32_t avg_ua;
+};
+
+struct energy_report {
+    uint32_t window_ms;
+    struct energy_subsys_report subsys[ENERGY_SUBSYS_COUNT];
+    uint32_t charge_uah;        /* all subsystems */
+    uint32_t avg_ua;
+};
+
+/**
+ * @brief Estimated consumption per subsystem and state
+ * @param since_boot Report since boot instead of since energy_reset()
+ */
+void energy_get_report(struct energy_report *report, bool since_boot);
+
+/**
+ * @brief Start a new measurement window
+ */
+void energy_reset(void);
+
+const char *energy_subsys_name(enum energy_subsys subsys);
+
+/**
+ * @return State name, NULL past the subsystem's last state
+ */
+const char *energy_state_name(enum energy_subsys subsys, int state);
+
+#endif /* ENERGY_H */
@@ -0,0 +1,99 @@
+/*
+ * BLE audio ingest
+ */
+
+#include "ingest.h"
+#include "cycle_counter.h"
+#include "omi_pm.h"
+#include "omi_threads.h"
+#include "speaker_pwm.h"
+#include "telemetry.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(ingest, CONFIG_LOG_DEFAULT_LEVEL);
+
+/* Release the amplifier vote after this long without packets */
+#define INGEST_IDLE_MS 100
+
+struct ingest_packet {
+    uint32_t queued;            /* cycle_counter_get() at submit */
+    uint16_t len;
+    uint8_t data[PACKET_SIZE];
+};
+
+K_MSGQ_DEFINE(ingest_msgq, sizeof(struct ingest_packet), CONFIG_OMI_INGEST_QUEUE_DEPTH, 4);
+
+static atomic_t packets;
+static atomic_t dropped;
+static atomic_t max_depth;
+static atomic_t max_wait_us;
+
+int ingest_submit(const void *buf, uint16_t len)
+{
+    struct ingest_packet pkt;
+
+    if (len > PACKET_SIZE) {
+        return -EINVAL;
+    }
+
+    pkt.queued = cycle_counter_get();
+    pkt.len = len;
+    memcpy(pkt.data, buf, len);
+    if (k_msgq_put(&ingest_msgq, &pkt, K_NO_WAIT) != 0) {
+        atomic_inc(&dropped);
+        return -ENOMEM;
+    }
+
+    atomic_val_t depth = k_msgq_num_used_get(&ingest_msgq);
+    atomic_val_t seen = atomic_get(&max_depth);
+    while (depth > seen && !atomic_cas(&max_depth, seen, depth)) {
+        seen = atomic_get(&max_depth);
+    }
+    return 0;
+}
+
+void ingest_get_stats(struct ingest_stats *stats)
+{
+    stats->packets = atomic_get(&packets);
+    stats->dropped = atomic_get(&dropped);
+    stats->max_depth = atomic_get(&max_depth);
+    stats->max_wait_us = atomic_get(&max_wait_us);
+}
+
+static void ingest_thread_fn(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    static struct ingest_packet pkt;
+    bool amp_vote = false;
+
+    while (1) {
+        if (k_msgq_get(&ingest_msgq, &pkt, amp_vote ? K_MSEC(INGEST_IDLE_MS) : K_FOREVER) != 0) {
+            omi_pm_put(OMI_PM_AMP);
+            amp_vote = false;
+            continue;
+        }
+
+        if (!amp_vote) {
+            omi_pm_get(OMI_PM_AMP);
+            amp_vote = true;
+        }
+
+        uint32_t wait_us = cycle_counter_to_ns(cycle_counter_get() - pkt.queued) / 1000U;
+
+        if (wait_us > (uint32_t)atomic_get(&max_wait_us)) {
+            atomic_set(&max_wait_us, wait_us);  /* only this thread writes it */
+        }
+        telemetry_record_latency(TELEMETRY_LATENCY_INGEST, wait_us);
+        speak(pkt.len, pkt.data);
+        atomic_inc(&packets);
+    }
+}
+
+K_THREAD_DEFINE(ingest, OMI_STACK_BLE_INGEST, ingest_thread_fn, NULL, NULL, NULL,
+                OMI_PRIO_BLE_INGEST, 0, 0);
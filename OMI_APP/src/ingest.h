@@ -0,0 +1,35 @@
+/*
+ * BLE audio ingest
+ * Decouples the BLE receive path from playback: packets are copied into
+ * a queue from the transport callback and handed to speak() by the
+ * ingest thread, so a slow block allocation never stalls the BT stack.
+ */
+
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stdint.h>
+
+struct ingest_stats {
+    uint32_t packets;           /* packets handed to speak() */
+    uint32_t dropped;           /* packets rejected because the queue was full */
+    uint32_t max_depth;         /* deepest the queue has been */
+    uint32_t max_wait_us;       /* longest a packet waited for speak() */
+};
+
+/**
+ * @brief Queue a speak() packet received over BLE
+ *
+ * Safe to call from the BT RX context and from ISRs; never blocks.
+ * @param buf Packet payload (4-byte length header or PCM samples)
+ * @param len Payload length, at most PACKET_SIZE
+ * @return 0 on success, -EINVAL if too long, -ENOMEM if the queue is full
+ */
+int ingest_submit(const void *buf, uint16_t len);
+
+/**
+ * @brief Get ingest statistics
+ */
+void ingest_get_stats(struct ingest_stats *stats);
+
+#endif /* INGEST_H */
@@ -0,0 +1,66 @@
+/*
+ * BLE ingest replay from the host (native_sim)
+ * Stands in for the BT RX path: packets sent by scripts/speak_replay.py
+ * to 127.0.0.1:CONFIG_OMI_INGEST_HOST_PORT go to ingest_submit() the way
+ * the GATT write callback would hand them over, so ingest throughput,
+ * queue depth and playback underruns can be load tested without a phone.
+ */
+
+#include "ingest.h"
+#include "omi_threads.h"
+#include "speaker_pwm.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(ingest_host, CONFIG_LOG_DEFAULT_LEVEL);
+
+/* Provided by ingest_host_bottom.c, built against the host libc */
+extern int ingest_host_bottom_open(int port);
+extern int ingest_host_bottom_read(uint8_t *buf, int max, int *len);
+extern int ingest_host_bottom_connected(void);
+
+/* Socket poll period while a client is connected; one BLE connection
+ * interval at the shortest the phone negotiates */
+#define HOST_RX_POLL_MS 8
+#define HOST_RX_IDLE_MS 100
+
+static void host_rx_thread_fn(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    static uint8_t buf[PACKET_SIZE];
+    bool connected = false;
+    int len;
+
+    if (ingest_host_bottom_open(CONFIG_OMI_INGEST_HOST_PORT) < 0) {
+        LOG_ERR("Cannot listen on port %d", CONFIG_OMI_INGEST_HOST_PORT);
+        return;
+    }
+    LOG_INF("speak() replay on 127.0.0.1:%d", CONFIG_OMI_INGEST_HOST_PORT);
+
+    while (1) {
+        /* Everything that arrived since the last poll is delivered back
+         * to back, like the packets of one connection event */
+        int ret = ingest_host_bottom_read(buf, sizeof(buf), &len);
+
+        if (ret > 0) {
+            if (ingest_submit(buf, len) != 0) {
+                LOG_DBG("Replay packet dropped");
+            }
+            continue;
+        }
+        if (ret < 0) {
+            LOG_INF("Replay client disconnected");
+        } else if (!connected && ingest_host_bottom_connected()) {
+            LOG_INF("Replay client connected");
+        }
+        connected = ingest_host_bottom_connected();
+        k_sleep(K_MSEC(connected ? HOST_RX_POLL_MS : HOST_RX_IDLE_MS));
+    }
+}
+
+K_THREAD_DEFINE(ingest_host, OMI_STACK_HOST_RX, host_rx_thread_fn, NULL, NULL, NULL,
+                OMI_PRIO_HOST_RX, 0, 0);
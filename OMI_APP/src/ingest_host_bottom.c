@@ -0,0 +1,110 @@
+/*
+ * native_sim host side of the replay socket
+ * Compiled into the native simulator runner against the host libc. The
+ * whole simulation runs on one host thread, so nothing here may block:
+ * the socket is non-blocking and ingest_host.c polls it.
+ *
+ * Stream format: each speak() packet is a little-endian uint16 length
+ * followed by that many payload bytes, exactly as one BLE write.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int listen_fd = -1;
+static int client_fd = -1;
+static uint8_t rx[2 + 0xFFFF];
+static size_t rx_len;
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    return (flags < 0) ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int ingest_host_bottom_open(int port)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        return -1;
+    }
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 1) < 0 || set_nonblocking(listen_fd) < 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void drop_client(void)
+{
+    close(client_fd);
+    client_fd = -1;
+    rx_len = 0;
+}
+
+/* 1 with a packet in buf/len, 0 if none is complete yet, -1 when the
+ * client disconnected or broke the framing (its connection is dropped) */
+int ingest_host_bottom_read(uint8_t *buf, int max, int *len)
+{
+    if (client_fd < 0) {
+        client_fd = accept(listen_fd, NULL, NULL);
+        if (client_fd < 0) {
+            return 0;
+        }
+        if (set_nonblocking(client_fd) < 0) {
+            drop_client();
+            return 0;
+        }
+    }
+
+    for (;;) {
+        if (rx_len >= 2) {
+            size_t need = 2 + (rx[0] | (rx[1] << 8));
+
+            if (need - 2 > (size_t)max) {
+                drop_client();
+                return -1;
+            }
+            if (rx_len >= need) {
+                memcpy(buf, rx + 2, need - 2);
+                *len = (int)(need - 2);
+                memmove(rx, rx + need, rx_len - need);
+                rx_len -= need;
+                return 1;
+            }
+        }
+
+        ssize_t n = read(client_fd, rx + rx_len, sizeof(rx) - rx_len);
+
+        if (n > 0) {
+            rx_len += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return 0;
+        } else {
+            drop_client();
+            return -1;
+        }
+    }
+}
+
+int ingest_host_bottom_connected(void)
+{
+    return client_fd >= 0;
+}
@@ -0,0 +1,690 @@
+/*
+ * Combined OMI Application
+ * XIAO BLE (nRF52840) with Generic MicroSD Module and PAM8403 amplifier
+ *
+ * Links the SD card storage module (SDHC_OMI) and the PWM audio engine
+ * (PAM8403) into one image. BLE ingest, SD playback, recording and offload
+ * run concurrently; thread priorities come from omi_threads.h, audio
+ * buffers from the shared pool and power from omi_pm votes.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sd_card.h"
+#include "pwm_audio.h"
+#include "sd_player.h"
+#include "omi_pm.h"
+#include "ingest.h"
+#if defined(CONFIG_OMI_UI_SOUND)
+#include "ui_sound.h"
+#if defined(CONFIG_OMI_ASSET_BANK)
+#include "asset_bank.h"
+#endif
+#if defined(CONFIG_OMI_PROMPT_CACHE)
+#include "prompt_cache.h"
+#endif
+#endif
+#if defined(CONFIG_OMI_CAPTURE)
+#include "capture.h"
+#include "storage_writer.h"
+#endif
+#if defined(CONFIG_OMI_AUDIO_SETTINGS)
+#include "audio_settings.h"
+#endif
+#if defined(CONFIG_OMI_TELEMETRY)
+#include "telemetry.h"
+#endif
+#if defined(CONFIG_OMI_ENERGY)
+#include "energy.h"
+#endif
+
+LOG_MODULE_REGISTER(main, CONFIG_LOG_DEFAULT_LEVEL);
+
+/* Shell Commands */
+
+static int cmd_play_start(const struct shell *shell, size_t argc, const char **argv)
+{
+    int ret = sd_player_start(argv[1]);
+    if (ret == 0) {
+        shell_print(shell, "Playing '%s'", argv[1]);
+    } else {
+        shell_error(shell, "Failed to play '%s': %d", argv[1], ret);
+    }
+    return ret;
+}
+
+static int cmd_play_stop(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    sd_player_stop();
+    shell_print(shell, "Playback stopped");
+    return 0;
+}
+
+static int cmd_play_pause(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    int ret = sd_player_pause();
+    if (ret) {
+        shell_error(shell, "Not playing");
+    }
+    return ret;
+}
+
+static int cmd_play_resume(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    int ret = sd_player_resume();
+    if (ret) {
+        shell_error(shell, "Not paused");
+    }
+    return ret;
+}
+
+static int cmd_play_seek(const struct shell *shell, size_t argc, const char **argv)
+{
+    uint32_t position_ms = strtoul(argv[1], NULL, 10);
+
+    int ret = sd_player_seek(position_ms);
+    if (ret) {
+        shell_error(shell, "Seek failed: %d", ret);
+    }
+    return ret;
+}
+
+static int cmd_play_stats(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    static const char *const state_str[] = { "IDLE", "PLAYING", "PAUSED" };
+    struct sd_player_stats stats;
+    struct pwm_audio_stream_stats engine;
+
+    sd_player_get_stats(&stats);
+    pwm_audio_stream_get_stats(&engine);
+
+    shell_print(shell, "Player: %s  %u / %u ms", state_str[sd_player_get_state()],
+                stats.position_ms, stats.duration_ms);
+    shell_print(shell, "  Blocks read: %u", stats.blocks_read);
+    shell_print(shell, "  Underruns (SD latency): %u", stats.underruns);
+    shell_print(shell, "  Slow sector reads: %u (max %u us, budget %u us)",
+                stats.slow_reads, stats.max_read_us, PWM_AUDIO_BLOCK_PERIOD_US);
+    shell_print(shell, "  Engine: %u blocks played, %u queued, %u underruns total",
+                engine.blocks_played, engine.queued, engine.underruns);
+    shell_print(shell, "  Mixer: %u mixed, %u ducked, %u crossfades",
+                engine.mixed_blocks, engine.ducked_blocks, engine.crossfades);
+    shell_print(shell, "  Pool: %u free (low-water %u)",
+                audio_pool_free_count(), audio_pool_min_free());
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(play_cmd,
+    SHELL_CMD_ARG(start, NULL, "Play a file from the SD card: start <file>", cmd_play_start, 2, 0),
+    SHELL_CMD(stop, NULL, "Stop playback", cmd_play_stop),
+    SHELL_CMD(pause, NULL, "Pause playback", cmd_play_pause),
+    SHELL_CMD(resume, NULL, "Resume playback", cmd_play_resume),
+    SHELL_CMD_ARG(seek, NULL, "Seek to position: seek <ms>", cmd_play_seek, 2, 0),
+    SHELL_CMD(stats, NULL, "Show playback and underrun statistics", cmd_play_stats),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(play, &play_cmd, "SD audio playback commands", NULL);
+
+static int cmd_ingest(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    struct ingest_stats stats;
+    struct pwm_audio_stream_stats engine;
+
+    ingest_get_stats(&stats);
+    pwm_audio_stream_get_stats(&engine);
+
+    shell_print(shell, "BLE ingest: %u packets, %u dropped (queue full)",
+                stats.packets, stats.dropped);
+    shell_print(shell, "  Queue: max depth %u of %u, max wait %u us",
+                stats.max_depth, CONFIG_OMI_INGEST_QUEUE_DEPTH, stats.max_wait_us);
+    shell_print(shell, "  Engine: %u blocks played, %u underruns",
+                engine.blocks_played, engine.underruns);
+    return 0;
+}
+
+SHELL_CMD_REGISTER(ingest, NULL, "BLE speech ingest statistics", cmd_ingest);
+
+static int cmd_volume_set(const struct shell *shell, size_t argc, const char **argv)
+{
+    struct pwm_audio_gain_plan plan;
+
+    pwm_audio_set_loudness(strtol(argv[1], NULL, 10));
+    pwm_audio_plan_gain(pwm_audio_get_loudness(), &plan);
+    shell_print(shell, "Loudness %d dB: PAM8403 %d dB, digital %d dB, %u dB PWM range",
+                plan.loudness_db, plan.amp_db, plan.digital_db, plan.dynamic_range_db);
+    return 0;
+}
+
+static int cmd_volume_table(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    struct pwm_audio_stream_stats engine;
+
+    shell_print(shell, "Loudness  PAM8403  Digital  Volume  PWM range");
+    for (int db = PWM_AUDIO_LOUDNESS_MAX_DB; db >= PWM_AUDIO_LOUDNESS_MIN_DB; db--) {
+        struct pwm_audio_gain_plan plan;
+
+        pwm_audio_plan_gain(db, &plan);
+        shell_print(shell, "%5d dB  %4d dB  %4d dB  %3u/256  %3u dB%s", plan.loudness_db,
+                    plan.amp_db, plan.digital_db, plan.volume, plan.dynamic_range_db,
+                    db == pwm_audio_get_loudness() ? "  <" : "");
+    }
+
+    pwm_audio_stream_get_stats(&engine);
+    shell_print(shell, "Gain steps switched: %u at zero crossings, %u forced",
+                engine.gain_switches, engine.gain_switches_forced);
+    return 0;
+}
+
+static int cmd_volume_duck(const struct shell *shell, size_t argc, const char **argv)
+{
+    long db = strtol(argv[1], NULL, 10);
+
+    if (db < 0 || db > 60) {
+        shell_error(shell, "Ducking is 0 (off) to 60 dB");
+        return -EINVAL;
+    }
+    pwm_audio_set_duck_db((uint8_t)db);
+    shell_print(shell, "Lower-priority sources ducked by %ld dB", db);
+    return 0;
+}
+
+static int cmd_volume_mute(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    pwm_audio_set_user_mute(true);
+    shell_print(shell, "Muted");
+    return 0;
+}
+
+static int cmd_volume_unmute(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    pwm_audio_set_user_mute(false);
+    shell_print(shell, "Unmuted");
+    return 0;
+}
+
+#if defined(CONFIG_OMI_AUDIO_SETTINGS)
+static int cmd_volume_save(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    struct audio_settings_stats stats;
+    int ret = audio_settings_sync();
+
+    if (ret != 0) {
+        shell_error(shell, "Saving settings failed: %d", ret);
+    }
+    audio_settings_get_stats(&stats);
+    shell_print(shell, "Settings: %u changes, %u keys written, %u write-backs deferred, "
+                "%u errors", stats.changes, stats.writes, stats.deferred, stats.errors);
+    return ret;
+}
+#endif
+
+SHELL_STATIC_SUBCMD_SET_CREATE(volume_cmd,
+    SHELL_CMD_ARG(set, NULL, "Set loudness: set <dB>", cmd_volume_set, 2, 0),
+    SHELL_CMD_ARG(duck, NULL, "Attenuate media/speech under prompts: duck <dB>",
+                  cmd_volume_duck, 2, 0),
+    SHELL_CMD(mute, NULL, "Mute until unmuted, across reboots", cmd_volume_mute),
+    SHELL_CMD(unmute, NULL, "Clear the user mute", cmd_volume_unmute),
+#if defined(CONFIG_OMI_AUDIO_SETTINGS)
+    SHELL_CMD(save, NULL, "Write pending settings to flash now", cmd_volume_save),
+#endif
+    SHELL_CMD(table, NULL, "Show the gain staging for every loudness step", cmd_volume_table),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(volume, &volume_cmd, "Speaker loudness (PAM8403 + digital gain)", NULL);
+
+#if defined(CONFIG_OMI_UI_SOUND)
+static void ui_sound_power(bool active)
+{
+    if (active) {
+        omi_pm_get(OMI_PM_AMP);
+    } else {
+        /* The last block is still queued; the idle-off delay covers it */
+        omi_pm_put(OMI_PM_AMP);
+    }
+}
+
+static int cmd_sound_play(const struct shell *shell, size_t argc, const char **argv)
+{
+    int ret = ui_sound_play(argv[1]);
+    if (ret == -ENOENT) {
+        shell_error(shell, "No sound '%s'", argv[1]);
+    } else if (ret) {
+        shell_error(shell, "Sound queue full");
+    }
+    return ret;
+}
+
+static int cmd_sound_list(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    const struct synth_sound *sound;
+    uint32_t total = 0;
+
+    for (size_t i = 0; (sound = synth_sound_at(i)) != NULL; i++) {
+        shell_print(shell, "%-16s %3u bytes", sound->name, sound->size);
+        total += sound->size;
+    }
+    shell_print(shell, "%-16s %3u bytes", "total", total);
+
+#if defined(CONFIG_OMI_ASSET_BANK)
+    struct asset asset;
+
+    for (size_t i = 0; asset_at(i, &asset) == 0; i++) {
+        shell_print(shell, "%-16s %5u ms %5u bytes (prompt %u)", asset.name,
+                    asset.samples / (ASSET_SAMPLE_RATE / 1000), asset.size, asset.id);
+    }
+#endif
+    return 0;
+}
+
+#if defined(CONFIG_OMI_ASSET_BANK)
+static int cmd_sound_prompt(const struct shell *shell, size_t argc, const char **argv)
+{
+    int ret = ui_sound_play_prompt(argv[1]);
+    if (ret == -ENOENT) {
+        shell_error(shell, "No prompt '%s'", argv[1]);
+    } else if (ret) {
+        shell_error(shell, "Sound queue full");
+    }
+    return ret;
+}
+#endif
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sound_cmd,
+    SHELL_CMD_ARG(play, NULL, "Play a UI sound: play <name>", cmd_sound_play, 2, 0),
+#if defined(CONFIG_OMI_ASSET_BANK)
+    SHELL_CMD_ARG(prompt, NULL, "Play a voice prompt from flash: prompt <name>",
+                  cmd_sound_prompt, 2, 0),
+#endif
+    SHELL_CMD(list, NULL, "List the built-in UI sounds and prompts", cmd_sound_list),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(sound, &sound_cmd, "UI sounds and voice prompts", NULL);
+
+#if defined(CONFIG_OMI_PROMPT_CACHE)
+static int cmd_prompts_play(const struct shell *shell, size_t argc, const char **argv)
+{
+    int ret = prompt_cache_play(argv[1]);
+    if (ret) {
+        shell_error(shell, "Cannot play '%s': %d", argv[1], ret);
+    }
+    return ret;
+}
+
+static int cmd_prompts_prefetch(const struct shell *shell, size_t argc, const char **argv)
+{
+    int ret = prompt_cache_prefetch(argv[1]);
+    if (ret) {
+        shell_error(shell, "Cannot prefetch '%s': %d", argv[1], ret);
+    }
+    return ret;
+}
+
+static int cmd_prompts_stats(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    struct prompt_cache_stats st;
+    uint32_t plays;
+
+    prompt_cache_get_stats(&st);
+    plays = st.hits + st.misses;
+    shell_print(shell, "Hits:        %u / %u plays (%u%%)", st.hits, plays,
+                plays ? st.hits * 100 / plays : 0);
+    shell_print(shell, "Prefetches:  %u", st.prefetches);
+    shell_print(shell, "Evictions:   %u", st.evictions);
+    shell_print(shell, "Load errors: %u", st.load_errors);
+    shell_print(shell, "Slowest load: %u ms", st.max_load_ms);
+    shell_print(shell, "Memory:      %u / %u bytes in %u prompts", st.bytes_used, st.bytes_max,
+                st.entries);
+    return 0;
+}
+
+static int cmd_prompts_flush(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    prompt_cache_flush();
+    shell_print(shell, "Prompt cache flushed");
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(prompts_cmd,
+    SHELL_CMD_ARG(play, NULL, "Play an SD prompt through the cache: play <name>",
+                  cmd_prompts_play, 2, 0),
+    SHELL_CMD_ARG(prefetch, NULL, "Load a prompt ahead of need: prefetch <name>",
+                  cmd_prompts_prefetch, 2, 0),
+    SHELL_CMD(stats, NULL, "Show hit rate and memory use", cmd_prompts_stats),
+    SHELL_CMD(flush, NULL, "Drop every idle cached prompt", cmd_prompts_flush),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(prompts, &prompts_cmd, "Voice prompts from the SD card, cached in RAM", NULL);
+#endif /* CONFIG_OMI_PROMPT_CACHE */
+#endif /* CONFIG_OMI_UI_SOUND */
+
+static int cmd_power_status(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    struct sd_card_pm_stats sd;
+
+    shell_print(shell, "amp: %s, %u votes", omi_pm_is_on(OMI_PM_AMP) ? "on" : "off",
+                omi_pm_votes(OMI_PM_AMP));
+    shell_print(shell, "sd: %s, %u votes", omi_pm_is_on(OMI_PM_SD) ? "on" : "off",
+                omi_pm_votes(OMI_PM_SD));
+
+    sd_card_get_pm_stats(&sd);
+    shell_print(shell, "  SPI sleep state: %s, supply switch: %s",
+                sd.bus_pm ? "yes" : "no", sd.supply_gated ? "yes" : "no");
+    shell_print(shell, "  %u suspends, %u resumes; %u ms on (%u ms busy), %u ms suspended",
+                sd.suspends, sd.resumes, sd.on_ms, sd.busy_ms, sd.off_ms);
+    shell_print(shell, "  Resume: last %u us, max %u us", sd.last_resume_us, sd.max_resume_us);
+    shell_print(shell, "  Resume to first write: last %u us, max %u us",
+                sd.last_first_write_us, sd.max_first_write_us);
+    return 0;
+}
+
+/* Suspend, resume and write one sector, through the PM votes like any user */
+static int cmd_power_sdtest(const struct shell *shell, size_t argc, const char **argv)
+{
+    static uint8_t sector[512];
+    struct sd_card_stream file;
+    struct sd_card_pm_stats sd;
+    int cycles = (argc > 1) ? strtol(argv[1], NULL, 10) : 3;
+    int ret = 0;
+
+    for (int i = 0; i < cycles && ret == 0; i++) {
+        /* Wait out the idle-off delay so the card is really suspended */
+        for (int wait = 0; omi_pm_is_on(OMI_PM_SD) && wait < 100; wait++) {
+            k_sleep(K_MSEC(CONFIG_OMI_PM_IDLE_OFF_MS / 10 + 1));
+        }
+        if (omi_pm_is_on(OMI_PM_SD)) {
+            shell_error(shell, "SD card is in use, cannot suspend it");
+            return -EBUSY;
+        }
+
+        omi_pm_get(OMI_PM_SD);
+        ret = sd_card_stream_create(&file, "pmtest.bin");
+        if (ret == 0) {
+            ret = sd_card_stream_write(&file, sector, sizeof(sector));
+            ret = (ret == sizeof(sector)) ? 0 : -EIO;
+            sd_card_stream_close(&file);
+        }
+        omi_pm_put(OMI_PM_SD);
+
+        sd_card_get_pm_stats(&sd);
+        shell_print(shell, "cycle %d: resume %u us, first write %u us", i + 1,
+                    sd.last_resume_us, sd.last_first_write_us);
+    }
+    omi_pm_get(OMI_PM_SD);
+    sd_card_delete_file("pmtest.bin");
+    omi_pm_put(OMI_PM_SD);
+
+    if (ret != 0) {
+        shell_error(shell, "Test write failed: %d", ret);
+    }
+    return ret;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(power_cmd,
+    SHELL_CMD(status, NULL, "Show power domains and SD suspend/resume statistics",
+              cmd_power_status),
+    SHELL_CMD_ARG(sdtest, NULL, "Measure SD resume-to-first-write: sdtest [cycles]",
+                  cmd_power_sdtest, 1, 1),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(power, &power_cmd, "Power domains", NULL);
+
+#if defined(CONFIG_OMI_CAPTURE)
+static int cmd_rec_start(const struct shell *shell, size_t argc, const char **argv)
+{
+    int ret = capture_start(argv[1]);
+    if (ret == 0) {
+        shell_print(shell, "Recording to '%s'", argv[1]);
+    } else {
+        shell_error(shell, "Failed to record to '%s': %d", argv[1], ret);
+    }
+    return ret;
+}
+
+static int cmd_rec_segments(const struct shell *shell, size_t argc, const char **argv)
+{
+    uint32_t first = strtoul(argv[1], NULL, 10);
+
+    int ret = capture_start_segments((uint8_t)MIN(first, UINT8_MAX));
+    if (ret == 0) {
+        shell_print(shell, "Recording to segments from %u", first);
+    } else {
+        shell_error(shell, "Failed to record to segment %u: %d", first, ret);
+    }
+    return ret;
+}
+
+static int cmd_rec_stop(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    int ret = capture_stop();
+    if (ret == -EALREADY) {
+        shell_error(shell, "Not recording");
+    } else if (ret) {
+        shell_error(shell, "Recording closed with errors: %d", ret);
+    } else {
+        shell_print(shell, "Recording stopped");
+    }
+    return ret;
+}
+
+static int cmd_rec_gain(const struct shell *shell, size_t argc, const char **argv)
+{
+    uint32_t gain = strtoul(argv[1], NULL, 10);
+
+    capture_set_gain((uint16_t)MIN(gain, UINT16_MAX));
+    shell_print(shell, "Capture gain %u/256", (uint32_t)MIN(gain, UINT16_MAX));
+    return 0;
+}
+
+static int cmd_rec_vad(const struct shell *shell, size_t argc, const char **argv)
+{
+    bool enable = (strcmp(argv[1], "on") == 0);
+
+    capture_set_vad(enable);
+    shell_print(shell, "VAD %s", enable ? "on" : "off");
+    return 0;
+}
+
+static int cmd_rec_stats(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    struct capture_stats stats;
+    struct storage_writer_stats writer;
+
+    capture_get_stats(&stats);
+    storage_writer_get_stats(&writer);
+
+    shell_print(shell, "Capture: %s", capture_is_running() ? "RECORDING" : "IDLE");
+    shell_print(shell, "  Blocks: %u captured, %u stored, %u skipped by VAD",
+                stats.blocks_captured, stats.blocks_stored, stats.vad_skipped);
+    shell_print(shell, "  Drops: %u source overruns, %u pool, %u source errors",
+                stats.source_overruns, stats.pool_drops, stats.source_errors);
+    shell_print(shell, "  Processing: max %u us per block", stats.max_process_us);
+#if defined(CONFIG_OMI_CAPTURE_AEC)
+    shell_print(shell, "  Echo: ERLE %d dB, %u double-talk blocks, max %u us (%u over budget)",
+                stats.aec_erle_db, stats.aec_double_talk, stats.aec_max_us,
+                stats.aec_over_budget);
+#endif
+    shell_print(shell, "Storage: %u blocks, %u bytes, %u errors",
+                writer.blocks_written, writer.bytes_written, writer.write_errors);
+    shell_print(shell, "  Queue: %u (max %u), max write %u us",
+                writer.queued, writer.max_queued, writer.max_write_us);
+    shell_print(shell, "  Segments: %u rollovers (%u created in the write path), max %u us",
+                writer.rollovers, writer.rollover_stalls, writer.max_rollover_us);
+    return 0;
+}
+
+#if defined(CONFIG_OMI_CAPTURE_EMUL)
+static int cmd_rec_verify(const struct shell *shell, size_t argc, const char **argv)
+{
+    uint32_t samples;
+    uint32_t errors;
+
+    int ret = capture_verify(argv[1], &samples, &errors);
+    if (ret) {
+        shell_error(shell, "Verify failed: %d", ret);
+        return ret;
+    }
+    shell_print(shell, "%u samples, %u discontinuities", samples, errors);
+    return 0;
+}
+#endif
+
+SHELL_STATIC_SUBCMD_SET_CREATE(rec_cmd,
+    SHELL_CMD_ARG(start, NULL, "Record to a file on the SD card: start <file>", cmd_rec_start, 2, 0),
+    SHELL_CMD_ARG(segments, NULL, "Record to the audio segments: segments <first>",
+                  cmd_rec_segments, 2, 0),
+    SHELL_CMD(stop, NULL, "Stop recording", cmd_rec_stop),
+    SHELL_CMD_ARG(gain, NULL, "Set capture gain: gain <q8, 256 = 0 dB>", cmd_rec_gain, 2, 0),
+    SHELL_CMD_ARG(vad, NULL, "Drop silent blocks: vad <on|off>", cmd_rec_vad, 2, 0),
+    SHELL_CMD(stats, NULL, "Show capture and storage statistics", cmd_rec_stats),
+#if defined(CONFIG_OMI_CAPTURE_EMUL)
+    SHELL_CMD_ARG(verify, NULL, "Check an emulated-source recording: verify <file>",
+                  cmd_rec_verify, 2, 0),
+#endif
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(rec, &rec_cmd, "Microphone recording commands", NULL);
+#endif /* CONFIG_OMI_CAPTURE */
+
+#if defined(CONFIG_OMI_TELEMETRY)
+static int cmd_telemetry(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    static struct omi_telemetry snap;
+    static char hex[2 * sizeof(snap) + 1];
+
+    telemetry_snapshot(&snap);
+    bin2hex((const uint8_t *)&snap, sizeof(snap), hex, sizeof(hex));
+    /* One line, so scripts/telemetry_decode.py can pick it out of a log */
+    shell_print(shell, "TLM %s", hex);
+    return 0;
+}
+
+SHELL_CMD_REGISTER(telemetry, NULL, "Print the binary telemetry record as hex", cmd_telemetry);
+#endif
+
+#if defined(CONFIG_OMI_ENERGY)
+static int cmd_energy_show(const struct shell *shell, size_t argc, const char **argv)
+{
+    bool since_boot = (argc > 1) && (strcmp(argv[1], "boot") == 0);
+    struct energy_report r;
+
+    energy_get_report(&r, since_boot);
+    shell_print(shell, "Estimated over %u s %s:", r.window_ms / MSEC_PER_SEC,
+                since_boot ? "since boot" : "since reset");
+    for (int i = 0; i < ENERGY_SUBSYS_COUNT; i++) {
+        const struct energy_subsys_report *s = &r.subsys[i];
+
+        shell_print(shell, "%-4s %7u uA avg, %6u uAh", energy_subsys_name(i), s->avg_ua,
+                    s->charge_uah);
+        for (int j = 0; energy_state_name(i, j) != NULL; j++) {
+            shell_print(shell, "       %-10s %10u ms", energy_state_name(i, j), s->state_ms[j]);
+        }
+    }
+    shell_print(shell, "all  %7u uA avg, %6u uAh", r.avg_ua, r.charge_uah);
+    return 0;
+}
+
+static int cmd_energy_reset(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    energy_reset();
+    shell_print(shell, "Measurement window started");
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(energy_cmd,
+    SHELL_CMD_ARG(show, NULL, "Consumption per subsystem and state [boot]",
+                  cmd_energy_show, 1, 1),
+    SHELL_CMD(reset, NULL, "Start a new measurement window", cmd_energy_reset),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(energy, &energy_cmd, "Estimated energy use (uA average = uAh per hour)", NULL);
+#endif
+
+/* Main Application */
+int main(void)
+{
+    int ret;
+
+    LOG_INF("OMI Combined Application");
+    LOG_INF("XIAO BLE (nRF52840) with MicroSD and PAM8403");
+
+    ret = sd_card_start();
+    if (ret != 0) {
+        LOG_ERR("Failed to initialize SD card: %d", ret);
+    }
+
+    ret = pwm_audio_init();
+    if (ret != 0) {
+        LOG_ERR("Failed to initialize PWM audio: %d", ret);
+        return ret;
+    }
+
+    /* Amplifier and SD card stay off until a subsystem votes for them */
+    omi_pm_init();
+#if defined(CONFIG_OMI_UI_SOUND)
+    ui_sound_set_power_hook(ui_sound_power);
+#endif
+
+    LOG_INF("Ready - use 'play start <file>' to stream audio from the SD card");
+    return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * Coordinated power management for the combined OMI image
+ * Power transitions run on a dedicated low-priority work queue. The
+ * amplifier has to finish its mute ramp before it is shut down; the
+ * shutdown is a second work item after the ramp, so neither the system
+ * work queue, the audio threads nor votes on other domains wait for it.
+ */
+
+#include "omi_pm.h"
+#include "omi_threads.h"
+#include "pwm_audio.h"
+#include "sd_card.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(omi_pm, CONFIG_LOG_DEFAULT_LEVEL);
+
+struct pm_domain {
+    const char *name;
+    uint32_t votes;
+    bool on;
+    struct k_work_delayable off_work;
+};
+
+static K_THREAD_STACK_DEFINE(pm_stack, OMI_STACK_PM);
+static struct k_work_q pm_work_q;
+static K_MUTEX_DEFINE(pm_lock);
+static struct k_work_delayable amp_off_work;
+static bool amp_muting;         /* mute ramp running, shutdown scheduled */
+
+static struct pm_domain domains[OMI_PM_DOMAIN_COUNT] = {
+    [OMI_PM_AMP] = { .name = "amp" },
+    [OMI_PM_SD] = { .name = "sd" },
+};
+
+/* Called with pm_lock held */
+static void domain_power(omi_pm_domain_t domain, bool on)
+{
+    switch (domain) {
+    case OMI_PM_AMP:
+        if (on) {
+            if (amp_muting) {
+                /* Still awake: ramp back up instead of shutting down */
+                k_work_cancel_delayable(&amp_off_work);
+                amp_muting = false;
+                pwm_audio_unmute();
+            } else if (pwm_audio_is_ready()) {
+                /* Until the engine's bring-up finishes it powers the amplifier itself */
+                pam8403_wakeup();
+                pwm_audio_unmute();
+            }
+        } else {
+            /* Cut the amplifier once the mute ramp has finished */
+            pwm_audio_mute();
+            amp_muting = true;
+            k_work_schedule_for_queue(&pm_work_q, &amp_off_work,
+                                      K_MSEC(PWM_AUDIO_MUTE_RAMP_MS));
+        }
+        break;
+    case OMI_PM_SD:
+        if (on) {
+            sd_on();
+        } else {
+            sd_off();
+        }
+        break;
+    default:
+        return;
+    }
+
+    domains[domain].on = on;
+    LOG_DBG("%s %s", domains[domain].name, on ? "on" : "off");
+}
+
+static void off_work_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct pm_domain *d = CONTAINER_OF(dwork, struct pm_domain, off_work);
+    omi_pm_domain_t domain = d - domains;
+
+    /* Never cut the amplifier in the middle of its bring-up sequence */
+    if (domain == OMI_PM_AMP) {
+        pwm_audio_wait_ready(K_FOREVER);
+    }
+
+    k_mutex_lock(&pm_lock, K_FOREVER);
+    /* A vote may have arrived after the work was scheduled */
+    if (d->votes == 0 && d->on) {
+        domain_power(domain, false);
+    }
+    k_mutex_unlock(&pm_lock);
+}
+
+static void amp_off_work_handler(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    k_mutex_lock(&pm_lock, K_FOREVER);
+    /* A vote during the ramp has already unmuted it */
+    if (amp_muting) {
+        amp_muting = false;
+        pam8403_shutdown();
+    }
+    k_mutex_unlock(&pm_lock);
+}
+
+int omi_pm_init(void)
+{
+    k_work_queue_init(&pm_work_q);
+    k_work_queue_start(&pm_work_q, pm_stack, K_THREAD_STACK_SIZEOF(pm_stack),
+                       OMI_PRIO_PM, NULL);
+    k_thread_name_set(&pm_work_q.thread, "omi_pm");
+
+    /* Everything is powered at boot (the audio bring-up wakes the
+     * amplifier). Domains nobody has voted for yet are switched off from
+     * the PM queue, after that bring-up, so boot does not wait for it. */
+    k_work_init_delayable(&amp_off_work, amp_off_work_handler);
+    k_mutex_lock(&pm_lock, K_FOREVER);
+    for (int i = 0; i < OMI_PM_DOMAIN_COUNT; i++) {
+        domains[i].on = true;
+        k_work_init_delayable(&domains[i].off_work, off_work_handler);
+        if (domains[i].votes == 0) {
+            k_work_schedule_for_queue(&pm_work_q, &domains[i].off_work, K_NO_WAIT);
+        }
+    }
+    k_mutex_unlock(&pm_lock);
+
+    return 0;
+}
+
+void omi_pm_get(omi_pm_domain_t domain)
+{
+    struct pm_domain *d = &domains[domain];
+
+    k_mutex_lock(&pm_lock, K_FOREVER);
+    if (d->votes++ == 0) {
+        k_work_cancel_delayable(&d->off_work);
+        if (!d->on) {
+            domain_power(domain, true);
+        }
+    }
+    k_mutex_unlock(&pm_lock);
+}
+
+void omi_pm_put(omi_pm_domain_t domain)
+{
+    struct pm_domain *d = &domains[domain];
+
+    k_mutex_lock(&pm_lock, K_FOREVER);
+    if (d->votes == 0) {
+        LOG_WRN("Unbalanced put on %s", d->name);
+    } else if (--d->votes == 0) {
+        k_work_schedule_for_queue(&pm_work_q, &d->off_work,
+                                  K_MSEC(CONFIG_OMI_PM_IDLE_OFF_MS));
+    }
+    k_mutex_unlock(&pm_lock);
+}
+
+uint32_t omi_pm_votes(omi_pm_domain_t domain)
+{
+    k_mutex_lock(&pm_lock, K_FOREVER);
+    uint32_t votes = domains[domain].votes;
+    k_mutex_unlock(&pm_lock);
+
+    return votes;
+}
+
+bool omi_pm_is_on(omi_pm_domain_t domain)
+{
+    k_mutex_lock(&pm_lock, K_FOREVER);
+    bool on = domains[domain].on;
+    k_mutex_unlock(&pm_lock);
+
+    return on;
+}
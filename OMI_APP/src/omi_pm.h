@@ -0,0 +1,49 @@
+/*
+ * Coordinated power management for the combined OMI image
+ * Subsystems hold votes on the power domains they use. A domain is
+ * powered on the first vote and switched off once it has had no votes
+ * for CONFIG_OMI_PM_IDLE_OFF_MS, so back-to-back users never bounce it.
+ */
+
+#ifndef OMI_PM_H
+#define OMI_PM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Power Domains */
+typedef enum {
+    OMI_PM_AMP,         /* PAM8403 amplifier and PWM outputs */
+    OMI_PM_SD,          /* SD card */
+    OMI_PM_DOMAIN_COUNT
+} omi_pm_domain_t;
+
+/**
+ * @brief Put all domains into their idle (off) state
+ * @return 0 on success, negative error code on failure
+ */
+int omi_pm_init(void);
+
+/**
+ * @brief Take a vote on a domain, powering it on if needed
+ * @param domain Domain the caller is about to use
+ */
+void omi_pm_get(omi_pm_domain_t domain);
+
+/**
+ * @brief Release a vote taken with omi_pm_get()
+ * @param domain Domain the caller no longer needs
+ */
+void omi_pm_put(omi_pm_domain_t domain);
+
+/**
+ * @brief Current number of votes on a domain
+ */
+uint32_t omi_pm_votes(omi_pm_domain_t domain);
+
+/**
+ * @brief Whether a domain is currently powered
+ */
+bool omi_pm_is_on(omi_pm_domain_t domain);
+
+#endif /* OMI_PM_H */
@@ -0,0 +1,343 @@
+/*
+ * Voice prompt cache
+ * Entries move through FREE -> LOADING -> READY. Only READY entries sit on
+ * the LRU list, and only those that are not queued on the player (pins) are
+ * evicted, least recently used first, to make room for a new load.
+ */
+
+#include "prompt_cache.h"
+#include "storage_writer.h"
+#include "sd_card.h"
+#include "ui_sound.h"
+#include "asset_bank.h"
+#include "audio_pool.h"
+#include "adpcm.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/dlist.h>
+#include <stdio.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(prompt_cache, CONFIG_LOG_DEFAULT_LEVEL);
+
+enum entry_state {
+    ENTRY_FREE,
+    ENTRY_LOADING,
+    ENTRY_READY,
+};
+
+struct cache_entry {
+    sys_dnode_t lru;                /* on lru_list while READY, oldest first */
+    struct storage_read req;
+    struct asset clip;
+    char name[PROMPT_CACHE_NAME_MAX + 1];
+    char path[PROMPT_CACHE_NAME_MAX + sizeof(CONFIG_OMI_PROMPT_CACHE_DIR) + 6];
+    uint32_t load_start;
+    uint8_t state;
+    uint8_t pins;                   /* plays queued on the player */
+    bool play_on_load;
+};
+
+K_HEAP_DEFINE(clip_heap, CONFIG_OMI_PROMPT_CACHE_BYTES);
+static K_MUTEX_DEFINE(cache_lock);
+static sys_dlist_t lru_list = SYS_DLIST_STATIC_INIT(&lru_list);
+static struct cache_entry entries[CONFIG_OMI_PROMPT_CACHE_ENTRIES];
+static struct prompt_cache_stats stats;
+
+/* Encoder input; only the storage thread loads */
+static int16_t load_pcm[AUDIO_BLOCK_SAMPLES];
+
+/* Called with cache_lock held */
+static void evict_locked(struct cache_entry *e)
+{
+    sys_dlist_remove(&e->lru);
+    k_heap_free(&clip_heap, (void *)e->clip.data);
+    stats.bytes_used -= e->clip.size;
+    stats.entries--;
+    stats.evictions++;
+    e->state = ENTRY_FREE;
+    LOG_DBG("Evicted '%s'", e->name);
+}
+
+/* Least recently used entry that is not playing; called with cache_lock held */
+static struct cache_entry *lru_victim_locked(void)
+{
+    struct cache_entry *e;
+
+    SYS_DLIST_FOR_EACH_CONTAINER(&lru_list, e, lru) {
+        if (e->pins == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* Called with cache_lock held */
+static struct cache_entry *find_locked(const char *name)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(entries); i++) {
+        if (entries[i].state != ENTRY_FREE && strcmp(entries[i].name, name) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* Free slot for a new load, evicting if all are taken; called with cache_lock held */
+static struct cache_entry *claim_locked(const char *name)
+{
+    struct cache_entry *e = NULL;
+
+    for (size_t i = 0; i < ARRAY_SIZE(entries) && e == NULL; i++) {
+        if (entries[i].state == ENTRY_FREE) {
+            e = &entries[i];
+        }
+    }
+    if (e == NULL) {
+        e = lru_victim_locked();
+        if (e == NULL) {
+            return NULL;
+        }
+        evict_locked(e);
+    }
+
+    strcpy(e->name, name);
+    e->pins = 0;
+    e->play_on_load = false;
+    return e;
+}
+
+/* Arena space for a clip, evicting idle clips until it fits */
+static uint8_t *clip_alloc(size_t size)
+{
+    uint8_t *data;
+
+    if (size > CONFIG_OMI_PROMPT_CACHE_BYTES) {
+        return NULL;
+    }
+
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    while ((data = k_heap_alloc(&clip_heap, size, K_NO_WAIT)) == NULL) {
+        struct cache_entry *victim = lru_victim_locked();
+
+        if (victim == NULL) {
+            break;
+        }
+        evict_locked(victim);
+    }
+    k_mutex_unlock(&cache_lock);
+    return data;
+}
+
+/* Storage thread: read the WAV and compress it block by block into the arena */
+static int load_clip(struct storage_read *req, struct sd_card_stream *file)
+{
+    struct cache_entry *e = CONTAINER_OF(req, struct cache_entry, req);
+    uint32_t start, end;
+    int ret;
+
+    ret = sd_card_stream_find_pcm(file, ASSET_SAMPLE_RATE, &start, &end);
+    if (ret != 0) {
+        return ret;
+    }
+
+    uint32_t samples = (end - start) / sizeof(int16_t);
+    uint32_t rest = samples % AUDIO_BLOCK_SAMPLES;
+    size_t size = (samples / AUDIO_BLOCK_SAMPLES) * ADPCM_BLOCK_BYTES(AUDIO_BLOCK_SAMPLES) +
+                  (rest ? ADPCM_BLOCK_BYTES(rest) : 0);
+
+    if (samples == 0) {
+        return -EINVAL;
+    }
+
+    uint8_t *data = clip_alloc(size);
+    if (data == NULL) {
+        LOG_WRN("'%s' needs %zu bytes, cache full", e->name, size);
+        return -ENOMEM;
+    }
+
+    struct adpcm_state state;
+    uint8_t *out = data;
+
+    adpcm_init(&state);
+    for (uint32_t done = 0; done < samples;) {
+        uint32_t n = MIN(AUDIO_BLOCK_SAMPLES, samples - done);
+
+        ret = sd_card_stream_read(file, load_pcm, n * sizeof(int16_t));
+        if (ret != (int)(n * sizeof(int16_t))) {
+            k_heap_free(&clip_heap, data);
+            return (ret < 0) ? ret : -EIO;
+        }
+        out += adpcm_encode_block(&state, load_pcm, n, out);
+        done += n;
+        storage_read_yield();
+    }
+
+    e->clip = (struct asset) {
+        .codec = ASSET_CODEC_ADPCM,
+        .block_samples = AUDIO_BLOCK_SAMPLES,
+        .samples = samples,
+        .data = data,
+        .size = size,
+    };
+    strncpy(e->clip.name, e->name, ASSET_NAME_MAX);
+    return 0;
+}
+
+static void clip_played(const struct asset *clip, void *arg)
+{
+    struct cache_entry *e = arg;
+
+    ARG_UNUSED(clip);
+
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    e->pins--;
+    k_mutex_unlock(&cache_lock);
+}
+
+/* Queue a pinned entry on the player; drops the pin if that fails */
+static int start_play(struct cache_entry *e)
+{
+    int ret = ui_sound_play_clip(&e->clip, clip_played, e);
+
+    if (ret != 0) {
+        clip_played(&e->clip, e);
+    }
+    return ret;
+}
+
+/* Storage thread: publish the clip and play it if a play was waiting */
+static void clip_loaded(struct storage_read *req, int result)
+{
+    struct cache_entry *e = CONTAINER_OF(req, struct cache_entry, req);
+    bool play;
+
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    stats.max_load_ms = MAX(stats.max_load_ms, k_uptime_get_32() - e->load_start);
+    if (result != 0) {
+        LOG_WRN("Loading '%s' failed: %d", e->path, result);
+        stats.load_errors++;
+        e->state = ENTRY_FREE;
+        k_mutex_unlock(&cache_lock);
+        return;
+    }
+
+    e->state = ENTRY_READY;
+    sys_dlist_append(&lru_list, &e->lru);
+    stats.bytes_used += e->clip.size;
+    stats.entries++;
+    play = e->play_on_load;
+    e->play_on_load = false;
+    if (play) {
+        e->pins++;
+    }
+    k_mutex_unlock(&cache_lock);
+
+    LOG_DBG("Loaded '%s': %u samples in %u bytes", e->name, e->clip.samples, e->clip.size);
+    if (play) {
+        start_play(e);
+    }
+}
+
+/*
+ * Called with cache_lock held. The clip's arena block is only allocated by
+ * load_clip(), so a rejected submit just hands the slot back.
+ */
+static int start_load_locked(struct cache_entry *e)
+{
+    int ret;
+
+    snprintf(e->path, sizeof(e->path), "%s/%s.wav", CONFIG_OMI_PROMPT_CACHE_DIR, e->name);
+    e->req.filename = e->path;
+    e->req.read = load_clip;
+    e->req.done = clip_loaded;
+    e->load_start = k_uptime_get_32();
+    e->state = ENTRY_LOADING;
+    ret = storage_read_submit(&e->req);
+    if (ret != 0) {
+        LOG_WRN("Queueing '%s' failed: %d", e->path, ret);
+        stats.load_errors++;
+        e->state = ENTRY_FREE;
+    }
+    return ret;
+}
+
+int prompt_cache_play(const char *name)
+{
+    struct cache_entry *e;
+    int ret = 0;
+
+    if (strlen(name) > PROMPT_CACHE_NAME_MAX) {
+        return -ENAMETOOLONG;
+    }
+
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    e = find_locked(name);
+    if (e != NULL && e->state == ENTRY_READY) {
+        stats.hits++;
+        sys_dlist_remove(&e->lru);
+        sys_dlist_append(&lru_list, &e->lru);
+        e->pins++;
+        k_mutex_unlock(&cache_lock);
+        return start_play(e);
+    }
+
+    stats.misses++;
+    if (e == NULL) {
+        e = claim_locked(name);
+        ret = (e != NULL) ? start_load_locked(e) : -ENOMEM;
+    }
+    if (ret == 0) {
+        e->play_on_load = true;
+    }
+    k_mutex_unlock(&cache_lock);
+    return ret;
+}
+
+int prompt_cache_prefetch(const char *name)
+{
+    struct cache_entry *e;
+    int ret = 0;
+
+    if (strlen(name) > PROMPT_CACHE_NAME_MAX) {
+        return -ENAMETOOLONG;
+    }
+
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    e = find_locked(name);
+    if (e == NULL) {
+        e = claim_locked(name);
+        if (e != NULL) {
+            stats.prefetches++;
+            ret = start_load_locked(e);
+        } else {
+            ret = -ENOMEM;
+        }
+    } else if (e->state == ENTRY_READY) {
+        /* About to be needed: keep it away from the eviction end */
+        sys_dlist_remove(&e->lru);
+        sys_dlist_append(&lru_list, &e->lru);
+    }
+    k_mutex_unlock(&cache_lock);
+    return ret;
+}
+
+void prompt_cache_flush(void)
+{
+    struct cache_entry *e;
+
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    while ((e = lru_victim_locked()) != NULL) {
+        evict_locked(e);
+    }
+    k_mutex_unlock(&cache_lock);
+}
+
+void prompt_cache_get_stats(struct prompt_cache_stats *out)
+{
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    *out = stats;
+    out->bytes_max = CONFIG_OMI_PROMPT_CACHE_BYTES;
+    k_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,59 @@
+/*
+ * Voice prompt cache
+ * Prompts stored on the SD card (CONFIG_OMI_PROMPT_CACHE_DIR/<name>.wav)
+ * are loaded through the storage thread's asynchronous reads, compressed
+ * to IMA ADPCM and kept in a bounded RAM arena with least-recently-used
+ * eviction. A cached prompt plays without touching the card, so repeat
+ * plays skip the SD wake-up, open and FAT walk. prompt_cache_prefetch()
+ * loads a prompt ahead of need.
+ */
+
+#ifndef PROMPT_CACHE_H
+#define PROMPT_CACHE_H
+
+#include <stdint.h>
+
+#define PROMPT_CACHE_NAME_MAX 24
+
+struct prompt_cache_stats {
+    uint32_t hits;              /* plays served from RAM */
+    uint32_t misses;            /* plays that had to wait for the card */
+    uint32_t prefetches;        /* loads started by a hint */
+    uint32_t evictions;
+    uint32_t load_errors;
+    uint32_t max_load_ms;       /* slowest load, SD power-up included */
+    uint32_t entries;           /* prompts resident in RAM */
+    uint32_t bytes_used;
+    uint32_t bytes_max;
+};
+
+/**
+ * @brief Play a prompt, loading it from the SD card on a miss
+ *
+ * A hit is queued on the UI sound player at once; a miss plays as soon as
+ * the load finishes.
+ * @return 0, -ENAMETOOLONG, -ENOMEM if every slot is in use, -EBUSY when
+ *         the player queue is full
+ */
+int prompt_cache_play(const char *name);
+
+/**
+ * @brief Hint that a prompt will be needed soon
+ *
+ * Starts loading it in the background, or marks it recently used if it is
+ * already resident.
+ * @return 0, -ENAMETOOLONG, -ENOMEM if every slot is in use
+ */
+int prompt_cache_prefetch(const char *name);
+
+/**
+ * @brief Drop every cached prompt that is not playing
+ */
+void prompt_cache_flush(void);
+
+/**
+ * @brief Get cache statistics
+ */
+void prompt_cache_get_stats(struct prompt_cache_stats *stats);
+
+#endif /* PROMPT_CACHE_H */
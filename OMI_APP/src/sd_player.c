@@ -0,0 +1,293 @@
+/*
+ * SD-to-speaker streaming player
+ * A reader thread keeps CONFIG_OMI_PLAYER_PREFETCH_BLOCKS sector-sized
+ * blocks queued ahead of the PWM stream engine. The file is never loaded
+ * into RAM beyond those blocks.
+ */
+
+#include "sd_player.h"
+#include "sd_card.h"
+#include "pwm_audio.h"
+#include "audio_pool.h"
+#include "cycle_counter.h"
+#include "omi_threads.h"
+#include "omi_pm.h"
+#include "audio_stage.h"
+#include "telemetry.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(sd_player, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define BYTES_PER_MS ((PWM_AUDIO_SAMPLE_RATE * sizeof(int16_t)) / 1000)
+
+AUDIO_PIPELINE_DEFINE(sdplay, "dcblock,eq,requant");
+
+static K_MUTEX_DEFINE(player_lock);
+static K_SEM_DEFINE(player_wake, 0, 1);
+
+static sd_player_state_t player_state = SD_PLAYER_IDLE;
+static struct sd_card_stream stream;
+static uint32_t data_start;
+static uint32_t data_end;
+static struct sd_player_stats stats;
+static uint32_t underrun_mark;
+static bool power_held;
+
+/* Hold the amplifier and SD card on while playing; called with player_lock held */
+static void hold_power_locked(bool hold)
+{
+    if (hold == power_held) {
+        return;
+    }
+    if (hold) {
+        omi_pm_get(OMI_PM_SD);
+        omi_pm_get(OMI_PM_AMP);
+    } else {
+        omi_pm_put(OMI_PM_AMP);
+        omi_pm_put(OMI_PM_SD);
+    }
+    power_held = hold;
+}
+
+static uint32_t engine_underruns(void)
+{
+    struct pwm_audio_stream_stats engine;
+
+    pwm_audio_stream_get_stats(&engine);
+    return engine.underruns;
+}
+
+/* Fold engine underruns since the last mark into the player stats */
+static void account_underruns(void)
+{
+    uint32_t now = engine_underruns();
+
+    stats.underruns += now - underrun_mark;
+    underrun_mark = now;
+}
+
+/* Called with player_lock held */
+static void close_locked(void)
+{
+    pwm_audio_source_flush(PWM_AUDIO_SRC_MEDIA);
+    account_underruns();
+    sd_card_stream_close(&stream);
+    player_state = SD_PLAYER_IDLE;
+    hold_power_locked(false);
+}
+
+/**
+ * @brief Read one sector-sized block and queue it on the engine
+ * @return true when the file is finished (or failed) and the player went idle
+ */
+static bool read_one_block_locked(void)
+{
+    struct audio_block *block = audio_pool_alloc(K_NO_WAIT);
+    if (block == NULL) {
+        return false;
+    }
+
+    uint32_t len = MIN(AUDIO_BLOCK_BYTES, data_end - stream.pos);
+    uint32_t start = cycle_counter_get();
+    int ret = sd_card_stream_read(&stream, block->data, len);
+    uint32_t read_us = cycle_counter_to_ns(cycle_counter_get() - start) / 1000U;
+
+    telemetry_record_io(TELEMETRY_IO_SD_READ, read_us, ret);
+    stats.max_read_us = MAX(stats.max_read_us, read_us);
+    if (read_us > PWM_AUDIO_BLOCK_PERIOD_US) {
+        stats.slow_reads++;
+    }
+
+    if (ret < 0) {
+        LOG_ERR("Read failed at %u: %d", stream.pos, ret);
+        audio_pool_free(block);
+        close_locked();
+        return true;
+    }
+
+    block->samples = ret / sizeof(int16_t);
+    bool last = (ret == 0) || (stream.pos >= data_end);
+    if (last) {
+        block->flags |= AUDIO_BLOCK_F_END;
+    }
+
+    audio_pipeline_process(AUDIO_PIPELINE_GET(sdplay), block);
+    pwm_audio_source_submit(PWM_AUDIO_SRC_MEDIA, block);
+    stats.blocks_read++;
+
+    if (last) {
+        LOG_INF("Playback finished, %u underruns", stats.underruns);
+        /* Let the queued tail play out; only release the file. The
+         * amplifier's idle-off delay covers the tail. */
+        account_underruns();
+        sd_card_stream_close(&stream);
+        player_state = SD_PLAYER_IDLE;
+        hold_power_locked(false);
+    }
+    return last;
+}
+
+static void player_thread_fn(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    while (1) {
+        k_sem_take(&player_wake, K_FOREVER);
+
+        while (1) {
+            k_mutex_lock(&player_lock, K_FOREVER);
+            if (player_state != SD_PLAYER_PLAYING) {
+                k_mutex_unlock(&player_lock);
+                break;
+            }
+
+            if (pwm_audio_source_queued(PWM_AUDIO_SRC_MEDIA) >= CONFIG_OMI_PLAYER_PREFETCH_BLOCKS) {
+                k_mutex_unlock(&player_lock);
+                k_sleep(K_USEC(PWM_AUDIO_BLOCK_PERIOD_US / 2));
+                continue;
+            }
+
+            bool done = read_one_block_locked();
+            k_mutex_unlock(&player_lock);
+            if (done) {
+                break;
+            }
+        }
+    }
+}
+
+K_THREAD_DEFINE(sd_player, OMI_STACK_PLAYER_FEED, player_thread_fn, NULL, NULL, NULL,
+                OMI_PRIO_PLAYER_FEED, 0, 0);
+
+int sd_player_start(const char *filename)
+{
+    int ret;
+
+    k_mutex_lock(&player_lock, K_FOREVER);
+    if (player_state != SD_PLAYER_IDLE) {
+        close_locked();
+    }
+
+    hold_power_locked(true);
+    ret = sd_card_stream_open(&stream, filename);
+    if (ret != 0) {
+        hold_power_locked(false);
+        k_mutex_unlock(&player_lock);
+        return ret;
+    }
+
+    ret = sd_card_stream_find_pcm(&stream, PWM_AUDIO_SAMPLE_RATE, &data_start, &data_end);
+    if (ret != 0) {
+        sd_card_stream_close(&stream);
+        hold_power_locked(false);
+        k_mutex_unlock(&player_lock);
+        return ret;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    stats.duration_ms = (data_end - data_start) / BYTES_PER_MS;
+    underrun_mark = engine_underruns();
+    player_state = SD_PLAYER_PLAYING;
+    k_mutex_unlock(&player_lock);
+
+    LOG_INF("Playing %s (%u ms)", filename, stats.duration_ms);
+    k_sem_give(&player_wake);
+    return 0;
+}
+
+void sd_player_stop(void)
+{
+    k_mutex_lock(&player_lock, K_FOREVER);
+    if (player_state != SD_PLAYER_IDLE) {
+        close_locked();
+    }
+    k_mutex_unlock(&player_lock);
+}
+
+int sd_player_pause(void)
+{
+    k_mutex_lock(&player_lock, K_FOREVER);
+    if (player_state != SD_PLAYER_PLAYING) {
+        k_mutex_unlock(&player_lock);
+        return -EALREADY;
+    }
+
+    /* Fade out and rewind over blocks that were prefetched but not yet played */
+    size_t dropped = pwm_audio_source_flush(PWM_AUDIO_SRC_MEDIA);
+    uint32_t rewind = MIN(dropped * sizeof(int16_t), stream.pos - data_start);
+    int ret = sd_card_stream_seek(&stream, stream.pos - rewind);
+
+    account_underruns();
+    player_state = SD_PLAYER_PAUSED;
+    hold_power_locked(false);
+    k_mutex_unlock(&player_lock);
+    return ret;
+}
+
+int sd_player_resume(void)
+{
+    k_mutex_lock(&player_lock, K_FOREVER);
+    if (player_state != SD_PLAYER_PAUSED) {
+        k_mutex_unlock(&player_lock);
+        return -EALREADY;
+    }
+
+    underrun_mark = engine_underruns();
+    player_state = SD_PLAYER_PLAYING;
+    hold_power_locked(true);
+    k_mutex_unlock(&player_lock);
+
+    k_sem_give(&player_wake);
+    return 0;
+}
+
+int sd_player_seek(uint32_t position_ms)
+{
+    int ret;
+
+    k_mutex_lock(&player_lock, K_FOREVER);
+    if (player_state == SD_PLAYER_IDLE) {
+        k_mutex_unlock(&player_lock);
+        return -ENODEV;
+    }
+
+    uint64_t offset = (uint64_t)position_ms * BYTES_PER_MS;
+    uint32_t pos = (uint32_t)MIN(data_start + (offset & ~1ULL), data_end);
+
+    /* The old position fades out as the new one fades in */
+    pwm_audio_source_flush(PWM_AUDIO_SRC_MEDIA);
+    account_underruns();
+    ret = sd_card_stream_seek(&stream, pos);
+    bool playing = (player_state == SD_PLAYER_PLAYING);
+    k_mutex_unlock(&player_lock);
+
+    if (ret == 0 && playing) {
+        k_sem_give(&player_wake);
+    }
+    return ret;
+}
+
+sd_player_state_t sd_player_get_state(void)
+{
+    k_mutex_lock(&player_lock, K_FOREVER);
+    sd_player_state_t state = player_state;
+    k_mutex_unlock(&player_lock);
+
+    return state;
+}
+
+void sd_player_get_stats(struct sd_player_stats *out)
+{
+    k_mutex_lock(&player_lock, K_FOREVER);
+    if (player_state == SD_PLAYER_PLAYING) {
+        account_underruns();
+    }
+    *out = stats;
+    out->position_ms = (stream.pos > data_start) ? (stream.pos - data_start) / BYTES_PER_MS : 0;
+    k_mutex_unlock(&player_lock);
+}
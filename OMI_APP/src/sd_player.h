@@ -0,0 +1,70 @@
+/*
+ * SD-to-speaker streaming player
+ * Streams 16-bit mono PCM (raw or WAV) from the SD card through the shared
+ * audio pool into the PWM stream engine, one sector-sized block at a time.
+ */
+
+#ifndef SD_PLAYER_H
+#define SD_PLAYER_H
+
+#include <zephyr/kernel.h>
+#include <stdint.h>
+
+/* Player States */
+typedef enum {
+    SD_PLAYER_IDLE,
+    SD_PLAYER_PLAYING,
+    SD_PLAYER_PAUSED
+} sd_player_state_t;
+
+struct sd_player_stats {
+    uint32_t blocks_read;
+    uint32_t underruns;         /* engine underruns while this player was feeding it */
+    uint32_t slow_reads;        /* sector reads slower than one block period */
+    uint32_t max_read_us;       /* worst single sector read latency */
+    uint32_t position_ms;       /* playback position of the next block to read */
+    uint32_t duration_ms;
+};
+
+/**
+ * @brief Start streaming a file from the SD card
+ * @param filename File name relative to the SD mount point
+ * @return 0 on success, negative error code on failure
+ */
+int sd_player_start(const char *filename);
+
+/**
+ * @brief Stop playback and close the file
+ */
+void sd_player_stop(void);
+
+/**
+ * @brief Pause playback, keeping the position of the first unplayed sample
+ * @return 0 on success, -EALREADY if not playing
+ */
+int sd_player_pause(void);
+
+/**
+ * @brief Resume paused playback
+ * @return 0 on success, -EALREADY if not paused
+ */
+int sd_player_resume(void);
+
+/**
+ * @brief Jump to a position in the current file
+ * @param position_ms Position from the start of the audio data
+ * @return 0 on success, negative error code on failure
+ */
+int sd_player_seek(uint32_t position_ms);
+
+/**
+ * @brief Get the player state
+ */
+sd_player_state_t sd_player_get_state(void);
+
+/**
+ * @brief Get playback statistics for the current or last file
+ */
+void sd_player_get_stats(struct sd_player_stats *stats);
+
+#endif /* SD_PLAYER_H */
@@ -0,0 +1,361 @@
+/*
+ * Asynchronous storage writer
+ * Blocks are written as they arrive and the file is synced every
+ * CONFIG_OMI_STORAGE_SYNC_BLOCKS so a power cut loses at most that much.
+ *
+ * Segmented recordings move on to the next audio file every
+ * CONFIG_OMI_STORAGE_SEGMENT_KB. Between blocks, once the current segment
+ * is CONFIG_OMI_STORAGE_PRECREATE_PERCENT full, the thread creates the
+ * next one, so the rollover in the write path is a pointer swap; the
+ * finished segment is closed between blocks too.
+ */
+
+#include "storage_writer.h"
+#include "sd_card.h"
+#include "omi_pm.h"
+#include "omi_threads.h"
+#include "cycle_counter.h"
+#include "telemetry.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(storage_writer, CONFIG_LOG_DEFAULT_LEVEL);
+
+static K_FIFO_DEFINE(writer_fifo);
+static K_FIFO_DEFINE(read_fifo);
+static K_SEM_DEFINE(writer_closed, 0, 1);
+static K_MUTEX_DEFINE(writer_lock);
+
+#define SEGMENT_BYTES   (CONFIG_OMI_STORAGE_SEGMENT_KB * 1024U)
+#define PRECREATE_BYTES (SEGMENT_BYTES / 100U * CONFIG_OMI_STORAGE_PRECREATE_PERCENT)
+
+static struct sd_card_stream streams[2];
+static struct sd_card_stream *stream = &streams[0];    /* being written */
+static struct sd_card_stream *next_stream;             /* pre-created next segment */
+static struct sd_card_stream *retiring;                /* finished segment, still open */
+static uint8_t segment;         /* audio file being written, 0 for a named file */
+static uint8_t last_segment;    /* the recording does not move past this one */
+static atomic_t is_open;        /* read by submitters without writer_lock */
+static atomic_t queued;
+static atomic_t max_queued;
+static struct storage_writer_stats stats;
+
+static int writer_open(const char *filename, uint8_t first)
+{
+    int ret;
+
+    k_mutex_lock(&writer_lock, K_FOREVER);
+    if (atomic_get(&is_open)) {
+        k_mutex_unlock(&writer_lock);
+        return -EBUSY;
+    }
+
+    omi_pm_get(OMI_PM_SD);
+    stream = &streams[0];
+    next_stream = NULL;
+    retiring = NULL;
+    if (filename != NULL) {
+        ret = sd_card_stream_create(stream, filename);
+    } else {
+        ret = sd_card_segment_create(stream, first);
+    }
+    if (ret != 0) {
+        omi_pm_put(OMI_PM_SD);
+        k_mutex_unlock(&writer_lock);
+        return ret;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    atomic_set(&max_queued, 0);
+    segment = (filename != NULL) ? 0 : first;
+    last_segment = SD_CARD_MAX_AUDIO_FILES;
+    if (segment != 0) {
+        /* The OMI write pointer follows the recording */
+        move_write_pointer(segment);
+    }
+    atomic_set(&is_open, 1);
+    k_mutex_unlock(&writer_lock);
+
+    if (filename != NULL) {
+        LOG_INF("Recording to %s", filename);
+    } else {
+        LOG_INF("Recording to segments from %u", first);
+    }
+    return 0;
+}
+
+int storage_writer_open(const char *filename)
+{
+    return writer_open(filename, 0);
+}
+
+int storage_writer_open_segments(uint8_t first)
+{
+    if (first == 0 || first > SD_CARD_MAX_AUDIO_FILES) {
+        return -EINVAL;
+    }
+    return writer_open(NULL, first);
+}
+
+int storage_writer_submit(struct audio_block *block)
+{
+    if (!atomic_get(&is_open)) {
+        audio_pool_free(block);
+        return -ENODEV;
+    }
+
+    atomic_val_t depth = atomic_inc(&queued) + 1;
+    atomic_val_t seen = atomic_get(&max_queued);
+    while (depth > seen && !atomic_cas(&max_queued, seen, depth)) {
+        seen = atomic_get(&max_queued);
+    }
+    k_fifo_put(&writer_fifo, block);
+    return 0;
+}
+
+int storage_writer_close(void)
+{
+    struct audio_block *marker;
+
+    k_mutex_lock(&writer_lock, K_FOREVER);
+    if (!atomic_get(&is_open)) {
+        k_mutex_unlock(&writer_lock);
+        return 0;
+    }
+
+    /* An empty END block tells the writer thread to close after the backlog */
+    marker = audio_pool_alloc(K_FOREVER);
+    marker->flags = AUDIO_BLOCK_F_END;
+    atomic_inc(&queued);
+    k_fifo_put(&writer_fifo, marker);
+    k_sem_take(&writer_closed, K_FOREVER);
+
+    atomic_set(&is_open, 0);
+    omi_pm_put(OMI_PM_SD);
+    k_mutex_unlock(&writer_lock);
+
+    LOG_INF("Recording closed: %u blocks, %u bytes, %u errors",
+            stats.blocks_written, stats.bytes_written, stats.write_errors);
+    return stats.write_errors ? -EIO : 0;
+}
+
+int storage_read_submit(struct storage_read *req)
+{
+    if (req->filename == NULL || req->read == NULL || req->done == NULL) {
+        return -EINVAL;
+    }
+    k_fifo_put(&read_fifo, req);
+    return 0;
+}
+
+void storage_writer_get_stats(struct storage_writer_stats *out)
+{
+    *out = stats;
+    out->queued = (uint32_t)atomic_get(&queued);
+    out->max_queued = (uint32_t)atomic_get(&max_queued);
+}
+
+/* Close the finished segment; its last blocks are synced by the close */
+static void retire_segment(void)
+{
+    if (retiring != NULL) {
+        sd_card_stream_close(retiring);
+        retiring = NULL;
+    }
+}
+
+static int prepare_segment(void)
+{
+    struct sd_card_stream *slot = (stream == &streams[0]) ? &streams[1] : &streams[0];
+    int ret = sd_card_segment_create(slot, segment + 1);
+
+    if (ret == -EBUSY) {
+        /* Still being read or offloaded: keep recording into this one */
+        LOG_WRN("Segment %u is in use, recording stays in segment %u", segment + 1, segment);
+        last_segment = segment;
+    }
+    if (ret != 0) {
+        return ret;
+    }
+    next_stream = slot;
+    return 0;
+}
+
+/* Move on to the next segment: a pointer swap when it was pre-created */
+static int rollover(void)
+{
+    uint32_t start = cycle_counter_get();
+
+    if (next_stream == NULL) {
+        /* Not prepared in time: create it here, in the write path */
+        int ret;
+
+        retire_segment();
+        ret = prepare_segment();
+        if (ret == -EBUSY) {
+            return 0;
+        }
+        if (ret != 0) {
+            return ret;
+        }
+        stats.rollover_stalls++;
+    }
+
+    retiring = stream;
+    stream = next_stream;
+    next_stream = NULL;
+    segment++;
+    move_write_pointer(segment);
+
+    uint32_t us = cycle_counter_to_ns(cycle_counter_get() - start) / 1000U;
+
+    stats.rollovers++;
+    stats.max_rollover_us = MAX(stats.max_rollover_us, us);
+    return 0;
+}
+
+/* Between blocks: close the finished segment, then create the next one
+ * once the current one is nearly full */
+static void segment_housekeeping(void)
+{
+    if (segment == 0) {
+        return;
+    }
+
+    retire_segment();
+    if (next_stream == NULL && segment < last_segment &&
+        stream->size >= PRECREATE_BYTES) {
+        prepare_segment();
+    }
+}
+
+static void write_block(struct audio_block *block)
+{
+    size_t len = block->samples * sizeof(int16_t);
+    uint32_t start = cycle_counter_get();
+    int ret = 0;
+
+    if (segment != 0 && segment < last_segment && stream->size + len > SEGMENT_BYTES) {
+        ret = rollover();
+    }
+    if (ret == 0) {
+        ret = sd_card_stream_write(stream, block->data, len);
+    }
+    uint32_t us = cycle_counter_to_ns(cycle_counter_get() - start) / 1000U;
+
+    telemetry_record_io(TELEMETRY_IO_SD_WRITE, us, (ret == (int)len || ret < 0) ? ret : -EIO);
+    stats.max_write_us = MAX(stats.max_write_us, us);
+    if (ret != (int)len) {
+        stats.write_errors++;
+        return;
+    }
+
+    stats.blocks_written++;
+    stats.bytes_written += len;
+    if (stats.blocks_written % CONFIG_OMI_STORAGE_SYNC_BLOCKS == 0) {
+        sd_card_stream_sync(stream);
+    }
+}
+
+/* Off the closer's path: the first query after a mount walks the FAT */
+static void refresh_free_space(void)
+{
+    uint64_t total_mb;
+    uint32_t free_mb;
+
+    sd_card_get_info(&total_mb, &free_mb);
+}
+
+static void run_read(struct storage_read *req)
+{
+    struct sd_card_stream file;
+    int ret;
+
+    omi_pm_get(OMI_PM_SD);
+    ret = sd_card_stream_open(&file, req->filename);
+    if (ret == 0) {
+        ret = req->read(req, &file);
+        sd_card_stream_close(&file);
+    }
+    omi_pm_put(OMI_PM_SD);
+
+    if (ret == 0) {
+        stats.reads++;
+    } else {
+        stats.read_errors++;
+    }
+    req->done(req, ret);
+}
+
+/* Write out the queued blocks */
+static void drain_writes(void)
+{
+    struct audio_block *block;
+
+    while ((block = k_fifo_get(&writer_fifo, K_NO_WAIT)) != NULL) {
+        atomic_dec(&queued);
+        if (block->samples > 0) {
+            write_block(block);
+        }
+
+        if (block->flags & AUDIO_BLOCK_F_END) {
+            sd_card_stream_sync(stream);
+            sd_card_stream_close(stream);
+            retire_segment();
+            if (next_stream != NULL) {
+                /* Stays on the card, empty */
+                sd_card_stream_close(next_stream);
+                next_stream = NULL;
+            }
+            segment = 0;
+            /* Keep the card up past the closer's release to refresh free space */
+            omi_pm_get(OMI_PM_SD);
+            k_sem_give(&writer_closed);
+            refresh_free_space();
+            omi_pm_put(OMI_PM_SD);
+        }
+        audio_pool_free(block);
+    }
+}
+
+static void writer_thread_fn(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    struct k_poll_event events[] = {
+        K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+                                 K_POLL_MODE_NOTIFY_ONLY, &writer_fifo),
+        K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+                                 K_POLL_MODE_NOTIFY_ONLY, &read_fifo),
+    };
+
+    while (1) {
+        k_poll(events, ARRAY_SIZE(events), K_FOREVER);
+        events[0].state = K_POLL_STATE_NOT_READY;
+        events[1].state = K_POLL_STATE_NOT_READY;
+
+        /* Pending writes hold pool blocks, so the backlog goes before a read */
+        drain_writes();
+        segment_housekeeping();
+
+        struct storage_read *req = k_fifo_get(&read_fifo, K_NO_WAIT);
+
+        if (req != NULL) {
+            run_read(req);
+        }
+    }
+}
+
+K_THREAD_DEFINE(storage_writer, OMI_STACK_STORAGE, writer_thread_fn, NULL, NULL, NULL,
+                OMI_PRIO_STORAGE, 0, 0);
+
+void storage_read_yield(void)
+{
+    if (k_current_get() == storage_writer) {
+        drain_writes();
+    }
+}
@@ -0,0 +1,114 @@
+/*
+ * Asynchronous storage writer
+ * Producers (capture) hand over pool blocks without waiting for the SD
+ * card; a storage-priority thread appends them to the open recording,
+ * either one named file or a run of OMI audio segments.
+ * The same thread serves asynchronous file reads (storage_read_submit)
+ * so SD latency never lands on the caller.
+ */
+
+#ifndef STORAGE_WRITER_H
+#define STORAGE_WRITER_H
+
+#include "audio_pool.h"
+
+#include <stdint.h>
+
+struct sd_card_stream;
+struct storage_read;
+
+/**
+ * @brief Consume an asynchronously opened file, on the storage thread
+ * @param stream The file, open at offset 0
+ * @return 0 or a negative error code, handed to the done callback
+ */
+typedef int (*storage_read_fn_t)(struct storage_read *req, struct sd_card_stream *stream);
+
+/* Called on the storage thread once the read has finished or failed */
+typedef void (*storage_read_done_t)(struct storage_read *req, int result);
+
+struct storage_read {
+    void *fifo_reserved;
+    const char *filename;       /* relative to the SD mount point */
+    storage_read_fn_t read;
+    storage_read_done_t done;
+};
+
+struct storage_writer_stats {
+    uint32_t blocks_written;
+    uint32_t bytes_written;
+    uint32_t write_errors;
+    uint32_t max_write_us;      /* worst single block write, rollovers included */
+    uint32_t rollovers;         /* moves to the next segment */
+    uint32_t rollover_stalls;   /* ... that had to create it in the write path */
+    uint32_t max_rollover_us;
+    uint32_t queued;            /* blocks waiting to be written */
+    uint32_t max_queued;        /* deepest the queue has been */
+    uint32_t reads;             /* asynchronous reads completed */
+    uint32_t read_errors;
+};
+
+/**
+ * @brief Create the recording file and start accepting blocks
+ * @param filename File name relative to the SD mount point
+ * @return 0 on success, -EBUSY if a file is already open, negative error code on failure
+ */
+int storage_writer_open(const char *filename);
+
+/**
+ * @brief Start a recording in the OMI audio segments (aNN.txt)
+ *
+ * Segment first is created (or truncated) now; the writer moves on to
+ * the next one every CONFIG_OMI_STORAGE_SEGMENT_KB, creating it ahead
+ * of time, and keeps the OMI write pointer on the segment being written.
+ * The last segment takes whatever is left, and so does the current one
+ * when the next is still being read (see sd_card_segment_create()).
+ * Closing can leave the next segment created and empty.
+ * @param first Audio file number of the first segment
+ * @return 0 on success, -EBUSY if a file is already open or segment first
+ *         is being read, negative error code on failure
+ */
+int storage_writer_open_segments(uint8_t first);
+
+/**
+ * @brief Queue a block for writing; never blocks
+ *
+ * block->samples is the payload length in 16-bit words, whatever the
+ * payload encoding. The block is freed by the writer (or here on error).
+ * @return 0 on success, -ENODEV if no file is open
+ */
+int storage_writer_submit(struct audio_block *block);
+
+/**
+ * @brief Write out everything queued and close the file
+ * @return 0 on success, negative error code on failure
+ */
+int storage_writer_close(void);
+
+/**
+ * @brief Queue an asynchronous read; never blocks
+ *
+ * The storage thread powers the SD card, opens req->filename, runs
+ * req->read and then req->done. Writes queued before it go first, later
+ * ones whenever req->read calls storage_read_yield(). req and its
+ * filename must stay valid until done is called.
+ * @return 0 on success, -EINVAL for an incomplete request
+ */
+int storage_read_submit(struct storage_read *req);
+
+/**
+ * @brief Let queued recording blocks through during a long read
+ *
+ * Called by a storage_read_fn_t between the blocks it reads, so a read
+ * that spans many blocks does not hold up the recording (whose blocks
+ * come from the shared audio pool) until it finishes. Does nothing off
+ * the storage thread.
+ */
+void storage_read_yield(void);
+
+/**
+ * @brief Get writer statistics (reset by storage_writer_open())
+ */
+void storage_writer_get_stats(struct storage_writer_stats *stats);
+
+#endif /* STORAGE_WRITER_H */
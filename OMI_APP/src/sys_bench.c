@@ -0,0 +1,345 @@
+/*
+ * System-level benchmark
+ * Runs BLE ingest, playback, recording and offload at the same time and
+ * reports, per workload, the worst job time against its period (headroom)
+ * and, per thread, the share of CPU used. The stream engine and ingest
+ * threads are the real ones; the producers and storage jobs are paced
+ * at the rates the product needs.
+ */
+
+#include "ingest.h"
+#include "omi_pm.h"
+#include "omi_threads.h"
+#include "pwm_audio.h"
+#include "sd_card.h"
+#include "speaker_pwm.h"
+#include "cycle_counter.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/fs/fs.h>
+#include <stdlib.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(sys_bench, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define SYSBENCH_FILE        "/SD:/sysbench.raw"
+#define SYSBENCH_MAX_THREADS 24
+#define SYSBENCH_SYNC_BLOCKS 32     // recording fs_sync interval
+
+/* One periodic workload; a job missing its next release is a deadline miss */
+struct sysbench_job {
+    const char *name;
+    uint32_t period_us;
+    int prio;
+    bool needs_sd;
+    void (*run)(void);
+    /* results */
+    uint32_t jobs;
+    uint32_t misses;
+    uint32_t max_us;
+};
+
+static void job_ingest(void);
+static void job_record(void);
+static void job_offload(void);
+
+static struct sysbench_job jobs[] = {
+    /* One speak() packet of 8 kHz mono audio */
+    { "ble_ingest", (PACKET_SIZE / 2) * (1000000U / SAMPLE_FREQUENCY),
+      OMI_PRIO_BLE_INGEST, false, job_ingest },
+    /* One sector of 16 kHz capture per block period */
+    { "record", PWM_AUDIO_BLOCK_PERIOD_US, OMI_PRIO_STORAGE, true, job_record },
+    /* Offload reads back at half the capture rate */
+    { "offload", 2 * PWM_AUDIO_BLOCK_PERIOD_US, OMI_PRIO_STORAGE, true, job_offload },
+};
+
+static K_THREAD_STACK_ARRAY_DEFINE(job_stacks, ARRAY_SIZE(jobs), OMI_STACK_STORAGE);
+static struct k_thread job_threads[ARRAY_SIZE(jobs)];
+static atomic_t stop;
+static K_MUTEX_DEFINE(sysbench_lock);
+
+static struct fs_file_t rec_file;
+static struct fs_file_t off_file;
+static uint8_t rec_buf[AUDIO_BLOCK_BYTES];
+static uint8_t off_buf[AUDIO_BLOCK_BYTES];
+static uint32_t rec_blocks;
+static uint32_t ingest_phase;
+
+/* Per-thread runtime snapshot taken at the start of a run */
+struct thread_usage {
+    k_tid_t tid;
+    uint64_t start_cycles;
+};
+
+static struct thread_usage usage[SYSBENCH_MAX_THREADS];
+static size_t usage_count;
+
+static void job_ingest(void)
+{
+    int16_t pkt[PACKET_SIZE / 2];
+
+    /* Stream header once: an endless transfer */
+    if (ingest_phase == 0) {
+        uint32_t total = UINT32_MAX;
+
+        ingest_submit(&total, sizeof(total));
+    }
+
+    /* 500 Hz square wave: cheap to make, easy to hear */
+    for (size_t i = 0; i < ARRAY_SIZE(pkt); i++) {
+        pkt[i] = ((ingest_phase + i) % 16 < 8) ? 8000 : -8000;
+    }
+    ingest_phase += ARRAY_SIZE(pkt);
+    ingest_submit(pkt, sizeof(pkt));
+}
+
+static void job_record(void)
+{
+    memset(rec_buf, (uint8_t)rec_blocks, sizeof(rec_buf));
+    if (fs_write(&rec_file, rec_buf, sizeof(rec_buf)) == sizeof(rec_buf)) {
+        rec_blocks++;
+    }
+    if (rec_blocks % SYSBENCH_SYNC_BLOCKS == 0) {
+        fs_sync(&rec_file);
+    }
+}
+
+static void job_offload(void)
+{
+    /* Wrap to the start once the reader catches up with the writer */
+    if (fs_read(&off_file, off_buf, sizeof(off_buf)) <= 0) {
+        fs_seek(&off_file, 0, FS_SEEK_SET);
+    }
+}
+
+static void job_thread_fn(void *p1, void *p2, void *p3)
+{
+    struct sysbench_job *job = p1;
+    k_ticks_t period = k_us_to_ticks_ceil64(job->period_us);
+    k_ticks_t release = k_uptime_ticks();
+
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    while (!atomic_get(&stop)) {
+        uint32_t start = cycle_counter_get();
+
+        job->run();
+
+        uint32_t us = cycle_counter_to_ns(cycle_counter_get() - start) / 1000U;
+
+        job->jobs++;
+        job->max_us = MAX(job->max_us, us);
+
+        release += period;
+        if (k_uptime_ticks() > release) {
+            /* Late: count it and restart the schedule from now */
+            job->misses++;
+            release = k_uptime_ticks();
+            continue;
+        }
+        k_sleep(K_TIMEOUT_ABS_TICKS(release));
+    }
+}
+
+static void usage_snapshot(const struct k_thread *thread, void *user_data)
+{
+    k_thread_runtime_stats_t st;
+
+    ARG_UNUSED(user_data);
+
+    if (usage_count < ARRAY_SIZE(usage) &&
+        k_thread_runtime_stats_get((k_tid_t)thread, &st) == 0) {
+        usage[usage_count].tid = (k_tid_t)thread;
+        usage[usage_count].start_cycles = st.execution_cycles;
+        usage_count++;
+    }
+}
+
+static void print_thread_usage(uint64_t total_cycles)
+{
+    printk("%-20s %5s %8s\n", "thread", "prio", "cpu %");
+    for (size_t i = 0; i < usage_count; i++) {
+        k_thread_runtime_stats_t st;
+
+        if (k_thread_runtime_stats_get(usage[i].tid, &st) != 0) {
+            continue;
+        }
+
+        uint64_t used = st.execution_cycles - usage[i].start_cycles;
+        uint32_t permille = total_cycles ? (uint32_t)(used * 1000U / total_cycles) : 0;
+        const char *name = k_thread_name_get(usage[i].tid);
+
+        printk("%-20s %5d %5u.%u\n", name ? name : "?", k_thread_priority_get(usage[i].tid),
+               permille / 10, permille % 10);
+    }
+}
+
+static bool open_storage(void)
+{
+    if (sd_card_get_state() != SD_CARD_MOUNTED) {
+        return false;
+    }
+
+    fs_file_t_init(&rec_file);
+    fs_file_t_init(&off_file);
+    fs_unlink(SYSBENCH_FILE);
+    if (fs_open(&rec_file, SYSBENCH_FILE, FS_O_CREATE | FS_O_RDWR) != 0) {
+        return false;
+    }
+    if (fs_open(&off_file, SYSBENCH_FILE, FS_O_READ) != 0) {
+        fs_close(&rec_file);
+        return false;
+    }
+    return true;
+}
+
+static void close_storage(void)
+{
+    fs_close(&off_file);
+    fs_close(&rec_file);
+    fs_unlink(SYSBENCH_FILE);
+}
+
+/**
+ * @brief Run all workloads concurrently and print the report
+ * @param seconds Run duration
+ * @return 0 on success, negative error code on failure
+ */
+static int sys_bench_run(uint32_t seconds)
+{
+    struct pwm_audio_stream_stats engine_start, engine_end;
+    struct ingest_stats ingest_start, ingest_end;
+    k_thread_runtime_stats_t all_start, all_end;
+    bool storage;
+
+    if (k_mutex_lock(&sysbench_lock, K_NO_WAIT) != 0) {
+        return -EBUSY;
+    }
+
+    omi_pm_get(OMI_PM_SD);
+    storage = open_storage();
+    if (!storage) {
+        LOG_WRN("SD card not available, skipping record/offload");
+    }
+
+    rec_blocks = 0;
+    ingest_phase = 0;
+    atomic_set(&stop, 0);
+
+    for (size_t i = 0; i < ARRAY_SIZE(jobs); i++) {
+        jobs[i].jobs = 0;
+        jobs[i].misses = 0;
+        jobs[i].max_us = 0;
+        if (jobs[i].needs_sd && !storage) {
+            continue;
+        }
+        k_thread_create(&job_threads[i], job_stacks[i], K_THREAD_STACK_SIZEOF(job_stacks[i]),
+                        job_thread_fn, &jobs[i], NULL, NULL, jobs[i].prio, 0, K_FOREVER);
+        k_thread_name_set(&job_threads[i], jobs[i].name);
+    }
+
+    /* Snapshot after the workload threads exist so they are reported too */
+    usage_count = 0;
+    k_thread_foreach(usage_snapshot, NULL);
+    k_thread_runtime_stats_all_get(&all_start);
+    pwm_audio_stream_get_stats(&engine_start);
+    ingest_get_stats(&ingest_start);
+
+    for (size_t i = 0; i < ARRAY_SIZE(jobs); i++) {
+        if (!jobs[i].needs_sd || storage) {
+            k_thread_start(&job_threads[i]);
+        }
+    }
+
+    k_sleep(K_SECONDS(seconds));
+
+    atomic_set(&stop, 1);
+    for (size_t i = 0; i < ARRAY_SIZE(jobs); i++) {
+        if (!jobs[i].needs_sd || storage) {
+            k_thread_join(&job_threads[i], K_FOREVER);
+        }
+    }
+
+    k_thread_runtime_stats_all_get(&all_end);
+    pwm_audio_stream_get_stats(&engine_end);
+    ingest_get_stats(&ingest_end);
+
+    /* End the endless ingest transfer */
+    pwm_audio_stream_flush();
+    if (storage) {
+        close_storage();
+    }
+    omi_pm_put(OMI_PM_SD);
+
+    uint64_t total = all_end.execution_cycles - all_start.execution_cycles;
+    uint64_t idle = all_end.idle_cycles - all_start.idle_cycles;
+
+    printk("sysbench: %u s\n", seconds);
+    printk("%-12s %8s %8s %8s %8s %9s\n", "workload", "period", "max", "headroom", "jobs", "misses");
+    for (size_t i = 0; i < ARRAY_SIZE(jobs); i++) {
+        struct sysbench_job *job = &jobs[i];
+        int headroom = 100 - (int)((job->max_us * 100U) / job->period_us);
+
+        if (job->needs_sd && !storage) {
+            printk("%-12s %8s\n", job->name, "skipped");
+            continue;
+        }
+        printk("%-12s %6uus %6uus %7d%% %8u %9u\n", job->name, job->period_us, job->max_us,
+               headroom, job->jobs, job->misses);
+    }
+    printk("engine: %u blocks, %u underruns; ingest: %u packets, %u dropped, max depth %u\n",
+           engine_end.blocks_played - engine_start.blocks_played,
+           engine_end.underruns - engine_start.underruns,
+           ingest_end.packets - ingest_start.packets,
+           ingest_end.dropped - ingest_start.dropped, ingest_end.max_depth);
+    printk("pool low-water: %u of %u blocks\n", audio_pool_min_free(),
+           CONFIG_OMI_AUDIO_POOL_BLOCKS);
+    print_thread_usage(total);
+    printk("idle: %u.%u%%\n", total ? (uint32_t)(idle * 1000U / total) / 10 : 0,
+           total ? (uint32_t)(idle * 1000U / total) % 10 : 0);
+    printk("SYSBENCH_DONE\n");
+
+    k_mutex_unlock(&sysbench_lock);
+    return 0;
+}
+
+#if defined(CONFIG_OMI_SYS_BENCH_RUN_AT_BOOT)
+static void sys_bench_boot_thread(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    /* Let main() finish bringing up storage and audio */
+    k_sleep(K_SECONDS(1));
+    sys_bench_run(CONFIG_OMI_SYS_BENCH_BOOT_SECONDS);
+}
+
+K_THREAD_DEFINE(sys_bench_boot, OMI_STACK_BENCH, sys_bench_boot_thread, NULL, NULL, NULL,
+                OMI_PRIO_BENCH, 0, 0);
+#endif
+
+/* Shell Commands */
+
+static int cmd_sysbench(const struct shell *shell, size_t argc, const char **argv)
+{
+    uint32_t seconds = (argc > 1) ? strtoul(argv[1], NULL, 10) : 10;
+
+    if (seconds == 0) {
+        shell_error(shell, "Invalid duration");
+        return -EINVAL;
+    }
+
+    shell_print(shell, "Running all workloads for %u s...", seconds);
+    int ret = sys_bench_run(seconds);
+    if (ret == -EBUSY) {
+        shell_error(shell, "sysbench already running");
+    }
+    return ret;
+}
+
+SHELL_CMD_ARG_REGISTER(sysbench, NULL, "Run ingest, playback, recording and offload together: "
+                       "sysbench [seconds]", cmd_sysbench, 1, 1);
@@ -0,0 +1,212 @@
+/*
+ * Binary telemetry snapshot
+ */
+
+#include "telemetry.h"
+#include "audio_pool.h"
+#include "ingest.h"
+#include "pwm_audio.h"
+#include "sd_card.h"
+#if defined(CONFIG_OMI_CAPTURE)
+#include "capture.h"
+#endif
+#if defined(CONFIG_OMI_ENERGY)
+#include "energy.h"
+
+BUILD_ASSERT(ENERGY_SUBSYS_COUNT == ARRAY_SIZE(((struct omi_telemetry *)0)->charge_uah));
+#endif
+
+#include <zephyr/kernel.h>
+#include <string.h>
+
+/* The record goes out as-is: it is defined little endian */
+BUILD_ASSERT(IS_ENABLED(CONFIG_LITTLE_ENDIAN), "telemetry record is little endian");
+
+struct io_accum {
+    uint32_t ops;
+    uint32_t errors;
+    uint32_t bytes;
+    uint32_t stalls;
+    uint32_t max_us;
+    uint64_t busy_us;
+    uint32_t hist[TELEMETRY_LATENCY_BUCKETS];
+};
+
+static struct k_spinlock io_lock;
+static struct io_accum io_accum[TELEMETRY_IO_COUNT];
+/* Latency samples share the histogram; only ops, max_us and hist are used */
+static struct io_accum lat_accum[TELEMETRY_LATENCY_COUNT];
+
+static inline uint32_t latency_bucket(uint32_t us)
+{
+    uint32_t b = (us > 1) ? 31 - __builtin_clz(us) : 0;
+
+    return MIN(b, TELEMETRY_LATENCY_BUCKETS - 1);
+}
+
+void telemetry_record_io(enum telemetry_io io, uint32_t us, int result)
+{
+    struct io_accum *a = &io_accum[io];
+    k_spinlock_key_t key = k_spin_lock(&io_lock);
+
+    a->ops++;
+    if (result < 0) {
+        a->errors++;
+    } else {
+        a->bytes += result;
+    }
+    a->busy_us += us;
+    a->max_us = MAX(a->max_us, us);
+    if (us > PWM_AUDIO_BLOCK_PERIOD_US) {
+        a->stalls++;
+    }
+    a->hist[latency_bucket(us)]++;
+    k_spin_unlock(&io_lock, key);
+}
+
+void telemetry_record_latency(enum telemetry_latency lat, uint32_t us)
+{
+    struct io_accum *a = &lat_accum[lat];
+    k_spinlock_key_t key = k_spin_lock(&io_lock);
+
+    a->ops++;
+    a->max_us = MAX(a->max_us, us);
+    a->hist[latency_bucket(us)]++;
+    k_spin_unlock(&io_lock, key);
+}
+
+/* Upper edge of the bucket holding the given rank; the last bucket is open, so max */
+static uint32_t percentile(const struct io_accum *a, uint32_t permille)
+{
+    uint32_t rank = DIV_ROUND_UP((uint64_t)a->ops * permille, 1000U);
+    uint32_t seen = 0;
+
+    if (a->ops == 0) {
+        return 0;
+    }
+    for (uint32_t b = 0; b < TELEMETRY_LATENCY_BUCKETS - 1; b++) {
+        seen += a->hist[b];
+        if (seen >= rank) {
+            return MIN((2U << b) - 1, a->max_us);
+        }
+    }
+    return a->max_us;
+}
+
+static void snapshot_io(enum telemetry_io io, struct telemetry_io_stats *out)
+{
+    struct io_accum a;
+    k_spinlock_key_t key = k_spin_lock(&io_lock);
+
+    a = io_accum[io];
+    k_spin_unlock(&io_lock, key);
+
+    out->ops = a.ops;
+    out->errors = a.errors;
+    out->bytes = a.bytes;
+    out->busy_ms = (uint32_t)(a.busy_us / 1000U);
+    out->stalls = a.stalls;
+    out->p50_us = percentile(&a, 500);
+    out->p90_us = percentile(&a, 900);
+    out->p99_us = percentile(&a, 990);
+    out->max_us = a.max_us;
+}
+
+static void snapshot_latency(enum telemetry_latency lat, struct telemetry_latency_stats *out)
+{
+    struct io_accum a;
+    k_spinlock_key_t key = k_spin_lock(&io_lock);
+
+    a = lat_accum[lat];
+    k_spin_unlock(&io_lock, key);
+
+    out->count = a.ops;
+    out->p50_us = percentile(&a, 500);
+    out->p90_us = percentile(&a, 900);
+    out->p99_us = percentile(&a, 990);
+    out->max_us = a.max_us;
+}
+
+void telemetry_snapshot(struct omi_telemetry *out)
+{
+    struct pwm_audio_stream_stats engine;
+    struct ingest_stats ingest;
+    k_thread_runtime_stats_t cpu;
+
+    memset(out, 0, sizeof(*out));
+    out->version = TELEMETRY_VERSION;
+    out->size = sizeof(*out);
+    out->uptime_s = (uint32_t)(k_uptime_get() / MSEC_PER_SEC);
+
+    pwm_audio_stream_get_stats(&engine);
+    out->blocks_played = engine.blocks_played;
+    out->underruns = engine.underruns;
+    ingest_get_stats(&ingest);
+    out->ingest_dropped = ingest.dropped;
+#if defined(CONFIG_OMI_CAPTURE)
+    struct capture_stats capture;
+
+    capture_get_stats(&capture);
+    out->capture_dropped = capture.source_overruns + capture.pool_drops;
+#endif
+    out->pool_min_free = audio_pool_min_free();
+
+    if (k_thread_runtime_stats_all_get(&cpu) == 0) {
+        out->cpu_busy_ms = (uint32_t)k_cyc_to_ms_floor64(cpu.execution_cycles - cpu.idle_cycles);
+        out->cpu_total_ms = (uint32_t)k_cyc_to_ms_floor64(cpu.execution_cycles);
+    }
+
+    for (int i = 0; i < TELEMETRY_IO_COUNT; i++) {
+        snapshot_io(i, &out->io[i]);
+    }
+    out->sd_free_kb = sd_card_get_free_kb();
+
+#if defined(CONFIG_OMI_ENERGY)
+    struct energy_report energy;
+
+    energy_get_report(&energy, true);
+    for (int i = 0; i < ENERGY_SUBSYS_COUNT; i++) {
+        out->charge_uah[i] = energy.subsys[i].charge_uah;
+    }
+#endif
+
+    for (int i = 0; i < TELEMETRY_LATENCY_COUNT; i++) {
+        snapshot_latency(i, &out->latency[i]);
+    }
+}
+
+#if defined(CONFIG_OMI_TELEMETRY_GATT)
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+
+/* 4f4d4900-7465-6c65-6d65-7472790000xx: "OMI\0telemetry" */
+#define TELEMETRY_UUID(n) BT_UUID_128_ENCODE(0x4f4d4900, 0x7465, 0x6c65, 0x6d65, 0x747279000000 + (n))
+
+static const struct bt_uuid_128 telemetry_svc_uuid = BT_UUID_INIT_128(TELEMETRY_UUID(0));
+static const struct bt_uuid_128 telemetry_chr_uuid = BT_UUID_INIT_128(TELEMETRY_UUID(1));
+
+/*
+ * One snapshot per connection: a long read continues at an offset and must
+ * keep serving the record it started on, even while another central reads.
+ */
+static struct omi_telemetry gatt_snapshot[CONFIG_BT_MAX_CONN];
+
+static ssize_t read_telemetry(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                              void *buf, uint16_t len, uint16_t offset)
+{
+    struct omi_telemetry *snap = &gatt_snapshot[bt_conn_index(conn)];
+
+    if (offset == 0) {
+        telemetry_snapshot(snap);
+    }
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, snap, sizeof(*snap));
+}
+
+BT_GATT_SERVICE_DEFINE(telemetry_svc,
+    BT_GATT_PRIMARY_SERVICE(&telemetry_svc_uuid),
+    BT_GATT_CHARACTERISTIC(&telemetry_chr_uuid.uuid, BT_GATT_CHRC_READ,
+                           BT_GATT_PERM_READ, read_telemetry, NULL, NULL),
+);
+#endif /* CONFIG_OMI_TELEMETRY_GATT */
@@ -0,0 +1,120 @@
+/*
+ * Binary telemetry snapshot
+ * One packed, versioned little-endian record with the counters the fleet
+ * is monitored on: audio underruns, drops and latency percentiles, SD
+ * read/write latency percentiles, throughput and stalls, CPU load and
+ * free space. It is read
+ * in one call, served as a GATT characteristic and printed as hex by the
+ * "telemetry" shell command; scripts/telemetry_decode.py decodes it.
+ *
+ * Everything is cumulative since boot so snapshots from different times
+ * and devices can be differenced and aggregated on the host. New fields
+ * are only ever appended; the size field tells a decoder how much of the
+ * record a device filled in. A layout change bumps TELEMETRY_VERSION.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <zephyr/toolchain.h>
+#include <stdint.h>
+
+#define TELEMETRY_VERSION 1
+
+/* Latency histogram: bucket b counts operations of 2^b..2^(b+1)-1 us */
+#define TELEMETRY_LATENCY_BUCKETS 20
+
+enum telemetry_io {
+    TELEMETRY_IO_SD_READ,       /* playback sector reads */
+    TELEMETRY_IO_SD_WRITE,      /* storage writer block writes */
+    TELEMETRY_IO_COUNT,
+};
+
+enum telemetry_latency {
+    TELEMETRY_LATENCY_INGEST,   /* BLE speech packet queued until handed to speak() */
+    TELEMETRY_LATENCY_COUNT,
+};
+
+struct telemetry_io_stats {
+    uint32_t ops;
+    uint32_t errors;
+    uint32_t bytes;
+    uint32_t busy_ms;           /* time spent in the operations; bytes / busy_ms is throughput */
+    uint32_t stalls;            /* operations longer than one audio block period */
+    uint32_t p50_us;            /* percentiles, rounded up to the histogram bucket */
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} __packed;
+
+struct telemetry_latency_stats {
+    uint32_t count;
+    uint32_t p50_us;            /* percentiles, rounded up to the histogram bucket */
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} __packed;
+
+struct omi_telemetry {
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t size;              /* bytes of this record the device filled in */
+    uint32_t uptime_s;
+
+    /* Audio */
+    uint32_t blocks_played;
+    uint32_t underruns;         /* engine block periods with nothing queued mid-stream */
+    uint32_t ingest_dropped;    /* BLE speech packets dropped on a full queue */
+    uint32_t capture_dropped;   /* microphone blocks lost in the current or last recording */
+    uint16_t pool_min_free;     /* audio pool low-water mark */
+    uint16_t reserved2;
+
+    /* CPU, from the scheduler's runtime stats */
+    uint32_t cpu_busy_ms;
+    uint32_t cpu_total_ms;
+
+    /* SD card */
+    struct telemetry_io_stats io[TELEMETRY_IO_COUNT];
+    uint32_t sd_free_kb;        /* as of the last free-space query, UINT32_MAX if unknown */
+
+    /* Estimated charge since boot per enum energy_subsys, 0 without CONFIG_OMI_ENERGY */
+    uint32_t charge_uah[4];
+
+    /* Audio path latency per enum telemetry_latency */
+    struct telemetry_latency_stats latency[TELEMETRY_LATENCY_COUNT];
+} __packed;
+
+#if defined(CONFIG_OMI_TELEMETRY)
+/**
+ * @brief Account one SD operation
+ * @param us Duration in microseconds
+ * @param result Bytes transferred, or a negative error code
+ */
+void telemetry_record_io(enum telemetry_io io, uint32_t us, int result);
+
+/**
+ * @brief Account one audio path latency sample
+ * @param us Latency in microseconds
+ */
+void telemetry_record_latency(enum telemetry_latency lat, uint32_t us);
+
+/**
+ * @brief Fill in a snapshot; cheap enough to call from a GATT read
+ */
+void telemetry_snapshot(struct omi_telemetry *out);
+#else
+static inline void telemetry_record_io(enum telemetry_io io, uint32_t us, int result)
+{
+    ARG_UNUSED(io);
+    ARG_UNUSED(us);
+    ARG_UNUSED(result);
+}
+
+static inline void telemetry_record_latency(enum telemetry_latency lat, uint32_t us)
+{
+    ARG_UNUSED(lat);
+    ARG_UNUSED(us);
+}
+#endif
+
+#endif /* TELEMETRY_H */
@@ -0,0 +1,205 @@
+/*
+ * Persistent audio settings
+ */
+
+#include "audio_settings.h"
+#include "pwm_audio.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+#include <stdio.h>
+
+LOG_MODULE_REGISTER(audio_settings, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define SETTINGS_SUBTREE    "audio"
+#define SETTINGS_NAME_MAX   32
+
+/* Write-back retries while audio plays before writing regardless */
+#define MAX_DEFERS          10
+
+struct audio_setting {
+    const char *key;
+    int (*get)(void);
+    void (*set)(int value);
+};
+
+static int mute_get(void)
+{
+    return pwm_audio_get_user_mute();
+}
+
+static void mute_set(int value)
+{
+    pwm_audio_set_user_mute(value != 0);
+}
+
+static int duck_get(void)
+{
+    return pwm_audio_get_duck_db();
+}
+
+static void duck_set(int value)
+{
+    pwm_audio_set_duck_db(CLAMP(value, 0, UINT8_MAX));
+}
+
+/* Every value is stored as an int32_t; new settings (EQ bands) add a row */
+static const struct audio_setting settings[] = {
+    { "loudness", pwm_audio_get_loudness, pwm_audio_set_loudness },
+    { "mute", mute_get, mute_set },
+    { "duck", duck_get, duck_set },
+};
+
+static int32_t flash_value[ARRAY_SIZE(settings)];   /* as last read or written */
+static bool loaded;
+static uint8_t defers;
+static struct k_work_delayable save_work;
+static K_MUTEX_DEFINE(save_lock);
+static atomic_t changes;
+static struct audio_settings_stats stats;
+
+static int audio_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+                              void *cb_arg)
+{
+    const char *next;
+    int32_t value;
+    int ret;
+
+    /* Only the boot-time restore applies; a later settings_load() elsewhere
+     * must not roll back changes that have not reached flash yet */
+    if (loaded) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(settings); i++) {
+        if (!settings_name_steq(name, settings[i].key, &next) || next != NULL) {
+            continue;
+        }
+        if (len != sizeof(value)) {
+            return -EINVAL;
+        }
+        ret = read_cb(cb_arg, &value, sizeof(value));
+        if (ret < 0) {
+            return ret;
+        }
+        settings[i].set(value);
+        LOG_DBG("Restored %s = %d", settings[i].key, value);
+        return 0;
+    }
+    return -ENOENT;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(audio, SETTINGS_SUBTREE, NULL, audio_settings_set, NULL, NULL);
+
+/* Called with save_lock held */
+static int save_changed_locked(void)
+{
+    char name[SETTINGS_NAME_MAX];
+    int ret = 0;
+
+    for (size_t i = 0; i < ARRAY_SIZE(settings); i++) {
+        int32_t value = settings[i].get();
+        int err;
+
+        if (value == flash_value[i]) {
+            continue;
+        }
+        snprintf(name, sizeof(name), SETTINGS_SUBTREE "/%s", settings[i].key);
+        err = settings_save_one(name, &value, sizeof(value));
+        if (err != 0) {
+            /* flash_value stays stale, so the next change retries this key */
+            LOG_WRN("Saving %s failed: %d", name, err);
+            stats.errors++;
+            ret = err;
+            continue;
+        }
+        flash_value[i] = value;
+        stats.writes++;
+    }
+    defers = 0;
+    return ret;
+}
+
+static void save_work_handler(struct k_work *work)
+{
+    struct pwm_audio_stream_stats engine;
+
+    pwm_audio_stream_get_stats(&engine);
+
+    k_mutex_lock(&save_lock, K_FOREVER);
+    if (engine.queued > 0 && defers < MAX_DEFERS) {
+        defers++;
+        stats.deferred++;
+        k_work_schedule(k_work_delayable_from_work(work),
+                        K_MSEC(CONFIG_OMI_AUDIO_SETTINGS_DELAY_MS));
+    } else {
+        save_changed_locked();
+    }
+    k_mutex_unlock(&save_lock);
+}
+
+int audio_settings_load(void)
+{
+    int ret;
+
+    if (loaded) {
+        return 0;
+    }
+
+    ret = settings_subsys_init();
+    if (ret == 0) {
+        ret = settings_load_subtree(SETTINGS_SUBTREE);
+    }
+    if (ret != 0) {
+        LOG_WRN("Audio settings not restored (%d), using defaults", ret);
+    }
+
+    /* Keys that were never stored compare against their defaults */
+    for (size_t i = 0; i < ARRAY_SIZE(settings); i++) {
+        flash_value[i] = settings[i].get();
+    }
+    k_work_init_delayable(&save_work, save_work_handler);
+    loaded = true;
+
+    LOG_INF("Audio settings: loudness %d dB, %s, ducking %d dB",
+            pwm_audio_get_loudness(), pwm_audio_get_user_mute() ? "muted" : "unmuted",
+            pwm_audio_get_duck_db());
+    return ret;
+}
+
+void audio_settings_changed(void)
+{
+    /* The restore itself goes through the setters */
+    if (!loaded) {
+        return;
+    }
+
+    atomic_inc(&changes);
+    /* Schedule, not reschedule: the window opens at the first change, so
+     * a steady stream of changes still reaches flash once per window */
+    k_work_schedule(&save_work, K_MSEC(CONFIG_OMI_AUDIO_SETTINGS_DELAY_MS));
+}
+
+int audio_settings_sync(void)
+{
+    int ret;
+
+    if (!loaded) {
+        return -EAGAIN;
+    }
+
+    k_work_cancel_delayable(&save_work);
+    k_mutex_lock(&save_lock, K_FOREVER);
+    ret = save_changed_locked();
+    k_mutex_unlock(&save_lock);
+    return ret;
+}
+
+void audio_settings_get_stats(struct audio_settings_stats *out)
+{
+    k_mutex_lock(&save_lock, K_FOREVER);
+    *out = stats;
+    k_mutex_unlock(&save_lock);
+    out->changes = atomic_get(&changes);
+}
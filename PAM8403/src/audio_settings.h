@@ -0,0 +1,49 @@
+/*
+ * Persistent audio settings
+ * Loudness, user mute and ducking are kept in the settings subsystem
+ * (NVS in the internal flash storage partition) under "audio/". They are
+ * restored by pwm_audio_init() before the amplifier bring-up unmutes, so
+ * a device that was muted or turned down stays that way across a reboot.
+ *
+ * Changes are written back lazily: the first change after a write starts
+ * a CONFIG_OMI_AUDIO_SETTINGS_DELAY_MS window on the system work queue and
+ * everything changed inside it lands in one pass, which only rewrites keys
+ * whose value differs from flash. The pass waits for the output to go idle,
+ * since a flash page erase halts the CPU long enough to underrun a block.
+ */
+
+#ifndef AUDIO_SETTINGS_H
+#define AUDIO_SETTINGS_H
+
+#include <stdint.h>
+
+struct audio_settings_stats {
+    uint32_t changes;           /* setter calls since boot */
+    uint32_t writes;            /* keys written to flash */
+    uint32_t deferred;          /* write-backs postponed while audio played */
+    uint32_t errors;
+};
+
+/**
+ * @brief Restore the stored settings into the PWM audio engine
+ *
+ * Called once by pwm_audio_init(); keys missing from flash keep their
+ * defaults. Later calls do nothing.
+ * @return 0, or a settings error (the defaults stay in effect)
+ */
+int audio_settings_load(void);
+
+/**
+ * @brief Note that a persistent setting changed; schedules the write-back
+ */
+void audio_settings_changed(void);
+
+/**
+ * @brief Write pending changes now, e.g. before a controlled power-off
+ * @return 0, or the last settings error
+ */
+int audio_settings_sync(void);
+
+void audio_settings_get_stats(struct audio_settings_stats *stats);
+
+#endif /* AUDIO_SETTINGS_H */
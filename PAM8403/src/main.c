@@ -8,6 +8,7 @@
 #include <zephyr/logging/log.h>
 #include <math.h>
 #include "pwm_audio.h"
+#include "synth.h"
 
 /* Define M_PI if not already defined */
 #ifndef M_PI
@@ -33,16 +34,7 @@ int main(void)
         return err;
     }
     
-    /* Wait a moment for PAM8403 to stabilize */
-    k_sleep(K_MSEC(100));
-    
-    /* Unmute with anti-pop ramp */
-    pwm_audio_unmute();
-    
-    /* Wait for unmute ramp to complete */
-    k_sleep(K_MSEC(100));
-    
-    /* Generate a test tone (440Hz A note) */
+    /* Generate a test tone (440Hz A note) while the amplifier comes up */
     LOG_INF("Generating test tone (440Hz)");
     err = pwm_audio_generate_tone(audio_buffer, AUDIO_BUFFER_SIZE, 440.0f, 0.3f);
     if (err) {
@@ -50,6 +42,9 @@ int main(void)
         return err;
     }
     
+    /* The direct-drive test calls below need the amplifier unmuted */
+    pwm_audio_wait_ready(K_FOREVER);
+    
     /* Play the tone */
     LOG_INF("Playing test tone");
     err = pwm_audio_play_mono(audio_buffer, AUDIO_BUFFER_SIZE);
@@ -61,33 +56,15 @@ int main(void)
     /* Wait for audio to finish */
     k_sleep(K_MSEC(1500));
     
-    /* Generate a chord (C major: C, E, G) */
+    /* Render a chord (C major: C, E, G) from its sound descriptor */
     LOG_INF("Generating C major chord");
-    for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) {
-        float t = (float)i / PWM_AUDIO_SAMPLE_RATE;
-        float sample = 0.0f;
-        
-        /* C4 (261.63 Hz) */
-        sample += sinf(2.0f * (float)M_PI * 261.63f * t) * 0.2f;
-        /* E4 (329.63 Hz) */
-        sample += sinf(2.0f * (float)M_PI * 329.63f * t) * 0.2f;
-        /* G4 (392.00 Hz) */
-        sample += sinf(2.0f * (float)M_PI * 392.00f * t) * 0.2f;
-        
-        /* Apply envelope */
-        float envelope = 1.0f;
-        if (i < 1000) {
-            envelope = (float)i / 1000.0f; // Fade in
-        } else if (i > AUDIO_BUFFER_SIZE - 1000) {
-            envelope = (float)(AUDIO_BUFFER_SIZE - i) / 1000.0f; // Fade out
-        }
-        
-        audio_buffer[i] = (int16_t)(sample * envelope * 32767.0f);
-    }
+    static struct synth chord;
+    synth_start(&chord, synth_find("chord"));
+    size_t chord_samples = synth_render(&chord, audio_buffer, AUDIO_BUFFER_SIZE);
     
     /* Play the chord */
     LOG_INF("Playing C major chord");
-    err = pwm_audio_play_mono(audio_buffer, AUDIO_BUFFER_SIZE);
+    err = pwm_audio_play_mono(audio_buffer, chord_samples);
     if (err) {
         LOG_ERR("Failed to play chord: %d", err);
         return err;
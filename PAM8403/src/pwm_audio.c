@@ -10,6 +10,17 @@
 #include <zephyr/kernel.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#if PWM_AUDIO_HAS_SAMPLE_TIMER
+#include <zephyr/drivers/counter.h>
+#endif
+#if defined(CONFIG_OMI_AUDIO_SETTINGS)
+#include "audio_settings.h"
+#else
+static inline void audio_settings_changed(void)
+{
+}
+#endif
 
 /* Define M_PI if not already defined */
 #ifndef M_PI
@@ -25,17 +36,142 @@ static const struct device *pwm_audio_r = DEVICE_DT_GET(DT_NODELABEL(pwm1));
 /* Global state */
 static uint8_t current_volume = PWM_AUDIO_MAX_VOLUME;
 static bool is_muted = false;
+static bool user_muted;         /* holds the output muted over pwm_audio_unmute() */
+static int64_t pwm_started;     /* uptime when the carrier started */
+
+/* PAM8403 power residency */
+static struct k_spinlock amp_lock;
+static bool amp_awake;
+static int64_t amp_since;
+static int64_t amp_awake_ms;
 static bool is_initialized = false;
 
+/* Gain staging; a PAM8403 step change waits in pending_* for a zero crossing */
+static const int8_t pam8403_gain_db[] = { 6, 15, 20, 24 };
+static const uint8_t digital_gain_q8[] = {      /* 256 * 10^(-dB/20), 0..42 dB (0 dB saturates) */
+    255, 228, 203, 181, 162, 144, 128, 114, 102, 91, 81, 72, 64, 57, 51,
+    46, 41, 36, 32, 29, 26, 23, 20, 18, 16, 14, 13, 11, 10, 9, 8, 7, 6,
+    6, 5, 5, 4, 4, 3, 3, 3, 2, 2,
+};
+BUILD_ASSERT(ARRAY_SIZE(digital_gain_q8) == 1 - PWM_AUDIO_DIGITAL_MIN_DB);
+
+static struct k_spinlock gain_lock;
+static uint8_t amp_gain = PAM8403_GAIN_15DB;
+static int8_t loudness_db = PWM_AUDIO_LOUDNESS_DEFAULT_DB;
+static uint8_t staged_volume = PWM_AUDIO_MAX_VOLUME;    /* digital gain of the plan, unmute target */
+static atomic_t gain_pending;
+static uint8_t pending_amp_gain;
+static uint8_t pending_volume;
+static int16_t gain_prev_sample;
+static uint16_t gain_wait;
+static uint32_t gain_switches;
+static uint32_t gain_switches_forced;
+
+/* Block streaming engine */
+static K_THREAD_STACK_DEFINE(stream_stack, PWM_AUDIO_STREAM_STACK_SIZE);
+static struct k_thread stream_thread;
+static atomic_t stream_active;
+static uint32_t stream_blocks_played;
+static uint32_t stream_underruns;
+
+/* Mixer: per-source queues, one block from each mixed per block period */
+#define MIX_UNITY (1 << 15)
+
+struct mix_source {
+    struct k_fifo fifo;
+    atomic_t queued;
+    struct audio_block *fade;   /* flushed block, faded out by the next mix */
+    int32_t fade_gain;          /* Q15 gain the fade starts from */
+    int32_t gain;               /* Q15 gain at the end of the last mixed block */
+    uint8_t priority;
+    bool active;                /* from its first block to AUDIO_BLOCK_F_END */
+    bool fade_in;               /* next stream starts from silence */
+};
+
+static struct mix_source sources[PWM_AUDIO_SRC_COUNT] = {
+    [PWM_AUDIO_SRC_MEDIA] = { .priority = 0, .gain = MIX_UNITY },
+    [PWM_AUDIO_SRC_SPEECH] = { .priority = 1, .gain = MIX_UNITY },
+    [PWM_AUDIO_SRC_PROMPT] = { .priority = 2, .gain = MIX_UNITY },
+};
+static struct k_spinlock mix_lock;
+static K_SEM_DEFINE(mix_avail, 0, K_SEM_MAX_LIMIT);  /* one count per submitted block */
+static int32_t duck_gain = MIX_UNITY;
+static uint8_t duck_db_set = PWM_AUDIO_DUCK_DB_DEFAULT;
+static int32_t mix_acc[AUDIO_BLOCK_SAMPLES];
+static uint32_t mixed_blocks;
+static uint32_t ducked_blocks;
+static uint32_t crossfades;
+
+/* Bring-up: timed steps on the audio work queue, readiness in audio_events */
+enum bringup_step {
+    BRINGUP_PWM_SETTLE,     /* PWM held at mid-scale, amplifier still in shutdown */
+    BRINGUP_AMP_WAKE,       /* amplifier released from shutdown */
+    BRINGUP_UNMUTE,         /* unmute ramp running */
+    BRINGUP_DONE,
+};
+
+static K_THREAD_STACK_DEFINE(audio_work_stack, PWM_AUDIO_WORK_STACK_SIZE);
+static struct k_work_q audio_work_q;
+static struct k_work_delayable bringup_work;
+static enum bringup_step bringup_step;
+static K_EVENT_DEFINE(audio_events);
+
+#if PWM_AUDIO_HAS_SAMPLE_TIMER
+/* The sample timer ISR plays one block while the engine thread refills the other */
+static const struct device *sample_timer = DEVICE_DT_GET(DT_ALIAS(pwm_audio_timer));
+static K_FIFO_DEFINE(out_fifo);
+static K_SEM_DEFINE(out_slots, PWM_AUDIO_OUT_SLOTS, PWM_AUDIO_OUT_SLOTS);
+static atomic_t out_queued;
+static struct audio_block *out_block;
+static uint16_t out_index;
+static uint16_t starved_ticks;
+#endif
+
+#if defined(CONFIG_OMI_AEC)
+/* Samples as sent to the speaker, for the echo canceller */
+static int16_t ref_ring[PWM_AUDIO_REF_SAMPLES];
+static atomic_t ref_head;
+static atomic_t ref_epoch;      /* bumped when the reference clock restarts */
+
+static inline void ref_push(int16_t sample)
+{
+    atomic_val_t head = atomic_get(&ref_head);
+
+    ref_ring[(uint32_t)head % PWM_AUDIO_REF_SAMPLES] = sample;
+    atomic_set(&ref_head, head + 1);
+}
+
+static inline void ref_restart(void)
+{
+    atomic_inc(&ref_epoch);
+}
+#else
+static inline void ref_push(int16_t sample)
+{
+    ARG_UNUSED(sample);
+}
+
+static inline void ref_restart(void)
+{
+}
+#endif
+
+static void stream_thread_fn(void *p1, void *p2, void *p3);
+static void pam8403_write_gain_pins(uint8_t gain_level);
+#if PWM_AUDIO_HAS_SAMPLE_TIMER
+static int sample_timer_start(void);
+#endif
+
 /* Timer for anti-pop ramping */
 static void mute_ramp_callback(struct k_timer *timer);
 K_TIMER_DEFINE(mute_ramp_timer, mute_ramp_callback, NULL);
 
-/* Convert 16-bit audio sample to PWM duty cycle with enhanced quality */
+/* Convert 16-bit audio sample to PWM duty cycle with enhanced quality.
+ * The volume applies here, after the pipelines' requant stage. */
 static uint32_t audio_sample_to_pwm(int16_t sample)
 {
-    /* Apply volume scaling with higher precision */
-    int32_t scaled = ((int32_t)sample * current_volume) / 256;
+    /* Q8 digital gain takes the 16-bit sample straight to the 8-bit PWM range */
+    int32_t scaled = ((int32_t)sample * current_volume) >> 16;
     
     /* Enhanced clipping protection for PAM8403 */
     if (scaled > 127) scaled = 127;
@@ -58,43 +194,28 @@ static uint32_t audio_sample_to_pwm(int16_t sample)
     return pulse_width;
 }
 
-/* Anti-pop mute ramp function */
+/* Anti-pop mute ramp function: moves the digital gain to 0 (mute) or to
+ * the gain-staged volume (unmute) in PWM_AUDIO_MUTE_RAMP_STEPS steps */
 static void mute_ramp_callback(struct k_timer *timer)
 {
     static uint8_t ramp_step = 0;
-    static uint8_t target_volume = 0;
-    static bool ramping_to_mute = false;
+    static uint8_t ramp_from = 0;
     
     if (ramp_step == 0) {
-        /* Start of ramp */
-        if (is_muted) {
-            /* Ramping to mute */
-            target_volume = 0;
-            ramping_to_mute = true;
-        } else {
-            /* Ramping to unmute */
-            target_volume = PWM_AUDIO_MAX_VOLUME;
-            ramping_to_mute = false;
-        }
+        ramp_from = current_volume;
     }
     
-    /* Calculate current volume for this step */
-    uint8_t step_volume = (target_volume * ramp_step) / PWM_AUDIO_MUTE_RAMP_STEPS;
-    if (ramping_to_mute) {
-        step_volume = current_volume - step_volume;
-    }
-    
-    /* Apply volume */
-    pwm_audio_set_volume(step_volume);
+    int target_volume = is_muted ? 0 : staged_volume;
     
     ramp_step++;
+    current_volume = ramp_from + ((target_volume - ramp_from) * ramp_step) / PWM_AUDIO_MUTE_RAMP_STEPS;
     
     if (ramp_step >= PWM_AUDIO_MUTE_RAMP_STEPS) {
         /* Ramp complete */
         ramp_step = 0;
         k_timer_stop(timer);
         
-        if (ramping_to_mute) {
+        if (is_muted) {
             /* Set PWM to 50% duty cycle (silence) */
             int err_l = pwm_set(pwm_audio_l, 0, PWM_AUDIO_PERIOD_NS, PWM_AUDIO_PERIOD_NS / 2, 0);
             int err_r = pwm_set(pwm_audio_r, 0, PWM_AUDIO_PERIOD_NS, PWM_AUDIO_PERIOD_NS / 2, 0);
@@ -105,6 +226,126 @@ static void mute_ramp_callback(struct k_timer *timer)
     }
 }
 
+/* Called with gain_lock held */
+static void gain_apply(uint8_t gain_level, uint8_t volume)
+{
+    if (gain_level != amp_gain) {
+        pam8403_write_gain_pins(gain_level);
+        amp_gain = gain_level;
+    }
+    if (!is_muted) {
+        current_volume = volume;
+    }
+    atomic_clear(&gain_pending);
+}
+
+/* Per output sample: switch a pending gain step where the waveform
+ * crosses zero, so the analog and digital changes cancel inaudibly */
+static inline void gain_switch_poll(int16_t sample)
+{
+    if (!atomic_get(&gain_pending)) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&gain_lock);
+
+    if (atomic_get(&gain_pending)) {
+        bool crossing = (gain_wait > 0) &&
+                        (sample == 0 || (sample < 0) != (gain_prev_sample < 0));
+
+        gain_prev_sample = sample;
+        if (crossing) {
+            gain_switches++;
+            gain_apply(pending_amp_gain, pending_volume);
+        } else if (++gain_wait >= PWM_AUDIO_GAIN_SWITCH_MAX_SAMPLES) {
+            gain_switches_forced++;
+            gain_apply(pending_amp_gain, pending_volume);
+        }
+    }
+    k_spin_unlock(&gain_lock, key);
+}
+
+void pwm_audio_plan_gain(int loudness, struct pwm_audio_gain_plan *plan)
+{
+    uint8_t step = 0;
+
+    loudness = CLAMP(loudness, PWM_AUDIO_LOUDNESS_MIN_DB, PWM_AUDIO_LOUDNESS_MAX_DB);
+
+    /* Lowest amplifier step that reaches the loudness under the digital ceiling */
+    while (step < ARRAY_SIZE(pam8403_gain_db) - 1 &&
+           pam8403_gain_db[step] - PWM_AUDIO_HEADROOM_DB < loudness) {
+        step++;
+    }
+
+    int digital_db = loudness - pam8403_gain_db[step];
+
+    plan->loudness_db = loudness;
+    plan->amp_gain = step;
+    plan->amp_db = pam8403_gain_db[step];
+    plan->digital_db = digital_db;
+    plan->volume = MIN(digital_gain_q8[-digital_db], PWM_AUDIO_MAX_VOLUME);
+    plan->dynamic_range_db = PWM_AUDIO_PWM_RANGE_DB + digital_db;
+}
+
+void pwm_audio_set_loudness(int loudness)
+{
+    struct pwm_audio_gain_plan plan;
+
+    pwm_audio_plan_gain(loudness, &plan);
+
+    k_spinlock_key_t key = k_spin_lock(&gain_lock);
+
+    loudness_db = plan.loudness_db;
+    staged_volume = plan.volume;
+
+    if (plan.amp_gain == amp_gain || is_muted || !atomic_get(&stream_active)) {
+        /* Digital-only change, or nothing audible playing: apply now */
+        gain_apply(plan.amp_gain, plan.volume);
+    } else {
+        pending_amp_gain = plan.amp_gain;
+        pending_volume = plan.volume;
+        gain_wait = 0;
+        atomic_set(&gain_pending, 1);
+    }
+    k_spin_unlock(&gain_lock, key);
+
+    audio_settings_changed();
+    LOG_DBG("Loudness %d dB: PAM8403 %d dB, digital %d dB (%u/256), %u dB PWM range",
+            plan.loudness_db, plan.amp_db, plan.digital_db, plan.volume,
+            plan.dynamic_range_db);
+}
+
+int pwm_audio_get_loudness(void)
+{
+    return loudness_db;
+}
+
+static void bringup_work_handler(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    switch (bringup_step) {
+    case BRINGUP_PWM_SETTLE:
+        /* Output is at mid-scale: the amplifier can wake without a step */
+        pam8403_wakeup();
+        bringup_step = BRINGUP_AMP_WAKE;
+        k_work_reschedule_for_queue(&audio_work_q, &bringup_work, K_MSEC(PAM8403_WAKEUP_MS));
+        break;
+    case BRINGUP_AMP_WAKE:
+        pwm_audio_unmute();
+        bringup_step = BRINGUP_UNMUTE;
+        k_work_reschedule_for_queue(&audio_work_q, &bringup_work, K_MSEC(PWM_AUDIO_MUTE_RAMP_MS));
+        break;
+    case BRINGUP_UNMUTE:
+        bringup_step = BRINGUP_DONE;
+        k_event_post(&audio_events, PWM_AUDIO_EVT_READY);
+        LOG_INF("PWM audio ready");
+        break;
+    default:
+        break;
+    }
+}
+
 int pwm_audio_init(void)
 {
     int err;
@@ -139,24 +380,76 @@ int pwm_audio_init(void)
         return err;
     }
     
-    /* Initialize PAM8403 with anti-pop sequence */
+    /* Configure the PAM8403 pins; it stays in shutdown until the bring-up wakes it */
     err = pam8403_init();
     if (err) {
         LOG_ERR("Failed to initialize PAM8403: %d", err);
         return err;
     }
     
-    /* Small delay to let PAM8403 stabilize */
-    k_sleep(K_MSEC(10));
-    
+    for (int i = 0; i < PWM_AUDIO_SRC_COUNT; i++) {
+        k_fifo_init(&sources[i].fifo);
+    }
+    pwm_audio_set_duck_db(PWM_AUDIO_DUCK_DB_DEFAULT);
+
     /* Start with muted state */
     is_muted = true;
+    pwm_started = k_uptime_get();
     is_initialized = true;
+
+#if defined(CONFIG_OMI_AUDIO_SETTINGS)
+    /* Stored loudness and mute are in place before the bring-up unmutes */
+    audio_settings_load();
+#endif
     
-    LOG_INF("PWM audio initialized successfully");
+    /* Start the block streaming engine; it holds blocks until the amplifier is ready */
+#if PWM_AUDIO_HAS_SAMPLE_TIMER
+    err = sample_timer_start();
+    if (err) {
+        LOG_ERR("Failed to start sample timer: %d", err);
+        return err;
+    }
+#endif
+    k_thread_create(&stream_thread, stream_stack, K_THREAD_STACK_SIZEOF(stream_stack),
+                    stream_thread_fn, NULL, NULL, NULL,
+                    PWM_AUDIO_STREAM_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&stream_thread, "pwm_audio_stream");
+    
+    /* Amplifier wake-up, settle and unmute continue off the caller's path */
+    k_work_queue_init(&audio_work_q);
+    k_work_queue_start(&audio_work_q, audio_work_stack, K_THREAD_STACK_SIZEOF(audio_work_stack),
+                       PWM_AUDIO_WORK_PRIORITY, NULL);
+    k_thread_name_set(&audio_work_q.thread, "pwm_audio_work");
+    
+    bringup_step = BRINGUP_PWM_SETTLE;
+    k_work_init_delayable(&bringup_work, bringup_work_handler);
+    k_work_schedule_for_queue(&audio_work_q, &bringup_work, K_MSEC(PWM_AUDIO_SETTLE_MS));
+    
+    LOG_INF("PWM audio initialized, amplifier bring-up started");
+    return 0;
+}
+
+bool pwm_audio_is_ready(void)
+{
+    return k_event_test(&audio_events, PWM_AUDIO_EVT_READY) != 0;
+}
+
+int pwm_audio_wait_ready(k_timeout_t timeout)
+{
+    if (!is_initialized) {
+        return -ENODEV;
+    }
+    if (k_event_wait(&audio_events, PWM_AUDIO_EVT_READY, false, timeout) == 0) {
+        return -EAGAIN;
+    }
     return 0;
 }
 
+struct k_event *pwm_audio_events(void)
+{
+    return &audio_events;
+}
+
 int pwm_audio_play(const int16_t *buffer, size_t samples)
 {
     if (!is_initialized) {
@@ -243,6 +536,542 @@ int pwm_audio_play_mono(const int16_t *buffer, size_t samples)
     return 0;
 }
 
+/* Hold both outputs at 50% duty cycle (silence) */
+static void stream_output_silence(void)
+{
+    pwm_set(pwm_audio_l, 0, PWM_AUDIO_PERIOD_NS, PWM_AUDIO_PERIOD_NS / 2, 0);
+    pwm_set(pwm_audio_r, 0, PWM_AUDIO_PERIOD_NS, PWM_AUDIO_PERIOD_NS / 2, 0);
+}
+
+static void stream_output_sample(int16_t sample)
+{
+    gain_switch_poll(sample);
+
+    uint32_t pulse = audio_sample_to_pwm(sample);
+
+    pwm_set(pwm_audio_l, 0, PWM_AUDIO_PERIOD_NS, pulse, 0);
+    pwm_set(pwm_audio_r, 0, PWM_AUDIO_PERIOD_NS, pulse, 0);
+}
+
+#if PWM_AUDIO_HAS_SAMPLE_TIMER
+/* Finish the block the ISR was playing and release its slot */
+static void sample_timer_retire_block(void)
+{
+    if (out_block->flags & AUDIO_BLOCK_F_END) {
+        atomic_set(&stream_active, 0);
+        stream_output_silence();
+    }
+    stream_blocks_played++;
+    audio_pool_free(out_block);
+    out_block = NULL;
+    k_sem_give(&out_slots);
+}
+
+/* Runs at PWM_AUDIO_SAMPLE_RATE; outputs one sample per tick */
+static void sample_timer_isr(const struct device *dev, void *user_data)
+{
+    ARG_UNUSED(dev);
+    ARG_UNUSED(user_data);
+
+    if (out_block == NULL) {
+        out_block = k_fifo_get(&out_fifo, K_NO_WAIT);
+        out_index = 0;
+        if (out_block == NULL) {
+            ref_push(0);
+            /* Mid-stream, every block period without data is an underrun */
+            if (atomic_get(&stream_active)) {
+                if (starved_ticks == 0) {
+                    stream_output_silence();
+                }
+                if (++starved_ticks >= AUDIO_BLOCK_SAMPLES) {
+                    stream_underruns++;
+                    starved_ticks = 0;
+                }
+            }
+            return;
+        }
+        atomic_dec(&out_queued);
+        starved_ticks = 0;
+    }
+
+    if (out_index < out_block->samples && !is_muted) {
+        stream_output_sample(out_block->data[out_index]);
+        ref_push(out_block->data[out_index]);
+    } else {
+        ref_push(0);
+    }
+    if (++out_index >= out_block->samples) {
+        sample_timer_retire_block();
+    }
+}
+
+static int sample_timer_start(void)
+{
+    if (!device_is_ready(sample_timer)) {
+        LOG_ERR("Sample timer is not ready");
+        return -ENODEV;
+    }
+
+    struct counter_top_cfg top_cfg = {
+        .ticks = counter_get_frequency(sample_timer) / PWM_AUDIO_SAMPLE_RATE,
+        .callback = sample_timer_isr,
+        .user_data = NULL,
+        .flags = 0,
+    };
+
+    int err = counter_set_top_value(sample_timer, &top_cfg);
+    if (err) {
+        LOG_ERR("Failed to set sample timer period: %d", err);
+        return err;
+    }
+
+    return counter_start(sample_timer);
+}
+
+/* Wait for a free ISR slot (the refill deadline) before mixing the next block */
+static void stream_wait_slot(void)
+{
+    k_sem_take(&out_slots, K_FOREVER);
+}
+
+static void stream_release_slot(void)
+{
+    k_sem_give(&out_slots);
+}
+
+/* Hand a mixed block to the ISR, into the slot taken by stream_wait_slot() */
+static void stream_output_block(struct audio_block *block)
+{
+    atomic_set(&stream_active, 1);
+    atomic_inc(&out_queued);
+    k_fifo_put(&out_fifo, block);
+}
+
+static size_t stream_flush_output(void)
+{
+    struct audio_block *block;
+    size_t dropped = 0;
+
+    while ((block = k_fifo_get(&out_fifo, K_NO_WAIT)) != NULL) {
+        atomic_dec(&out_queued);
+        dropped += block->samples;
+        audio_pool_free(block);
+        k_sem_give(&out_slots);
+    }
+    return dropped;
+}
+#else
+static void stream_wait_slot(void)
+{
+}
+
+static void stream_release_slot(void)
+{
+}
+
+/* No sample timer: play the block from this thread, pacing with busy-waits.
+ * The sample period is not a whole number of microseconds, so the
+ * remainder is carried between samples. The last period of each block is
+ * slept instead, or the threads below this one (shell, storage) would
+ * never run while a stream plays. */
+static void stream_output_block(struct audio_block *block)
+{
+    static uint32_t period_rem;
+
+    /* The reference only advances while playing here, so after a gap its
+     * positions no longer follow the microphone's clock */
+    if (atomic_set(&stream_active, 1) == 0) {
+        ref_restart();
+    }
+    for (size_t i = 0; i < block->samples; i++) {
+        if (!is_muted) {
+            stream_output_sample(block->data[i]);
+        }
+        ref_push(is_muted ? 0 : block->data[i]);
+        period_rem += 1000000U;
+
+        uint32_t us = period_rem / PWM_AUDIO_SAMPLE_RATE;
+
+        period_rem %= PWM_AUDIO_SAMPLE_RATE;
+        if (i + 1 < block->samples) {
+            k_busy_wait(us);
+        } else {
+            k_usleep(us);
+        }
+    }
+    stream_blocks_played++;
+
+    if (block->flags & AUDIO_BLOCK_F_END) {
+        atomic_set(&stream_active, 0);
+        stream_output_silence();
+    }
+    audio_pool_free(block);
+}
+
+static size_t stream_flush_output(void)
+{
+    return 0;
+}
+#endif /* PWM_AUDIO_HAS_SAMPLE_TIMER */
+
+/* Add a block to the mix, its gain ramping linearly from -> to (Q15) */
+static void mix_add(const struct audio_block *block, int32_t from, int32_t to)
+{
+    int32_t g = from << 8;
+    int32_t step = ((to - from) << 8) / (int32_t)MAX(block->samples, 1);
+
+    for (uint16_t i = 0; i < block->samples; i++) {
+        mix_acc[i] += (block->data[i] * (g >> 8)) >> 15;
+        g += step;
+    }
+}
+
+/**
+ * @brief Build the next output block from every source's queue
+ *
+ * Sources below the highest-priority active source ramp down to the duck
+ * gain within the block and come back up over PWM_AUDIO_DUCK_RELEASE_BLOCKS;
+ * flushed blocks fade to silence. A lone source at unity gain passes its
+ * block through untouched.
+ * @return NULL if nothing was queued
+ */
+static struct audio_block *mix_round(void)
+{
+    struct audio_block *in[PWM_AUDIO_SRC_COUNT];
+    struct audio_block *fade[PWM_AUDIO_SRC_COUNT];
+    int32_t from[PWM_AUDIO_SRC_COUNT], to[PWM_AUDIO_SRC_COUNT], fade_from[PWM_AUDIO_SRC_COUNT];
+    struct audio_block *out = NULL;
+    int blocks = 0;
+    int top = -1;
+    bool more = false;
+
+    k_spinlock_key_t key = k_spin_lock(&mix_lock);
+
+    for (int i = 0; i < PWM_AUDIO_SRC_COUNT; i++) {
+        struct mix_source *src = &sources[i];
+
+        in[i] = k_fifo_get(&src->fifo, K_NO_WAIT);
+        fade[i] = src->fade;
+        fade_from[i] = src->fade_gain;
+        src->fade = NULL;
+        if (in[i] != NULL) {
+            atomic_dec(&src->queued);
+            src->active = !(in[i]->flags & AUDIO_BLOCK_F_END);
+        }
+        if ((in[i] != NULL || src->active) && src->priority > top) {
+            top = src->priority;
+        }
+    }
+
+    for (int i = 0; i < PWM_AUDIO_SRC_COUNT; i++) {
+        struct mix_source *src = &sources[i];
+        int32_t target = (src->priority < top) ? duck_gain : MIX_UNITY;
+
+        if (in[i] != NULL) {
+            /* A stream after a flush fades in over one block; a duck releases slowly */
+            if (src->fade_in) {
+                src->gain = 0;
+                src->fade_in = false;
+            } else if (target > src->gain) {
+                target = MIN(target, src->gain + MIX_UNITY / PWM_AUDIO_DUCK_RELEASE_BLOCKS);
+            }
+            from[i] = src->gain;
+            src->gain = target;
+            blocks++;
+        } else if (!src->active && !src->fade_in) {
+            /* Idle: the next stream starts at the right level */
+            src->gain = target;
+        }
+        to[i] = src->gain;
+        blocks += (fade[i] != NULL);
+        more |= src->active || atomic_get(&src->queued) > 0;
+    }
+
+    k_spin_unlock(&mix_lock, key);
+
+    if (blocks == 0) {
+        return NULL;
+    }
+
+    for (int i = 0; i < PWM_AUDIO_SRC_COUNT && out == NULL; i++) {
+        if (in[i] != NULL && blocks == 1 && from[i] == MIX_UNITY && to[i] == MIX_UNITY) {
+            out = in[i];
+        }
+    }
+
+    if (out == NULL) {
+        uint16_t samples = 0;
+
+        memset(mix_acc, 0, sizeof(mix_acc));
+        for (int i = 0; i < PWM_AUDIO_SRC_COUNT; i++) {
+            if (in[i] != NULL) {
+                mix_add(in[i], from[i], to[i]);
+                samples = MAX(samples, in[i]->samples);
+                if (to[i] < MIX_UNITY) {
+                    ducked_blocks++;
+                }
+            }
+            if (fade[i] != NULL) {
+                mix_add(fade[i], fade_from[i], 0);
+                samples = MAX(samples, fade[i]->samples);
+            }
+        }
+
+        /* Reuse one of the inputs for the output, free the rest */
+        for (int i = 0; i < PWM_AUDIO_SRC_COUNT; i++) {
+            struct audio_block *used[] = { in[i], fade[i] };
+
+            for (size_t k = 0; k < ARRAY_SIZE(used); k++) {
+                if (used[k] == NULL) {
+                    continue;
+                }
+                if (out == NULL) {
+                    out = used[k];
+                } else {
+                    audio_pool_free(used[k]);
+                }
+            }
+        }
+
+        for (uint16_t i = 0; i < samples; i++) {
+            out->data[i] = (int16_t)CLAMP(mix_acc[i], INT16_MIN, INT16_MAX);
+        }
+        out->samples = samples;
+        if (blocks > 1) {
+            mixed_blocks++;
+        }
+    }
+
+    /* The output stream only ends once every source has */
+    out->flags = more ? 0 : AUDIO_BLOCK_F_END;
+    return out;
+}
+
+static void stream_thread_fn(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    /* Blocks submitted during bring-up wait in the source queues */
+    k_event_wait(&audio_events, PWM_AUDIO_EVT_READY, false, K_FOREVER);
+
+    while (1) {
+#if PWM_AUDIO_HAS_SAMPLE_TIMER
+        k_sem_take(&mix_avail, K_FOREVER);
+#else
+        /* Mid-stream, every block period without data is an underrun */
+        if (k_sem_take(&mix_avail, atomic_get(&stream_active) ?
+                       K_USEC(PWM_AUDIO_BLOCK_PERIOD_US) : K_FOREVER) != 0) {
+            if (atomic_get(&stream_active)) {
+                stream_underruns++;
+                stream_output_silence();
+                for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
+                    ref_push(0);
+                }
+            }
+            continue;
+        }
+#endif
+        /* Mix as late as possible so a source that just started joins this block */
+        stream_wait_slot();
+        struct audio_block *block = mix_round();
+
+        if (block == NULL) {
+            stream_release_slot();
+            continue;
+        }
+        stream_output_block(block);
+    }
+}
+
+int pwm_audio_source_submit(enum pwm_audio_source src, struct audio_block *block)
+{
+    if (!is_initialized || src >= PWM_AUDIO_SRC_COUNT) {
+        audio_pool_free(block);
+        return -ENODEV;
+    }
+
+    atomic_inc(&sources[src].queued);
+    k_fifo_put(&sources[src].fifo, block);
+    k_sem_give(&mix_avail);
+    return 0;
+}
+
+int pwm_audio_stream_submit(struct audio_block *block)
+{
+    return pwm_audio_source_submit(PWM_AUDIO_SRC_MEDIA, block);
+}
+
+/* Blocks taken off the queues under mix_lock are chained through their
+ * fifo word and returned to the pool once the lock is dropped */
+static void unlink_block(struct audio_block **chain, struct audio_block *block)
+{
+    block->fifo_reserved = *chain;
+    *chain = block;
+}
+
+static void free_chain(struct audio_block *chain)
+{
+    while (chain != NULL) {
+        struct audio_block *next = chain->fifo_reserved;
+
+        audio_pool_free(chain);
+        chain = next;
+    }
+}
+
+size_t pwm_audio_source_flush(enum pwm_audio_source src)
+{
+    struct audio_block *chain = NULL;
+    struct audio_block *block;
+    size_t dropped = 0;
+
+    if (!is_initialized || src >= PWM_AUDIO_SRC_COUNT) {
+        return 0;
+    }
+
+    struct mix_source *s = &sources[src];
+    k_spinlock_key_t key = k_spin_lock(&mix_lock);
+
+    /* The block due next fades out; an older fade not yet mixed is superseded */
+    if (s->fade != NULL) {
+        unlink_block(&chain, s->fade);
+    }
+    s->fade = k_fifo_get(&s->fifo, K_NO_WAIT);
+    if (s->fade != NULL) {
+        atomic_dec(&s->queued);
+        s->fade_gain = s->gain;
+        crossfades++;
+    }
+    while ((block = k_fifo_get(&s->fifo, K_NO_WAIT)) != NULL) {
+        atomic_dec(&s->queued);
+        dropped += block->samples;
+        unlink_block(&chain, block);
+    }
+    s->active = false;
+    s->fade_in = true;
+
+    k_spin_unlock(&mix_lock, key);
+    free_chain(chain);
+    return dropped;
+}
+
+uint32_t pwm_audio_source_queued(enum pwm_audio_source src)
+{
+    if (src >= PWM_AUDIO_SRC_COUNT) {
+        return 0;
+    }
+    return (uint32_t)atomic_get(&sources[src].queued);
+}
+
+void pwm_audio_source_set_priority(enum pwm_audio_source src, uint8_t priority)
+{
+    if (src >= PWM_AUDIO_SRC_COUNT) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&mix_lock);
+
+    sources[src].priority = priority;
+    k_spin_unlock(&mix_lock, key);
+}
+
+void pwm_audio_set_duck_db(uint8_t duck_db)
+{
+    int32_t gain = (int32_t)(MIX_UNITY * powf(10.0f, -(float)duck_db / 20.0f));
+    k_spinlock_key_t key = k_spin_lock(&mix_lock);
+
+    duck_gain = gain;
+    duck_db_set = duck_db;
+    k_spin_unlock(&mix_lock, key);
+
+    audio_settings_changed();
+}
+
+uint8_t pwm_audio_get_duck_db(void)
+{
+    return duck_db_set;
+}
+
+size_t pwm_audio_stream_flush(void)
+{
+    struct audio_block *chain = NULL;
+    struct audio_block *block;
+    size_t dropped = 0;
+
+    /* The stream is over as far as underrun accounting is concerned */
+    atomic_set(&stream_active, 0);
+
+    k_spinlock_key_t key = k_spin_lock(&mix_lock);
+
+    for (int i = 0; i < PWM_AUDIO_SRC_COUNT; i++) {
+        struct mix_source *s = &sources[i];
+
+        while ((block = k_fifo_get(&s->fifo, K_NO_WAIT)) != NULL) {
+            atomic_dec(&s->queued);
+            dropped += block->samples;
+            unlink_block(&chain, block);
+        }
+        if (s->fade != NULL) {
+            unlink_block(&chain, s->fade);
+            s->fade = NULL;
+        }
+        s->active = false;
+    }
+
+    k_spin_unlock(&mix_lock, key);
+    free_chain(chain);
+    return dropped + stream_flush_output();
+}
+
+void pwm_audio_stream_get_stats(struct pwm_audio_stream_stats *stats)
+{
+    stats->blocks_played = stream_blocks_played;
+    stats->underruns = stream_underruns;
+    stats->queued = 0;
+    for (int i = 0; i < PWM_AUDIO_SRC_COUNT; i++) {
+        stats->queued += (uint32_t)atomic_get(&sources[i].queued);
+    }
+    stats->gain_switches = gain_switches;
+    stats->gain_switches_forced = gain_switches_forced;
+    stats->mixed_blocks = mixed_blocks;
+    stats->ducked_blocks = ducked_blocks;
+    stats->crossfades = crossfades;
+#if PWM_AUDIO_HAS_SAMPLE_TIMER
+    stats->queued += (uint32_t)atomic_get(&out_queued);
+#endif
+}
+
+#if defined(CONFIG_OMI_AEC)
+uint32_t pwm_audio_ref_position(void)
+{
+    return (uint32_t)atomic_get(&ref_head);
+}
+
+uint32_t pwm_audio_ref_epoch(void)
+{
+    return (uint32_t)atomic_get(&ref_epoch);
+}
+
+int pwm_audio_ref_read(uint32_t pos, int16_t *out, size_t samples)
+{
+    uint32_t head = (uint32_t)atomic_get(&ref_head);
+
+    if ((int32_t)(head - (pos + samples)) < 0) {
+        return -EAGAIN;     // not played yet
+    }
+    if (head - pos > PWM_AUDIO_REF_SAMPLES) {
+        return -ERANGE;     // already overwritten
+    }
+
+    for (size_t i = 0; i < samples; i++) {
+        out[i] = ref_ring[(pos + i) % PWM_AUDIO_REF_SAMPLES];
+    }
+    return 0;
+}
+#endif
+
 void pwm_audio_mute(void)
 {
     if (!is_initialized) {
@@ -266,6 +1095,11 @@ void pwm_audio_unmute(void)
         return;
     }
     
+    if (user_muted) {
+        LOG_DBG("Muted by the user, staying muted");
+        return;
+    }
+
     if (is_muted) {
         LOG_INF("Unmuting audio with anti-pop ramp");
         is_muted = false;
@@ -277,14 +1111,40 @@ void pwm_audio_unmute(void)
     }
 }
 
+void pwm_audio_set_user_mute(bool mute)
+{
+    if (mute == user_muted) {
+        return;
+    }
+
+    user_muted = mute;
+    if (mute) {
+        pwm_audio_mute();
+    } else if (pwm_audio_is_ready()) {
+        /* Before the bring-up is done it unmutes by itself */
+        pwm_audio_unmute();
+    }
+    audio_settings_changed();
+}
+
+bool pwm_audio_get_user_mute(void)
+{
+    return user_muted;
+}
+
 void pwm_audio_set_volume(uint8_t volume)
 {
-    if (volume > PWM_AUDIO_MAX_VOLUME) {
-        volume = PWM_AUDIO_MAX_VOLUME;
+    int loudness = PWM_AUDIO_LOUDNESS_MIN_DB;
+
+    /* PWM_AUDIO_MAX_VOLUME is the loudest the plan goes; below it, the
+     * linear volume maps to the same number of dB less */
+    if (volume > 0) {
+        float ratio = (float)MIN(volume, PWM_AUDIO_MAX_VOLUME) / PWM_AUDIO_MAX_VOLUME;
+
+        loudness = PWM_AUDIO_LOUDNESS_MAX_DB + (int)roundf(20.0f * log10f(ratio));
     }
-    
-    current_volume = volume;
-    LOG_DBG("Volume set to %d", volume);
+    LOG_DBG("Volume %d: loudness %d dB", volume, loudness);
+    pwm_audio_set_loudness(loudness);
 }
 
 int pwm_audio_generate_tone(int16_t *buffer, size_t samples, float frequency, float amplitude)
@@ -345,16 +1205,26 @@ int pam8403_init(void)
     /* Set conservative default gain (15dB) to avoid clipping */
     pam8403_set_gain(PAM8403_GAIN_15DB);
     
-    /* Wake up the amplifier with anti-pop sequence */
-    pam8403_wakeup();
-    
-    /* Additional delay for PAM8403 to fully wake up */
-    k_sleep(K_MSEC(5));
-    
+    /* The shutdown pin stays active: pwm_audio_init()'s bring-up wakes the
+     * amplifier once the PWM has settled at mid-scale */
     LOG_INF("PAM8403 initialized successfully");
     return 0;
 }
 
+/* Residency of the shutdown pin state; the pin starts inactive at boot */
+static void amp_account(bool awake)
+{
+    k_spinlock_key_t key = k_spin_lock(&amp_lock);
+    int64_t now = k_uptime_get();
+
+    if (amp_awake) {
+        amp_awake_ms += now - amp_since;
+    }
+    amp_since = now;
+    amp_awake = awake;
+    k_spin_unlock(&amp_lock, key);
+}
+
 void pam8403_shutdown(void)
 {
     LOG_INF("Shutting down PAM8403");
@@ -362,6 +1232,7 @@ void pam8403_shutdown(void)
     if (err) {
         LOG_ERR("Failed to shutdown PAM8403: %d", err);
     }
+    amp_account(false);
 }
 
 void pam8403_wakeup(void)
@@ -371,6 +1242,36 @@ void pam8403_wakeup(void)
     if (err) {
         LOG_ERR("Failed to wake up PAM8403: %d", err);
     }
+    amp_account(true);
+}
+
+void pwm_audio_get_power_stats(struct pwm_audio_power_stats *stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&amp_lock);
+    int64_t now = k_uptime_get();
+    int64_t awake = amp_awake_ms + (amp_awake ? now - amp_since : 0);
+
+    k_spin_unlock(&amp_lock, key);
+
+    /* Every played block is one block period of PWM output; the carrier
+     * runs at mid-scale from pwm_audio_init() on */
+    uint64_t stream = (uint64_t)stream_blocks_played * PWM_AUDIO_BLOCK_PERIOD_US / 1000U;
+    int64_t running = is_initialized ? now - pwm_started : 0;
+
+    stats->amp_awake_ms = (uint32_t)awake;
+    stats->amp_shutdown_ms = (uint32_t)(now - awake);
+    stats->pwm_stream_ms = (uint32_t)MIN(stream, (uint64_t)running);
+    stats->pwm_idle_ms = (uint32_t)(running - stats->pwm_stream_ms);
+}
+
+static void pam8403_write_gain_pins(uint8_t gain_level)
+{
+    if (gpio_is_ready_dt(&pam8403_gain0_pin)) {
+        gpio_pin_set_dt(&pam8403_gain0_pin, gain_level & 0x01);
+    }
+    if (gpio_is_ready_dt(&pam8403_gain1_pin)) {
+        gpio_pin_set_dt(&pam8403_gain1_pin, (gain_level >> 1) & 0x01);
+    }
 }
 
 void pam8403_set_gain(uint8_t gain_level)
@@ -382,19 +1283,11 @@ void pam8403_set_gain(uint8_t gain_level)
         gain_level = 1; // Default to 15dB
     }
     
-    if (gpio_is_ready_dt(&pam8403_gain0_pin)) {
-        int err = gpio_pin_set_dt(&pam8403_gain0_pin, gain_level & 0x01);
-        if (err) {
-            LOG_WRN("Failed to set gain0 pin: %d", err);
-        }
-    }
-    
-    if (gpio_is_ready_dt(&pam8403_gain1_pin)) {
-        int err = gpio_pin_set_dt(&pam8403_gain1_pin, (gain_level >> 1) & 0x01);
-        if (err) {
-            LOG_WRN("Failed to set gain1 pin: %d", err);
-        }
-    }
+    k_spinlock_key_t key = k_spin_lock(&gain_lock);
+    pam8403_write_gain_pins(gain_level);
+    amp_gain = gain_level;
+    atomic_clear(&gain_pending);
+    k_spin_unlock(&gain_lock, key);
     
     LOG_INF("PAM8403 gain set to level %d", gain_level);
 }
@@ -415,7 +1308,7 @@ int pwm_audio_test_sine_wave(float frequency, uint8_t volume, uint16_t duration_
     
     LOG_INF("Testing sine wave: %.1f Hz, volume %d, duration %d ms", (double)frequency, volume, duration_ms);
     
-    uint8_t original_volume = current_volume;
+    int original_loudness = pwm_audio_get_loudness();
     pwm_audio_set_volume(volume);
     
     /* Use memory slab allocation (like Omi) */
@@ -444,7 +1337,7 @@ int pwm_audio_test_sine_wave(float frequency, uint8_t volume, uint16_t duration_
     /* Free the buffer */
     k_mem_slab_free(&audio_mem_slab, buffer);
     
-    pwm_audio_set_volume(original_volume);
+    pwm_audio_set_loudness(original_loudness);
     
     return ret;
 }
@@ -534,6 +1427,42 @@ void pwm_audio_print_stats(void)
     LOG_INF("  PWM Period: %llu ns", PWM_AUDIO_PERIOD_NS);
     LOG_INF("  Max Volume: %d/256", PWM_AUDIO_MAX_VOLUME);
     LOG_INF("  Current Volume: %d/256", current_volume);
-    LOG_INF("  Muted: %s", is_muted ? "Yes" : "No");
+    LOG_INF("  Loudness: %d dB (PAM8403 %d dB)", loudness_db, pam8403_gain_db[amp_gain]);
+    LOG_INF("  Gain switches: %u at zero crossings, %u forced",
+            gain_switches, gain_switches_forced);
+    LOG_INF("  Muted: %s%s", is_muted ? "Yes" : "No", user_muted ? " (by user)" : "");
     LOG_INF("  Initialized: %s", is_initialized ? "Yes" : "No");
+    LOG_INF("  Ready: %s", pwm_audio_is_ready() ? "Yes" : "No");
+}
+
+#if defined(CONFIG_OMI_BENCH)
+#include "bench.h"
+
+#define BENCH_BLOCK_SAMPLES 256
+
+static int16_t bench_block[BENCH_BLOCK_SAMPLES];
+
+static void bench_block_setup(void)
+{
+    pwm_audio_generate_tone(bench_block, BENCH_BLOCK_SAMPLES, 1000.0f, 0.8f);
 }
+
+static void bench_sample_to_pwm(void)
+{
+    uint32_t acc = 0;
+
+    for (size_t i = 0; i < BENCH_BLOCK_SAMPLES; i++) {
+        acc += audio_sample_to_pwm(bench_block[i]);
+    }
+    bench_sink = acc;
+}
+
+static void bench_tone_gen(void)
+{
+    pwm_audio_generate_tone(bench_block, BENCH_BLOCK_SAMPLES, 440.0f, 0.5f);
+    bench_sink = (uint32_t)bench_block[BENCH_BLOCK_SAMPLES - 1];
+}
+
+BENCH_REGISTER(audio_sample_to_pwm_256, bench_block_setup, bench_sample_to_pwm, 128);
+BENCH_REGISTER(tone_gen_256, NULL, bench_tone_gen, 64);
+#endif /* CONFIG_OMI_BENCH */
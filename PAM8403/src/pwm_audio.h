@@ -11,6 +11,8 @@
 #include <zephyr/device.h>
 #include <zephyr/drivers/pwm.h>
 #include <zephyr/drivers/gpio.h>
+#include "audio_pool.h"
+#include "omi_threads.h"
 
 /* Audio configuration for PAM8403 - Optimized for high fidelity */
 #define PWM_AUDIO_SAMPLE_RATE     16000   // 16kHz sample rate (better quality)
@@ -23,12 +25,58 @@
 #define PWM_AUDIO_MUTE_RAMP_MS    100     // Longer mute/unmute ramp time (prevents pops)
 #define PWM_AUDIO_MUTE_RAMP_STEPS 20      // More steps for smoother ramping
 
+/* Bring-up sequence, run on the audio work queue after pwm_audio_init() */
+#define PWM_AUDIO_SETTLE_MS       10      // PWM at mid-scale before the amplifier wakes
+#define PAM8403_WAKEUP_MS         100     // shutdown released until the output is stable
+#define PWM_AUDIO_BRINGUP_MS      (PWM_AUDIO_SETTLE_MS + PAM8403_WAKEUP_MS + PWM_AUDIO_MUTE_RAMP_MS)
+#define PWM_AUDIO_WORK_STACK_SIZE OMI_STACK_AUDIO_CTRL
+#define PWM_AUDIO_WORK_PRIORITY   OMI_PRIO_AUDIO_CTRL
+
+/* pwm_audio_events() bits */
+#define PWM_AUDIO_EVT_READY       BIT(0)  // amplifier on and unmuted, stream engine running
+
+/* Block streaming engine */
+#define PWM_AUDIO_BLOCK_PERIOD_US ((AUDIO_BLOCK_SAMPLES * 1000000U) / PWM_AUDIO_SAMPLE_RATE)
+#define PWM_AUDIO_STREAM_STACK_SIZE OMI_STACK_AUDIO_OUT
+#define PWM_AUDIO_STREAM_PRIORITY OMI_PRIO_AUDIO_OUT
+#define PWM_AUDIO_OUT_SLOTS       2       // blocks handed to the sample timer ISR (double buffer)
+
+/* Mixer: lower-priority sources are ducked while a higher one plays */
+#define PWM_AUDIO_DUCK_DB_DEFAULT 18      // attenuation of ducked sources
+#define PWM_AUDIO_DUCK_RELEASE_BLOCKS 8   // blocks to come back up after the interruption (128 ms)
+
+/* Echo reference: ring of recently output samples (128 ms) */
+#define PWM_AUDIO_REF_SAMPLES     2048
+
+/* Optional hardware sample clock: "pwm-audio-timer" alias to a counter */
+#define PWM_AUDIO_HAS_SAMPLE_TIMER DT_NODE_EXISTS(DT_ALIAS(pwm_audio_timer))
+
 /* PAM8403 gain settings */
 #define PAM8403_GAIN_6DB          0       // 6dB gain
 #define PAM8403_GAIN_15DB         1       // 15dB gain (default)
 #define PAM8403_GAIN_20DB         2       // 20dB gain
 #define PAM8403_GAIN_24DB         3       // 24dB gain (max)
 
+/* Gain staging: a loudness in dB (PAM8403 gain + digital gain) is split
+ * so the amplifier runs at the lowest step that reaches it, keeping the
+ * digital attenuation - and the PWM levels lost to it - to a minimum */
+#define PWM_AUDIO_PWM_RANGE_DB    48      // 8-bit PWM at full digital scale
+#define PWM_AUDIO_HEADROOM_DB     3       // digital ceiling, matches PWM_AUDIO_MAX_VOLUME
+#define PWM_AUDIO_DIGITAL_MIN_DB  (-42)   // below this the PWM has under 1 bit left
+#define PWM_AUDIO_LOUDNESS_MAX_DB (24 - PWM_AUDIO_HEADROOM_DB)
+#define PWM_AUDIO_LOUDNESS_MIN_DB (6 + PWM_AUDIO_DIGITAL_MIN_DB)
+#define PWM_AUDIO_LOUDNESS_DEFAULT_DB (15 - PWM_AUDIO_HEADROOM_DB)
+#define PWM_AUDIO_GAIN_SWITCH_MAX_SAMPLES 160   // 10 ms without a zero crossing: switch anyway
+
+struct pwm_audio_gain_plan {
+    int8_t loudness_db;
+    uint8_t amp_gain;           // PAM8403_GAIN_*
+    int8_t amp_db;
+    int8_t digital_db;          // relative to digital full scale
+    uint8_t volume;             // digital gain, Q8
+    uint8_t dynamic_range_db;   // PWM levels left after the digital gain
+};
+
 /* PAM8403 control pins using devicetree macros */
 static const struct gpio_dt_spec pam8403_shutdown_pin =
     GPIO_DT_SPEC_GET_OR(DT_NODELABEL(pam8403_shutdown_pin), gpios, {0});
@@ -42,14 +90,139 @@ static const struct gpio_dt_spec pam8403_gain1_pin =
 #define PWM_AUDIO_R_CHANNEL       DT_NODELABEL(pwm1)
 
 /* Function prototypes */
+
+/**
+ * @brief Start the audio output
+ *
+ * Returns once the PWM is at mid-scale and the stream engine runs; the
+ * amplifier wake-up, settle and unmute continue on the audio work queue
+ * and PWM_AUDIO_EVT_READY is posted when they are done. Blocks submitted
+ * before then are held and play as soon as the amplifier is ready.
+ */
 int pwm_audio_init(void);
+bool pwm_audio_is_ready(void);
+int pwm_audio_wait_ready(k_timeout_t timeout);
+struct k_event *pwm_audio_events(void);
 int pwm_audio_play(const int16_t *buffer, size_t samples);
 int pwm_audio_play_mono(const int16_t *buffer, size_t samples);
 void pwm_audio_mute(void);
 void pwm_audio_unmute(void);
+
+/**
+ * @brief Mute on the user's request
+ *
+ * Unlike pwm_audio_mute(), which power management and the bring-up use
+ * around amplifier power changes, a user mute holds: pwm_audio_unmute()
+ * leaves the output silent until the user mute is cleared again.
+ */
+void pwm_audio_set_user_mute(bool mute);
+bool pwm_audio_get_user_mute(void);
+
+/**
+ * @brief Set a linear volume (0..PWM_AUDIO_MAX_VOLUME) through gain staging
+ *
+ * Shorthand for pwm_audio_set_loudness(): PWM_AUDIO_MAX_VOLUME is
+ * PWM_AUDIO_LOUDNESS_MAX_DB, 0 is PWM_AUDIO_LOUDNESS_MIN_DB.
+ */
 void pwm_audio_set_volume(uint8_t volume);
 int pwm_audio_generate_tone(int16_t *buffer, size_t samples, float frequency, float amplitude);
 
+/**
+ * @brief Split a loudness into PAM8403 gain step and digital gain
+ * @param loudness_db Clamped to PWM_AUDIO_LOUDNESS_MIN_DB..PWM_AUDIO_LOUDNESS_MAX_DB
+ */
+void pwm_audio_plan_gain(int loudness_db, struct pwm_audio_gain_plan *plan);
+
+/**
+ * @brief Set loudness through gain staging
+ *
+ * A change of PAM8403 gain step is applied together with the matching
+ * digital gain on the next zero crossing of the output, so the total
+ * gain never jumps mid-waveform.
+ */
+void pwm_audio_set_loudness(int loudness_db);
+int pwm_audio_get_loudness(void);
+
+/* Block streaming engine: blocks come from the shared audio pool and are
+ * freed by the engine once played. Each source has its own queue; the
+ * engine mixes one block from every source per block period, ducking
+ * sources below the highest-priority one that is playing. */
+enum pwm_audio_source {
+    PWM_AUDIO_SRC_MEDIA,        // SD card playback
+    PWM_AUDIO_SRC_SPEECH,       // speak() audio from the phone
+    PWM_AUDIO_SRC_PROMPT,       // UI sounds and voice prompts
+    PWM_AUDIO_SRC_COUNT,
+};
+
+struct pwm_audio_stream_stats {
+    uint32_t blocks_played;
+    uint32_t underruns;         // block periods with nothing queued mid-stream
+    uint32_t queued;            // blocks waiting to be played (engine + ISR queues)
+    uint32_t gain_switches;     // PAM8403 gain steps applied at a zero crossing
+    uint32_t gain_switches_forced;  // ... or after PWM_AUDIO_GAIN_SWITCH_MAX_SAMPLES
+    uint32_t mixed_blocks;      // output blocks built from more than one source
+    uint32_t ducked_blocks;     // source blocks played below unity gain
+    uint32_t crossfades;        // source flushes faded out instead of cut
+};
+
+/**
+ * @brief Queue a block on a mixer source
+ *
+ * AUDIO_BLOCK_F_END marks the end of the source's stream; a source is
+ * active (and ducks the ones below it) from its first block to then.
+ */
+int pwm_audio_source_submit(enum pwm_audio_source src, struct audio_block *block);
+
+/**
+ * @brief Stop a source without a click
+ *
+ * The next block of the source is kept and faded out over one block
+ * period; the source's next stream fades in from silence, so a stream
+ * replaced right away crossfades sample by sample.
+ * @return Samples dropped from the queue (the faded block is played)
+ */
+size_t pwm_audio_source_flush(enum pwm_audio_source src);
+
+/**
+ * @brief Blocks waiting in a source's queue
+ */
+uint32_t pwm_audio_source_queued(enum pwm_audio_source src);
+
+/**
+ * @brief Change a source's priority; higher values duck lower ones
+ */
+void pwm_audio_source_set_priority(enum pwm_audio_source src, uint8_t priority);
+
+/**
+ * @brief Set how far lower-priority sources are ducked (0 disables ducking)
+ */
+void pwm_audio_set_duck_db(uint8_t duck_db);
+uint8_t pwm_audio_get_duck_db(void);
+
+/* Queue on PWM_AUDIO_SRC_MEDIA */
+int pwm_audio_stream_submit(struct audio_block *block);
+/* Drop everything queued on every source and in the ISR, without fades */
+size_t pwm_audio_stream_flush(void);
+void pwm_audio_stream_get_stats(struct pwm_audio_stream_stats *stats);
+
+/* Echo reference (CONFIG_OMI_AEC): every sample period is recorded,
+ * silence included, so positions are a sample clock. Without a sample
+ * timer the clock stops between streams; the epoch changes when it starts
+ * again, and positions taken before then must be re-anchored. */
+uint32_t pwm_audio_ref_position(void);
+uint32_t pwm_audio_ref_epoch(void);
+int pwm_audio_ref_read(uint32_t pos, int16_t *out, size_t samples);
+
+/* Power state residency since boot, for energy accounting */
+struct pwm_audio_power_stats {
+    uint32_t amp_awake_ms;      // PAM8403 out of shutdown
+    uint32_t amp_shutdown_ms;
+    uint32_t pwm_stream_ms;     // PWM carrying audio blocks
+    uint32_t pwm_idle_ms;       // PWM running at mid-scale (silence)
+};
+
+void pwm_audio_get_power_stats(struct pwm_audio_power_stats *stats);
+
 /* PAM8403 specific functions */
 int pam8403_init(void);
 void pam8403_shutdown(void);
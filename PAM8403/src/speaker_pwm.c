@@ -11,6 +11,12 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/logging/log_ctrl.h>
 #include "pwm_audio.h"
+#if defined(CONFIG_OMI_AUDIO_STAGE)
+#include "audio_stage.h"
+#endif
+#if defined(CONFIG_OMI_UI_SOUND)
+#include "ui_sound.h"
+#endif
 
 /* Define PI if not already defined */
 #ifndef PI
@@ -19,55 +25,76 @@
 
 LOG_MODULE_REGISTER(speaker_pwm, CONFIG_LOG_DEFAULT_LEVEL);
 
-K_MEM_SLAB_DEFINE_STATIC(mem_slab, MAX_BLOCK_SIZE, BLOCK_COUNT, 2);
-
 /* Dummy device for compatibility with original interface */
 struct device *audio_speaker = (struct device *)0x12345678; // Dummy address
 
-static void* rx_buffer;
-static void* buzz_buffer;
-static int16_t *ptr2;
-static int16_t *clear_ptr;
+/* Incoming audio is SAMPLE_FREQUENCY; each sample is repeated to reach the engine rate */
+#define UPSAMPLE_FACTOR (PWM_AUDIO_SAMPLE_RATE / SAMPLE_FREQUENCY)
+#define CHIME_SAMPLES   2500
 
-static uint16_t current_length;
-static uint16_t offset;
+#if defined(CONFIG_OMI_AUDIO_STAGE)
+/* Phone speech may carry DC and hot peaks; the chime is generated clean */
+AUDIO_PIPELINE_DEFINE(speech, "dcblock,eq,limiter,requant");
+#if !defined(CONFIG_OMI_UI_SOUND)
+AUDIO_PIPELINE_DEFINE(chime, "limiter,requant");
+#endif
+static struct audio_pipeline *fill_pipeline = AUDIO_PIPELINE_GET(speech);
+#endif
 
+static struct audio_block *fill_block;
+static uint32_t current_length;
+static uint32_t offset;
+static uint32_t dropped_samples;
 
+/* Queue the block being filled on the stream engine */
+static void submit_fill_block(bool last)
+{
+    if (fill_block == NULL) {
+        return;
+    }
+    if (last) {
+        fill_block->flags |= AUDIO_BLOCK_F_END;
+    }
+#if defined(CONFIG_OMI_AUDIO_STAGE)
+    audio_pipeline_process(fill_pipeline, fill_block);
+#endif
+    pwm_audio_source_submit(PWM_AUDIO_SRC_SPEECH, fill_block);
+    fill_block = NULL;
+}
+
+/* Append one sample, waiting up to a block period for a pool block. This
+ * runs on the BT receive path, so while the engine holds queued blocks for
+ * the amplifier bring-up it does not wait: samples that find the pool
+ * empty are dropped and counted */
+static void push_sample(int16_t sample)
+{
+    for (int n = 0; n < UPSAMPLE_FACTOR; n++) {
+        if (fill_block == NULL) {
+            fill_block = audio_pool_alloc(pwm_audio_is_ready() ?
+                                          K_USEC(PWM_AUDIO_BLOCK_PERIOD_US) : K_NO_WAIT);
+            if (fill_block == NULL) {
+                dropped_samples++;
+                return;
+            }
+        }
+        fill_block->data[fill_block->samples++] = sample;
+        if (fill_block->samples == AUDIO_BLOCK_SAMPLES) {
+            submit_fill_block(false);
+        }
+    }
+}
 
 int speaker_init() 
 {
     LOG_INF("PWM Speaker init");
     
-    /* Initialize PWM audio system */
+    /* Initialize PWM audio system; it unmutes itself once the amplifier is up */
     int err = pwm_audio_init();
     if (err) {
         LOG_ERR("Failed to initialize PWM audio: %d", err);
         return err;
     }
     
-
-    
-    /* Allocate memory buffers */
-    err = k_mem_slab_alloc(&mem_slab, &rx_buffer, K_MSEC(200));
-	if (err)
-    {
-		LOG_INF("Failed to allocate memory for speaker%d)", err);
-        return -1;
-	}
-
-	err = k_mem_slab_alloc(&mem_slab, &buzz_buffer, K_MSEC(200));
-	if (err) 
-    {
-		LOG_INF("Failed to allocate for chime (%d)", err);
-        return -1;
-	}
-      
-    memset(rx_buffer, 0, MAX_BLOCK_SIZE);
-    memset(buzz_buffer, 0, MAX_BLOCK_SIZE);
-    
-    /* Unmute with anti-pop protection */
-    pwm_audio_unmute();
-    
     return 0;
 }
 
@@ -77,72 +104,65 @@ uint16_t speak(uint16_t len, const void *buf) //direct from bt
     amount = len;
 	if (len == 4)  //if stage 1 
 	{
+        if (current_length > 0) {
+            /* A new transfer cuts into one still arriving: its partial
+             * block is dropped and what is queued fades out under the new
+             * audio. A finished transfer plays out to its end. */
+            audio_pool_free(fill_block);
+            fill_block = NULL;
+            pwm_audio_source_flush(PWM_AUDIO_SRC_SPEECH);
+        }
         current_length = ((uint32_t *)buf)[0];
 	    LOG_INF("About to write %u bytes", current_length);
-        ptr2 = (int16_t *)rx_buffer;
-        clear_ptr = (int16_t *)rx_buffer;
+        offset = 0;
+#if defined(CONFIG_OMI_AUDIO_STAGE)
+        fill_pipeline = AUDIO_PIPELINE_GET(speech);
+#endif
 	}
     else 
     { //if not stage 1
-        if (current_length > PACKET_SIZE) 
+        LOG_DBG("Data length: %u", len);
+        current_length = (current_length > len) ? current_length - len : 0;
+        LOG_DBG("remaining data: %u", current_length);
+
+        /* Samples stream out block by block while the rest is still arriving */
+        for (int i = 0; i < len / 2; i++) 
         {
-            LOG_INF("Data length: %u", len);
-            current_length = current_length - PACKET_SIZE;
-            LOG_INF("remaining data: %u", current_length);
-
-            for (int i = 0; i < (int)(len/2); i++) 
-            {
-                *ptr2++ = ((int16_t *)buf)[i];  
-                *ptr2++ = ((int16_t *)buf)[i]; 
-            }
-            offset = offset + len;
+            push_sample(((int16_t *)buf)[i]);
         }
-        else if (current_length < PACKET_SIZE) 
+        offset = offset + len;
+
+        if (current_length == 0) 
         {
-            LOG_INF("entered the final stretch");
-            LOG_INF("Data length: %u", len);
-            current_length = current_length - len;
-            LOG_INF("remaining data: %u", current_length);
-            
-            for (int i = 0; i < len/2; i++) 
-            {
-                *ptr2++ = ((int16_t *)buf)[i];  
-                *ptr2++ = ((int16_t *)buf)[i];  
-            }
-            offset = offset + len;
-            LOG_INF("offset: %u", offset);
+            LOG_INF("Transfer complete, %u bytes, %u samples dropped", offset, dropped_samples);
+            submit_fill_block(true);
             offset = 0;
-            
-            /* Play audio using PWM instead of I2S */
-            int res = pwm_audio_play_mono(rx_buffer, MAX_BLOCK_SIZE / sizeof(int16_t));
-            if (res < 0)
-            {
-                LOG_PRINTK("Failed to play PWM audio: %d\n", res);
-            }
-            
-            //clear the buffer
-            k_sleep(K_MSEC(4000));
-            memset(clear_ptr, 0, MAX_BLOCK_SIZE);
+            dropped_samples = 0;
         }
     }
     return amount;
 }
 
-void generate_gentle_chime(int16_t *buffer, int num_samples)
+static int16_t chime_sample(int i)
 {
-    LOG_INF("Generating gentle chime");
     const float frequencies[] = {523.25, 659.25, 783.99, 1046.50}; // C5, E5, G5, C6
     const int num_freqs = sizeof(frequencies) / sizeof(frequencies[0]);
+    float t = (float)i / SAMPLE_FREQUENCY;
+    float sample = 0;
 
+    for (int j = 0; j < num_freqs; j++) 
+    {
+       sample += sinf(2.0f * (float)PI * frequencies[j] * t) * (1.0f - t);
+    }
+    return (int16_t)(sample / num_freqs * 32767.0f * 0.5f);
+}
+
+void generate_gentle_chime(int16_t *buffer, int num_samples)
+{
+    LOG_INF("Generating gentle chime");
     for (int i = 0; i < num_samples; i++) 
     { 
-        float t = (float)i / SAMPLE_FREQUENCY;
-        float sample = 0;
-        for (int j = 0; j < num_freqs; j++) 
-        {
-           sample += sinf(2.0f * (float)PI * frequencies[j] * t) * (1.0f - t);
-        }
-        int16_t int_sample = (int16_t)(sample / num_freqs * 32767.0f * 0.5f);
+        int16_t int_sample = chime_sample(i);
         buffer[i * NUM_CHANNELS] = int_sample;
         buffer[i * NUM_CHANNELS + 1] = int_sample;
     }
@@ -151,24 +171,23 @@ void generate_gentle_chime(int16_t *buffer, int num_samples)
 
 int play_boot_sound(void)
 {
-    int ret;
-    int16_t *buffer = (int16_t *) buzz_buffer;
-    const int samples_per_block = MAX_BLOCK_SIZE / (NUM_CHANNELS * sizeof(int16_t));
-
-    generate_gentle_chime(buffer, samples_per_block);
     LOG_INF("Writing to PWM speaker");
-    k_sleep(K_MSEC(100));
-    
-    /* Play using PWM audio instead of I2S */
-    ret = pwm_audio_play_mono(buffer, samples_per_block);
-    if (ret) 
+
+#if defined(CONFIG_OMI_UI_SOUND)
+    /* Synthesized as it plays, from a 45-byte descriptor */
+    return ui_sound_play("chime");
+#else
+#if defined(CONFIG_OMI_AUDIO_STAGE)
+    fill_pipeline = AUDIO_PIPELINE_GET(chime);
+#endif
+    /* Generate straight into pool blocks instead of a whole-sound buffer */
+    for (int i = 0; i < CHIME_SAMPLES; i++) 
     {
-        LOG_ERR("Failed to play PWM audio: %d", ret);
-        return ret;
+        push_sample(chime_sample(i));
     }
-    
-    k_sleep(K_MSEC(3000));  
+    submit_fill_block(true);
     return 0;
+#endif
 }
 
 void speaker_off()
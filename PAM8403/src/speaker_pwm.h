@@ -17,8 +17,6 @@
 
 /* LOG_MODULE_REGISTER is defined in speaker_pwm.c */
 
-#define MAX_BLOCK_SIZE   10000 //24000 * 2
-#define BLOCK_COUNT 2     
 #define SAMPLE_FREQUENCY 8000
 #define NUMBER_OF_CHANNELS 2
 #define PACKET_SIZE 400
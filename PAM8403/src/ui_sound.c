@@ -0,0 +1,227 @@
+/*
+ * UI sound player
+ */
+
+#include "ui_sound.h"
+#include "pwm_audio.h"
+#include "audio_pool.h"
+#include "omi_threads.h"
+#if defined(CONFIG_OMI_AUDIO_STAGE)
+#include "audio_stage.h"
+#endif
+#if defined(CONFIG_OMI_ASSET_BANK)
+#include "asset_bank.h"
+#endif
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(ui_sound, CONFIG_LOG_DEFAULT_LEVEL);
+
+#if defined(CONFIG_OMI_AUDIO_STAGE)
+/* Synth output is clean; only requantize for the PWM */
+AUDIO_PIPELINE_DEFINE(ui, "requant");
+#if defined(CONFIG_OMI_ASSET_BANK)
+/* Recorded prompts: voice-band EQ and peak control before requantizing */
+AUDIO_PIPELINE_DEFINE(prompt, "eq,limiter,requant");
+#endif
+#endif
+
+/* A queued request: a synthesized sound, a prompt from the asset bank or a clip in RAM */
+struct ui_sound_req {
+    const struct synth_sound *sound;
+#if defined(CONFIG_OMI_ASSET_BANK)
+    const struct asset *clip;
+    ui_sound_done_t done;
+    void *arg;
+#endif
+    uint16_t asset_id;
+};
+
+K_MSGQ_DEFINE(ui_sound_msgq, sizeof(struct ui_sound_req),
+              CONFIG_OMI_UI_SOUND_QUEUE_DEPTH, sizeof(void *));
+static K_MUTEX_DEFINE(pending_lock);
+static K_EVENT_DEFINE(ui_sound_events);
+static uint32_t pending;
+
+#define UI_SOUND_EVT_IDLE BIT(0)
+
+static ui_sound_power_hook_t power_hook;
+static struct synth synth;
+#if defined(CONFIG_OMI_ASSET_BANK)
+static struct asset_stream prompt_stream;
+#endif
+
+/* Render one sound block by block; waits for pool blocks as the engine plays */
+static void render_sound(const struct synth_sound *sound)
+{
+    bool last = false;
+
+    synth_start(&synth, sound);
+    while (!last) {
+        /* The pool drains at the engine's pace, also during amplifier bring-up */
+        struct audio_block *block = audio_pool_alloc(K_MSEC(PWM_AUDIO_BRINGUP_MS));
+        if (block == NULL) {
+            LOG_WRN("No audio block, '%s' cut short", sound->name);
+            return;
+        }
+
+        block->samples = synth_render(&synth, block->data, AUDIO_BLOCK_SAMPLES);
+        last = synth_done(&synth);
+        if (last) {
+            block->flags |= AUDIO_BLOCK_F_END;
+        }
+#if defined(CONFIG_OMI_AUDIO_STAGE)
+        audio_pipeline_process(AUDIO_PIPELINE_GET(ui), block);
+#endif
+        pwm_audio_source_submit(PWM_AUDIO_SRC_PROMPT, block);
+    }
+}
+
+#if defined(CONFIG_OMI_ASSET_BANK)
+/* Decode a prompt straight into pool blocks, one block ahead of the engine */
+static void render_prompt(const struct asset *asset)
+{
+    asset_stream_open(&prompt_stream, asset);
+    LOG_DBG("Playing prompt '%s' (%u samples)", asset->name, asset->samples);
+    while (!asset_stream_done(&prompt_stream)) {
+        struct audio_block *block = audio_pool_alloc(K_MSEC(PWM_AUDIO_BRINGUP_MS));
+        if (block == NULL) {
+            LOG_WRN("No audio block, '%s' cut short", asset->name);
+            return;
+        }
+
+        block->samples = asset_stream_read(&prompt_stream, block->data, AUDIO_BLOCK_SAMPLES);
+        if (asset_stream_done(&prompt_stream)) {
+            block->flags |= AUDIO_BLOCK_F_END;
+        }
+#if defined(CONFIG_OMI_AUDIO_STAGE)
+        audio_pipeline_process(AUDIO_PIPELINE_GET(prompt), block);
+#endif
+        pwm_audio_source_submit(PWM_AUDIO_SRC_PROMPT, block);
+    }
+}
+#endif
+
+static void ui_sound_thread_fn(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    struct ui_sound_req req;
+
+    while (1) {
+        k_msgq_get(&ui_sound_msgq, &req, K_FOREVER);
+
+        if (power_hook != NULL) {
+            power_hook(true);
+        }
+        if (req.sound != NULL) {
+            LOG_DBG("Playing '%s' (%u bytes)", req.sound->name, req.sound->size);
+            render_sound(req.sound);
+        }
+#if defined(CONFIG_OMI_ASSET_BANK)
+        else if (req.clip != NULL) {
+            render_prompt(req.clip);
+            req.done(req.clip, req.arg);
+        } else {
+            struct asset asset;
+
+            if (asset_get(req.asset_id, &asset) == 0) {
+                render_prompt(&asset);
+            }
+        }
+#endif
+        if (power_hook != NULL) {
+            power_hook(false);
+        }
+
+        k_mutex_lock(&pending_lock, K_FOREVER);
+        if (--pending == 0) {
+            k_event_post(&ui_sound_events, UI_SOUND_EVT_IDLE);
+        }
+        k_mutex_unlock(&pending_lock);
+    }
+}
+
+K_THREAD_DEFINE(ui_sound, OMI_STACK_UI_SOUND, ui_sound_thread_fn, NULL, NULL, NULL,
+                OMI_PRIO_UI_SOUND, 0, 0);
+
+static int queue_request(const struct ui_sound_req *req)
+{
+    int ret = 0;
+
+    k_mutex_lock(&pending_lock, K_FOREVER);
+    if (k_msgq_put(&ui_sound_msgq, req, K_NO_WAIT) != 0) {
+        ret = -EBUSY;
+    } else if (pending++ == 0) {
+        k_event_clear(&ui_sound_events, UI_SOUND_EVT_IDLE);
+    }
+    k_mutex_unlock(&pending_lock);
+    return ret;
+}
+
+int ui_sound_play_sound(const struct synth_sound *sound)
+{
+    struct ui_sound_req req = { .sound = sound };
+
+    return queue_request(&req);
+}
+
+int ui_sound_play(const char *name)
+{
+    const struct synth_sound *sound = synth_find(name);
+
+    if (sound == NULL) {
+        return -ENOENT;
+    }
+    return ui_sound_play_sound(sound);
+}
+
+#if defined(CONFIG_OMI_ASSET_BANK)
+int ui_sound_play_prompt(const char *name)
+{
+    struct asset asset;
+
+    if (asset_find(name, &asset) != 0) {
+        return -ENOENT;
+    }
+    return ui_sound_play_prompt_id(asset.id);
+}
+
+int ui_sound_play_prompt_id(uint16_t id)
+{
+    struct ui_sound_req req = { .asset_id = id };
+    struct asset asset;
+
+    if (asset_get(id, &asset) != 0) {
+        return -ENOENT;
+    }
+    return queue_request(&req);
+}
+
+int ui_sound_play_clip(const struct asset *clip, ui_sound_done_t done, void *arg)
+{
+    struct ui_sound_req req = { .clip = clip, .done = done, .arg = arg };
+
+    return queue_request(&req);
+}
+#endif
+
+int ui_sound_wait_idle(k_timeout_t timeout)
+{
+    k_mutex_lock(&pending_lock, K_FOREVER);
+    bool idle = (pending == 0);
+    k_mutex_unlock(&pending_lock);
+
+    if (idle || k_event_wait(&ui_sound_events, UI_SOUND_EVT_IDLE, false, timeout) != 0) {
+        return 0;
+    }
+    return -EAGAIN;
+}
+
+void ui_sound_set_power_hook(ui_sound_power_hook_t hook)
+{
+    power_hook = hook;
+}
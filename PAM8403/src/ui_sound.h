@@ -0,0 +1,66 @@
+/*
+ * UI sound player
+ * Renders synthesized UI sounds (common/src/synth.h) straight into audio
+ * pool blocks on its own thread and queues them on the PWM stream engine.
+ * Voice prompts from the flash asset bank (common/src/asset_bank.h) go
+ * through the same queue and are decoded one block ahead of the engine.
+ * Triggering is a queue put; playback starts with the next block.
+ */
+
+#ifndef UI_SOUND_H
+#define UI_SOUND_H
+
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+#include "synth.h"
+
+/* Called with true before a sound's first block and false after its last */
+typedef void (*ui_sound_power_hook_t)(bool active);
+
+struct asset;
+
+/* Called on the player thread once a clip's last block has been queued */
+typedef void (*ui_sound_done_t)(const struct asset *clip, void *arg);
+
+/**
+ * @brief Queue a built-in sound by name
+ * @return 0, -ENOENT for an unknown name, -EBUSY when the queue is full
+ */
+int ui_sound_play(const char *name);
+
+/**
+ * @brief Queue a compiled sound
+ */
+int ui_sound_play_sound(const struct synth_sound *sound);
+
+/**
+ * @brief Queue a voice prompt from the asset bank by name
+ * @return 0, -ENOENT for an unknown prompt, -EBUSY when the queue is full
+ */
+int ui_sound_play_prompt(const char *name);
+
+/**
+ * @brief Queue a voice prompt by its asset id
+ */
+int ui_sound_play_prompt_id(uint16_t id);
+
+/**
+ * @brief Queue a clip held by the caller, e.g. from a RAM cache
+ *
+ * The clip must stay valid until done is called; done is called exactly
+ * once if this returns 0.
+ * @return 0, -EBUSY when the queue is full
+ */
+int ui_sound_play_clip(const struct asset *clip, ui_sound_done_t done, void *arg);
+
+/**
+ * @brief Wait until every queued sound has been handed to the engine
+ */
+int ui_sound_wait_idle(k_timeout_t timeout);
+
+/**
+ * @brief Let the application power the amplifier around sounds
+ */
+void ui_sound_set_power_hook(ui_sound_power_hook_t hook);
+
+#endif /* UI_SOUND_H */
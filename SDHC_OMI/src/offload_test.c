@@ -0,0 +1,229 @@
+/*
+ * Chunked offload test (native_sim, CONFIG_OMI_OFFLOAD_TEST)
+ *
+ * Offloads an audio segment over a simulated link that loses chunks,
+ * corrupts them and disconnects, while the segment grows and the offload
+ * is ended and resumed from the bitmap store halfway through. Checks that:
+ *  - every corrupted chunk is caught by its CRC and sent again
+ *  - no acknowledged chunk is ever sent again, across disconnects and
+ *    the resume
+ *  - the resume takes up exactly the chunks acknowledged before it
+ *  - the received image matches the segment
+ * Results end with an OFFLOAD_DONE line for twister.
+ */
+
+#include "sd_test.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/crc.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(offload_test, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define OT_SEGMENT          2
+#define OT_INITIAL          (200 * CONFIG_OMI_SD_OFFLOAD_CHUNK + 123)
+#define OT_GROWTH           (3 * CONFIG_OMI_SD_OFFLOAD_CHUNK + 77)
+#define OT_MAX_SIZE         (OT_INITIAL + OT_GROWTH)
+#define OT_MAX_CHUNKS       DIV_ROUND_UP(OT_MAX_SIZE, CONFIG_OMI_SD_OFFLOAD_CHUNK)
+#define OT_LOSS_PCT         5
+#define OT_CORRUPT_PCT      10
+#define OT_DISCONNECT_PCT   2
+#define OT_MAX_ROUNDS       10000
+
+struct ot_results {
+    uint32_t sent;
+    uint32_t lost;
+    uint32_t corrupted;
+    uint32_t mismatches;        /* corruptions the ack caught */
+    uint32_t disconnects;
+    uint32_t repeats;           /* acknowledged chunks sent again */
+    uint32_t resumed;
+    uint32_t errors;
+};
+
+static uint32_t rng_state = 0x2545F491;
+static uint8_t image[OT_MAX_SIZE];      /* what the receiver has */
+static uint16_t acked_len[OT_MAX_CHUNKS];
+static uint8_t chunk_buf[CONFIG_OMI_SD_OFFLOAD_CHUNK];
+static uint8_t write_buf[512];
+
+static int append(uint32_t from, uint32_t len)
+{
+    while (len > 0) {
+        uint32_t n = MIN(len, sizeof(write_buf));
+
+        for (uint32_t i = 0; i < n; i++) {
+            write_buf[i] = sd_test_pattern(from + i);
+        }
+        if (write_to_file(write_buf, n) != (int)n) {
+            return -EIO;
+        }
+        from += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Chunks the receiver has, as the segment is now */
+static uint32_t count_acked(uint32_t size)
+{
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i * CONFIG_OMI_SD_OFFLOAD_CHUNK < size; i++) {
+        n += (acked_len[i] == MIN(CONFIG_OMI_SD_OFFLOAD_CHUNK,
+                                   size - i * CONFIG_OMI_SD_OFFLOAD_CHUNK));
+    }
+    return n;
+}
+
+/* End the offload and begin it again, as after a reboot */
+static int resume(struct ot_results *res, uint32_t size)
+{
+    struct sd_offload_stats stats;
+    int ret = sd_offload_end();
+
+    if (ret == 0) {
+        ret = sd_offload_begin(OT_SEGMENT);
+    }
+    if (ret != 0) {
+        LOG_ERR("Resume failed: %d", ret);
+        return ret;
+    }
+    sd_offload_get_stats(&stats);
+    res->resumed = stats.resumed;
+
+    /* The store is only recognized through chunk 0 */
+    uint32_t expected = acked_len[0] ? count_acked(size) : 0;
+
+    if (stats.resumed != expected) {
+        LOG_ERR("Resumed with %u chunks acknowledged, expected %u", stats.resumed, expected);
+        return -EIO;
+    }
+    if (expected == 0) {
+        memset(acked_len, 0, sizeof(acked_len));
+    }
+    return 0;
+}
+
+/* Send until every chunk is acknowledged */
+static int run_link(struct ot_results *res, uint32_t *size)
+{
+    struct sd_offload_chunk chunk;
+    bool grown = false;
+    bool resumed = false;
+
+    for (int rounds = 0; rounds < OT_MAX_ROUNDS; ) {
+        int n = sd_offload_next(&chunk, chunk_buf, sizeof(chunk_buf));
+
+        if (n == 0 || n == -EBUSY) {
+            if (n == 0 && sd_offload_remaining() == 0) {
+                return 0;
+            }
+            /* Acknowledgment timeout */
+            sd_offload_rewind();
+            rounds++;
+            continue;
+        }
+        if (n < 0) {
+            LOG_ERR("Next chunk failed: %d", n);
+            return n;
+        }
+        res->sent++;
+        if (acked_len[chunk.index] == chunk.len) {
+            LOG_ERR("Chunk %u sent again after its acknowledgment", chunk.index);
+            res->repeats++;
+        }
+
+        uint32_t roll = xorshift32(&rng_state) % 100;
+
+        if (roll < OT_LOSS_PCT) {
+            res->lost++;
+            continue;
+        }
+        if (roll < OT_LOSS_PCT + OT_DISCONNECT_PCT) {
+            /* Gone before the acknowledgment; reconnect */
+            res->disconnects++;
+            sd_offload_rewind();
+            continue;
+        }
+        if (roll < OT_LOSS_PCT + OT_DISCONNECT_PCT + OT_CORRUPT_PCT) {
+            chunk_buf[xorshift32(&rng_state) % n] ^= 0x5a;
+            res->corrupted++;
+        }
+
+        uint32_t crc = crc32_ieee(chunk_buf, n);
+        int ret = sd_offload_ack(chunk.index, crc);
+
+        if (crc != chunk.crc) {
+            if (ret != -EBADMSG) {
+                LOG_ERR("Corrupted chunk %u acknowledged: %d", chunk.index, ret);
+                return -EIO;
+            }
+            res->mismatches++;
+            continue;
+        }
+        if (ret != 0) {
+            LOG_ERR("Ack of chunk %u failed: %d", chunk.index, ret);
+            return ret;
+        }
+        memcpy(&image[chunk.offset], chunk_buf, n);
+        acked_len[chunk.index] = n;
+
+        if (!grown && chunk.index >= 50) {
+            if (append(*size, OT_GROWTH) != 0) {
+                return -EIO;
+            }
+            *size += OT_GROWTH;
+            grown = true;
+        }
+        if (!resumed && chunk.index >= 120) {
+            ret = resume(res, *size);
+            if (ret != 0) {
+                return ret;
+            }
+            resumed = true;
+        }
+    }
+    LOG_ERR("Offload did not finish");
+    return -ETIMEDOUT;
+}
+
+static void offload_test_run(void)
+{
+    struct ot_results res = { 0 };
+    struct sd_offload_stats stats;
+    uint32_t size = OT_INITIAL;
+
+    if (!sd_test_wait_mounted() || initialize_audio_file(OT_SEGMENT) != 0 ||
+        clear_audio_file(OT_SEGMENT) != 0 || move_write_pointer(OT_SEGMENT) != 0 ||
+        append(0, size) != 0 || sd_offload_begin(OT_SEGMENT) != 0) {
+        SD_TEST_SETUP_FAILED("OFFLOAD");
+        return;
+    }
+
+    if (run_link(&res, &size) != 0) {
+        res.errors++;
+    }
+    sd_offload_get_stats(&stats);
+    sd_offload_end();
+
+    for (uint32_t i = 0; i < size; i++) {
+        if (image[i] != sd_test_pattern(i)) {
+            LOG_ERR("Received byte %u is 0x%02x, expected 0x%02x", i, image[i],
+                    sd_test_pattern(i));
+            res.errors++;
+            break;
+        }
+    }
+    res.errors += res.repeats + (res.mismatches != res.corrupted);
+
+    printk("offload: %u bytes, %u chunks sent, %u lost, %u corrupted (%u caught), "
+           "%u disconnects\n", size, res.sent, res.lost, res.corrupted, res.mismatches,
+           res.disconnects);
+    printk("offload: %u resumed from the store, %u resent, %u rewinds, %u store writes after it\n",
+           res.resumed, stats.resent, stats.rewinds, stats.saves);
+    printk("OFFLOAD_DONE chunks=%u sent=%u errors=%u\n", stats.chunks, res.sent, res.errors);
+}
+
+SD_TEST_DEFINE(offload_test, offload_test_run);
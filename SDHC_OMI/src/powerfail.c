@@ -0,0 +1,252 @@
+/*
+ * Power-fail injection test (native_sim, CONFIG_OMI_POWERFAIL_TEST)
+ *
+ * Each iteration appends to the audio segment through write_to_file(),
+ * saves the offset store every few appends and now and then rotates the
+ * segment with clear_audio_file(), while the card emulator cuts power at
+ * a random sector write. Power is restored, sd_card_recover() is timed,
+ * and the card is checked against what the workload knows was durable:
+ *  - recovery succeeds within CONFIG_OMI_POWERFAIL_RECOVERY_BUDGET_MS
+ *  - the cursors' segment exists, is no shorter than the last completed
+ *    append and no longer than the one in flight, and holds exactly the
+ *    bytes written
+ *  - the offset store holds the last saved offset or the one in flight
+ * Results end with a POWERFAIL_DONE line for twister.
+ */
+
+#include "sd_test.h"
+#include "disk_emul.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(powerfail, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define PF_SEGMENT          1
+#define PF_MAX_APPEND       1024
+#define PF_SEGMENT_BYTES    (64 * 1024)     /* rotate the segment past this */
+#define PF_SAVE_EVERY       4               /* appends between offset saves */
+#define PF_MAX_OPS          10000           /* a cut must come long before this */
+
+struct pf_state {
+    uint32_t durable;           /* segment bytes known to be on the card */
+    uint32_t in_flight;         /* bytes of the append that was cut, if any */
+    bool clearing;              /* the cut hit clear_audio_file() */
+    uint32_t offset;            /* last offset saved successfully */
+    uint32_t offset_pending;    /* offset being saved when power was cut */
+    bool offset_cut;
+};
+
+struct pf_results {
+    uint32_t iterations;
+    uint32_t failures;
+    uint32_t torn;
+    uint32_t repaired;
+    uint32_t recreated;
+    uint32_t over_budget;
+    uint64_t total_us;
+    uint32_t max_us;
+};
+
+static uint32_t rng_state = CONFIG_OMI_DISK_EMUL_SEED * 2654435761U;
+static uint8_t buf[PF_MAX_APPEND];
+static struct sd_cursor *verify_cursor;
+
+/* Append, save and rotate until the cut; false if it never came */
+static bool run_workload(struct pf_state *st)
+{
+    for (int op = 1; op < PF_MAX_OPS; op++) {
+        int ret;
+
+        if (st->durable >= PF_SEGMENT_BYTES) {
+            st->clearing = true;
+            if (clear_audio_file(PF_SEGMENT) != 0) {
+                return true;
+            }
+            st->clearing = false;
+            st->durable = 0;
+            st->offset_pending = 0;
+            st->offset_cut = true;
+            if (save_offset(0) != 0) {
+                return true;
+            }
+            st->offset_cut = false;
+            st->offset = 0;
+            continue;
+        }
+
+        if (op % PF_SAVE_EVERY == 0) {
+            /* Offload "progress": anywhere in the durable part */
+            st->offset_pending = st->durable ? xorshift32(&rng_state) % (st->durable + 1) : 0;
+            st->offset_cut = true;
+            if (save_offset(st->offset_pending) != 0) {
+                return true;
+            }
+            st->offset_cut = false;
+            st->offset = st->offset_pending;
+            continue;
+        }
+
+        uint32_t len = 1 + xorshift32(&rng_state) % PF_MAX_APPEND;
+
+        for (uint32_t i = 0; i < len; i++) {
+            buf[i] = sd_test_pattern(st->durable + i);
+        }
+        st->in_flight = len;
+        ret = write_to_file(buf, len);
+        if (ret != (int)len) {
+            return true;
+        }
+        st->in_flight = 0;
+        st->durable += len;
+    }
+    return false;
+}
+
+static int verify_segment(struct pf_state *st)
+{
+    uint32_t size = get_file_size(PF_SEGMENT);
+    uint32_t min = st->clearing ? 0 : st->durable;
+    uint32_t max = st->durable + st->in_flight;
+
+    if (size < min || size > max) {
+        LOG_ERR("Segment is %u bytes, expected %u..%u%s", size, min, max,
+                st->clearing ? " (cut while clearing)" : "");
+        return -EIO;
+    }
+    /* After a cut while clearing, the segment is either gone (and
+     * recreated empty) or untouched */
+    if (st->clearing && size != 0 && size != st->durable) {
+        LOG_ERR("Segment is %u bytes after a cut while clearing %u", size, st->durable);
+        return -EIO;
+    }
+
+    /* Checked in place in the cursor's buffer, without copying it out */
+    for (uint32_t pos = 0; pos < size; ) {
+        struct sd_view view;
+        int n = sd_cursor_view(verify_cursor, pos, size - pos, &view);
+
+        if (n <= 0) {
+            LOG_ERR("Segment read at %u failed: %d", pos, n);
+            return -EIO;
+        }
+        for (int i = 0; i < n; i++) {
+            if (view.data[i] != sd_test_pattern(pos + i)) {
+                LOG_ERR("Segment byte %u is 0x%02x, expected 0x%02x", pos + i, view.data[i],
+                        sd_test_pattern(pos + i));
+                sd_view_release(&view);
+                return -EIO;
+            }
+        }
+        sd_view_release(&view);
+        pos += n;
+    }
+
+    st->durable = size;
+    st->in_flight = 0;
+    st->clearing = false;
+    return 0;
+}
+
+static int verify_offset(struct pf_state *st, bool repaired)
+{
+    int offset = get_offset();
+
+    if (offset < 0) {
+        LOG_ERR("Offset store unreadable after recovery: %d", offset);
+        return -EIO;
+    }
+    /* A repaired store points at the segment end; otherwise it must hold
+     * one of the two values the workload saved */
+    if (!repaired && (uint32_t)offset != st->offset &&
+        !(st->offset_cut && (uint32_t)offset == st->offset_pending)) {
+        LOG_ERR("Offset store holds %d, expected %u%s", offset, st->offset,
+                st->offset_cut ? " or the one being saved" : "");
+        return -EIO;
+    }
+    if ((uint32_t)offset > st->durable) {
+        LOG_ERR("Offset %d is past the segment end %u", offset, st->durable);
+        return -EIO;
+    }
+    st->offset = offset;
+    st->offset_cut = false;
+    return 0;
+}
+
+static int run_iteration(struct pf_state *st, struct pf_results *res)
+{
+    struct sd_card_recovery rec;
+    bool tear = IS_ENABLED(CONFIG_OMI_POWERFAIL_TEAR) && (xorshift32(&rng_state) & 1);
+    int ret;
+
+    disk_emul_power_fail_arm(1 + xorshift32(&rng_state) % CONFIG_OMI_POWERFAIL_MAX_SECTORS, tear);
+    if (!run_workload(st) || !disk_emul_power_failed()) {
+        LOG_ERR("Power was never cut");
+        return -EIO;
+    }
+    disk_emul_power_restore();
+    res->torn += tear;
+
+    ret = sd_card_recover(&rec);
+    if (ret != 0) {
+        LOG_ERR("Recovery failed: %d", ret);
+        return ret;
+    }
+    res->total_us += rec.total_us;
+    res->max_us = MAX(res->max_us, rec.total_us);
+    res->repaired += rec.offset_repaired;
+    res->recreated += rec.segment_recreated;
+    if (rec.total_us > CONFIG_OMI_POWERFAIL_RECOVERY_BUDGET_MS * USEC_PER_MSEC) {
+        LOG_ERR("Recovery took %u us (init %u, mount %u, offset store %u)", rec.total_us,
+                rec.init_us, rec.mount_us, rec.offset_us);
+        res->over_budget++;
+        return -ETIMEDOUT;
+    }
+
+    ret = verify_segment(st);
+    if (ret == 0) {
+        ret = verify_offset(st, rec.offset_repaired);
+    }
+    return ret;
+}
+
+static void powerfail_run(void)
+{
+    struct pf_state st = { 0 };
+    struct pf_results res = { 0 };
+
+    if (!sd_test_wait_mounted() || clear_audio_file(PF_SEGMENT) != 0 ||
+        move_read_pointer(PF_SEGMENT) != 0 || save_offset(0) != 0 ||
+        sd_cursor_open(&verify_cursor, PF_SEGMENT) != 0) {
+        SD_TEST_SETUP_FAILED("POWERFAIL");
+        return;
+    }
+
+    for (res.iterations = 0; res.iterations < CONFIG_OMI_POWERFAIL_ITERATIONS;
+         res.iterations++) {
+        if (run_iteration(&st, &res) != 0) {
+            res.failures++;
+            printk("powerfail: iteration %u failed\n", res.iterations);
+            /* Start the next iteration from whatever the card now holds */
+            if (sd_card_get_state() != SD_CARD_MOUNTED) {
+                break;
+            }
+            st.durable = get_file_size(PF_SEGMENT);
+            st.in_flight = 0;
+            st.clearing = false;
+            st.offset_cut = false;
+            st.offset = MAX(get_offset(), 0);
+        }
+    }
+
+    printk("powerfail: %u cuts (%u torn), %u offset store repairs, %u segments recreated\n",
+           res.iterations, res.torn, res.repaired, res.recreated);
+    printk("powerfail: recovery avg %u us, max %u us, budget %u ms, %u over\n",
+           res.iterations ? (uint32_t)(res.total_us / res.iterations) : 0, res.max_us,
+           CONFIG_OMI_POWERFAIL_RECOVERY_BUDGET_MS, res.over_budget);
+    printk("POWERFAIL_DONE iterations=%u failures=%u max_recovery_us=%u\n", res.iterations,
+           res.failures, res.max_us);
+}
+
+SD_TEST_DEFINE(powerfail, powerfail_run);
@@ -6,74 +6,188 @@
 
 #include <ff.h>
 #include <zephyr/kernel.h>
+#include <zephyr/init.h>
 #include <zephyr/device.h>
 #include <zephyr/storage/disk_access.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/fs/fs.h>
 #include <zephyr/drivers/gpio.h>
+#include <zephyr/pm/device.h>
+#include <zephyr/sys/crc.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 
+#include "sd_card.h"
+#include "cycle_counter.h"
+
 LOG_MODULE_REGISTER(sd_card, CONFIG_LOG_DEFAULT_LEVEL);
 
+/* The native_sim overlays name the RAM disk "RAM"; only the card
+ * emulator registers an "SD" disk on top of it */
+#if defined(CONFIG_BOARD_NATIVE_SIM) && !defined(CONFIG_OMI_DISK_EMUL)
+#error "native_sim needs CONFIG_OMI_DISK_EMUL=y to provide the SD disk"
+#endif
+
 /* SD Card Configuration - OMI Compatible */
 #define SD_DISK_NAME "SD"
 #define SD_MOUNT_PT "/SD:"
 #define AUDIO_DIR "/SD:/audio"
+#define INFO_FILE "/SD:/info.txt"
+#define OFFLOAD_FILE "/SD:/offload.bin"
 #define MAX_PATH 128
 #define MAX_FILE_SIZE 1024*1024  // 1MB max file size
 
 /* OMI Audio File Configuration */
-#define MAX_AUDIO_FILES 99
+#define MAX_AUDIO_FILES SD_CARD_MAX_AUDIO_FILES
 #define AUDIO_FILE_PREFIX "a"
 #define AUDIO_FILE_EXTENSION ".txt"
 #define AUDIO_FILE_NAME_LEN 8  // "a01.txt" = 7 chars + null
 
-/* SD Card States */
-typedef enum {
-    SD_CARD_UNINITIALIZED,
-    SD_CARD_INITIALIZED,
-    SD_CARD_MOUNTED,
-    SD_CARD_ERROR
-} sd_card_state_t;
-
 static sd_card_state_t sd_card_state = SD_CARD_UNINITIALIZED;
+static atomic_t free_space_kb = ATOMIC_INIT(SD_CARD_FREE_UNKNOWN);
+
+/* Power: the SPI bus controller suspends into its sleep pinctrl state and,
+ * on boards that have one, a load switch cuts the card's supply */
+#if defined(CONFIG_PM_DEVICE) && DT_NODE_HAS_STATUS(DT_NODELABEL(sdhc0), okay)
+#define SD_HAS_BUS_PM 1
+static const struct device *const sd_bus = DEVICE_DT_GET(DT_BUS(DT_NODELABEL(sdhc0)));
+#else
+#define SD_HAS_BUS_PM 0
+#endif
+static const struct gpio_dt_spec sd_power_pin =
+    GPIO_DT_SPEC_GET_OR(DT_NODELABEL(sd_power_pin), gpios, {0});
+
+static K_MUTEX_DEFINE(sd_pm_lock);
+static bool sd_powered = true;          /* sd_card_start() leaves everything on */
+static bool first_write_pending;
+static int64_t state_since;             /* uptime of the last on/off transition */
+static int64_t resume_start;
+static struct sd_card_pm_stats pm_stats;
+static struct k_spinlock busy_lock;
+static uint64_t busy_ticks;             /* inside stream reads, writes and syncs */
 static struct fs_mount_t mp;
 static FATFS fat_fs;
 
 /* OMI Audio File Management */
 static uint8_t file_count = 0;
-static uint8_t current_read_file = 1;
 static uint8_t current_write_file = 1;
 static uint32_t file_num_array[2];
 
+/* Offset store: two slots written alternately, each with a sequence
+ * number and a CRC, so a write torn by a power cut leaves the other slot
+ * intact. A 4-byte file is the original single-value format. */
+struct offset_slot {
+    uint32_t offset;
+    uint32_t seq;
+    uint32_t crc;
+};
+
+static uint32_t offset_seq;             /* sequence number of the newest slot */
+
+/* Read cursors: slot 0 is the OMI API's read pointer, the rest are
+ * handed out by sd_cursor_open() */
+struct sd_cursor {
+    struct k_mutex lock;
+    struct fs_file_t file;
+    bool in_use;
+    bool file_open;
+    uint8_t num;                /* audio file number */
+    uint32_t size;              /* segment size when the file was opened */
+    uint32_t file_pos;          /* position of the open file */
+    uint32_t buf_start;         /* segment offset of buf[0] */
+    uint32_t buf_len;           /* valid bytes in buf */
+    atomic_t pins;              /* views borrowing buf; it is not refilled while pinned */
+    struct sd_cursor_stats stats;
+    uint8_t buf[CONFIG_OMI_SD_CURSOR_PREFETCH];
+};
+
+static struct sd_cursor cursors[1 + CONFIG_OMI_SD_CURSORS];
+static struct sd_cursor *const read_cursor = &cursors[0];
+static K_MUTEX_DEFINE(cursor_pool_lock);
+
+/* Segment cache: what the OMI functions have learned about each audio
+ * file since the mount, so repeat accesses neither stat the card (a
+ * directory scan) nor build paths on the heap. The OMI functions keep it
+ * current; sd_card_create_file(), sd_card_delete_file() and
+ * sd_card_stream_create() forget it, since they may touch a segment.
+ * Streams from sd_card_segment_create() update it when they sync. */
+struct segment_entry {
+    bool known;                 /* resolved since the mount */
+    bool exists;
+    uint32_t size;
+};
+
+/* Append handles kept open for write_to_file(); the least recently used
+ * is closed when another segment needs one */
+struct segment_handle {
+    struct fs_file_t file;
+    uint8_t num;                /* audio file number, 0 if free */
+    uint32_t last_use;
+};
+
+static struct segment_entry segments[MAX_AUDIO_FILES + 1];
+static struct segment_handle handles[CONFIG_OMI_SD_HANDLE_CACHE];
+static uint32_t handle_clock;
+static struct sd_card_cache_stats cache_stats;
+static K_MUTEX_DEFINE(segment_lock);
+
+/* Chunked offload: the acknowledged-chunk bitmap and what identifies its
+ * segment, stored in two slots written alternately like the offset store */
+#define OFFLOAD_CHUNK CONFIG_OMI_SD_OFFLOAD_CHUNK
+
+struct offload_slot {
+    uint32_t seq;
+    uint32_t num;               /* audio file number, 0 if none */
+    uint32_t chunk_size;
+    uint32_t first_crc;         /* chunk 0 as acknowledged, to recognize the segment */
+    uint32_t tail_index;        /* short last chunk acknowledged at tail_len bytes */
+    uint32_t tail_len;
+    uint32_t acked[DIV_ROUND_UP(CONFIG_OMI_SD_OFFLOAD_MAX_CHUNKS, 32)];
+    uint32_t crc;
+};
+
+/* Chunk sent and not acknowledged yet */
+struct offload_flight {
+    bool used;
+    uint32_t index;
+    uint32_t len;
+    uint32_t crc;
+};
+
+static bool offload_active;
+static struct sd_cursor *offload_cursor;
+static struct offload_slot offload_state;
+static struct offload_slot offload_stored[2];   /* store slots as read */
+static struct offload_flight offload_flights[CONFIG_OMI_SD_OFFLOAD_WINDOW];
+static uint32_t offload_resend[CONFIG_OMI_SD_OFFLOAD_WINDOW];
+static uint32_t offload_resend_count;
+static uint32_t offload_scan;           /* no chunk before this is waiting to be sent */
+static uint32_t offload_short_index;    /* short last chunk sent, to send again once it grows */
+static uint32_t offload_short_len;      /* ... at this length, 0 if none */
+static uint32_t offload_unsaved;        /* acknowledgments not in the store yet */
+static struct sd_offload_stats offload_stats;
+static K_MUTEX_DEFINE(offload_lock);
+
 /* File Path Buffers */
 static char current_full_path[MAX_PATH];
-static char read_buffer[MAX_PATH];
-static char write_buffer[MAX_PATH];
 
 /* Function Declarations */
 static int sd_card_init(void);
 static int sd_card_mount(void);
 static int sd_card_unmount(void);
 static int sd_card_test_read_write(void);
-int sd_card_list_files(const char *path);
-int sd_card_create_file(const char *filename, const char *content);
-int sd_card_read_file(const char *filename, char *buffer, size_t buffer_size);
-int sd_card_delete_file(const char *filename);
-int sd_card_get_info(uint64_t *total_size_mb, uint32_t *free_space_mb);
+static int load_offset(uint32_t *offset, uint32_t *seq);
+static void cursors_invalidate(uint8_t num);
+static void segments_forget(uint8_t num);
+static void segment_stream_synced(const struct sd_card_stream *stream);
+static void offload_forget(uint8_t num);
+static void note_write(void);
+static void note_busy(uint32_t start);
 
 /* OMI Audio File Functions */
-static char* generate_new_audio_header(uint8_t num);
+static void segment_name(uint8_t num, char *name, size_t len);
 static int get_file_contents(struct fs_dir_t *zdp, struct fs_dirent *entry);
-static int initialize_audio_file(uint8_t num);
-static int move_read_pointer(uint8_t num);
-static int move_write_pointer(uint8_t num);
-static int clear_audio_file(uint8_t num);
-static int delete_audio_file(uint8_t num);
-static int clear_audio_directory(void);
-static int save_offset(uint32_t offset);
-static int get_offset(void);
 
 /**
  * @brief Initialize SD card with OMI's approach
@@ -169,6 +283,13 @@ static int sd_card_mount(void)
         LOG_INF("Audio directory creation failed: %d", ret);
     }
 
+    /* save_offset() continues the offset store's slot sequence */
+    uint32_t offset;
+
+    if (load_offset(&offset, &offset_seq) != 0) {
+        offset_seq = 0;
+    }
+
     /* Initialize file management (OMI's approach) */
     struct fs_dir_t audio_dir_entry;
     fs_dir_t_init(&audio_dir_entry);
@@ -216,6 +337,8 @@ static int sd_card_unmount(void)
 
     LOG_INF("Unmounting SD card filesystem...");
 
+    cursors_invalidate(0);
+    segments_forget(0);
     ret = fs_unmount(&mp);
     if (ret != 0) {
         LOG_ERR("Failed to unmount SD card: %d", ret);
@@ -228,30 +351,17 @@ static int sd_card_unmount(void)
 }
 
 /**
- * @brief Generate audio file header (OMI's approach)
- * @param num File number
- * @return Pointer to generated header string (must be freed by caller)
+ * @brief Audio file name relative to the mount point (OMI's layout)
+ * @param num File number, "audio/a01.txt" for 1
  */
-static char* generate_new_audio_header(uint8_t num)
+static void segment_name(uint8_t num, char *name, size_t len)
 {
-    if (num > 99) return NULL;
-    char *ptr_ = k_malloc(14);
-    ptr_[0] = 'a';
-    ptr_[1] = 'u';
-    ptr_[2] = 'd';
-    ptr_[3] = 'i';
-    ptr_[4] = 'o';
-    ptr_[5] = '/';
-    ptr_[6] = 'a';
-    ptr_[7] = 48 + (num / 10);
-    ptr_[8] = 48 + (num % 10);
-    ptr_[9] = '.';
-    ptr_[10] = 't';
-    ptr_[11] = 'x';
-    ptr_[12] = 't';
-    ptr_[13] = '\0';
+    snprintf(name, len, "audio/%s%02u%s", AUDIO_FILE_PREFIX, num, AUDIO_FILE_EXTENSION);
+}
 
-    return ptr_;
+static void segment_path(uint8_t num, char *path, size_t len)
+{
+    snprintf(path, len, "%s/%s%02u%s", AUDIO_DIR, AUDIO_FILE_PREFIX, num, AUDIO_FILE_EXTENSION);
 }
 
 
@@ -342,6 +452,7 @@ int sd_card_create_file(const char *filename, const char *content)
 
     snprintf(filepath, sizeof(filepath), "%s/%s", SD_MOUNT_PT, filename);
     fs_file_t_init(&file);
+    segments_forget(0);
 
     ret = fs_open(&file, filepath, FS_O_CREATE | FS_O_WRITE);
     if (ret != 0) {
@@ -410,6 +521,8 @@ int sd_card_delete_file(const char *filename)
     }
 
     snprintf(filepath, sizeof(filepath), "%s/%s", SD_MOUNT_PT, filename);
+    cursors_invalidate(0);
+    segments_forget(0);
 
     ret = fs_unlink(filepath);
     if (ret != 0) {
@@ -448,11 +561,29 @@ int sd_card_get_info(uint64_t *total_size_mb, uint32_t *free_space_mb)
 
     memory_size_mb = (uint64_t)block_count * block_size;
     *total_size_mb = memory_size_mb >> 20;
-    *free_space_mb = (uint32_t)(memory_size_mb >> 20);
+
+    /* The first statvfs after a mount walks the whole FAT; later ones are cheap */
+    struct fs_statvfs vfs;
+
+    ret = fs_statvfs(SD_MOUNT_PT, &vfs);
+    if (ret != 0) {
+        LOG_ERR("Failed to get free space: %d", ret);
+        return ret;
+    }
+
+    uint64_t free_bytes = (uint64_t)vfs.f_frsize * vfs.f_bfree;
+
+    atomic_set(&free_space_kb, (atomic_val_t)MIN(free_bytes >> 10, SD_CARD_FREE_UNKNOWN - 1));
+    *free_space_mb = (uint32_t)(free_bytes >> 20);
 
     return 0;
 }
 
+uint32_t sd_card_get_free_kb(void)
+{
+    return (uint32_t)atomic_get(&free_space_kb);
+}
+
 static int sd_card_test_read_write(void)
 {
     int ret;
@@ -497,6 +628,15 @@ int sd_card_start(void)
 {
     int ret;
 
+    if (gpio_is_ready_dt(&sd_power_pin)) {
+        ret = gpio_pin_configure_dt(&sd_power_pin, GPIO_OUTPUT_ACTIVE);
+        if (ret != 0) {
+            LOG_ERR("Failed to configure SD power pin: %d", ret);
+            return ret;
+        }
+        k_sleep(K_MSEC(SD_CARD_POWER_UP_MS));
+    }
+
     ret = sd_card_init();
     if (ret != 0) {
         return ret;
@@ -568,261 +708,1737 @@ int sd_card_run_tests(void)
     return 0;
 }
 
-/* OMI Compatible Functions */
+/* Streaming Read/Write Functions */
 
-int mount_sd_card(void)
+int sd_card_stream_open(struct sd_card_stream *stream, const char *filename)
 {
-    return sd_card_start();
+    int ret;
+    char filepath[MAX_PATH];
+    struct fs_dirent entry;
+
+    if (sd_card_state != SD_CARD_MOUNTED) {
+        LOG_ERR("SD card not mounted");
+        return -ENODEV;
+    }
+
+    snprintf(filepath, sizeof(filepath), "%s/%s", SD_MOUNT_PT, filename);
+
+    ret = fs_stat(filepath, &entry);
+    if (ret != 0) {
+        LOG_ERR("Failed to stat file %s: %d", filepath, ret);
+        return ret;
+    }
+
+    fs_file_t_init(&stream->file);
+    ret = fs_open(&stream->file, filepath, FS_O_READ);
+    if (ret != 0) {
+        LOG_ERR("Failed to open file %s: %d", filepath, ret);
+        return ret;
+    }
+
+    stream->size = (uint32_t)entry.size;
+    stream->pos = 0;
+    stream->segment = 0;
+    return 0;
 }
 
-int create_file(const char* file_path)
+int sd_card_stream_read(struct sd_card_stream *stream, void *buf, size_t len)
 {
-    int ret = 0;
-    snprintf(current_full_path, sizeof(current_full_path), "%s%s", SD_MOUNT_PT, file_path);
-    struct fs_file_t data_file;
-    fs_file_t_init(&data_file);
-    ret = fs_open(&data_file, current_full_path, FS_O_WRITE | FS_O_CREATE);
-    if (ret) {
-        LOG_ERR("File creation failed %d", ret);
-        return -2;
-    } 
-    fs_close(&data_file);
-    return 0;
+    uint32_t start = cycle_counter_get();
+    ssize_t ret = fs_read(&stream->file, buf, len);
+
+    note_busy(start);
+    if (ret < 0) {
+        LOG_ERR("Stream read failed at %u: %d", stream->pos, (int)ret);
+        return (int)ret;
+    }
+
+    stream->pos += (uint32_t)ret;
+    return (int)ret;
 }
 
-int initialize_audio_file(uint8_t num)
+int sd_card_stream_seek(struct sd_card_stream *stream, uint32_t pos)
 {
-    char *header = generate_new_audio_header(num);
-    if (header == NULL) {
-        return -1;
+    if (pos > stream->size) {
+        pos = stream->size;
+    }
+
+    int ret = fs_seek(&stream->file, pos, FS_SEEK_SET);
+    if (ret != 0) {
+        LOG_ERR("Stream seek to %u failed: %d", pos, ret);
+        return ret;
     }
-    k_free(header);
-    create_file(header);
+
+    stream->pos = pos;
     return 0;
 }
 
-int write_to_file(uint8_t *data, uint32_t length)
+void sd_card_stream_close(struct sd_card_stream *stream)
 {
-    struct fs_file_t write_file;
-    fs_file_t_init(&write_file);
-    uint8_t *write_ptr = data;
-    fs_open(&write_file, write_buffer, FS_O_WRITE | FS_O_APPEND);
-    fs_write(&write_file, write_ptr, length);
-    fs_close(&write_file);
-    return 0;
+    if (fs_close(&stream->file) == 0) {
+        segment_stream_synced(stream);
+    }
 }
 
-int read_audio_data(uint8_t *buf, int amount, int offset)
+int sd_card_stream_create(struct sd_card_stream *stream, const char *filename)
 {
-    struct fs_file_t read_file;
-    fs_file_t_init(&read_file); 
-    uint8_t *temp_ptr = buf;
+    int ret;
+    char filepath[MAX_PATH];
+
+    if (sd_card_state != SD_CARD_MOUNTED) {
+        LOG_ERR("SD card not mounted");
+        return -ENODEV;
+    }
 
-    int rc = fs_open(&read_file, read_buffer, FS_O_READ | FS_O_RDWR);
-    rc = fs_seek(&read_file, offset, FS_SEEK_SET);
-    rc = fs_read(&read_file, temp_ptr, amount);
-    fs_close(&read_file);
+    snprintf(filepath, sizeof(filepath), "%s/%s", SD_MOUNT_PT, filename);
+    cursors_invalidate(0);
+    segments_forget(0);
 
-    return rc;
+    fs_file_t_init(&stream->file);
+    ret = fs_open(&stream->file, filepath, FS_O_CREATE | FS_O_RDWR);
+    if (ret != 0) {
+        LOG_ERR("Failed to create file %s: %d", filepath, ret);
+        return ret;
+    }
+
+    ret = fs_truncate(&stream->file, 0);
+    if (ret != 0) {
+        LOG_ERR("Failed to truncate file %s: %d", filepath, ret);
+        fs_close(&stream->file);
+        return ret;
+    }
+
+    stream->size = 0;
+    stream->pos = 0;
+    stream->segment = 0;
+    return 0;
 }
 
-uint32_t get_file_size(uint8_t num)
+int sd_card_stream_write(struct sd_card_stream *stream, const void *buf, size_t len)
 {
-    char *ptr = generate_new_audio_header(num);
-    snprintf(current_full_path, sizeof(current_full_path), "%s%s", SD_MOUNT_PT, ptr);
-    k_free(ptr);
-    struct fs_dirent entry;
-    int res = fs_stat(current_full_path, &entry);
-    if (res) {
-        LOG_ERR("invalid file in get file size\n");
-        return 0;  
+    uint32_t start = cycle_counter_get();
+    ssize_t ret = fs_write(&stream->file, buf, len);
+
+    note_busy(start);
+    if (ret < 0) {
+        LOG_ERR("Stream write failed at %u: %d", stream->pos, (int)ret);
+        return (int)ret;
     }
-    return (uint32_t)entry.size;
+    note_write();
+
+    stream->pos += (uint32_t)ret;
+    stream->size = MAX(stream->size, stream->pos);
+    return (int)ret;
 }
 
-int move_read_pointer(uint8_t num)
+int sd_card_stream_sync(struct sd_card_stream *stream)
 {
-    char *read_ptr = generate_new_audio_header(num);
-    snprintf(read_buffer, sizeof(read_buffer), "%s%s", SD_MOUNT_PT, read_ptr);
-    k_free(read_ptr);
-    struct fs_dirent entry; 
-    int res = fs_stat(read_buffer, &entry);
-    if (res) {
-        LOG_ERR("invalid file in move read ptr\n");
-        return -1;  
+    uint32_t start = cycle_counter_get();
+    int ret = fs_sync(&stream->file);
+
+    note_busy(start);
+    if (ret == 0) {
+        segment_stream_synced(stream);
     }
-    current_read_file = num;
-    return 0;
+    return ret;
 }
 
-int move_write_pointer(uint8_t num)
+static uint32_t le32(const uint8_t *p)
 {
-    char *write_ptr = generate_new_audio_header(num);
-    snprintf(write_buffer, sizeof(write_buffer), "%s%s", SD_MOUNT_PT, write_ptr);
-    k_free(write_ptr);
-    struct fs_dirent entry;
-    int res = fs_stat(write_buffer, &entry);
-    if (res) {
-        LOG_ERR("invalid file in move write pointer\n");  
-        return -1;  
-    }
-    current_write_file = num;
-    return 0;   
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
 }
 
-int clear_audio_file(uint8_t num)
+static uint16_t le16(const uint8_t *p)
 {
-    char *clear_header = generate_new_audio_header(num);
-    snprintf(current_full_path, sizeof(current_full_path), "%s%s", SD_MOUNT_PT, clear_header);
-    k_free(clear_header);
-    int res = fs_unlink(current_full_path);
-    if (res) {
-        LOG_ERR("error deleting file");
-        return -1;
+    return p[0] | (p[1] << 8);
+}
+
+int sd_card_stream_find_pcm(struct sd_card_stream *stream, uint32_t rate, uint32_t *start,
+                            uint32_t *end)
+{
+    uint8_t hdr[16];
+    int ret;
+
+    *start = 0;
+    *end = stream->size;
+
+    ret = sd_card_stream_read(stream, hdr, 12);
+    if (ret < 12 || memcmp(hdr, "RIFF", 4) != 0 || memcmp(&hdr[8], "WAVE", 4) != 0) {
+        LOG_INF("No WAV header, playing as raw PCM");
+        return sd_card_stream_seek(stream, 0);
     }
 
-    char *create_file_header = generate_new_audio_header(num);
-    k_msleep(10);
-    res = create_file(create_file_header);
-    k_free(create_file_header);
-    if (res) {
-        LOG_ERR("error creating file");
-        return -1;
+    while (stream->pos + 8 <= stream->size) {
+        ret = sd_card_stream_read(stream, hdr, 8);
+        if (ret < 8) {
+            return -EIO;
+        }
+
+        uint32_t chunk_size = le32(&hdr[4]);
+        uint32_t chunk_start = stream->pos;
+
+        if (memcmp(hdr, "data", 4) == 0) {
+            *start = chunk_start;
+            *end = MIN(chunk_start + chunk_size, stream->size);
+            return 0;
+        }
+
+        if (memcmp(hdr, "fmt ", 4) == 0) {
+            ret = sd_card_stream_read(stream, hdr, 16);
+            if (ret < 16) {
+                return -EIO;
+            }
+            uint16_t format = le16(&hdr[0]);
+            uint16_t channels = le16(&hdr[2]);
+            uint32_t file_rate = le32(&hdr[4]);
+            uint16_t bits = le16(&hdr[14]);
+
+            if (format != 1 || channels != 1 || bits != 16) {
+                LOG_ERR("Unsupported WAV format %u, %u ch, %u bit", format, channels, bits);
+                return -ENOTSUP;
+            }
+            if (file_rate != rate) {
+                LOG_WRN("WAV is %u Hz, playing at %u Hz", file_rate, rate);
+            }
+        }
+
+        /* Chunks are word aligned */
+        ret = sd_card_stream_seek(stream, chunk_start + chunk_size + (chunk_size & 1));
+        if (ret != 0) {
+            return ret;
+        }
     }
 
-    return 0;
+    LOG_ERR("WAV file has no data chunk");
+    return -EINVAL;
 }
 
-int delete_audio_file(uint8_t num)
+/* Segment Cache */
+
+/* Called with segment_lock held */
+static int segment_lookup_locked(uint8_t num, uint32_t *size)
 {
-    char *ptr = generate_new_audio_header(num);
-    snprintf(current_full_path, sizeof(current_full_path), "%s%s", SD_MOUNT_PT, ptr);
-    k_free(ptr);
-    int res = fs_unlink(current_full_path);
-    if (res) {
-        LOG_ERR("error deleting file in delete\n");
-        return -1;
+    struct segment_entry *entry = &segments[num];
+
+    cache_stats.lookups++;
+    if (!entry->known) {
+        char path[MAX_PATH];
+        struct fs_dirent dirent;
+        int ret;
+
+        segment_path(num, path, sizeof(path));
+        cache_stats.dir_reads++;
+        ret = fs_stat(path, &dirent);
+        if (ret != 0 && ret != -ENOENT) {
+            return ret;
+        }
+        entry->known = true;
+        entry->exists = (ret == 0);
+        entry->size = (ret == 0) ? (uint32_t)dirent.size : 0;
     }
 
+    if (!entry->exists) {
+        return -ENOENT;
+    }
+    if (size != NULL) {
+        *size = entry->size;
+    }
     return 0;
 }
 
-int clear_audio_directory()
+/**
+ * @brief Size of an audio file, from the cache when it is known
+ * @return 0 on success, -ENOENT if there is no such file
+ */
+static int segment_lookup(uint8_t num, uint32_t *size)
 {
-    if (file_count == 1) {
-        return 0;
-    }
-    
-    int res = 0;
-    for (uint8_t i = file_count; i > 0; i--) {
-        res = delete_audio_file(i);
-        k_msleep(10);
-        if (res) {
-            LOG_ERR("error on %d\n", i);
-            return -1;
-        }  
-    }
-    
-    res = fs_unlink("/SD:/audio");
-    if (res) {
-        LOG_ERR("error deleting file");
-        return -1;
-    }
-    
-    res = fs_mkdir("/SD:/audio");
-    if (res) {
-        LOG_ERR("failed to make directory");
-        return -1;
+    int ret;
+
+    if (num == 0 || num > MAX_AUDIO_FILES) {
+        return -EINVAL;
     }
-    
-    res = create_file("audio/a01.txt");
-    if (res) {
-        LOG_ERR("failed to make new file in directory files");
-        return -1;
+    if (sd_card_state != SD_CARD_MOUNTED) {
+        return -ENODEV;
     }
-    
-    LOG_INF("done with clearing");
 
-    file_count = 1;  
-    move_write_pointer(1);
-    return 0;
+    k_mutex_lock(&segment_lock, K_FOREVER);
+    ret = segment_lookup_locked(num, size);
+    k_mutex_unlock(&segment_lock);
+    return ret;
 }
 
-int save_offset(uint32_t offset)
+/* Close the append handles on segment num (0: all). Called with
+ * segment_lock held. */
+static void segment_handles_close_locked(uint8_t num)
 {
-    uint8_t buf[4] = {
-        offset & 0xFF,
-        (offset >> 8) & 0xFF,
-        (offset >> 16) & 0xFF, 
-        (offset >> 24) & 0xFF 
-    };
+    for (size_t i = 0; i < ARRAY_SIZE(handles); i++) {
+        if (handles[i].num != 0 && (num == 0 || handles[i].num == num)) {
+            fs_close(&handles[i].file);
+            handles[i].num = 0;
+        }
+    }
+}
 
-    struct fs_file_t write_file;
-    fs_file_t_init(&write_file);
-    
-    int res = fs_open(&write_file, "/SD:/info.txt", FS_O_WRITE | FS_O_CREATE);
-    if (res != 0) {
-        LOG_ERR("Error opening info file: %d", res);
-        return res;
+/* Append handle for segment num, opened on first use. Called with
+ * segment_lock held. */
+static int segment_handle_get_locked(uint8_t num, struct fs_file_t **file)
+{
+    struct segment_handle *victim = &handles[0];
+    char path[MAX_PATH];
+    int ret;
+
+    for (size_t i = 0; i < ARRAY_SIZE(handles); i++) {
+        if (handles[i].num == num) {
+            handles[i].last_use = ++handle_clock;
+            cache_stats.handle_hits++;
+            *file = &handles[i].file;
+            return 0;
+        }
+        if (victim->num != 0 && (handles[i].num == 0 || handles[i].last_use < victim->last_use)) {
+            victim = &handles[i];
+        }
     }
-    
-    res = fs_write(&write_file, &buf, 4);
-    if (res < 0) {
-        LOG_ERR("Error writing info file: %d", res);
-        fs_close(&write_file);
-        return res;
+
+    if (victim->num != 0) {
+        fs_close(&victim->file);
+        victim->num = 0;
     }
-    
-    fs_close(&write_file);
+
+    segment_path(num, path, sizeof(path));
+    fs_file_t_init(&victim->file);
+    ret = fs_open(&victim->file, path, FS_O_WRITE | FS_O_APPEND);
+    if (ret != 0) {
+        return ret;
+    }
+    cache_stats.handle_opens++;
+    victim->num = num;
+    victim->last_use = ++handle_clock;
+    *file = &victim->file;
     return 0;
 }
 
-int get_offset()
+/* Forget what is cached about segment num (0: all) and close its append
+ * handle, before it is removed, recreated or the card unmounted */
+static void segments_forget(uint8_t num)
 {
-    uint8_t buf[4];
-    struct fs_file_t read_file;
-    fs_file_t_init(&read_file);
-    
-    int rc = fs_open(&read_file, "/SD:/info.txt", FS_O_READ | FS_O_RDWR);
-    if (rc < 0) {
-        LOG_ERR("Error opening info file: %d", rc);
-        return rc;
-    }
-    
-    rc = fs_seek(&read_file, 0, FS_SEEK_SET);
-    if (rc < 0) {
-        LOG_ERR("Error seeking info file: %d", rc);
-        fs_close(&read_file);
-        return rc;
-    }
-    
-    rc = fs_read(&read_file, &buf, 4);
-    if (rc < 0) {
-        LOG_ERR("Error reading info file: %d", rc);
-        fs_close(&read_file);
-        return rc;
+    k_mutex_lock(&segment_lock, K_FOREVER);
+    segment_handles_close_locked(num);
+    if (num == 0) {
+        memset(segments, 0, sizeof(segments));
+    } else {
+        segments[num].known = false;
     }
-    
-    fs_close(&read_file);
-    uint32_t *offset_ptr = (uint32_t*)buf;
-    LOG_INF("Get offset is %d", offset_ptr[0]);
-    
-    return offset_ptr[0];
+    k_mutex_unlock(&segment_lock);
 }
 
-void sd_on()
+/* A segment written through a stream is as long as what has been synced */
+static void segment_stream_synced(const struct sd_card_stream *stream)
 {
-    /* No separate enable pin - CS pin handles enable/disable automatically */
-    LOG_INF("SD card enabled via CS pin");
+    if (stream->segment == 0) {
+        return;
+    }
+    k_mutex_lock(&segment_lock, K_FOREVER);
+    segments[stream->segment] = (struct segment_entry){
+        .known = true, .exists = true, .size = stream->size,
+    };
+    k_mutex_unlock(&segment_lock);
 }
 
-void sd_off()
+/* Segment num still has a reader: the read pointer (whose offset the
+ * offset store holds), another cursor or the offload in progress */
+static bool segment_busy(uint8_t num)
 {
-    /* No separate enable pin - CS pin handles enable/disable automatically */
-    LOG_INF("SD card disabled via CS pin");
+    bool busy = false;
+
+    for (size_t i = 0; !busy && i < ARRAY_SIZE(cursors); i++) {
+        struct sd_cursor *cursor = &cursors[i];
+
+        k_mutex_lock(&cursor->lock, K_FOREVER);
+        busy = cursor->in_use && cursor->num == num;
+        k_mutex_unlock(&cursor->lock);
+    }
+
+    k_mutex_lock(&offload_lock, K_FOREVER);
+    busy = busy || (offload_active && offload_state.num == num);
+    k_mutex_unlock(&offload_lock);
+    return busy;
 }
 
-bool is_sd_on()
+int sd_card_segment_create(struct sd_card_stream *stream, uint8_t num)
 {
-    return sd_card_state == SD_CARD_MOUNTED;
-}
\ No newline at end of file
+    char path[MAX_PATH];
+    int ret;
+
+    if (num == 0 || num > MAX_AUDIO_FILES) {
+        return -EINVAL;
+    }
+    if (sd_card_state != SD_CARD_MOUNTED) {
+        return -ENODEV;
+    }
+    if (segment_busy(num)) {
+        return -EBUSY;
+    }
+
+    segment_path(num, path, sizeof(path));
+    offload_forget(num);
+    cursors_invalidate(num);
+
+    k_mutex_lock(&segment_lock, K_FOREVER);
+    segment_handles_close_locked(num);
+    segments[num].known = false;
+
+    fs_file_t_init(&stream->file);
+    ret = fs_open(&stream->file, path, FS_O_CREATE | FS_O_RDWR);
+    if (ret == 0) {
+        ret = fs_truncate(&stream->file, 0);
+        if (ret == 0) {
+            /* Flush the new directory entry now rather than on the first
+             * sync, which the caller may be timing */
+            ret = fs_sync(&stream->file);
+        }
+        if (ret != 0) {
+            fs_close(&stream->file);
+        }
+    }
+    if (ret == 0) {
+        segments[num] = (struct segment_entry){ .known = true, .exists = true, .size = 0 };
+    }
+    k_mutex_unlock(&segment_lock);
+
+    if (ret != 0) {
+        LOG_ERR("Failed to create segment %s: %d", path, ret);
+        return ret;
+    }
+
+    stream->size = 0;
+    stream->pos = 0;
+    stream->segment = num;
+    return 0;
+}
+
+void sd_card_get_cache_stats(struct sd_card_cache_stats *stats)
+{
+    k_mutex_lock(&segment_lock, K_FOREVER);
+    *stats = cache_stats;
+    k_mutex_unlock(&segment_lock);
+}
+
+/* Two-Slot Stores */
+
+/* The offset store and the offload bitmap store keep their record in two
+ * slots, each with a sequence number and a CRC checked by the caller. A
+ * write goes over the older slot, so one torn by a power cut leaves the
+ * newer one intact. */
+
+/* Read both slots; returns the bytes read, fewer for a short file */
+static int slot_store_read(const char *path, void *slots, size_t slot_size)
+{
+    struct fs_file_t file;
+
+    fs_file_t_init(&file);
+    int rc = fs_open(&file, path, FS_O_READ);
+    if (rc < 0) {
+        return rc;
+    }
+    rc = fs_read(&file, slots, 2 * slot_size);
+    fs_close(&file);
+    return rc;
+}
+
+/* Write a record into the slot its sequence number selects */
+static int slot_store_write(const char *path, const void *slot, size_t slot_size, uint32_t seq)
+{
+    struct fs_file_t file;
+
+    fs_file_t_init(&file);
+    int res = fs_open(&file, path, FS_O_WRITE | FS_O_CREATE);
+    if (res != 0) {
+        LOG_ERR("Error opening %s: %d", path, res);
+        return res;
+    }
+
+    res = fs_seek(&file, (seq & 1) * slot_size, FS_SEEK_SET);
+    if (res == 0) {
+        res = fs_write(&file, slot, slot_size);
+    }
+    if (res < 0) {
+        LOG_ERR("Error writing %s: %d", path, res);
+        fs_close(&file);
+        return res;
+    }
+
+    res = fs_close(&file);
+    if (res < 0) {
+        LOG_ERR("Error closing %s: %d", path, res);
+        return res;
+    }
+    return 0;
+}
+
+/* Read Cursors */
+
+static int cursor_pool_init(void)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(cursors); i++) {
+        k_mutex_init(&cursors[i].lock);
+        fs_file_t_init(&cursors[i].file);
+    }
+    /* The OMI read pointer starts at a01.txt */
+    read_cursor->in_use = true;
+    read_cursor->num = 1;
+    return 0;
+}
+
+SYS_INIT(cursor_pool_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+/* Called with the cursor's lock held */
+static void cursor_drop_file(struct sd_cursor *cursor)
+{
+    if (cursor->file_open) {
+        fs_close(&cursor->file);
+        cursor->file_open = false;
+    }
+    cursor->buf_len = 0;
+}
+
+/* Called with the cursor's lock held */
+static int cursor_open_file(struct sd_cursor *cursor)
+{
+    char path[MAX_PATH];
+    uint32_t size;
+    int ret;
+
+    ret = segment_lookup(cursor->num, &size);
+    if (ret != 0) {
+        return ret;
+    }
+
+    segment_path(cursor->num, path, sizeof(path));
+    fs_file_t_init(&cursor->file);
+    ret = fs_open(&cursor->file, path, FS_O_READ);
+    if (ret != 0) {
+        LOG_ERR("Cursor failed to open %s: %d", path, ret);
+        return ret;
+    }
+
+    cursor->file_open = true;
+    cursor->size = size;
+    cursor->file_pos = 0;
+    cursor->stats.opens++;
+    return 0;
+}
+
+/* Whether the segment grew past what the open file knows; FatFs fixes a
+ * file's size when it is opened, so appends need a reopen to be seen */
+static bool cursor_segment_grew(struct sd_cursor *cursor)
+{
+    uint32_t size;
+
+    return segment_lookup(cursor->num, &size) == 0 && size > cursor->size;
+}
+
+/* Read from the card at pos, reusing the open file and its position.
+ * Called with the cursor's lock held. */
+static int cursor_read_card(struct sd_cursor *cursor, uint32_t pos, uint8_t *dst, size_t len)
+{
+    int ret;
+
+    if (cursor->file_open && pos >= cursor->size && cursor_segment_grew(cursor)) {
+        cursor_drop_file(cursor);
+    }
+    if (!cursor->file_open) {
+        ret = cursor_open_file(cursor);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    if (pos >= cursor->size) {
+        return 0;
+    }
+
+    if (cursor->file_pos != pos) {
+        ret = fs_seek(&cursor->file, pos, FS_SEEK_SET);
+        if (ret != 0) {
+            LOG_ERR("Cursor seek to %u failed: %d", pos, ret);
+            return ret;
+        }
+        cursor->file_pos = pos;
+        cursor->stats.seeks++;
+    }
+
+    uint32_t start = cycle_counter_get();
+    ssize_t n = fs_read(&cursor->file, dst, len);
+
+    note_busy(start);
+    cursor->stats.card_reads++;
+    if (n < 0) {
+        LOG_ERR("Cursor read at %u failed: %d", pos, (int)n);
+        /* Position unknown now */
+        cursor_drop_file(cursor);
+        return (int)n;
+    }
+    cursor->file_pos += (uint32_t)n;
+    return (int)n;
+}
+
+/* Close every cursor's file on segment num (0: all segments) so the
+ * segment can be removed or the filesystem unmounted; each cursor reopens
+ * on its next read */
+static void cursors_invalidate(uint8_t num)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(cursors); i++) {
+        struct sd_cursor *cursor = &cursors[i];
+
+        k_mutex_lock(&cursor->lock, K_FOREVER);
+        if (cursor->in_use && (num == 0 || cursor->num == num)) {
+            cursor_drop_file(cursor);
+        }
+        k_mutex_unlock(&cursor->lock);
+    }
+}
+
+int sd_cursor_open(struct sd_cursor **cursor, uint8_t num)
+{
+    struct sd_cursor *found = NULL;
+    int ret;
+
+    k_mutex_lock(&cursor_pool_lock, K_FOREVER);
+    for (size_t i = 1; i < ARRAY_SIZE(cursors); i++) {
+        if (!cursors[i].in_use) {
+            found = &cursors[i];
+            found->in_use = true;
+            break;
+        }
+    }
+    k_mutex_unlock(&cursor_pool_lock);
+
+    if (found == NULL) {
+        LOG_WRN("No free read cursor");
+        return -ENOMEM;
+    }
+
+    memset(&found->stats, 0, sizeof(found->stats));
+    ret = sd_cursor_move(found, num);
+    if (ret != 0) {
+        sd_cursor_close(found);
+        return ret;
+    }
+    *cursor = found;
+    return 0;
+}
+
+int sd_cursor_move(struct sd_cursor *cursor, uint8_t num)
+{
+    int ret;
+
+    if (num == 0 || num > MAX_AUDIO_FILES) {
+        return -EINVAL;
+    }
+
+    k_mutex_lock(&cursor->lock, K_FOREVER);
+    if (cursor->num == num && cursor->file_open) {
+        k_mutex_unlock(&cursor->lock);
+        return 0;
+    }
+    cursor_drop_file(cursor);
+    cursor->num = num;
+    ret = cursor_open_file(cursor);
+    k_mutex_unlock(&cursor->lock);
+    return ret;
+}
+
+int sd_cursor_read(struct sd_cursor *cursor, uint8_t *buf, int amount, uint32_t offset)
+{
+    bool card = false;
+    int done = 0;
+    int ret = 0;
+
+    k_mutex_lock(&cursor->lock, K_FOREVER);
+    cursor->stats.reads++;
+
+    while (done < amount) {
+        uint32_t pos = offset + done;
+        uint32_t left = amount - done;
+
+        if (pos >= cursor->buf_start && pos < cursor->buf_start + cursor->buf_len) {
+            uint32_t n = MIN(left, cursor->buf_start + cursor->buf_len - pos);
+
+            memcpy(buf + done, &cursor->buf[pos - cursor->buf_start], n);
+            done += n;
+            continue;
+        }
+
+        card = true;
+        if (left >= sizeof(cursor->buf) || atomic_get(&cursor->pins) != 0) {
+            /* Large reads bypass the buffer rather than copy through it,
+             * and a buffer lent out to views must stay as it is */
+            ret = cursor_read_card(cursor, pos, buf + done, left);
+            if (ret > 0) {
+                done += ret;
+            }
+        } else {
+            cursor->buf_len = 0;
+            ret = cursor_read_card(cursor, pos, cursor->buf, sizeof(cursor->buf));
+            if (ret > 0) {
+                cursor->buf_start = pos;
+                cursor->buf_len = ret;
+            }
+        }
+        if (ret <= 0) {
+            break;
+        }
+    }
+
+    if (!card) {
+        cursor->stats.hits++;
+    }
+    k_mutex_unlock(&cursor->lock);
+
+    return (done > 0 || ret >= 0) ? done : ret;
+}
+
+int sd_cursor_view(struct sd_cursor *cursor, uint32_t offset, uint32_t max, struct sd_view *view)
+{
+    int ret = 0;
+
+    view->data = NULL;
+    view->len = 0;
+    view->offset = offset;
+    view->cursor = NULL;
+
+    if (max == 0) {
+        return 0;
+    }
+
+    k_mutex_lock(&cursor->lock, K_FOREVER);
+    cursor->stats.views++;
+
+    if (offset < cursor->buf_start || offset >= cursor->buf_start + cursor->buf_len) {
+        if (atomic_get(&cursor->pins) != 0) {
+            k_mutex_unlock(&cursor->lock);
+            return -EBUSY;
+        }
+        cursor->buf_len = 0;
+        ret = cursor_read_card(cursor, offset, cursor->buf, sizeof(cursor->buf));
+        if (ret <= 0) {
+            k_mutex_unlock(&cursor->lock);
+            return ret;
+        }
+        cursor->buf_start = offset;
+        cursor->buf_len = ret;
+    } else {
+        cursor->stats.hits++;
+    }
+
+    /* An empty view borrows nothing, so it takes no pin */
+    view->len = MIN(max, cursor->buf_start + cursor->buf_len - offset);
+    if (view->len > 0) {
+        view->data = &cursor->buf[offset - cursor->buf_start];
+        view->cursor = cursor;
+        atomic_inc(&cursor->pins);
+    }
+    k_mutex_unlock(&cursor->lock);
+
+    return (int)view->len;
+}
+
+void sd_view_release(struct sd_view *view)
+{
+    if (view->cursor == NULL) {
+        return;
+    }
+    atomic_dec(&view->cursor->pins);
+    view->cursor = NULL;
+    view->data = NULL;
+}
+
+uint8_t sd_cursor_segment(const struct sd_cursor *cursor)
+{
+    return cursor->num;
+}
+
+void sd_cursor_get_stats(struct sd_cursor *cursor, struct sd_cursor_stats *stats)
+{
+    k_mutex_lock(&cursor->lock, K_FOREVER);
+    *stats = cursor->stats;
+    k_mutex_unlock(&cursor->lock);
+}
+
+void sd_cursor_close(struct sd_cursor *cursor)
+{
+    if (cursor == read_cursor) {
+        return;
+    }
+    __ASSERT(atomic_get(&cursor->pins) == 0, "cursor closed with views outstanding");
+
+    k_mutex_lock(&cursor->lock, K_FOREVER);
+    cursor_drop_file(cursor);
+    k_mutex_unlock(&cursor->lock);
+
+    k_mutex_lock(&cursor_pool_lock, K_FOREVER);
+    cursor->in_use = false;
+    k_mutex_unlock(&cursor_pool_lock);
+}
+
+/* Chunked Offload */
+
+static uint32_t offload_slot_crc(const struct offload_slot *slot)
+{
+    return crc32_ieee((const uint8_t *)slot, offsetof(struct offload_slot, crc));
+}
+
+/* Newest intact slot of the bitmap store, NULL if there is none.
+ * Called with offload_lock held. */
+static const struct offload_slot *offload_load(void)
+{
+    const struct offload_slot *newest = NULL;
+    int rc = slot_store_read(OFFLOAD_FILE, offload_stored, sizeof(offload_stored[0]));
+
+    for (int i = 0; i < rc / (int)sizeof(offload_stored[0]); i++) {
+        const struct offload_slot *slot = &offload_stored[i];
+
+        if (slot->crc == offload_slot_crc(slot) &&
+            (newest == NULL || (int32_t)(slot->seq - newest->seq) > 0)) {
+            newest = slot;
+        }
+    }
+    return newest;
+}
+
+/* Called with offload_lock held */
+static int offload_save(void)
+{
+    offload_state.seq++;
+    offload_state.crc = offload_slot_crc(&offload_state);
+
+    int res = slot_store_write(OFFLOAD_FILE, &offload_state, sizeof(offload_state),
+                               offload_state.seq);
+    if (res != 0) {
+        return res;
+    }
+    offload_unsaved = 0;
+    offload_stats.saves++;
+    return 0;
+}
+
+static inline bool offload_bit(const struct offload_slot *slot, uint32_t index)
+{
+    return slot->acked[index / 32] & BIT(index % 32);
+}
+
+static inline uint32_t offload_chunks(uint32_t size)
+{
+    return MIN(DIV_ROUND_UP(size, OFFLOAD_CHUNK), CONFIG_OMI_SD_OFFLOAD_MAX_CHUNKS);
+}
+
+static inline uint32_t offload_chunk_len(uint32_t index, uint32_t size)
+{
+    return MIN(OFFLOAD_CHUNK, size - index * OFFLOAD_CHUNK);
+}
+
+/* Whether chunk index, as the segment is now, has been acknowledged */
+static bool offload_chunk_done(const struct offload_slot *slot, uint32_t index, uint32_t size)
+{
+    uint32_t len = offload_chunk_len(index, size);
+
+    return offload_bit(slot, index) ||
+           (len < OFFLOAD_CHUNK && index == slot->tail_index && len == slot->tail_len);
+}
+
+static uint32_t offload_pending(uint32_t size)
+{
+    uint32_t chunks = offload_chunks(size);
+    uint32_t pending = 0;
+
+    for (uint32_t i = 0; i < chunks; i++) {
+        pending += !offload_chunk_done(&offload_state, i, size);
+    }
+    return pending;
+}
+
+static bool offload_in_flight(uint32_t index)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(offload_flights); i++) {
+        if (offload_flights[i].used && offload_flights[i].index == index) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void offload_drop_flights(void)
+{
+    memset(offload_flights, 0, sizeof(offload_flights));
+    offload_resend_count = 0;
+    offload_scan = 0;
+    offload_short_len = 0;
+}
+
+/* Start the segment over with nothing acknowledged, continuing the
+ * store's slot sequence */
+static void offload_reset(uint8_t num)
+{
+    uint32_t seq = offload_state.seq;
+
+    memset(&offload_state, 0, sizeof(offload_state));
+    offload_state.seq = seq;
+    offload_state.num = num;
+    offload_state.chunk_size = OFFLOAD_CHUNK;
+    offload_drop_flights();
+}
+
+/* CRC of a stretch of the segment, computed in place in the cursor's buffer */
+static int offload_crc(uint32_t offset, uint32_t len, uint32_t *crc)
+{
+    *crc = 0;
+    while (len > 0) {
+        struct sd_view view;
+        int n = sd_cursor_view(offload_cursor, offset, len, &view);
+
+        if (n <= 0) {
+            return (n < 0) ? n : -EIO;
+        }
+        *crc = crc32_ieee_update(*crc, view.data, n);
+        sd_view_release(&view);
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Whether a stored bitmap applies to segment num as it is now: nothing
+ * acknowledged past its end, and chunk 0 unchanged, as it would not be
+ * after the segment was cleared and recorded again */
+static bool offload_slot_matches(const struct offload_slot *slot, uint8_t num, uint32_t size)
+{
+    uint32_t crc;
+    uint32_t len = 0;
+
+    if (slot->num != num || slot->chunk_size != OFFLOAD_CHUNK) {
+        return false;
+    }
+    for (uint32_t i = offload_chunks(size); i < CONFIG_OMI_SD_OFFLOAD_MAX_CHUNKS; i++) {
+        if (offload_bit(slot, i)) {
+            return false;
+        }
+    }
+    if (size % OFFLOAD_CHUNK != 0 && size > 0 && offload_bit(slot, size / OFFLOAD_CHUNK)) {
+        return false;
+    }
+    if (slot->tail_len != 0 && slot->tail_index * OFFLOAD_CHUNK + slot->tail_len > size) {
+        return false;
+    }
+
+    if (offload_bit(slot, 0)) {
+        len = OFFLOAD_CHUNK;
+    } else if (slot->tail_index == 0) {
+        len = slot->tail_len;
+    }
+    if (len == 0) {
+        /* Without chunk 0 the segment cannot be recognized: only an empty
+         * bitmap applies */
+        for (size_t i = 0; i < ARRAY_SIZE(slot->acked); i++) {
+            if (slot->acked[i] != 0) {
+                return false;
+            }
+        }
+        return slot->tail_len == 0;
+    }
+    return offload_crc(0, len, &crc) == 0 && crc == slot->first_crc;
+}
+
+/* Segment num is being removed or recreated: nothing of it has been
+ * acknowledged any more, in the offload in progress or in the store */
+static void offload_forget(uint8_t num)
+{
+    k_mutex_lock(&offload_lock, K_FOREVER);
+    if (offload_active) {
+        if (offload_state.num == num) {
+            offload_reset(num);
+            offload_save();
+        }
+    } else {
+        const struct offload_slot *stored = offload_load();
+
+        if (stored != NULL && stored->num == num) {
+            offload_state.seq = stored->seq;
+            offload_reset(0);
+            offload_save();
+        }
+    }
+    k_mutex_unlock(&offload_lock);
+}
+
+int sd_offload_begin(uint8_t num)
+{
+    const struct offload_slot *stored;
+    uint32_t size;
+    int ret;
+
+    k_mutex_lock(&offload_lock, K_FOREVER);
+    if (offload_active) {
+        k_mutex_unlock(&offload_lock);
+        return -EBUSY;
+    }
+
+    ret = sd_cursor_open(&offload_cursor, num);
+    if (ret != 0) {
+        k_mutex_unlock(&offload_lock);
+        return ret;
+    }
+    ret = segment_lookup(num, &size);
+    if (ret != 0) {
+        sd_cursor_close(offload_cursor);
+        k_mutex_unlock(&offload_lock);
+        return ret;
+    }
+
+    memset(&offload_stats, 0, sizeof(offload_stats));
+    offload_state.seq = 0;
+    stored = offload_load();
+    if (stored != NULL) {
+        offload_state.seq = stored->seq;
+        if (offload_slot_matches(stored, num, size)) {
+            offload_state = *stored;
+            offload_drop_flights();
+            offload_stats.resumed = offload_chunks(size) - offload_pending(size);
+        } else {
+            offload_reset(num);
+        }
+    } else {
+        offload_reset(num);
+    }
+    offload_unsaved = 0;
+    offload_active = true;
+    k_mutex_unlock(&offload_lock);
+
+    LOG_INF("Offloading segment %u: %u bytes, %u chunks already acknowledged", num, size,
+            offload_stats.resumed);
+    return 0;
+}
+
+int sd_offload_next(struct sd_offload_chunk *chunk, uint8_t *buf, size_t len)
+{
+    struct offload_flight *flight = NULL;
+    uint32_t size;
+    uint32_t index;
+    int ret;
+
+    if (len < OFFLOAD_CHUNK) {
+        return -EINVAL;
+    }
+
+    k_mutex_lock(&offload_lock, K_FOREVER);
+    if (!offload_active) {
+        k_mutex_unlock(&offload_lock);
+        return -ENOENT;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(offload_flights); i++) {
+        if (!offload_flights[i].used) {
+            flight = &offload_flights[i];
+            break;
+        }
+    }
+    if (flight == NULL) {
+        k_mutex_unlock(&offload_lock);
+        return -EBUSY;
+    }
+    ret = segment_lookup(offload_state.num, &size);
+    if (ret != 0) {
+        k_mutex_unlock(&offload_lock);
+        return ret;
+    }
+
+    if (offload_resend_count > 0) {
+        index = offload_resend[0];
+        offload_resend_count--;
+        memmove(&offload_resend[0], &offload_resend[1],
+                offload_resend_count * sizeof(offload_resend[0]));
+        offload_stats.resent++;
+    } else {
+        uint32_t chunks = offload_chunks(size);
+
+        /* The segment grew past a short last chunk already sent */
+        if (offload_short_len != 0 &&
+            offload_chunk_len(offload_short_index, size) > offload_short_len &&
+            !offload_in_flight(offload_short_index)) {
+            offload_scan = MIN(offload_scan, offload_short_index);
+            offload_short_len = 0;
+        }
+        while (offload_scan < chunks && offload_chunk_done(&offload_state, offload_scan, size)) {
+            offload_scan++;
+        }
+        if (offload_scan >= chunks) {
+            k_mutex_unlock(&offload_lock);
+            return 0;
+        }
+        index = offload_scan++;
+    }
+
+    uint32_t offset = index * OFFLOAD_CHUNK;
+    uint32_t chunk_len = offload_chunk_len(index, size);
+
+    ret = sd_cursor_read(offload_cursor, buf, chunk_len, offset);
+    if (ret != (int)chunk_len) {
+        k_mutex_unlock(&offload_lock);
+        return (ret < 0) ? ret : -EIO;
+    }
+
+    *chunk = (struct sd_offload_chunk){
+        .index = index, .offset = offset, .len = chunk_len, .crc = crc32_ieee(buf, chunk_len),
+    };
+    *flight = (struct offload_flight){
+        .used = true, .index = index, .len = chunk_len, .crc = chunk->crc,
+    };
+    if (chunk_len < OFFLOAD_CHUNK) {
+        offload_short_index = index;
+        offload_short_len = chunk_len;
+    }
+    offload_stats.sent++;
+    k_mutex_unlock(&offload_lock);
+    return chunk_len;
+}
+
+int sd_offload_ack(uint32_t index, uint32_t crc)
+{
+    struct offload_flight *flight = NULL;
+
+    k_mutex_lock(&offload_lock, K_FOREVER);
+    for (size_t i = 0; offload_active && i < ARRAY_SIZE(offload_flights); i++) {
+        if (offload_flights[i].used && offload_flights[i].index == index) {
+            flight = &offload_flights[i];
+            break;
+        }
+    }
+    if (flight == NULL) {
+        k_mutex_unlock(&offload_lock);
+        return -ENOENT;
+    }
+    flight->used = false;
+
+    if (crc != flight->crc) {
+        /* Chunks in flight and waiting to be resent never exceed the
+         * window, so there is room */
+        offload_resend[offload_resend_count++] = index;
+        offload_stats.crc_mismatches++;
+        k_mutex_unlock(&offload_lock);
+        LOG_WRN("Offload chunk %u failed its CRC check, resending", index);
+        return -EBADMSG;
+    }
+
+    if (flight->len == OFFLOAD_CHUNK) {
+        offload_state.acked[index / 32] |= BIT(index % 32);
+    } else {
+        offload_state.tail_index = index;
+        offload_state.tail_len = flight->len;
+    }
+    if (index == 0) {
+        offload_state.first_crc = crc;
+    }
+    if (++offload_unsaved >= CONFIG_OMI_SD_OFFLOAD_SAVE_EVERY) {
+        offload_save();
+    }
+    k_mutex_unlock(&offload_lock);
+    return 0;
+}
+
+void sd_offload_rewind(void)
+{
+    k_mutex_lock(&offload_lock, K_FOREVER);
+    if (offload_active) {
+        offload_drop_flights();
+        offload_stats.rewinds++;
+        if (offload_unsaved > 0) {
+            offload_save();
+        }
+    }
+    k_mutex_unlock(&offload_lock);
+}
+
+int sd_offload_remaining(void)
+{
+    uint32_t size;
+    int ret;
+
+    k_mutex_lock(&offload_lock, K_FOREVER);
+    if (!offload_active) {
+        ret = -ENOENT;
+    } else {
+        ret = segment_lookup(offload_state.num, &size);
+        if (ret == 0) {
+            ret = offload_pending(size);
+        }
+    }
+    k_mutex_unlock(&offload_lock);
+    return ret;
+}
+
+int sd_offload_end(void)
+{
+    int ret = 0;
+
+    k_mutex_lock(&offload_lock, K_FOREVER);
+    if (!offload_active) {
+        k_mutex_unlock(&offload_lock);
+        return -EALREADY;
+    }
+    if (offload_unsaved > 0) {
+        ret = offload_save();
+    }
+    sd_cursor_close(offload_cursor);
+    offload_cursor = NULL;
+    offload_active = false;
+    k_mutex_unlock(&offload_lock);
+    return ret;
+}
+
+void sd_offload_get_stats(struct sd_offload_stats *stats)
+{
+    uint32_t size;
+
+    k_mutex_lock(&offload_lock, K_FOREVER);
+    if (offload_active && segment_lookup(offload_state.num, &size) == 0) {
+        offload_stats.chunks = offload_chunks(size);
+        offload_stats.acked = offload_stats.chunks - offload_pending(size);
+    }
+    *stats = offload_stats;
+    k_mutex_unlock(&offload_lock);
+}
+
+/* OMI Compatible Functions */
+
+int mount_sd_card(void)
+{
+    return sd_card_start();
+}
+
+int create_file(const char* file_path)
+{
+    int ret = 0;
+    snprintf(current_full_path, sizeof(current_full_path), "%s%s", SD_MOUNT_PT, file_path);
+    struct fs_file_t data_file;
+    fs_file_t_init(&data_file);
+    ret = fs_open(&data_file, current_full_path, FS_O_WRITE | FS_O_CREATE);
+    if (ret) {
+        LOG_ERR("File creation failed %d", ret);
+        return -2;
+    } 
+    fs_close(&data_file);
+    return 0;
+}
+
+int initialize_audio_file(uint8_t num)
+{
+    char name[MAX_PATH];
+
+    if (num == 0 || num > MAX_AUDIO_FILES) {
+        return -1;
+    }
+    segment_name(num, name, sizeof(name));
+    int ret = create_file(name);
+    /* It may have existed already, with data */
+    segments_forget(num);
+    return ret;
+}
+
+int write_to_file(uint8_t *data, uint32_t length)
+{
+    struct fs_file_t *file;
+    ssize_t written;
+    int ret;
+
+    k_mutex_lock(&segment_lock, K_FOREVER);
+    uint8_t num = current_write_file;
+
+    ret = segment_handle_get_locked(num, &file);
+    if (ret < 0) {
+        goto out;
+    }
+    written = fs_write(file, data, length);
+    /* Syncing flushes the data, FAT and directory entry: the write is only
+     * durable once it succeeds */
+    ret = (written < 0) ? (int)written : fs_sync(file);
+    if (ret < 0) {
+        /* Close now, while whatever the failed write left cached can still
+         * only fail too; the size is re-read on the next lookup */
+        segment_handles_close_locked(num);
+        segments[num].known = false;
+        goto out;
+    }
+    if (segments[num].known) {
+        segments[num].size += (uint32_t)written;
+    }
+    note_write();
+    ret = ((uint32_t)written == length) ? (int)written : -ENOSPC;
+out:
+    k_mutex_unlock(&segment_lock);
+    return ret;
+}
+
+int read_audio_data(uint8_t *buf, int amount, int offset)
+{
+    return sd_cursor_read(read_cursor, buf, amount, offset);
+}
+
+uint32_t get_file_size(uint8_t num)
+{
+    uint32_t size;
+
+    if (segment_lookup(num, &size) != 0) {
+        LOG_ERR("invalid file in get file size\n");
+        return 0;
+    }
+    return size;
+}
+
+int move_read_pointer(uint8_t num)
+{
+    int res = sd_cursor_move(read_cursor, num);
+    if (res) {
+        LOG_ERR("invalid file in move read ptr\n");
+        return -1;
+    }
+    return 0;
+}
+
+int move_write_pointer(uint8_t num)
+{
+    int res = segment_lookup(num, NULL);
+    if (res) {
+        LOG_ERR("invalid file in move write pointer\n");
+        return -1;
+    }
+    current_write_file = num;
+    return 0;
+}
+
+int clear_audio_file(uint8_t num)
+{
+    char path[MAX_PATH];
+
+    if (num == 0 || num > MAX_AUDIO_FILES) {
+        return -1;
+    }
+    segment_path(num, path, sizeof(path));
+    offload_forget(num);
+    cursors_invalidate(num);
+
+    k_mutex_lock(&segment_lock, K_FOREVER);
+    segment_handles_close_locked(num);
+    segments[num].known = false;
+    int res = fs_unlink(path);
+    if (res == 0) {
+        segments[num] = (struct segment_entry){ .known = true, .exists = false };
+    }
+    k_mutex_unlock(&segment_lock);
+    if (res) {
+        LOG_ERR("error deleting file");
+        return -1;
+    }
+
+    k_msleep(10);
+    segment_name(num, path, sizeof(path));
+    res = create_file(path);
+    if (res) {
+        LOG_ERR("error creating file");
+        return -1;
+    }
+
+    k_mutex_lock(&segment_lock, K_FOREVER);
+    segments[num] = (struct segment_entry){ .known = true, .exists = true, .size = 0 };
+    k_mutex_unlock(&segment_lock);
+    return 0;
+}
+
+int delete_audio_file(uint8_t num)
+{
+    char path[MAX_PATH];
+
+    if (num == 0 || num > MAX_AUDIO_FILES) {
+        return -1;
+    }
+    segment_path(num, path, sizeof(path));
+    offload_forget(num);
+    cursors_invalidate(num);
+
+    k_mutex_lock(&segment_lock, K_FOREVER);
+    segment_handles_close_locked(num);
+    segments[num].known = false;
+    int res = fs_unlink(path);
+    if (res == 0) {
+        segments[num] = (struct segment_entry){ .known = true, .exists = false };
+    }
+    k_mutex_unlock(&segment_lock);
+    if (res) {
+        LOG_ERR("error deleting file in delete\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int clear_audio_directory()
+{
+    if (file_count == 1) {
+        return 0;
+    }
+    
+    int res = 0;
+    for (uint8_t i = file_count; i > 0; i--) {
+        res = delete_audio_file(i);
+        k_msleep(10);
+        if (res) {
+            LOG_ERR("error on %d\n", i);
+            return -1;
+        }  
+    }
+    
+    res = fs_unlink("/SD:/audio");
+    if (res) {
+        LOG_ERR("error deleting file");
+        return -1;
+    }
+    
+    res = fs_mkdir("/SD:/audio");
+    if (res) {
+        LOG_ERR("failed to make directory");
+        return -1;
+    }
+    
+    res = create_file("audio/a01.txt");
+    if (res) {
+        LOG_ERR("failed to make new file in directory files");
+        return -1;
+    }
+    
+    LOG_INF("done with clearing");
+
+    segments_forget(0);
+    file_count = 1;  
+    move_write_pointer(1);
+    return 0;
+}
+
+static uint32_t offset_slot_crc(const struct offset_slot *slot)
+{
+    return crc32_ieee((const uint8_t *)slot, offsetof(struct offset_slot, crc));
+}
+
+/* Newest intact value in the offset store; -EBADMSG if no slot is intact */
+static int load_offset(uint32_t *offset, uint32_t *seq)
+{
+    struct offset_slot slots[2];
+    int newest = -1;
+
+    int rc = slot_store_read(INFO_FILE, slots, sizeof(slots[0]));
+    if (rc < 0) {
+        return rc;
+    }
+
+    if (rc == sizeof(uint32_t)) {
+        *offset = le32((const uint8_t *)slots);
+        *seq = 0;
+        return 0;
+    }
+    for (int i = 0; i < rc / (int)sizeof(slots[0]); i++) {
+        if (slots[i].crc == offset_slot_crc(&slots[i]) &&
+            (newest < 0 || (int32_t)(slots[i].seq - slots[newest].seq) > 0)) {
+            newest = i;
+        }
+    }
+    if (newest < 0) {
+        return -EBADMSG;
+    }
+    *offset = slots[newest].offset;
+    *seq = slots[newest].seq;
+    return 0;
+}
+
+int save_offset(uint32_t offset)
+{
+    struct offset_slot slot = {
+        .offset = offset,
+        .seq = offset_seq + 1,
+    };
+
+    slot.crc = offset_slot_crc(&slot);
+
+    int res = slot_store_write(INFO_FILE, &slot, sizeof(slot), slot.seq);
+    if (res != 0) {
+        return res;
+    }
+    offset_seq = slot.seq;
+    return 0;
+}
+
+int get_offset()
+{
+    uint32_t offset;
+    uint32_t seq;
+
+    int rc = load_offset(&offset, &seq);
+    if (rc < 0) {
+        LOG_ERR("Error reading info file: %d", rc);
+        return rc;
+    }
+
+    LOG_INF("Get offset is %u", offset);
+    return offset;
+}
+
+/* The offset store must be readable and point inside the read segment; a
+ * cut can leave it torn, and one during an append can shorten the segment
+ * it points into. Returns whether it had to be rewritten. */
+static int check_offset_store(bool *repaired)
+{
+    uint32_t offset = 0;
+    uint32_t seq;
+    struct fs_dirent entry;
+
+    int ret = fs_stat(INFO_FILE, &entry);
+    if (ret == -ENOENT) {
+        return 0;
+    }
+    if (ret == 0) {
+        ret = load_offset(&offset, &seq);
+    }
+    if (ret == 0 && offset <= get_file_size(read_cursor->num)) {
+        return 0;
+    }
+
+    /* Restart offload from what is known to be on the card: a repeat,
+     * never a gap */
+    LOG_WRN("Offset store %s, resetting it", (ret == 0) ? "past the segment end" : "unreadable");
+    *repaired = true;
+    offset = (ret == 0) ? get_file_size(read_cursor->num) : 0;
+    return save_offset(offset);
+}
+
+int sd_card_recover(struct sd_card_recovery *report)
+{
+    int64_t start = k_uptime_ticks();
+    int64_t step = start;
+    int ret;
+
+    memset(report, 0, sizeof(*report));
+
+    /* Nothing cached for the old mount can reach a card that lost power:
+     * forget it and start over from what is on the card */
+    if (sd_card_state == SD_CARD_MOUNTED) {
+        cursors_invalidate(0);
+        segments_forget(0);
+        ret = fs_unmount(&mp);
+        if (ret != 0) {
+            LOG_WRN("Unmount before recovery failed: %d", ret);
+        }
+    }
+    sd_card_state = SD_CARD_UNINITIALIZED;
+
+    ret = disk_access_ioctl(SD_DISK_NAME, DISK_IOCTL_CTRL_INIT, NULL);
+    if (ret != 0) {
+        LOG_ERR("Card re-initialization failed: %d", ret);
+        sd_card_state = SD_CARD_ERROR;
+        return ret;
+    }
+    sd_card_state = SD_CARD_INITIALIZED;
+    report->init_us = k_ticks_to_us_ceil32(k_uptime_ticks() - step);
+    step = k_uptime_ticks();
+
+    /* Mounting re-reads the FAT and re-establishes the read/write cursors */
+    ret = sd_card_mount();
+    if (ret != 0 && sd_card_state == SD_CARD_MOUNTED) {
+        /* A cut between clear_audio_file()'s unlink and create leaves the
+         * cursors' segment missing */
+        ret = initialize_audio_file(file_count);
+        if (ret == 0) {
+            ret = move_write_pointer(file_count);
+        }
+        if (ret == 0) {
+            ret = move_read_pointer(file_count);
+        }
+        report->segment_recreated = true;
+    }
+    report->mount_us = k_ticks_to_us_ceil32(k_uptime_ticks() - step);
+    step = k_uptime_ticks();
+    if (ret != 0) {
+        return ret;
+    }
+
+    ret = check_offset_store(&report->offset_repaired);
+    report->offset_us = k_ticks_to_us_ceil32(k_uptime_ticks() - step);
+    report->total_us = k_ticks_to_us_ceil32(k_uptime_ticks() - start);
+    return ret;
+}
+
+/* Called with sd_pm_lock held */
+static void account_state_locked(void)
+{
+    int64_t now = k_uptime_get();
+    uint32_t ms = (uint32_t)(now - state_since);
+
+    if (sd_powered) {
+        pm_stats.on_ms += ms;
+    } else {
+        pm_stats.off_ms += ms;
+    }
+    state_since = now;
+}
+
+void sd_on()
+{
+    uint32_t start = cycle_counter_get();
+    int ret;
+
+    k_mutex_lock(&sd_pm_lock, K_FOREVER);
+    if (sd_powered) {
+        k_mutex_unlock(&sd_pm_lock);
+        return;
+    }
+    account_state_locked();
+    resume_start = k_uptime_ticks();
+
+    if (gpio_is_ready_dt(&sd_power_pin)) {
+        gpio_pin_set_dt(&sd_power_pin, 1);
+        k_sleep(K_MSEC(SD_CARD_POWER_UP_MS));
+    }
+#if SD_HAS_BUS_PM
+    ret = pm_device_action_run(sd_bus, PM_DEVICE_ACTION_RESUME);
+    if (ret != 0 && ret != -EALREADY) {
+        LOG_ERR("SD bus resume failed: %d", ret);
+    }
+#endif
+    if (gpio_is_ready_dt(&sd_power_pin) && sd_card_state == SD_CARD_MOUNTED) {
+        /* The card lost its state with its supply; FatFs did not, so a
+         * card re-init is enough and open files stay valid */
+        ret = disk_access_ioctl(SD_DISK_NAME, DISK_IOCTL_CTRL_INIT, NULL);
+        if (ret != 0) {
+            LOG_ERR("SD card re-init failed: %d", ret);
+        }
+    }
+
+    sd_powered = true;
+    first_write_pending = true;
+    pm_stats.resumes++;
+    pm_stats.last_resume_us = cycle_counter_to_ns(cycle_counter_get() - start) / 1000U;
+    pm_stats.max_resume_us = MAX(pm_stats.max_resume_us, pm_stats.last_resume_us);
+    k_mutex_unlock(&sd_pm_lock);
+
+    LOG_DBG("SD card resumed in %u us", pm_stats.last_resume_us);
+}
+
+void sd_off()
+{
+    int ret;
+
+    k_mutex_lock(&sd_pm_lock, K_FOREVER);
+    if (!sd_powered) {
+        k_mutex_unlock(&sd_pm_lock);
+        return;
+    }
+    account_state_locked();
+
+    /* Every FatFs write has completed by now (the caller holds no vote),
+     * and the deselected card drops to its standby current by itself.
+     * Mount state and open handles are kept for a fast resume. */
+    if (gpio_is_ready_dt(&sd_power_pin) && sd_card_state == SD_CARD_MOUNTED) {
+        ret = disk_access_ioctl(SD_DISK_NAME, DISK_IOCTL_CTRL_DEINIT, NULL);
+        if (ret != 0) {
+            LOG_WRN("SD card de-init failed: %d", ret);
+        }
+    }
+#if SD_HAS_BUS_PM
+    ret = pm_device_action_run(sd_bus, PM_DEVICE_ACTION_SUSPEND);
+    if (ret != 0 && ret != -EALREADY) {
+        LOG_ERR("SD bus suspend failed: %d", ret);
+    }
+#endif
+    if (gpio_is_ready_dt(&sd_power_pin)) {
+        gpio_pin_set_dt(&sd_power_pin, 0);
+    }
+
+    sd_powered = false;
+    first_write_pending = false;
+    pm_stats.suspends++;
+    k_mutex_unlock(&sd_pm_lock);
+
+    LOG_DBG("SD card suspended");
+}
+
+static void note_write(void)
+{
+    if (!first_write_pending) {
+        return;
+    }
+
+    k_mutex_lock(&sd_pm_lock, K_FOREVER);
+    if (first_write_pending) {
+        first_write_pending = false;
+        pm_stats.last_first_write_us = k_ticks_to_us_floor32(k_uptime_ticks() - resume_start);
+        pm_stats.max_first_write_us = MAX(pm_stats.max_first_write_us,
+                                          pm_stats.last_first_write_us);
+    }
+    k_mutex_unlock(&sd_pm_lock);
+}
+
+/* Raw ticks: cycle_counter_to_ns() would wrap on a single stall past 4.29 s */
+static void note_busy(uint32_t start)
+{
+    uint32_t ticks = cycle_counter_get() - start;
+    k_spinlock_key_t key = k_spin_lock(&busy_lock);
+
+    busy_ticks += ticks;
+    k_spin_unlock(&busy_lock, key);
+}
+
+void sd_card_get_pm_stats(struct sd_card_pm_stats *out)
+{
+    k_mutex_lock(&sd_pm_lock, K_FOREVER);
+    account_state_locked();
+    *out = pm_stats;
+
+    k_spinlock_key_t key = k_spin_lock(&busy_lock);
+
+    uint64_t freq = cycle_counter_freq_hz();
+
+    out->busy_ms = (uint32_t)(busy_ticks / freq * 1000U + busy_ticks % freq * 1000U / freq);
+    k_spin_unlock(&busy_lock, key);
+    out->powered = sd_powered;
+    out->supply_gated = gpio_is_ready_dt(&sd_power_pin);
+    out->bus_pm = SD_HAS_BUS_PM;
+    k_mutex_unlock(&sd_pm_lock);
+}
+
+bool is_sd_on()
+{
+    return sd_powered && sd_card_state == SD_CARD_MOUNTED;
+}
+
+#if defined(CONFIG_OMI_BENCH)
+#include "bench.h"
+
+static uint8_t bench_sector[512];
+
+static void bench_sector_setup(void)
+{
+    for (size_t i = 0; i < sizeof(bench_sector); i++) {
+        bench_sector[i] = (uint8_t)(i * 31 + 7);
+    }
+}
+
+/* Path construction done by the OMI file functions on a segment cache miss */
+static void bench_path_build(void)
+{
+    char path[MAX_PATH];
+
+    segment_path(42, path, sizeof(path));
+    bench_sink = (uint32_t)path[10];
+}
+
+static void bench_crc32_sector(void)
+{
+    bench_sink = crc32_ieee(bench_sector, sizeof(bench_sector));
+}
+
+BENCH_REGISTER(sd_path_build, NULL, bench_path_build, 128);
+BENCH_REGISTER(crc32_512, bench_sector_setup, bench_crc32_sector, 128);
+#endif /* CONFIG_OMI_BENCH */
@@ -2,6 +2,7 @@
 #define SD_CARD_H
 
 #include <zephyr/kernel.h>
+#include <zephyr/fs/fs.h>
 #include <stdint.h>
 
 /* SD Card States */
@@ -87,6 +88,290 @@ int sd_card_list_files(const char *path);
  */
 int sd_card_get_info(uint64_t *total_size_mb, uint32_t *free_space_mb);
 
+#define SD_CARD_FREE_UNKNOWN UINT32_MAX
+
+/**
+ * @brief Free space as of the last sd_card_get_info(), without touching the card
+ * @return Free space in KiB, SD_CARD_FREE_UNKNOWN before the first query
+ */
+uint32_t sd_card_get_free_kb(void);
+
+/* Streaming Read/Write Functions */
+
+/* Open file read or written sequentially in caller-sized chunks (e.g. one sector) */
+struct sd_card_stream {
+    struct fs_file_t file;
+    uint32_t size;          /* file size in bytes (grows as a write stream appends) */
+    uint32_t pos;           /* current read/write position */
+    uint8_t segment;        /* audio file number, 0 for other files */
+};
+
+/**
+ * @brief Open a file on the SD card for streaming reads
+ * @param stream Stream object to initialize
+ * @param filename File name relative to the mount point
+ * @return 0 on success, negative error code on failure
+ */
+int sd_card_stream_open(struct sd_card_stream *stream, const char *filename);
+
+/**
+ * @brief Read the next chunk of a stream
+ * @param stream Open stream
+ * @param buf Destination buffer
+ * @param len Bytes to read
+ * @return Number of bytes read (0 at end of file), negative error code on failure
+ */
+int sd_card_stream_read(struct sd_card_stream *stream, void *buf, size_t len);
+
+/**
+ * @brief Move the read position of a stream
+ * @param stream Open stream
+ * @param pos Absolute byte position (clamped to the file size)
+ * @return 0 on success, negative error code on failure
+ */
+int sd_card_stream_seek(struct sd_card_stream *stream, uint32_t pos);
+
+/**
+ * @brief Close a stream
+ */
+void sd_card_stream_close(struct sd_card_stream *stream);
+
+/**
+ * @brief Create (or truncate) a file on the SD card for streaming writes
+ * @param stream Stream object to initialize
+ * @param filename File name relative to the mount point
+ * @return 0 on success, negative error code on failure
+ */
+int sd_card_stream_create(struct sd_card_stream *stream, const char *filename);
+
+/* Audio files ("segments") a01.txt to a99.txt */
+#define SD_CARD_MAX_AUDIO_FILES 99
+
+/**
+ * @brief Create (or truncate) an audio segment for streaming writes
+ *
+ * Like sd_card_stream_create(), for the OMI audio file num, with its
+ * directory entry already on the card when this returns. The segment
+ * cache, read cursors and append handles see what the stream has synced.
+ * A segment that is still being read (the read pointer's, another open
+ * cursor's or the offload's) is not truncated.
+ * @param stream Stream object to initialize
+ * @param num Audio file number
+ * @return 0 on success, -EBUSY if the segment is being read, negative
+ *         error code on other failures
+ */
+int sd_card_segment_create(struct sd_card_stream *stream, uint8_t num);
+
+/**
+ * @brief Append a chunk to a stream opened with sd_card_stream_create() or
+ *        sd_card_segment_create()
+ * @param stream Open stream
+ * @param buf Data to write
+ * @param len Bytes to write
+ * @return Number of bytes written, negative error code on failure
+ */
+int sd_card_stream_write(struct sd_card_stream *stream, const void *buf, size_t len);
+
+/**
+ * @brief Flush a write stream's cached data and directory entry to the card
+ * @return 0 on success, negative error code on failure
+ */
+int sd_card_stream_sync(struct sd_card_stream *stream);
+
+/**
+ * @brief Locate the 16-bit mono PCM samples of an open audio file
+ *
+ * WAV files must be 16-bit mono PCM; anything without a RIFF header is
+ * treated as raw 16-bit mono PCM. The stream is left at the first sample.
+ * @param stream Stream opened with sd_card_stream_open()
+ * @param rate Expected sample rate; a WAV at another rate only warns
+ * @param start Byte offset of the first sample
+ * @param end Byte offset just past the last sample
+ * @return 0 on success, -ENOTSUP for another WAV format, negative error code on failure
+ */
+int sd_card_stream_find_pcm(struct sd_card_stream *stream, uint32_t rate, uint32_t *start,
+                            uint32_t *end);
+
+/* Read Cursors */
+
+/* Reader of one audio segment with its own open file, position and
+ * prefetch buffer, so offload and playback of the same or different
+ * segments never reopen or re-seek because of each other. Cursors come
+ * from a pool of CONFIG_OMI_SD_CURSORS; the read pointer of the OMI API
+ * (move_read_pointer(), read_audio_data()) is one more, built in. */
+struct sd_cursor;
+
+struct sd_cursor_stats {
+    uint32_t reads;         /* sd_cursor_read() calls */
+    uint32_t views;         /* sd_cursor_view() calls */
+    uint32_t hits;          /* reads and views served entirely from the prefetch buffer */
+    uint32_t card_reads;    /* fs_read() calls */
+    uint32_t seeks;         /* repositionings of the open file */
+    uint32_t opens;         /* first open, segment change, growth, clear or remount */
+};
+
+/**
+ * @brief Take a cursor from the pool and point it at a segment
+ * @param cursor Set to the cursor on success
+ * @param num Audio file number
+ * @return 0 on success, -ENOMEM if the pool is empty, negative error code if
+ *         the segment does not exist
+ */
+int sd_cursor_open(struct sd_cursor **cursor, uint8_t num);
+
+/**
+ * @brief Point a cursor at another segment
+ * @param cursor Open cursor
+ * @param num Audio file number
+ * @return 0 on success, negative error code if the segment does not exist
+ */
+int sd_cursor_move(struct sd_cursor *cursor, uint8_t num);
+
+/**
+ * @brief Read from a cursor's segment
+ *
+ * Sequential reads smaller than the prefetch buffer are served from it;
+ * larger ones go straight to the caller's buffer. Data appended to the
+ * segment since the last read is picked up.
+ * @param cursor Open cursor
+ * @param buf Destination buffer
+ * @param amount Bytes to read
+ * @param offset Byte offset in the segment
+ * @return Number of bytes read (short at the end of the segment),
+ *         negative error code on failure
+ */
+int sd_cursor_read(struct sd_cursor *cursor, uint8_t *buf, int amount, uint32_t offset);
+
+/* Borrowed, read-only window into a cursor's prefetch buffer */
+struct sd_view {
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t offset;        /* segment offset of data[0] */
+    struct sd_cursor *cursor;   /* release token; NULL once released */
+};
+
+/**
+ * @brief Borrow stored data without copying it
+ *
+ * Returns a view of the cursor's prefetch buffer, filling the buffer from
+ * offset first if it does not hold that byte. The buffer is pinned, and
+ * not refilled, until every view of it is released; meanwhile
+ * sd_cursor_read() on the cursor goes to the card, and views outside the
+ * buffer fail with -EBUSY. A sequential consumer takes a view, processes
+ * it in place and releases it before taking the next one.
+ * @param cursor Open cursor
+ * @param offset Byte offset in the segment
+ * @param max Longest view wanted; the view can be shorter (buffer end)
+ * @param view Filled in on success, emptied on failure
+ * @return Bytes in the view (0 at the end of the segment or for max 0,
+ *         with nothing pinned), -EBUSY if the buffer is pinned elsewhere,
+ *         negative error code on failure
+ */
+int sd_cursor_view(struct sd_cursor *cursor, uint32_t offset, uint32_t max, struct sd_view *view);
+
+/**
+ * @brief Return a view taken with sd_cursor_view(); may be called from any
+ *        context, and more than once
+ */
+void sd_view_release(struct sd_view *view);
+
+/**
+ * @brief Audio file number a cursor reads
+ */
+uint8_t sd_cursor_segment(const struct sd_cursor *cursor);
+
+void sd_cursor_get_stats(struct sd_cursor *cursor, struct sd_cursor_stats *stats);
+
+/**
+ * @brief Return a cursor to the pool, closing its file
+ *
+ * Every view of the cursor must have been released.
+ */
+void sd_cursor_close(struct sd_cursor *cursor);
+
+/* Chunked Offload */
+
+/* Offload of one audio segment in CONFIG_OMI_SD_OFFLOAD_CHUNK chunks, each
+ * sent with a CRC-32 that the receiver checks and echoes back in its
+ * acknowledgment. Acknowledged chunks are kept in a bitmap on the card, so
+ * after a disconnect or a reboot only chunks never acknowledged are sent,
+ * and a chunk that arrived corrupted is sent again on its own. The byte
+ * offset of save_offset() is independent of it. One offload at a time. */
+struct sd_offload_chunk {
+    uint32_t index;
+    uint32_t offset;        /* segment offset of the chunk */
+    uint32_t len;           /* the chunk size, less for the last chunk */
+    uint32_t crc;           /* crc32_ieee() of the data */
+};
+
+struct sd_offload_stats {
+    uint32_t chunks;        /* in the segment so far */
+    uint32_t acked;
+    uint32_t resumed;       /* found acknowledged by sd_offload_begin() */
+    uint32_t sent;          /* chunks returned by sd_offload_next() */
+    uint32_t resent;        /* ... again after a CRC mismatch */
+    uint32_t crc_mismatches;
+    uint32_t rewinds;
+    uint32_t saves;         /* bitmap store writes */
+};
+
+/**
+ * @brief Start or resume offloading a segment
+ *
+ * Takes up the acknowledged chunks from the bitmap store if they are for
+ * this segment as it is now. Uses a read cursor from the pool.
+ * @param num Audio file number
+ * @return 0 on success, -EBUSY if an offload is in progress, negative error
+ *         code on failure
+ */
+int sd_offload_begin(uint8_t num);
+
+/**
+ * @brief Read the next chunk to send
+ *
+ * Chunks come in order, skipping acknowledged ones and those in flight,
+ * with chunks that failed their CRC check first. Data appended to the
+ * segment is picked up; a short last chunk is sent again once it grows.
+ * @param chunk Filled in with the chunk's position and CRC
+ * @param buf Destination, at least CONFIG_OMI_SD_OFFLOAD_CHUNK bytes
+ * @param len Size of buf
+ * @return Bytes in the chunk, 0 if every chunk has been sent since the last
+ *         rewind, -EBUSY if CONFIG_OMI_SD_OFFLOAD_WINDOW chunks await their
+ *         acknowledgment, negative error code on failure
+ */
+int sd_offload_next(struct sd_offload_chunk *chunk, uint8_t *buf, size_t len);
+
+/**
+ * @brief Acknowledge a chunk with the CRC the receiver computed over it
+ * @param index Chunk index
+ * @param crc CRC-32 of the data as received
+ * @return 0 if the chunk is now acknowledged, -EBADMSG if the CRC does not
+ *         match (the chunk is queued to be sent again), -ENOENT if the chunk
+ *         is not in flight
+ */
+int sd_offload_ack(uint32_t index, uint32_t crc);
+
+/**
+ * @brief Forget the chunks in flight and start sending from the first chunk
+ *        not acknowledged, e.g. after a reconnect or an acknowledgment timeout
+ */
+void sd_offload_rewind(void);
+
+/**
+ * @brief Chunks of the segment not acknowledged yet
+ * @return Chunk count, -ENOENT if no offload is in progress
+ */
+int sd_offload_remaining(void);
+
+/**
+ * @brief End the offload, writing the bitmap store
+ * @return 0 on success, -EALREADY if no offload is in progress, negative
+ *         error code if the store could not be written
+ */
+int sd_offload_end(void);
+
+void sd_offload_get_stats(struct sd_offload_stats *stats);
+
 /* OMI Compatible Functions - Direct API Compatibility */
 
 /**
@@ -120,19 +405,22 @@ int initialize_audio_file(uint8_t num);
 /**
  * @brief Write to the current audio file specified by the write pointer
  *
+ * The data is synced before returning; the file stays open for the next
+ * call.
  * @param data Data to write
  * @param length Length of data to write
- * @return number of bytes written
+ * @return number of bytes written, or a negative error code
  */
 int write_to_file(uint8_t *data, uint32_t length);
 
 /**
  * @brief Read from the current audio file specified by the read pointer
  *
+ * The read pointer is a cursor of its own (see sd_cursor_read()).
  * @param buf Buffer to store read data
  * @param amount Amount of data to read
  * @param offset Offset in file to read from
- * @return number of bytes read
+ * @return number of bytes read, or a negative error code
  */
 int read_audio_data(uint8_t *buf, int amount, int offset);
 
@@ -188,11 +476,28 @@ int clear_audio_directory(void);
 /**
  * @brief Save offset to info file
  *
+ * Alternates between two checksummed slots, so a power cut during the
+ * write leaves either the old or the new offset readable.
  * @param offset Offset to save
  * @return 0 if successful, negative errno code if error
  */
 int save_offset(uint32_t offset);
 
+struct sd_card_cache_stats {
+    uint32_t lookups;           /* audio file size/existence checks */
+    uint32_t dir_reads;         /* ... that had to stat the card */
+    uint32_t handle_hits;       /* write_to_file() calls on an open segment */
+    uint32_t handle_opens;
+};
+
+/**
+ * @brief Segment cache effectiveness since boot
+ *
+ * The OMI functions keep each audio file's size and existence, and the
+ * append handles of the last written segments, between calls.
+ */
+void sd_card_get_cache_stats(struct sd_card_cache_stats *stats);
+
 /**
  * @brief Get offset from info file
  *
@@ -200,20 +505,71 @@ int save_offset(uint32_t offset);
  */
 int get_offset(void);
 
+struct sd_card_recovery {
+    uint32_t total_us;
+    uint32_t init_us;           /* card re-initialization */
+    uint32_t mount_us;          /* filesystem mount, audio directory and cursors */
+    uint32_t offset_us;         /* offset store check */
+    bool segment_recreated;     /* the cursors' segment was missing */
+    bool offset_repaired;       /* the offset store was unreadable or past the segment end */
+};
+
+/**
+ * @brief Bring the card back after a power loss
+ *
+ * Drops the old mount without flushing, re-initializes the card, mounts
+ * it again, re-establishes the read/write cursors (recreating their
+ * segment if a cut lost it) and checks the offset store against the read
+ * segment.
+ * @return 0 on success, negative error code on failure
+ */
+int sd_card_recover(struct sd_card_recovery *report);
+
+/* Supply ramp after the optional sd_power_pin load switch turns on */
+#define SD_CARD_POWER_UP_MS 2
+
+struct sd_card_pm_stats {
+    uint32_t suspends;
+    uint32_t resumes;
+    uint32_t on_ms;                 /* time powered since boot */
+    uint32_t off_ms;                /* time suspended since boot */
+    uint32_t busy_ms;               /* part of on_ms spent in stream reads, writes and syncs */
+    uint32_t last_resume_us;        /* sd_on() duration */
+    uint32_t max_resume_us;
+    uint32_t last_first_write_us;   /* from sd_on() to the first write completing */
+    uint32_t max_first_write_us;
+    bool powered;
+    bool bus_pm;                    /* SPI controller suspended into its sleep pinctrl */
+    bool supply_gated;              /* card supply switched through sd_power_pin */
+};
+
 /**
- * @brief Turn on SD card
+ * @brief Resume the SD card from sd_off()
+ *
+ * Resumes the SPI controller and, if the card's supply was cut,
+ * re-initializes the card. The filesystem stays mounted across a
+ * suspend, so open files remain valid and no remount is needed.
  */
 void sd_on(void);
 
 /**
- * @brief Turn off SD card
+ * @brief Suspend the SD card between bursts of activity
+ *
+ * The SPI controller goes to its sleep pinctrl state and, on boards with
+ * an sd_power_pin load switch, the card's supply is cut. The caller must
+ * not have file operations in flight.
  */
 void sd_off(void);
 
+/**
+ * @brief Get suspend/resume counts, residency and resume latencies
+ */
+void sd_card_get_pm_stats(struct sd_card_pm_stats *stats);
+
 /**
  * @brief Check if SD card is on
  *
- * @return true if SD card is mounted, false otherwise
+ * @return true if the SD card is mounted and not suspended
  */
 bool is_sd_on(void);
 
@@ -0,0 +1,49 @@
+/*
+ * Boot-time storage test fixture (native_sim)
+ * Shared by the power-fail and offload tests: the segment content
+ * pattern, the wait for main() to mount the card and the test thread.
+ * Each test prints <NAME>_FAILED setup if it cannot start and ends with
+ * a <NAME>_DONE line for twister.
+ */
+
+#ifndef SD_TEST_H
+#define SD_TEST_H
+
+#include "sd_card.h"
+#include "omi_threads.h"
+#include "xorshift.h"
+
+#include <zephyr/kernel.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Segment content is a function of the byte position */
+static inline uint8_t sd_test_pattern(uint32_t pos)
+{
+    return (uint8_t)(pos * 7 + (pos >> 9));
+}
+
+/* main() mounts the card at boot; false if it has not within 5 s */
+static inline bool sd_test_wait_mounted(void)
+{
+    for (int i = 0; i < 100 && sd_card_get_state() != SD_CARD_MOUNTED; i++) {
+        k_sleep(K_MSEC(50));
+    }
+    return sd_card_get_state() == SD_CARD_MOUNTED;
+}
+
+#define SD_TEST_SETUP_FAILED(_name) printk(_name "_FAILED setup\n")
+
+/* Run _fn(void) once after boot on a benchmark-priority thread */
+#define SD_TEST_DEFINE(_name, _fn)                                             \
+    static void _name##_thread(void *p1, void *p2, void *p3)                   \
+    {                                                                          \
+        ARG_UNUSED(p1);                                                        \
+        ARG_UNUSED(p2);                                                        \
+        ARG_UNUSED(p3);                                                        \
+        _fn();                                                                 \
+    }                                                                          \
+    K_THREAD_DEFINE(_name, OMI_STACK_BENCH, _name##_thread, NULL, NULL, NULL,  \
+                    OMI_PRIO_BENCH, 0, 0)
+
+#endif /* SD_TEST_H */
@@ -0,0 +1,89 @@
+#
+# Shared OMI sources, included from each application's CMakeLists.txt
+#
+
+set(OMI_COMMON_DIR ${CMAKE_CURRENT_LIST_DIR})
+
+target_include_directories(app PRIVATE
+    ${OMI_COMMON_DIR}/src
+)
+
+target_sources(app PRIVATE
+    ${OMI_COMMON_DIR}/src/cycle_counter.c
+)
+
+if(CONFIG_OMI_AUDIO_POOL)
+    target_sources(app PRIVATE ${OMI_COMMON_DIR}/src/audio_pool.c)
+endif()
+
+if(CONFIG_OMI_AUDIO_STAGE)
+    target_sources(app PRIVATE
+        ${OMI_COMMON_DIR}/src/audio_stage.c
+        ${OMI_COMMON_DIR}/src/audio_stages.c
+    )
+    zephyr_linker_sources(SECTIONS ${OMI_COMMON_DIR}/audio_stage.ld)
+    zephyr_linker_sources(DATA_SECTIONS ${OMI_COMMON_DIR}/audio_pipeline.ld)
+endif()
+
+if(CONFIG_OMI_ADPCM)
+    target_sources(app PRIVATE ${OMI_COMMON_DIR}/src/adpcm.c)
+endif()
+
+if(CONFIG_OMI_ASSET_BANK)
+    # Voice prompts are encoded from the asset manifest at build time
+    file(GLOB_RECURSE OMI_ASSET_WAVS ${OMI_COMMON_DIR}/assets/*.wav)
+    set(OMI_ASSETS_DIR ${CMAKE_CURRENT_BINARY_DIR}/omi_generated)
+    set(OMI_ASSETS_INC ${OMI_ASSETS_DIR}/omi_assets.inc)
+    set(OMI_MKASSETS ${OMI_COMMON_DIR}/../scripts/mkassets.py)
+    file(MAKE_DIRECTORY ${OMI_ASSETS_DIR})
+    add_custom_command(
+        OUTPUT ${OMI_ASSETS_INC}
+        COMMAND ${PYTHON_EXECUTABLE} ${OMI_MKASSETS} -o ${OMI_ASSETS_INC}
+                ${OMI_COMMON_DIR}/assets/assets.txt
+        DEPENDS ${OMI_MKASSETS} ${OMI_COMMON_DIR}/assets/assets.txt ${OMI_ASSET_WAVS}
+        COMMENT "Building the sound asset bank"
+    )
+    add_custom_target(omi_assets DEPENDS ${OMI_ASSETS_INC})
+    add_dependencies(app omi_assets)
+    target_include_directories(app PRIVATE ${OMI_ASSETS_DIR})
+    target_sources(app PRIVATE ${OMI_COMMON_DIR}/src/asset_bank.c)
+endif()
+
+if(CONFIG_OMI_SYNTH)
+    # UI sounds are compiled from text descriptions at build time
+    file(GLOB OMI_SOUND_SOURCES ${OMI_COMMON_DIR}/sounds/*.snd)
+    set(OMI_SOUNDS_DIR ${CMAKE_CURRENT_BINARY_DIR}/omi_generated)
+    set(OMI_SOUNDS_INC ${OMI_SOUNDS_DIR}/omi_sounds.inc)
+    set(OMI_SNDC ${OMI_COMMON_DIR}/../scripts/sndc.py)
+    file(MAKE_DIRECTORY ${OMI_SOUNDS_DIR})
+    add_custom_command(
+        OUTPUT ${OMI_SOUNDS_INC}
+        COMMAND ${PYTHON_EXECUTABLE} ${OMI_SNDC} -o ${OMI_SOUNDS_INC} ${OMI_SOUND_SOURCES}
+        DEPENDS ${OMI_SNDC} ${OMI_SOUND_SOURCES}
+        COMMENT "Compiling UI sounds"
+    )
+    add_custom_target(omi_sounds DEPENDS ${OMI_SOUNDS_INC})
+    add_dependencies(app omi_sounds)
+    target_include_directories(app PRIVATE ${OMI_SOUNDS_DIR})
+    target_sources(app PRIVATE ${OMI_COMMON_DIR}/src/synth.c)
+endif()
+
+if(CONFIG_OMI_DISK_EMUL)
+    target_sources(app PRIVATE ${OMI_COMMON_DIR}/src/disk_emul.c)
+endif()
+
+if(CONFIG_OMI_AEC)
+    target_sources(app PRIVATE ${OMI_COMMON_DIR}/src/aec.c)
+endif()
+
+if(CONFIG_OMI_BENCH)
+    target_sources(app PRIVATE ${OMI_COMMON_DIR}/src/bench.c)
+    zephyr_linker_sources(SECTIONS ${OMI_COMMON_DIR}/bench.ld)
+endif()
+
+# native_sim: host-side helpers are linked into the native simulator runner
+if(CONFIG_NATIVE_LIBRARY)
+    target_sources(native_simulator INTERFACE
+        ${OMI_COMMON_DIR}/src/cycle_counter_bottom.c
+    )
+endif()
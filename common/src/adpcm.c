@@ -0,0 +1,166 @@
+/*
+ * IMA ADPCM codec
+ */
+
+#include "adpcm.h"
+
+static const int16_t step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+static const int8_t index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+/* Apply one code to the state, exactly as the decoder will */
+static void adpcm_step(struct adpcm_state *state, uint8_t code)
+{
+    int32_t step = step_table[state->index];
+    int32_t diff = step >> 3;
+
+    if (code & 4) {
+        diff += step;
+    }
+    if (code & 2) {
+        diff += step >> 1;
+    }
+    if (code & 1) {
+        diff += step >> 2;
+    }
+
+    int32_t pred = state->predictor + ((code & 8) ? -diff : diff);
+    if (pred > INT16_MAX) {
+        pred = INT16_MAX;
+    } else if (pred < INT16_MIN) {
+        pred = INT16_MIN;
+    }
+    state->predictor = (int16_t)pred;
+
+    int index = state->index + index_table[code];
+    if (index < 0) {
+        index = 0;
+    } else if (index > 88) {
+        index = 88;
+    }
+    state->index = (uint8_t)index;
+}
+
+static uint8_t adpcm_encode_sample(struct adpcm_state *state, int16_t sample)
+{
+    int32_t step = step_table[state->index];
+    int32_t diff = sample - state->predictor;
+    uint8_t code = 0;
+
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+    if (diff >= step) {
+        code |= 4;
+        diff -= step;
+    }
+    if (diff >= step >> 1) {
+        code |= 2;
+        diff -= step >> 1;
+    }
+    if (diff >= step >> 2) {
+        code |= 1;
+    }
+
+    adpcm_step(state, code);
+    return code;
+}
+
+void adpcm_init(struct adpcm_state *state)
+{
+    state->predictor = 0;
+    state->index = 0;
+}
+
+size_t adpcm_encode_block(struct adpcm_state *state, const int16_t *in, size_t samples,
+                          uint8_t *out)
+{
+    out[0] = (uint8_t)state->predictor;
+    out[1] = (uint8_t)((uint16_t)state->predictor >> 8);
+    out[2] = state->index;
+    out[3] = 0;
+
+    uint8_t *p = &out[ADPCM_BLOCK_HEADER_BYTES];
+    for (size_t i = 0; i < samples; i += 2) {
+        uint8_t lo = adpcm_encode_sample(state, in[i]);
+        uint8_t hi = (i + 1 < samples) ? adpcm_encode_sample(state, in[i + 1]) : 0;
+
+        *p++ = lo | (hi << 4);
+    }
+
+    return ADPCM_BLOCK_BYTES(samples);
+}
+
+size_t adpcm_decode_block(const uint8_t *in, size_t bytes, int16_t *out, size_t max_samples)
+{
+    struct adpcm_state state;
+    size_t n = 0;
+
+    if (bytes < ADPCM_BLOCK_HEADER_BYTES) {
+        return 0;
+    }
+
+    state.predictor = (int16_t)(in[0] | (in[1] << 8));
+    state.index = (in[2] > 88) ? 88 : in[2];
+
+    for (size_t i = ADPCM_BLOCK_HEADER_BYTES; i < bytes && n < max_samples; i++) {
+        adpcm_step(&state, in[i] & 0x0f);
+        out[n++] = state.predictor;
+        if (n < max_samples) {
+            adpcm_step(&state, in[i] >> 4);
+            out[n++] = state.predictor;
+        }
+    }
+
+    return n;
+}
+
+#if defined(CONFIG_OMI_BENCH)
+#include "bench.h"
+
+static int16_t bench_pcm[256];
+static uint8_t bench_adpcm[ADPCM_BLOCK_BYTES(256)];
+
+static void bench_adpcm_setup(void)
+{
+    struct adpcm_state state;
+
+    /* Speech-like level: a 440 Hz-ish triangle with some amplitude movement */
+    for (int i = 0; i < 256; i++) {
+        int tri = (i % 36 < 18) ? (i % 36) : (36 - i % 36);
+        bench_pcm[i] = (int16_t)((tri - 9) * (900 + i * 4));
+    }
+    adpcm_init(&state);
+    adpcm_encode_block(&state, bench_pcm, 256, bench_adpcm);
+}
+
+static void bench_adpcm_encode(void)
+{
+    struct adpcm_state state;
+
+    adpcm_init(&state);
+    bench_sink = adpcm_encode_block(&state, bench_pcm, 256, bench_adpcm);
+}
+
+static void bench_adpcm_decode(void)
+{
+    int16_t out[256];
+
+    bench_sink = adpcm_decode_block(bench_adpcm, sizeof(bench_adpcm), out, 256) + out[255];
+}
+
+BENCH_REGISTER(adpcm_encode_256, bench_adpcm_setup, bench_adpcm_encode, 64);
+BENCH_REGISTER(adpcm_decode_256, bench_adpcm_setup, bench_adpcm_decode, 64);
+#endif
@@ -0,0 +1,49 @@
+/*
+ * IMA ADPCM codec
+ * 4 bits per sample (4:1 over 16-bit PCM). Each encoded block starts with
+ * the predictor state so blocks can be decoded independently, which lets
+ * recordings and flash assets be read from any block boundary.
+ */
+
+#ifndef ADPCM_H
+#define ADPCM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Block header: int16 predictor (LE), uint8 step index, uint8 reserved */
+#define ADPCM_BLOCK_HEADER_BYTES  4
+#define ADPCM_BLOCK_BYTES(samples) (ADPCM_BLOCK_HEADER_BYTES + ((samples) + 1) / 2)
+
+struct adpcm_state {
+    int16_t predictor;
+    uint8_t index;
+};
+
+/**
+ * @brief Reset an encoder state to silence
+ */
+void adpcm_init(struct adpcm_state *state);
+
+/**
+ * @brief Encode one block of samples
+ * @param state Encoder state, carried from the previous block
+ * @param in PCM samples
+ * @param samples Number of samples
+ * @param out Destination of ADPCM_BLOCK_BYTES(samples) bytes
+ * @return Number of bytes written
+ */
+size_t adpcm_encode_block(struct adpcm_state *state, const int16_t *in, size_t samples,
+                          uint8_t *out);
+
+/**
+ * @brief Decode one block produced by adpcm_encode_block()
+ * @param in Encoded block including its header
+ * @param bytes Size of the encoded block
+ * @param out Destination for up to max_samples samples
+ * @param max_samples Capacity of out
+ * @return Number of samples decoded
+ */
+size_t adpcm_decode_block(const uint8_t *in, size_t bytes, int16_t *out, size_t max_samples);
+
+#endif /* ADPCM_H */
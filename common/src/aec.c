@@ -0,0 +1,169 @@
+/*
+ * Acoustic echo suppression (NLMS)
+ */
+
+#include "aec.h"
+#include "cycle_counter.h"
+
+#include <zephyr/sys/util.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Adaptation step: 0.5 in Q15 converges in well under a second of speech */
+#define AEC_MU_Q15          16384
+/* Regularisation so quiet references do not blow up the step */
+#define AEC_DELTA           ((int64_t)AEC_TAPS * 64 * 64)
+
+static uint32_t ilog2_64(uint64_t v)
+{
+    uint32_t r = 0;
+
+    while (v >>= 1) {
+        r++;
+    }
+    return r;
+}
+
+void aec_init(struct aec *aec)
+{
+    memset(aec, 0, sizeof(*aec));
+    aec->mu_q15 = AEC_MU_Q15;
+}
+
+void aec_process(struct aec *aec, int16_t *mic, const int16_t *ref, size_t n)
+{
+    uint32_t start = cycle_counter_get();
+    uint64_t mic_energy = 0;
+    uint64_t err_energy = 0;
+    int16_t ref_peak = 0;
+    int16_t mic_peak = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        ref_peak = MAX(ref_peak, (int16_t)MIN(abs(ref[i]), INT16_MAX));
+        mic_peak = MAX(mic_peak, (int16_t)MIN(abs(mic[i]), INT16_MAX));
+    }
+
+    /* Nothing playing and nothing left in the window: no echo to remove */
+    int16_t far_peak = MAX(ref_peak, aec->ref_peak_prev);
+    if (far_peak == 0 && aec->energy == 0) {
+        aec->stats.blocks++;
+        aec->stats.erle_db = 0;
+        return;
+    }
+
+    /* Geigel: near end louder than 3/4 of the recent far-end peak is double talk */
+    bool adapt = (far_peak > 0) && (mic_peak < far_peak / 2 + far_peak / 4);
+    aec->ref_peak_prev = ref_peak;
+
+    for (size_t i = 0; i < n; i++) {
+        /* Slide the window: drop the oldest sample, add the newest */
+        int16_t oldest = aec->x[aec->pos];
+
+        aec->energy += (int32_t)ref[i] * ref[i] - (int32_t)oldest * oldest;
+        aec->x[aec->pos] = ref[i];
+        aec->x[aec->pos + AEC_TAPS] = ref[i];
+        aec->pos = (aec->pos + 1) % AEC_TAPS;
+
+        /* x[pos .. pos+TAPS) is oldest..newest; w[0] pairs with the newest */
+        const int16_t *xw = &aec->x[aec->pos];
+        int64_t acc = 0;
+
+        for (int k = 0; k < AEC_TAPS; k++) {
+            acc += (int64_t)aec->w[k] * xw[AEC_TAPS - 1 - k];
+        }
+
+        int32_t echo = (int32_t)(acc >> 30);
+        int32_t e = CLAMP((int32_t)mic[i] - echo, INT16_MIN, INT16_MAX);
+
+        mic_energy += (int32_t)mic[i] * mic[i];
+        err_energy += e * e;
+        mic[i] = (int16_t)e;
+
+        if (adapt) {
+            int64_t g = (((int64_t)aec->mu_q15 * e) << 15) / (aec->energy + AEC_DELTA);
+
+            /* Against a quiet reference g * x exceeds 32 bits: the
+             * weight update saturates instead of wrapping */
+            for (int k = 0; k < AEC_TAPS; k++) {
+                int64_t w = aec->w[k] + g * xw[AEC_TAPS - 1 - k];
+
+                aec->w[k] = (int32_t)CLAMP(w, INT32_MIN, INT32_MAX);
+            }
+        }
+    }
+
+    aec->stats.blocks++;
+    if (!adapt) {
+        aec->stats.double_talk_blocks++;
+    }
+    /* ERLE in dB, 3 dB per power of two */
+    aec->stats.erle_db = 3 * ((int32_t)ilog2_64(mic_energy + 1) -
+                              (int32_t)ilog2_64(err_energy + 1));
+
+    uint32_t us = cycle_counter_to_ns(cycle_counter_get() - start) / 1000U;
+    aec->stats.max_block_us = MAX(aec->stats.max_block_us, us);
+    if (us > CONFIG_OMI_AEC_BUDGET_US) {
+        aec->stats.over_budget++;
+    }
+}
+
+#if defined(CONFIG_OMI_BENCH)
+#include "bench.h"
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(aec, CONFIG_LOG_DEFAULT_LEVEL);
+
+/* Synthetic echo: white-ish far end through a short decaying path */
+#define BENCH_AEC_BLOCK     256
+#define BENCH_AEC_WARMUP    125     // 2 s at 16 kHz
+
+static struct aec bench_aec;
+static int16_t bench_ref[BENCH_AEC_BLOCK];
+static int16_t bench_mic[BENCH_AEC_BLOCK];
+static int16_t bench_hist[8];
+static uint32_t bench_seed = 1;
+
+static void bench_aec_make_block(void)
+{
+    static const int16_t path_q15[8] = { 0, 9830, -6554, 4915, -3277, 1638, -819, 410 };
+
+    for (int i = 0; i < BENCH_AEC_BLOCK; i++) {
+        bench_seed = bench_seed * 1103515245U + 12345U;
+        int16_t x = (int16_t)((int32_t)(bench_seed >> 16) - 32768) / 4;
+        int32_t echo = 0;
+
+        memmove(&bench_hist[1], &bench_hist[0], 7 * sizeof(int16_t));
+        bench_hist[0] = x;
+        for (int k = 0; k < 8; k++) {
+            echo += ((int32_t)path_q15[k] * bench_hist[k]) >> 15;
+        }
+        bench_ref[i] = x;
+        bench_mic[i] = (int16_t)echo;
+    }
+}
+
+static void bench_aec_setup(void)
+{
+    aec_init(&bench_aec);
+    for (int b = 0; b < BENCH_AEC_WARMUP; b++) {
+        bench_aec_make_block();
+        aec_process(&bench_aec, bench_mic, bench_ref, BENCH_AEC_BLOCK);
+    }
+    LOG_INF("Synthetic echo ERLE after 2 s: %d dB", bench_aec.stats.erle_db);
+    bench_aec_make_block();
+}
+
+/* Steady-state cost of one block, including the copy of the mic block */
+static void bench_aec_block(void)
+{
+    int16_t mic[BENCH_AEC_BLOCK];
+
+    memcpy(mic, bench_mic, sizeof(mic));
+    aec_process(&bench_aec, mic, bench_ref, BENCH_AEC_BLOCK);
+    bench_sink = mic[BENCH_AEC_BLOCK - 1];
+}
+
+BENCH_REGISTER(aec_block_256, bench_aec_setup, bench_aec_block, 32);
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Acoustic echo suppression
+ * Fixed-point NLMS canceller: the speaker output (reference) is filtered
+ * by an adaptive estimate of the speaker-to-microphone path and
+ * subtracted from the microphone signal. A Geigel-style detector holds
+ * adaptation while the near end talks over the prompt.
+ *
+ * Cost per sample is 2 * CONFIG_OMI_AEC_TAPS multiply-accumulates plus
+ * one division. With the default 64 taps a 256-sample block is about
+ * 40k cycles on a Cortex-M4F, around 4% of a 16 ms block at 64 MHz.
+ * The per-block budget is CONFIG_OMI_AEC_BUDGET_US; blocks over it are
+ * counted in the stats.
+ */
+
+#ifndef AEC_H
+#define AEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AEC_TAPS CONFIG_OMI_AEC_TAPS
+
+struct aec_stats {
+    uint32_t blocks;
+    uint32_t double_talk_blocks;    /* blocks with adaptation held */
+    uint32_t over_budget;           /* blocks over CONFIG_OMI_AEC_BUDGET_US */
+    uint32_t max_block_us;
+    int32_t erle_db;                /* echo return loss enhancement, last block */
+};
+
+struct aec {
+    int32_t w[AEC_TAPS];            /* path estimate, Q30 */
+    int16_t x[2 * AEC_TAPS];        /* reference history, mirrored for a contiguous window */
+    uint16_t pos;
+    int64_t energy;                 /* sum of x^2 over the window */
+    int16_t ref_peak_prev;          /* previous block's reference peak */
+    uint16_t mu_q15;
+    struct aec_stats stats;
+};
+
+/**
+ * @brief Reset the canceller (zero path estimate and history)
+ */
+void aec_init(struct aec *aec);
+
+/**
+ * @brief Remove the echo of ref from mic, in place
+ * @param aec Canceller state
+ * @param mic Microphone block, replaced by the echo-cancelled signal
+ * @param ref Speaker output aligned with mic (same length)
+ * @param n Samples in the block
+ */
+void aec_process(struct aec *aec, int16_t *mic, const int16_t *ref, size_t n);
+
+#endif /* AEC_H */
@@ -0,0 +1,221 @@
+/*
+ * Flash sound asset bank
+ */
+
+#include "asset_bank.h"
+#include "adpcm.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(asset_bank, CONFIG_LOG_DEFAULT_LEVEL);
+
+/* Layout written by scripts/mkassets.py, little endian */
+#define BANK_MAGIC          0x41494D4FU     /* "OMIA" */
+#define BANK_VERSION        1
+#define BANK_HEADER_BYTES   8
+#define BANK_ENTRY_BYTES    32
+
+#define ENTRY_ID            0
+#define ENTRY_CODEC         2
+#define ENTRY_BLOCK_SAMPLES 4
+#define ENTRY_RATE          6
+#define ENTRY_SAMPLES       8
+#define ENTRY_OFFSET        12
+#define ENTRY_SIZE          16
+#define ENTRY_NAME          20
+
+/* Generated from common/assets/ by scripts/mkassets.py: asset_bank_blob[] */
+#include "omi_assets.inc"
+
+/* 0 = not checked yet, 1 = valid, -1 = rejected */
+static atomic_t bank_state;
+
+static size_t block_bytes(const struct asset *asset, uint32_t samples)
+{
+    return (asset->codec == ASSET_CODEC_ADPCM) ? ADPCM_BLOCK_BYTES(samples)
+                                               : samples * sizeof(int16_t);
+}
+
+/* Payload size implied by the sample count, to catch a mismatched index */
+static size_t payload_bytes(const struct asset *asset)
+{
+    uint32_t full = asset->samples / asset->block_samples;
+    uint32_t rest = asset->samples % asset->block_samples;
+
+    return full * block_bytes(asset, asset->block_samples) +
+           (rest ? block_bytes(asset, rest) : 0);
+}
+
+static void parse_entry(size_t index, struct asset *out)
+{
+    const uint8_t *e = &asset_bank_blob[BANK_HEADER_BYTES + index * BANK_ENTRY_BYTES];
+
+    out->id = sys_get_le16(&e[ENTRY_ID]);
+    out->codec = e[ENTRY_CODEC];
+    out->block_samples = sys_get_le16(&e[ENTRY_BLOCK_SAMPLES]);
+    out->samples = sys_get_le32(&e[ENTRY_SAMPLES]);
+    out->data = asset_bank_blob + sys_get_le32(&e[ENTRY_OFFSET]);
+    out->size = sys_get_le32(&e[ENTRY_SIZE]);
+    memcpy(out->name, &e[ENTRY_NAME], ASSET_NAME_MAX);
+    out->name[ASSET_NAME_MAX] = '\0';
+}
+
+static int check_entry(size_t index)
+{
+    const uint8_t *e = &asset_bank_blob[BANK_HEADER_BYTES + index * BANK_ENTRY_BYTES];
+    uint32_t offset = sys_get_le32(&e[ENTRY_OFFSET]);
+    struct asset asset;
+
+    parse_entry(index, &asset);
+    if (asset.codec > ASSET_CODEC_ADPCM || asset.block_samples == 0 ||
+        asset.block_samples > ASSET_BLOCK_SAMPLES_MAX ||
+        sys_get_le16(&e[ENTRY_RATE]) != ASSET_SAMPLE_RATE) {
+        return -ENOTSUP;
+    }
+    if (offset > sizeof(asset_bank_blob) || asset.size > sizeof(asset_bank_blob) - offset ||
+        asset.size != payload_bytes(&asset)) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/* Validate the header and index once; payloads are trusted after that */
+static bool bank_valid(void)
+{
+    atomic_val_t state = atomic_get(&bank_state);
+
+    if (state != 0) {
+        return state > 0;
+    }
+
+    uint16_t count = sys_get_le16(&asset_bank_blob[6]);
+    int ret = 0;
+
+    if (sys_get_le32(&asset_bank_blob[0]) != BANK_MAGIC ||
+        sys_get_le16(&asset_bank_blob[4]) != BANK_VERSION ||
+        BANK_HEADER_BYTES + (size_t)count * BANK_ENTRY_BYTES > sizeof(asset_bank_blob)) {
+        ret = -EINVAL;
+    }
+    for (size_t i = 0; ret == 0 && i < count; i++) {
+        ret = check_entry(i);
+        if (ret != 0) {
+            LOG_ERR("Asset %zu: bad index entry (%d)", i, ret);
+        }
+    }
+    if (ret != 0) {
+        LOG_ERR("Asset bank rejected (%d)", ret);
+    }
+
+    atomic_set(&bank_state, (ret == 0) ? 1 : -1);
+    return ret == 0;
+}
+
+size_t asset_count(void)
+{
+    return bank_valid() ? sys_get_le16(&asset_bank_blob[6]) : 0;
+}
+
+int asset_at(size_t index, struct asset *out)
+{
+    if (index >= asset_count()) {
+        return -ENOENT;
+    }
+    parse_entry(index, out);
+    return 0;
+}
+
+int asset_find(const char *name, struct asset *out)
+{
+    size_t count = asset_count();
+
+    for (size_t i = 0; i < count; i++) {
+        parse_entry(i, out);
+        if (strcmp(out->name, name) == 0) {
+            return 0;
+        }
+    }
+    return -ENOENT;
+}
+
+int asset_get(uint16_t id, struct asset *out)
+{
+    size_t count = asset_count();
+
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *e = &asset_bank_blob[BANK_HEADER_BYTES + i * BANK_ENTRY_BYTES];
+
+        if (sys_get_le16(&e[ENTRY_ID]) == id) {
+            parse_entry(i, out);
+            return 0;
+        }
+    }
+    return -ENOENT;
+}
+
+void asset_stream_open(struct asset_stream *stream, const struct asset *asset)
+{
+    stream->asset = *asset;
+    stream->block = 0;
+    stream->pos = 0;
+}
+
+void asset_stream_seek(struct asset_stream *stream, uint32_t sample)
+{
+    sample = MIN(sample, stream->asset.samples);
+    stream->block = sample / stream->asset.block_samples;
+    stream->pos = stream->block * stream->asset.block_samples;
+}
+
+size_t asset_stream_read(struct asset_stream *stream, int16_t *out, size_t max_samples)
+{
+    const struct asset *asset = &stream->asset;
+    uint32_t n = MIN(asset->block_samples, asset->samples - stream->pos);
+
+    if (asset_stream_done(stream)) {
+        return 0;
+    }
+    __ASSERT(max_samples >= n, "output smaller than an asset block");
+    n = MIN(n, max_samples);
+
+    /* Every block but the last is full, so block N sits at a fixed stride */
+    const uint8_t *in = asset->data + stream->block * block_bytes(asset, asset->block_samples);
+
+    if (asset->codec == ASSET_CODEC_ADPCM) {
+        n = adpcm_decode_block(in, block_bytes(asset, n), out, n);
+    } else {
+        memcpy(out, in, n * sizeof(int16_t));
+    }
+
+    stream->block++;
+    stream->pos += n;
+    return n;
+}
+
+#if defined(CONFIG_OMI_BENCH)
+#include "bench.h"
+
+static struct asset_stream bench_stream;
+static int16_t bench_out[ASSET_BLOCK_SAMPLES_MAX];
+
+static void bench_asset_setup(void)
+{
+    struct asset asset;
+
+    if (asset_at(0, &asset) == 0) {
+        asset_stream_open(&bench_stream, &asset);
+    }
+}
+
+static void bench_asset_read(void)
+{
+    if (asset_stream_read(&bench_stream, bench_out, ARRAY_SIZE(bench_out)) == 0 &&
+        bench_stream.asset.samples > 0) {
+        asset_stream_seek(&bench_stream, 0);
+    }
+}
+
+BENCH_REGISTER(asset_read_256, bench_asset_setup, bench_asset_read, 64);
+#endif
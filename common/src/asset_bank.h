@@ -0,0 +1,88 @@
+/*
+ * Flash sound asset bank
+ * Voice prompts and other recorded sounds, built by scripts/mkassets.py
+ * from common/assets/assets.txt and linked into flash as one const blob:
+ * a header, an index of (id, codec, length, offset) entries and the
+ * payloads. Payloads are IMA ADPCM blocks that decode independently, so
+ * a stream reads straight from flash one block at a time and needs no
+ * RAM beyond the caller's output block.
+ */
+
+#ifndef ASSET_BANK_H
+#define ASSET_BANK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ASSET_SAMPLE_RATE       16000
+#define ASSET_NAME_MAX          12
+#define ASSET_BLOCK_SAMPLES_MAX 256
+
+enum asset_codec {
+    ASSET_CODEC_PCM16,
+    ASSET_CODEC_ADPCM,
+};
+
+struct asset {
+    uint16_t id;
+    uint8_t codec;
+    uint16_t block_samples;         /* samples per independently decodable block */
+    uint32_t samples;
+    const uint8_t *data;            /* payload in flash */
+    uint32_t size;
+    char name[ASSET_NAME_MAX + 1];
+};
+
+struct asset_stream {
+    struct asset asset;
+    uint32_t block;                 /* next block to decode */
+    uint32_t pos;                   /* samples produced so far */
+};
+
+/**
+ * @brief Number of assets in the bank, 0 if the bank is invalid
+ */
+size_t asset_count(void);
+
+/**
+ * @brief Asset by index
+ * @return 0, -ENOENT past the end
+ */
+int asset_at(size_t index, struct asset *out);
+
+/**
+ * @brief Look up an asset by name
+ * @return 0, -ENOENT if there is no such asset
+ */
+int asset_find(const char *name, struct asset *out);
+
+/**
+ * @brief Look up an asset by id
+ * @return 0, -ENOENT if there is no such asset
+ */
+int asset_get(uint16_t id, struct asset *out);
+
+/**
+ * @brief Start streaming an asset from its first sample
+ */
+void asset_stream_open(struct asset_stream *stream, const struct asset *asset);
+
+/**
+ * @brief Position a stream at a sample, rounded down to a block boundary
+ */
+void asset_stream_seek(struct asset_stream *stream, uint32_t sample);
+
+/**
+ * @brief Decode the next block straight from flash
+ * @param out Destination, at least asset.block_samples samples
+ * @return Samples written, 0 at the end of the asset
+ */
+size_t asset_stream_read(struct asset_stream *stream, int16_t *out, size_t max_samples);
+
+static inline bool asset_stream_done(const struct asset_stream *stream)
+{
+    return stream->pos >= stream->asset.samples;
+}
+
+#endif /* ASSET_BANK_H */
@@ -0,0 +1,53 @@
+/*
+ * Shared audio block pool
+ */
+
+#include "audio_pool.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(audio_pool, CONFIG_LOG_DEFAULT_LEVEL);
+
+K_MEM_SLAB_DEFINE_STATIC(audio_pool_slab, sizeof(struct audio_block),
+                         CONFIG_OMI_AUDIO_POOL_BLOCKS, 4);
+
+static atomic_t min_free = ATOMIC_INIT(CONFIG_OMI_AUDIO_POOL_BLOCKS);
+
+struct audio_block *audio_pool_alloc(k_timeout_t timeout)
+{
+    struct audio_block *block;
+
+    if (k_mem_slab_alloc(&audio_pool_slab, (void **)&block, timeout) != 0) {
+        return NULL;
+    }
+
+    block->samples = 0;
+    block->flags = 0;
+
+    /* Track the low-water mark to size CONFIG_OMI_AUDIO_POOL_BLOCKS */
+    atomic_val_t free_now = k_mem_slab_num_free_get(&audio_pool_slab);
+    atomic_val_t seen = atomic_get(&min_free);
+    while (free_now < seen && !atomic_cas(&min_free, seen, free_now)) {
+        seen = atomic_get(&min_free);
+    }
+
+    return block;
+}
+
+void audio_pool_free(struct audio_block *block)
+{
+    if (block != NULL) {
+        k_mem_slab_free(&audio_pool_slab, block);
+    }
+}
+
+uint32_t audio_pool_free_count(void)
+{
+    return k_mem_slab_num_free_get(&audio_pool_slab);
+}
+
+uint32_t audio_pool_min_free(void)
+{
+    return (uint32_t)atomic_get(&min_free);
+}
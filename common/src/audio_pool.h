@@ -0,0 +1,51 @@
+/*
+ * Shared audio block pool
+ * Fixed-size blocks passed between audio producers (SD player, BLE ingest,
+ * capture) and consumers (PWM stream engine, storage writer).
+ */
+
+#ifndef AUDIO_POOL_H
+#define AUDIO_POOL_H
+
+#include <zephyr/kernel.h>
+#include <stdint.h>
+
+#define AUDIO_SAMPLE_RATE         16000
+
+/* One block is one 512-byte SD sector of 16-bit mono samples (16 ms at 16 kHz) */
+#define AUDIO_BLOCK_SAMPLES       256
+#define AUDIO_BLOCK_BYTES         (AUDIO_BLOCK_SAMPLES * sizeof(int16_t))
+
+/* Block flags */
+#define AUDIO_BLOCK_F_END         BIT(0)  // last block of a stream, no underrun after it
+
+struct audio_block {
+    void *fifo_reserved;    /* first word reserved for k_fifo */
+    uint16_t samples;       /* valid samples in data[] */
+    uint16_t flags;
+    int16_t data[AUDIO_BLOCK_SAMPLES];
+};
+
+/**
+ * @brief Allocate a block from the shared pool
+ * @param timeout How long to wait for a free block
+ * @return Block with samples and flags cleared, or NULL on timeout
+ */
+struct audio_block *audio_pool_alloc(k_timeout_t timeout);
+
+/**
+ * @brief Return a block to the shared pool
+ */
+void audio_pool_free(struct audio_block *block);
+
+/**
+ * @brief Number of blocks currently free
+ */
+uint32_t audio_pool_free_count(void);
+
+/**
+ * @brief Lowest number of free blocks seen since boot
+ */
+uint32_t audio_pool_min_free(void);
+
+#endif /* AUDIO_POOL_H */
@@ -0,0 +1,342 @@
+/*
+ * Audio stage graph
+ */
+
+#include "audio_stage.h"
+#include "cycle_counter.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(audio_stage, CONFIG_LOG_DEFAULT_LEVEL);
+
+const struct audio_stage_type *audio_stage_find(const char *name)
+{
+    STRUCT_SECTION_FOREACH(audio_stage_type, type) {
+        if (strcmp(type->name, name) == 0) {
+            return type;
+        }
+    }
+    return NULL;
+}
+
+struct audio_pipeline *audio_pipeline_find(const char *name)
+{
+    STRUCT_SECTION_FOREACH(audio_pipeline, pipeline) {
+        if (strcmp(pipeline->name, name) == 0) {
+            return pipeline;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Parse a spec, optionally building it into a pipeline
+ * @param pipeline Pipeline to build, or NULL to only validate
+ * @return 0 on success, -EINVAL on an unknown stage, -ENOMEM if it does not fit
+ */
+static int parse_spec(struct audio_pipeline *pipeline, const char *spec)
+{
+    char buf[AUDIO_PIPELINE_SPEC_LEN];
+    char *save;
+    size_t used = 0;
+    uint8_t count = 0;
+
+    if (strlen(spec) >= sizeof(buf)) {
+        return -ENOMEM;
+    }
+    strcpy(buf, spec);
+
+    for (char *tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        char *arg = strchr(tok, ':');
+
+        if (arg != NULL) {
+            *arg++ = '\0';
+        }
+
+        const struct audio_stage_type *type = audio_stage_find(tok);
+        if (type == NULL) {
+            LOG_ERR("Unknown stage '%s'", tok);
+            return -EINVAL;
+        }
+        if (arg != NULL && type->configure == NULL) {
+            LOG_ERR("Stage '%s' takes no argument", tok);
+            return -EINVAL;
+        }
+
+        size_t size = ROUND_UP(type->state_size, sizeof(uint32_t));
+        if (count == AUDIO_PIPELINE_MAX_STAGES ||
+            used + size > CONFIG_OMI_AUDIO_PIPELINE_STATE_BYTES) {
+            return -ENOMEM;
+        }
+
+        if (pipeline != NULL) {
+            struct audio_stage_slot *slot = &pipeline->stages[count];
+
+            slot->type = type;
+            slot->state = (uint8_t *)pipeline->arena + used;
+            memset(&slot->stats, 0, sizeof(slot->stats));
+            type->reset(slot->state);
+            if (arg != NULL && type->configure(slot->state, strtol(arg, NULL, 0)) != 0) {
+                LOG_WRN("Stage '%s' rejected argument '%s', using defaults", tok, arg);
+            }
+            if (type->set_quality != NULL) {
+                type->set_quality(slot->state, pipeline->quality.level);
+            }
+        }
+
+        used += size;
+        count++;
+    }
+
+    if (pipeline != NULL) {
+        pipeline->count = count;
+        pipeline->built = true;
+    }
+    return 0;
+}
+
+static void build(struct audio_pipeline *pipeline, const char *spec)
+{
+    pipeline->count = 0;
+    if (parse_spec(pipeline, spec) != 0) {
+        /* Specs are validated before they get here; pass audio through */
+        pipeline->count = 0;
+        pipeline->built = true;
+    }
+    LOG_DBG("Pipeline %s: %s (%u stages)", pipeline->name, spec, pipeline->count);
+}
+
+static void apply_quality(struct audio_pipeline *pipeline, uint8_t level)
+{
+    pipeline->quality.level = level;
+    pipeline->over_blocks = 0;
+    pipeline->under_blocks = 0;
+
+    for (uint8_t i = 0; i < pipeline->count; i++) {
+        const struct audio_stage_type *type = pipeline->stages[i].type;
+
+        if (type->set_quality != NULL) {
+            type->set_quality(pipeline->stages[i].state, level);
+        }
+    }
+}
+
+#if defined(CONFIG_OMI_AUDIO_QUALITY_SCALING)
+/*
+ * Step quality down after CONFIG_OMI_AUDIO_QUALITY_DEGRADE_BLOCKS blocks
+ * in a row over budget, and back up only after a much longer run below
+ * the (lower) restore threshold, so a borderline load does not flap.
+ */
+static void govern_quality(struct audio_pipeline *pipeline, uint32_t cost, size_t samples)
+{
+    struct audio_quality_stats *q = &pipeline->quality;
+    uint64_t period_ns = (uint64_t)samples * NSEC_PER_SEC / AUDIO_SAMPLE_RATE;
+
+    if (period_ns == 0) {
+        return;
+    }
+
+    /* 64-bit: an overloaded block of a few ms would wrap 32 bits here */
+    uint32_t load = (uint32_t)MIN((uint64_t)cycle_counter_to_ns(cost) * 1000U / period_ns,
+                                  UINT16_MAX);
+    q->load_permille = load;
+    q->peak_load_permille = MAX(q->peak_load_permille, load);
+    q->blocks_at_level[q->level]++;
+
+    if (load > CONFIG_OMI_AUDIO_QUALITY_DEGRADE_PERMILLE) {
+        pipeline->under_blocks = 0;
+        if (++pipeline->over_blocks >= CONFIG_OMI_AUDIO_QUALITY_DEGRADE_BLOCKS &&
+            q->level > AUDIO_QUALITY_MIN) {
+            q->degrade_events++;
+            LOG_WRN("%s: load %u/1000, quality %u -> %u", pipeline->name, load,
+                    q->level, q->level - 1);
+            apply_quality(pipeline, q->level - 1);
+        }
+    } else if (load < CONFIG_OMI_AUDIO_QUALITY_RESTORE_PERMILLE) {
+        pipeline->over_blocks = 0;
+        if (++pipeline->under_blocks >= CONFIG_OMI_AUDIO_QUALITY_RESTORE_BLOCKS &&
+            q->level < AUDIO_QUALITY_FULL) {
+            q->restore_events++;
+            LOG_INF("%s: headroom back, quality %u -> %u", pipeline->name,
+                    q->level, q->level + 1);
+            apply_quality(pipeline, q->level + 1);
+        }
+    } else {
+        /* Between the thresholds: hold the level, restart both runs */
+        pipeline->over_blocks = 0;
+        pipeline->under_blocks = 0;
+    }
+}
+#endif
+
+void audio_pipeline_set_quality(struct audio_pipeline *pipeline, uint8_t level)
+{
+    /* Stage state belongs to the processing thread: only record the request */
+    atomic_set(&pipeline->quality_request, MIN(level, AUDIO_QUALITY_FULL) + 1);
+}
+
+void audio_pipeline_process(struct audio_pipeline *pipeline, struct audio_block *block)
+{
+    uint32_t total = 0;
+    atomic_val_t quality = atomic_set(&pipeline->quality_request, 0);
+
+    if (quality != 0) {
+        apply_quality(pipeline, quality - 1);
+    }
+
+    if (atomic_cas(&pipeline->rebuild, AUDIO_PIPELINE_REBUILD_PENDING,
+                   AUDIO_PIPELINE_REBUILD_APPLYING)) {
+        build(pipeline, pipeline->pending_spec);
+        atomic_set(&pipeline->rebuild, AUDIO_PIPELINE_REBUILD_IDLE);
+    } else if (!pipeline->built) {
+        build(pipeline, pipeline->default_spec);
+    }
+
+    for (uint8_t i = 0; i < pipeline->count; i++) {
+        struct audio_stage_slot *slot = &pipeline->stages[i];
+        uint32_t start = cycle_counter_get();
+
+        slot->type->process(slot->state, block->data, block->samples);
+
+        uint32_t cost = cycle_counter_get() - start;
+        slot->stats.blocks++;
+        slot->stats.total += cost;
+        slot->stats.max = MAX(slot->stats.max, cost);
+        total += cost;
+    }
+
+#if defined(CONFIG_OMI_AUDIO_QUALITY_SCALING)
+    govern_quality(pipeline, total, block->samples);
+#else
+    ARG_UNUSED(total);
+#endif
+}
+
+int audio_pipeline_set(struct audio_pipeline *pipeline, const char *spec)
+{
+    int ret = parse_spec(NULL, spec);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (!atomic_cas(&pipeline->rebuild, AUDIO_PIPELINE_REBUILD_IDLE,
+                    AUDIO_PIPELINE_REBUILD_WRITING)) {
+        return -EBUSY;
+    }
+    strcpy(pipeline->pending_spec, spec);
+    atomic_set(&pipeline->rebuild, AUDIO_PIPELINE_REBUILD_PENDING);
+    return 0;
+}
+
+uint32_t audio_pipeline_latency(const struct audio_pipeline *pipeline)
+{
+    uint32_t latency = 0;
+
+    for (uint8_t i = 0; i < pipeline->count; i++) {
+        latency += pipeline->stages[i].type->latency;
+    }
+    return latency;
+}
+
+/* Shell Commands */
+
+#if defined(CONFIG_SHELL)
+static int cmd_pipeline_list(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    shell_print(shell, "Stage types:");
+    STRUCT_SECTION_FOREACH(audio_stage_type, type) {
+        shell_print(shell, "  %-12s state %u B, latency %u%s", type->name,
+                    (uint32_t)type->state_size, type->latency,
+                    type->configure ? ", takes :arg" : "");
+    }
+
+    shell_print(shell, "Pipelines:");
+    STRUCT_SECTION_FOREACH(audio_pipeline, pipeline) {
+        shell_print(shell, "  %-12s default \"%s\"%s", pipeline->name, pipeline->default_spec,
+                    pipeline->built ? "" : " (not built yet)");
+    }
+    return 0;
+}
+
+static int cmd_pipeline_show(const struct shell *shell, size_t argc, const char **argv)
+{
+    struct audio_pipeline *pipeline = audio_pipeline_find(argv[1]);
+    if (pipeline == NULL) {
+        shell_error(shell, "No pipeline '%s'", argv[1]);
+        return -ENOENT;
+    }
+
+    const struct audio_quality_stats *q = &pipeline->quality;
+
+    shell_print(shell, "%s: %u stages, %u samples latency (costs in %s)", pipeline->name,
+                pipeline->count, audio_pipeline_latency(pipeline), cycle_counter_unit());
+    shell_print(shell, "  quality %u, load %u/1000 (peak %u), %u degrades, %u restores",
+                q->level, q->load_permille, q->peak_load_permille, q->degrade_events,
+                q->restore_events);
+    shell_print(shell, "  blocks at quality 0/1/2: %u/%u/%u", q->blocks_at_level[0],
+                q->blocks_at_level[1], q->blocks_at_level[2]);
+    for (uint8_t i = 0; i < pipeline->count; i++) {
+        const struct audio_stage_slot *slot = &pipeline->stages[i];
+        uint32_t avg = slot->stats.blocks ? (uint32_t)(slot->stats.total / slot->stats.blocks) : 0;
+
+        shell_print(shell, "  %u %-12s blocks=%-8u avg=%-8u max=%u", i, slot->type->name,
+                    slot->stats.blocks, avg, slot->stats.max);
+    }
+    return 0;
+}
+
+static int cmd_pipeline_set(const struct shell *shell, size_t argc, const char **argv)
+{
+    struct audio_pipeline *pipeline = audio_pipeline_find(argv[1]);
+    if (pipeline == NULL) {
+        shell_error(shell, "No pipeline '%s'", argv[1]);
+        return -ENOENT;
+    }
+
+    /* An empty spec ("") is a pass-through pipeline */
+    int ret = audio_pipeline_set(pipeline, argv[2]);
+    if (ret) {
+        shell_error(shell, "Invalid spec '%s': %d", argv[2], ret);
+        return ret;
+    }
+    shell_print(shell, "%s will use \"%s\" from its next block", pipeline->name, argv[2]);
+    return 0;
+}
+
+static int cmd_pipeline_quality(const struct shell *shell, size_t argc, const char **argv)
+{
+    struct audio_pipeline *pipeline = audio_pipeline_find(argv[1]);
+    if (pipeline == NULL) {
+        shell_error(shell, "No pipeline '%s'", argv[1]);
+        return -ENOENT;
+    }
+
+    uint32_t level = strtoul(argv[2], NULL, 10);
+    if (level > AUDIO_QUALITY_FULL) {
+        shell_error(shell, "Quality is 0..%d", AUDIO_QUALITY_FULL);
+        return -EINVAL;
+    }
+    audio_pipeline_set_quality(pipeline, level);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(pipeline_cmd,
+    SHELL_CMD(list, NULL, "List stage types and pipelines", cmd_pipeline_list),
+    SHELL_CMD_ARG(show, NULL, "Show a pipeline's stages and costs: show <name>",
+                  cmd_pipeline_show, 2, 0),
+    SHELL_CMD_ARG(set, NULL, "Rebuild a pipeline: set <name> <stage[:arg],...>",
+                  cmd_pipeline_set, 3, 0),
+    SHELL_CMD_ARG(quality, NULL, "Force a quality level: quality <name> <0-2>",
+                  cmd_pipeline_quality, 3, 0),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(pipeline, &pipeline_cmd, "Audio stage pipeline commands", NULL);
+#endif /* CONFIG_SHELL */
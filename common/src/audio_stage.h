@@ -0,0 +1,176 @@
+/*
+ * Audio stage graph
+ * A pipeline is a chain of in-place, block-based stages (filters, gain,
+ * limiter, ...). Stage types register themselves with
+ * AUDIO_STAGE_REGISTER(); pipelines are declared per use case with
+ * AUDIO_PIPELINE_DEFINE() and a default spec such as "dcblock,limiter",
+ * and can be rebuilt from the shell ("pipeline set <name> <spec>").
+ * Every stage's cost is measured on each block.
+ *
+ * Quality scaling: stages that can trade quality for cycles provide
+ * set_quality(). When a pipeline's processing time stays above its
+ * budget share of the block period, its quality level drops one step;
+ * it is restored after a longer stretch with headroom (hysteresis).
+ */
+
+#ifndef AUDIO_STAGE_H
+#define AUDIO_STAGE_H
+
+#include "audio_pool.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/iterable_sections.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AUDIO_PIPELINE_MAX_STAGES   CONFIG_OMI_AUDIO_PIPELINE_MAX_STAGES
+#define AUDIO_PIPELINE_SPEC_LEN     64
+
+/* Quality levels, applied to every scalable stage of a pipeline */
+#define AUDIO_QUALITY_MIN           0
+#define AUDIO_QUALITY_REDUCED       1
+#define AUDIO_QUALITY_FULL          2
+#define AUDIO_QUALITY_LEVELS        3
+
+/* Stage type descriptor, placed in ROM by AUDIO_STAGE_REGISTER() */
+struct audio_stage_type {
+    const char *name;
+    size_t state_size;
+    uint16_t latency;                               /* samples of delay added */
+    void (*reset)(void *state);                     /* set defaults, clear history */
+    int (*configure)(void *state, int32_t arg);     /* optional ":arg" from the spec */
+    void (*process)(void *state, int16_t *buf, size_t n);   /* in place */
+    void (*set_quality)(void *state, uint8_t level);        /* optional, AUDIO_QUALITY_* */
+};
+
+/**
+ * @brief Register a stage type
+ * @param _name Name used in pipeline specs
+ * @param _state Type of the per-instance state
+ * @param _latency Samples of delay the stage adds
+ * @param _reset Reset function
+ * @param _configure Optional argument parser (may be NULL)
+ * @param _process Block processing function
+ */
+#define AUDIO_STAGE_REGISTER(_name, _state, _latency, _reset, _configure, _process)   \
+    AUDIO_STAGE_REGISTER_SCALABLE(_name, _state, _latency, _reset, _configure,        \
+                                  _process, NULL)
+
+/**
+ * @brief Register a stage type that can run at reduced quality under load
+ * @param _set_quality Called with AUDIO_QUALITY_* whenever the level changes
+ */
+#define AUDIO_STAGE_REGISTER_SCALABLE(_name, _state, _latency, _reset, _configure,    \
+                                      _process, _set_quality)                         \
+    STRUCT_SECTION_ITERABLE(audio_stage_type, audio_stage_##_name) = {                \
+        .name = #_name,                                                               \
+        .state_size = sizeof(_state),                                                 \
+        .latency = _latency,                                                          \
+        .reset = _reset,                                                              \
+        .configure = _configure,                                                      \
+        .process = _process,                                                          \
+        .set_quality = _set_quality,                                                  \
+    }
+
+/* Per-stage cost, in cycle_counter_unit() ticks */
+struct audio_stage_stats {
+    uint32_t blocks;
+    uint32_t max;
+    uint64_t total;
+};
+
+struct audio_stage_slot {
+    const struct audio_stage_type *type;
+    void *state;
+    struct audio_stage_stats stats;
+};
+
+/* Rebuild hand-off states */
+#define AUDIO_PIPELINE_REBUILD_IDLE     0
+#define AUDIO_PIPELINE_REBUILD_WRITING  1
+#define AUDIO_PIPELINE_REBUILD_PENDING  2
+#define AUDIO_PIPELINE_REBUILD_APPLYING 3
+
+/* Load governor state and counters */
+struct audio_quality_stats {
+    uint8_t level;                  /* current AUDIO_QUALITY_* */
+    uint16_t load_permille;         /* last block: processing time / block period */
+    uint16_t peak_load_permille;
+    uint32_t degrade_events;
+    uint32_t restore_events;
+    uint32_t blocks_at_level[AUDIO_QUALITY_LEVELS];
+};
+
+struct audio_pipeline {
+    const char *name;
+    const char *default_spec;
+    /* built state */
+    bool built;
+    uint8_t count;
+    uint16_t over_blocks;           /* consecutive blocks over budget */
+    uint16_t under_blocks;          /* consecutive blocks under the restore threshold */
+    struct audio_quality_stats quality;
+    struct audio_stage_slot stages[AUDIO_PIPELINE_MAX_STAGES];
+    uint32_t arena[CONFIG_OMI_AUDIO_PIPELINE_STATE_BYTES / sizeof(uint32_t)];
+    /* rebuild requested from another thread, applied by the processing thread */
+    atomic_t rebuild;       /* AUDIO_PIPELINE_REBUILD_* */
+    atomic_t quality_request;   /* forced AUDIO_QUALITY_* + 1, 0 if none */
+    char pending_spec[AUDIO_PIPELINE_SPEC_LEN];
+};
+
+/**
+ * @brief Declare a pipeline
+ * @param _name Identifier, also used by the shell
+ * @param _spec Default comma-separated stage list, e.g. "dcblock,gain:128,limiter"
+ */
+#define AUDIO_PIPELINE_DEFINE(_name, _spec)                             \
+    STRUCT_SECTION_ITERABLE(audio_pipeline, audio_pipeline_##_name) = { \
+        .name = #_name,                                                 \
+        .default_spec = _spec,                                          \
+        .quality = { .level = AUDIO_QUALITY_FULL },                     \
+    }
+
+/* Reference a pipeline declared with AUDIO_PIPELINE_DEFINE() in the same file */
+#define AUDIO_PIPELINE_GET(_name) (&audio_pipeline_##_name)
+
+/**
+ * @brief Run a block through a pipeline, in place
+ *
+ * Builds the pipeline on first use and applies pending rebuilds, so only
+ * the thread that owns the pipeline ever touches its stage state.
+ */
+void audio_pipeline_process(struct audio_pipeline *pipeline, struct audio_block *block);
+
+/**
+ * @brief Request a new stage list; applied before the next block
+ * @param pipeline Pipeline to change
+ * @param spec Comma-separated stage list
+ * @return 0 on success, -EINVAL for an unknown stage or an argument to a
+ *         stage that takes none, -ENOMEM if the spec is too long or its
+ *         stages do not fit, -EBUSY if another change is being queued
+ */
+int audio_pipeline_set(struct audio_pipeline *pipeline, const char *spec);
+
+/**
+ * @brief Force a quality level (e.g. from the shell); the governor keeps running
+ */
+void audio_pipeline_set_quality(struct audio_pipeline *pipeline, uint8_t level);
+
+/**
+ * @brief Total latency of a built pipeline in samples
+ */
+uint32_t audio_pipeline_latency(const struct audio_pipeline *pipeline);
+
+/**
+ * @brief Find a pipeline by name
+ * @return Pipeline or NULL if not found
+ */
+struct audio_pipeline *audio_pipeline_find(const char *name);
+
+/**
+ * @brief Find a stage type by name
+ * @return Stage type or NULL if not found
+ */
+const struct audio_stage_type *audio_stage_find(const char *name);
+
+#endif /* AUDIO_STAGE_H */
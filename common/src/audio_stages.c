@@ -0,0 +1,278 @@
+/*
+ * Built-in audio stages
+ */
+
+#include "audio_stage.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <stdlib.h>
+
+/* gain[:q8] - fixed gain, 256 = 0 dB */
+struct gain_state {
+    int32_t gain_q8;
+};
+
+static void gain_reset(void *state)
+{
+    ((struct gain_state *)state)->gain_q8 = 256;
+}
+
+static int gain_configure(void *state, int32_t arg)
+{
+    if (arg < 0 || arg > 4096) {
+        return -EINVAL;
+    }
+    ((struct gain_state *)state)->gain_q8 = arg;
+    return 0;
+}
+
+static void gain_process(void *state, int16_t *buf, size_t n)
+{
+    int32_t g = ((struct gain_state *)state)->gain_q8;
+
+    for (size_t i = 0; i < n; i++) {
+        int32_t v = (buf[i] * g) >> 8;
+        buf[i] = (int16_t)CLAMP(v, INT16_MIN, INT16_MAX);
+    }
+}
+
+AUDIO_STAGE_REGISTER(gain, struct gain_state, 0, gain_reset, gain_configure, gain_process);
+
+/* dcblock - one-pole high-pass (about 13 Hz at 16 kHz) */
+struct dcblock_state {
+    int32_t x1;
+    int32_t y1;     /* Q8 */
+};
+
+static void dcblock_reset(void *state)
+{
+    struct dcblock_state *s = state;
+
+    s->x1 = 0;
+    s->y1 = 0;
+}
+
+static void dcblock_process(void *state, int16_t *buf, size_t n)
+{
+    struct dcblock_state *s = state;
+
+    for (size_t i = 0; i < n; i++) {
+        int32_t x = buf[i];
+
+        /* y = x - x1 + 0.995 * y1, with y kept in Q8 for precision */
+        s->y1 = ((x - s->x1) << 8) + (int32_t)(((int64_t)s->y1 * 32604) >> 15);
+        s->x1 = x;
+        int32_t y = s->y1 >> 8;
+        buf[i] = (int16_t)CLAMP(y, INT16_MIN, INT16_MAX);
+    }
+}
+
+AUDIO_STAGE_REGISTER(dcblock, struct dcblock_state, 0, dcblock_reset, NULL, dcblock_process);
+
+/* limiter[:threshold] - instant attack, ~50 ms release, no look-ahead */
+struct limiter_state {
+    int32_t threshold;
+    int32_t gain_q15;
+};
+
+static void limiter_reset(void *state)
+{
+    struct limiter_state *s = state;
+
+    s->threshold = 28000;
+    s->gain_q15 = 32768;
+}
+
+static int limiter_configure(void *state, int32_t arg)
+{
+    if (arg < 1000 || arg > INT16_MAX) {
+        return -EINVAL;
+    }
+    ((struct limiter_state *)state)->threshold = arg;
+    return 0;
+}
+
+static void limiter_process(void *state, int16_t *buf, size_t n)
+{
+    struct limiter_state *s = state;
+
+    for (size_t i = 0; i < n; i++) {
+        int32_t mag = abs(buf[i]);
+
+        if ((mag * s->gain_q15) >> 15 > s->threshold) {
+            s->gain_q15 = (s->threshold << 15) / mag;
+        } else if (s->gain_q15 < 32768) {
+            /* Release: close 1/1024 of the gap per sample */
+            s->gain_q15 += ((32768 - s->gain_q15) >> 10) + 1;
+        }
+        buf[i] = (int16_t)((buf[i] * s->gain_q15) >> 15);
+    }
+}
+
+AUDIO_STAGE_REGISTER(limiter, struct limiter_state, 0, limiter_reset, limiter_configure,
+                     limiter_process);
+
+/* eq - 200 Hz high-pass (the speaker cannot reproduce below it) and a
+ * +4 dB presence peak at 3 kHz. Reduced quality keeps only the
+ * high-pass; minimum quality bypasses the stage. */
+struct biquad {
+    int32_t b0, b1, b2, a1, a2;     /* Q28 */
+    int32_t x1, x2, y1, y2;
+};
+
+struct eq_state {
+    struct biquad band[2];
+    uint8_t active;                 /* bands processed at the current quality */
+};
+
+static const int32_t eq_coeffs[2][5] = {
+    { 253933601, -507867201, 253933601, -507083200, 240215746 },   /* HPF 200 Hz, Q 0.707 */
+    { 310581319, -150301283, 82174861, -150301283, 124320724 },    /* peak 3 kHz, +4 dB, Q 1 */
+};
+
+static void eq_reset(void *state)
+{
+    struct eq_state *s = state;
+
+    for (int b = 0; b < 2; b++) {
+        struct biquad *q = &s->band[b];
+
+        q->b0 = eq_coeffs[b][0];
+        q->b1 = eq_coeffs[b][1];
+        q->b2 = eq_coeffs[b][2];
+        q->a1 = eq_coeffs[b][3];
+        q->a2 = eq_coeffs[b][4];
+        q->x1 = q->x2 = q->y1 = q->y2 = 0;
+    }
+    s->active = 2;
+}
+
+static void eq_set_quality(void *state, uint8_t level)
+{
+    ((struct eq_state *)state)->active = MIN(level, 2);
+}
+
+static void biquad_process(struct biquad *q, int16_t *buf, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        int32_t x = buf[i];
+        int64_t acc = (int64_t)q->b0 * x + (int64_t)q->b1 * q->x1 + (int64_t)q->b2 * q->x2 -
+                      (int64_t)q->a1 * q->y1 - (int64_t)q->a2 * q->y2;
+        int32_t y = (int32_t)CLAMP(acc >> 28, INT16_MIN, INT16_MAX);
+
+        q->x2 = q->x1;
+        q->x1 = x;
+        q->y2 = q->y1;
+        q->y1 = y;
+        buf[i] = (int16_t)y;
+    }
+}
+
+static void eq_process(void *state, int16_t *buf, size_t n)
+{
+    struct eq_state *s = state;
+
+    for (uint8_t b = 0; b < s->active; b++) {
+        biquad_process(&s->band[b], buf, n);
+    }
+}
+
+AUDIO_STAGE_REGISTER_SCALABLE(eq, struct eq_state, 0, eq_reset, NULL, eq_process,
+                              eq_set_quality);
+
+/* requant[:bits] - requantize to the output resolution (8 bits for the PWM)
+ * with error-feedback noise shaping. The shaping order follows quality:
+ * 2nd order at full, 1st order reduced, plain rounding at minimum.
+ * Pipelines run before the PWM engine's volume, which rescales and
+ * truncates again, so the shaping is exact only at full volume; below it
+ * the second truncation adds its own unshaped error. Keep it last. */
+struct requant_state {
+    uint8_t shift;
+    uint8_t order;
+    int32_t e1, e2;
+};
+
+static void requant_reset(void *state)
+{
+    struct requant_state *s = state;
+
+    s->shift = 16 - 8;
+    s->order = 2;
+    s->e1 = 0;
+    s->e2 = 0;
+}
+
+static int requant_configure(void *state, int32_t arg)
+{
+    if (arg < 4 || arg > 15) {
+        return -EINVAL;
+    }
+    ((struct requant_state *)state)->shift = 16 - arg;
+    return 0;
+}
+
+static void requant_set_quality(void *state, uint8_t level)
+{
+    struct requant_state *s = state;
+
+    s->order = level;
+    s->e1 = 0;
+    s->e2 = 0;
+}
+
+static void requant_process(void *state, int16_t *buf, size_t n)
+{
+    struct requant_state *s = state;
+    int32_t half = 1 << (s->shift - 1);
+
+    for (size_t i = 0; i < n; i++) {
+        int32_t v = buf[i];
+
+        /* Push the quantization error up in frequency: H(z) = (1 - z^-1)^order */
+        if (s->order == 1) {
+            v -= s->e1;
+        } else if (s->order == 2) {
+            v -= 2 * s->e1 - s->e2;
+        }
+
+        int32_t q = ((v + half) >> s->shift) << s->shift;
+        q = CLAMP(q, INT16_MIN, INT16_MAX - (2 * half - 1));
+
+        s->e2 = s->e1;
+        s->e1 = q - v;
+        buf[i] = (int16_t)q;
+    }
+}
+
+AUDIO_STAGE_REGISTER_SCALABLE(requant, struct requant_state, 0, requant_reset,
+                              requant_configure, requant_process, requant_set_quality);
+
+/* burn:us - busy-waits per block to emulate DSP load (testing the governor) */
+struct burn_state {
+    int32_t us;
+};
+
+static void burn_reset(void *state)
+{
+    ((struct burn_state *)state)->us = 0;
+}
+
+static int burn_configure(void *state, int32_t arg)
+{
+    if (arg < 0) {
+        return -EINVAL;
+    }
+    ((struct burn_state *)state)->us = arg;
+    return 0;
+}
+
+static void burn_process(void *state, int16_t *buf, size_t n)
+{
+    ARG_UNUSED(buf);
+    ARG_UNUSED(n);
+
+    k_busy_wait(((struct burn_state *)state)->us);
+}
+
+AUDIO_STAGE_REGISTER(burn, struct burn_state, 0, burn_reset, burn_configure, burn_process);
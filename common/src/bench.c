@@ -0,0 +1,212 @@
+/*
+ * OMI microbenchmark harness
+ * Warm-up, N-iteration timing and min/median/p99 reporting for kernels
+ * registered with BENCH_REGISTER().
+ */
+
+#include "bench.h"
+#include "cycle_counter.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(bench, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define BENCH_OVERHEAD_SAMPLES 32
+
+volatile uint32_t bench_sink;
+
+/* Per-iteration samples of the benchmark currently running */
+static uint32_t samples[CONFIG_OMI_BENCH_MAX_ITERATIONS];
+static K_MUTEX_DEFINE(bench_lock);
+
+/* Cost of the timing scaffolding itself, subtracted from every sample */
+static uint32_t timing_overhead;
+
+static void bench_empty(void)
+{
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t time_one(void (*fn)(void))
+{
+    uint32_t start = cycle_counter_get();
+    fn();
+    return cycle_counter_get() - start;
+}
+
+static void calibrate_overhead(void)
+{
+    uint32_t best = UINT32_MAX;
+
+    for (int i = 0; i < BENCH_OVERHEAD_SAMPLES; i++) {
+        uint32_t t = time_one(bench_empty);
+        if (t < best) {
+            best = t;
+        }
+    }
+    timing_overhead = best;
+}
+
+const struct bench_case *bench_find(const char *name)
+{
+    STRUCT_SECTION_FOREACH(bench_case, bench) {
+        if (strcmp(bench->name, name) == 0) {
+            return bench;
+        }
+    }
+    return NULL;
+}
+
+int bench_run(const struct bench_case *bench, struct bench_result *result)
+{
+    if (bench == NULL || bench->run == NULL || result == NULL) {
+        return -EINVAL;
+    }
+
+    uint32_t iterations = MIN(MAX(bench->iterations, 1U), ARRAY_SIZE(samples));
+
+    k_mutex_lock(&bench_lock, K_FOREVER);
+    cycle_counter_init();
+    if (timing_overhead == 0) {
+        calibrate_overhead();
+    }
+
+    if (bench->setup) {
+        bench->setup();
+    }
+
+    /* Keep other threads off the CPU while timing; interrupts stay enabled */
+    k_sched_lock();
+    for (int i = 0; i < CONFIG_OMI_BENCH_WARMUP; i++) {
+        bench->run();
+    }
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint32_t t = time_one(bench->run);
+        samples[i] = t > timing_overhead ? t - timing_overhead : 0;
+    }
+    k_sched_unlock();
+
+    qsort(samples, iterations, sizeof(samples[0]), compare_u32);
+
+    /* Nearest-rank percentiles */
+    result->iterations = iterations;
+    result->min = samples[0];
+    result->median = samples[(iterations - 1) / 2];
+    result->p99 = samples[DIV_ROUND_UP(iterations * 99, 100) - 1];
+    result->max = samples[iterations - 1];
+    k_mutex_unlock(&bench_lock);
+
+    return 0;
+}
+
+void bench_print_json(const struct bench_case *bench, const struct bench_result *result)
+{
+    printk("{\"bench\":\"%s\",\"unit\":\"%s\",\"freq_hz\":%u,\"iterations\":%u,"
+           "\"min\":%u,\"median\":%u,\"p99\":%u,\"max\":%u}\n",
+           bench->name, cycle_counter_unit(), cycle_counter_freq_hz(),
+           result->iterations, result->min, result->median, result->p99, result->max);
+}
+
+#if defined(CONFIG_OMI_BENCH_RUN_AT_BOOT)
+static void bench_boot_thread(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    struct bench_result result;
+
+    STRUCT_SECTION_FOREACH(bench_case, bench) {
+        if (bench_run(bench, &result) == 0) {
+            bench_print_json(bench, &result);
+        } else {
+            LOG_ERR("Benchmark %s failed", bench->name);
+        }
+    }
+    printk("BENCH_DONE\n");
+}
+
+K_THREAD_DEFINE(bench_boot, 2048, bench_boot_thread, NULL, NULL, NULL,
+                K_LOWEST_APPLICATION_THREAD_PRIO, 0, 500);
+#endif
+
+#if defined(CONFIG_SHELL)
+static void print_result(const struct shell *shell, const struct bench_case *bench,
+                         const struct bench_result *result, bool json)
+{
+    if (json) {
+        bench_print_json(bench, result);
+        return;
+    }
+    shell_print(shell, "%-28s n=%-4u min=%-8u median=%-8u p99=%-8u max=%-8u %s",
+                bench->name, result->iterations, result->min, result->median,
+                result->p99, result->max, cycle_counter_unit());
+}
+
+static int cmd_bench_list(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    int count = 0;
+
+    STRUCT_SECTION_FOREACH(bench_case, bench) {
+        shell_print(shell, "  %-28s (%u iterations)", bench->name, bench->iterations);
+        count++;
+    }
+    shell_print(shell, "%d benchmarks registered", count);
+    return 0;
+}
+
+static int cmd_bench_run(const struct shell *shell, size_t argc, const char **argv)
+{
+    bool json = (argc > 2) && (strcmp(argv[2], "json") == 0);
+    struct bench_result result;
+    int ret;
+
+    if (strcmp(argv[1], "all") == 0) {
+        STRUCT_SECTION_FOREACH(bench_case, bench) {
+            ret = bench_run(bench, &result);
+            if (ret) {
+                shell_error(shell, "Benchmark %s failed: %d", bench->name, ret);
+                return ret;
+            }
+            print_result(shell, bench, &result, json);
+        }
+        return 0;
+    }
+
+    const struct bench_case *bench = bench_find(argv[1]);
+    if (bench == NULL) {
+        shell_error(shell, "Unknown benchmark '%s' (see 'bench list')", argv[1]);
+        return -ENOENT;
+    }
+
+    ret = bench_run(bench, &result);
+    if (ret) {
+        shell_error(shell, "Benchmark %s failed: %d", bench->name, ret);
+        return ret;
+    }
+    print_result(shell, bench, &result, json);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(bench_cmd,
+    SHELL_CMD(list, NULL, "List registered benchmarks", cmd_bench_list),
+    SHELL_CMD_ARG(run, NULL, "Run benchmarks: run <name|all> [json]", cmd_bench_run, 2, 1),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(bench, &bench_cmd, "Microbenchmark commands", NULL);
+#endif /* CONFIG_SHELL */
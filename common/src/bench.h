@@ -0,0 +1,68 @@
+/*
+ * OMI microbenchmark harness
+ * Kernels register themselves with BENCH_REGISTER() and are run from the
+ * "bench" shell command or at boot (CONFIG_OMI_BENCH_RUN_AT_BOOT).
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/iterable_sections.h>
+#include <stdint.h>
+
+/* Benchmark descriptor, placed in ROM by BENCH_REGISTER() */
+struct bench_case {
+    const char *name;
+    void (*setup)(void);    /* optional, called once before warm-up */
+    void (*run)(void);      /* one timed iteration */
+    uint16_t iterations;
+};
+
+/* Summary of one run, in cycle_counter_unit() ticks */
+struct bench_result {
+    uint32_t iterations;
+    uint32_t min;
+    uint32_t median;
+    uint32_t p99;
+    uint32_t max;
+};
+
+/**
+ * @brief Register a benchmark kernel
+ * @param _name Identifier used by "bench run <name>" and in JSON output
+ * @param _setup Optional one-time setup function (may be NULL)
+ * @param _run Function executing one iteration
+ * @param _iters Timed iterations (clamped to CONFIG_OMI_BENCH_MAX_ITERATIONS)
+ */
+#define BENCH_REGISTER(_name, _setup, _run, _iters)                 \
+    STRUCT_SECTION_ITERABLE(bench_case, bench_case_##_name) = {     \
+        .name = #_name,                                             \
+        .setup = _setup,                                            \
+        .run = _run,                                                \
+        .iterations = _iters,                                       \
+    }
+
+/**
+ * @brief Find a registered benchmark by name
+ * @return Descriptor or NULL if not found
+ */
+const struct bench_case *bench_find(const char *name);
+
+/**
+ * @brief Warm up and time a benchmark
+ * @param bench Benchmark to run
+ * @param result Filled with min/median/p99/max per-iteration cost
+ * @return 0 on success, negative error code on failure
+ */
+int bench_run(const struct bench_case *bench, struct bench_result *result);
+
+/**
+ * @brief Print a result as one JSON object on a single console line
+ */
+void bench_print_json(const struct bench_case *bench, const struct bench_result *result);
+
+/* Keep a value alive so the compiler cannot drop benchmarked work */
+extern volatile uint32_t bench_sink;
+
+#endif /* BENCH_H */
@@ -0,0 +1,67 @@
+/*
+ * Free-running cycle counter for OMI timing measurements
+ */
+
+#include "cycle_counter.h"
+
+#include <zephyr/init.h>
+
+#if defined(CONFIG_NATIVE_LIBRARY)
+/* Provided by cycle_counter_bottom.c, built against the host libc */
+extern uint64_t cycle_counter_host_ns(void);
+#elif defined(CONFIG_CPU_CORTEX_M_HAS_DWT)
+#include <cmsis_core.h>
+#endif
+
+void cycle_counter_init(void)
+{
+#if !defined(CONFIG_NATIVE_LIBRARY) && defined(CONFIG_CPU_CORTEX_M_HAS_DWT)
+    if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+#endif
+}
+
+/* Timing outside the benches (players, storage, pipeline, energy) relies
+ * on the counter running from boot, not only once a debugger sets TRCENA */
+static int cycle_counter_sys_init(void)
+{
+    cycle_counter_init();
+    return 0;
+}
+
+SYS_INIT(cycle_counter_sys_init, PRE_KERNEL_1, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
+
+uint32_t cycle_counter_get(void)
+{
+#if defined(CONFIG_NATIVE_LIBRARY)
+    return (uint32_t)cycle_counter_host_ns();
+#elif defined(CONFIG_CPU_CORTEX_M_HAS_DWT)
+    return DWT->CYCCNT;
+#else
+    return k_cycle_get_32();
+#endif
+}
+
+uint32_t cycle_counter_freq_hz(void)
+{
+#if defined(CONFIG_NATIVE_LIBRARY)
+    return 1000000000U;
+#elif defined(CONFIG_CPU_CORTEX_M_HAS_DWT)
+    /* DWT counts core clock cycles, not system timer ticks */
+    return SystemCoreClock;
+#else
+    return sys_clock_hw_cycles_per_sec();
+#endif
+}
+
+const char *cycle_counter_unit(void)
+{
+#if defined(CONFIG_NATIVE_LIBRARY)
+    return "ns";
+#else
+    return "cycles";
+#endif
+}
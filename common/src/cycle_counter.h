@@ -0,0 +1,47 @@
+/*
+ * Free-running cycle counter for OMI timing measurements
+ * DWT CYCCNT on Cortex-M (nRF52840), host monotonic clock on native_sim
+ */
+
+#ifndef CYCLE_COUNTER_H
+#define CYCLE_COUNTER_H
+
+#include <zephyr/kernel.h>
+#include <stdint.h>
+
+/**
+ * @brief Enable the underlying counter (idempotent)
+ *
+ * Done at boot; callers need not call it.
+ */
+void cycle_counter_init(void);
+
+/**
+ * @brief Read the counter
+ *
+ * The value wraps at 32 bits; always subtract two readings as uint32_t.
+ * @return Current counter value in counter ticks
+ */
+uint32_t cycle_counter_get(void);
+
+/**
+ * @brief Counter tick frequency
+ * @return Ticks per second (CPU clock on hardware, 1 GHz on native_sim)
+ */
+uint32_t cycle_counter_freq_hz(void);
+
+/**
+ * @brief Unit name used when reporting raw counter deltas
+ * @return "cycles" on hardware, "ns" on native_sim
+ */
+const char *cycle_counter_unit(void);
+
+/**
+ * @brief Convert a counter delta to nanoseconds
+ */
+static inline uint32_t cycle_counter_to_ns(uint32_t ticks)
+{
+    return (uint32_t)(((uint64_t)ticks * 1000000000ULL) / cycle_counter_freq_hz());
+}
+
+#endif /* CYCLE_COUNTER_H */
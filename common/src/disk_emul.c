@@ -0,0 +1,432 @@
+/*
+ * Latency-injecting SD card emulator
+ */
+
+#include "disk_emul.h"
+#include "xorshift.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/storage/disk_access.h>
+#include <stdlib.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(disk_emul, CONFIG_LOG_DEFAULT_LEVEL);
+
+#define SECTOR_SIZE 512
+
+/* Zero delays: the backing disk as-is */
+static const struct disk_emul_profile profile_ideal = {
+    .name = "ideal",
+};
+
+/* A mainstream microSD card on an 8 MHz SPI bus */
+static const struct disk_emul_profile profile_typical = {
+    .name = "typical",
+    .read_us = 400,
+    .write_us = 900,
+    .read_kbps = 600,
+    .write_kbps = 350,
+    .tail_permille = 20,
+    .tail_us = 4000,
+    .gc_sectors = 512,
+    .gc_ms = 60,
+    .init_ms = 30,
+};
+
+/* A budget card near the spec limits: writes may stay busy for the
+ * 250 ms SDHC write timeout */
+static const struct disk_emul_profile profile_worst = {
+    .name = "worst",
+    .read_us = 1200,
+    .write_us = 2500,
+    .read_kbps = 300,
+    .write_kbps = 150,
+    .tail_permille = 50,
+    .tail_us = 25000,
+    .gc_sectors = 128,
+    .gc_ms = 250,
+    .init_ms = 250,
+};
+
+/* Occasional CRC and timeout errors on top of the worst case */
+static const struct disk_emul_profile profile_flaky = {
+    .name = "flaky",
+    .read_us = 1200,
+    .write_us = 2500,
+    .read_kbps = 300,
+    .write_kbps = 150,
+    .tail_permille = 50,
+    .tail_us = 25000,
+    .gc_sectors = 128,
+    .gc_ms = 250,
+    .init_ms = 250,
+    .error_permille = 5,
+};
+
+const struct disk_emul_profile *const disk_emul_profiles[] = {
+    &profile_ideal,
+    &profile_typical,
+    &profile_worst,
+    &profile_flaky,
+    NULL,
+};
+
+/* The card handles one command at a time */
+static K_MUTEX_DEFINE(card_lock);
+static const struct disk_emul_profile *profile = &profile_ideal;
+static uint32_t rng_state = CONFIG_OMI_DISK_EMUL_SEED;
+static uint32_t gc_written;             /* sectors written since the last GC stall */
+static uint32_t fail_reads;
+static uint32_t fail_writes;
+static uint32_t cut_countdown;          /* sectors until the power cut, 0 if not armed */
+static bool cut_tear;
+static bool powered_off;
+static struct disk_emul_stats stats;
+static uint8_t tear_buf[SECTOR_SIZE];
+
+/* The same seed gives the same delays every run */
+static uint32_t rng_next(void)
+{
+    return xorshift32(&rng_state);
+}
+
+static bool rng_permille(uint16_t permille)
+{
+    return permille && (rng_next() % 1000U) < permille;
+}
+
+/* Delay for one operation; called with card_lock held */
+static uint32_t op_delay_us(bool write, uint32_t sectors)
+{
+    uint32_t kbps = write ? profile->write_kbps : profile->read_kbps;
+    uint64_t us = write ? profile->write_us : profile->read_us;
+
+    if (kbps) {
+        us += (uint64_t)sectors * SECTOR_SIZE * USEC_PER_SEC / (kbps * 1024U);
+    }
+    if (rng_permille(profile->tail_permille) && profile->tail_us) {
+        us += rng_next() % profile->tail_us;
+        stats.tails++;
+    }
+    if (write && profile->gc_sectors) {
+        gc_written += sectors;
+        if (gc_written >= profile->gc_sectors) {
+            gc_written = 0;
+            us += profile->gc_ms * USEC_PER_MSEC;
+            stats.gc_stalls++;
+        }
+    }
+    return (uint32_t)MIN(us, UINT32_MAX);
+}
+
+static bool op_fails(bool write)
+{
+    uint32_t *pending = write ? &fail_writes : &fail_reads;
+
+    if (*pending) {
+        (*pending)--;
+        return true;
+    }
+    return rng_permille(profile->error_permille);
+}
+
+/* Write the sectors before the cut, tear the one it falls on and power
+ * off; called with card_lock held */
+static int write_until_cut(const uint8_t *buf, uint32_t sector)
+{
+    uint32_t done = cut_countdown - 1;
+    int ret = 0;
+
+    cut_countdown = 0;
+    powered_off = true;
+    stats.power_cuts++;
+
+    if (done > 0) {
+        ret = disk_access_write(CONFIG_OMI_DISK_EMUL_BACKING, buf, sector, done);
+    }
+    if (ret == 0 && cut_tear &&
+        disk_access_read(CONFIG_OMI_DISK_EMUL_BACKING, tear_buf, sector + done, 1) == 0) {
+        uint32_t keep = rng_next() % SECTOR_SIZE;
+
+        memcpy(tear_buf, buf + done * SECTOR_SIZE, keep);
+        disk_access_write(CONFIG_OMI_DISK_EMUL_BACKING, tear_buf, sector + done, 1);
+        stats.torn_sectors++;
+    }
+    return -EIO;
+}
+
+/* Sleeps with the card locked, like a thread waiting on SPI DMA */
+static int card_op(bool write, uint8_t *buf, uint32_t sector, uint32_t count)
+{
+    int ret;
+
+    k_mutex_lock(&card_lock, K_FOREVER);
+
+    if (powered_off) {
+        k_mutex_unlock(&card_lock);
+        return -EIO;
+    }
+    if (write && cut_countdown && cut_countdown <= count) {
+        ret = write_until_cut(buf, sector);
+        k_mutex_unlock(&card_lock);
+        return ret;
+    }
+    if (write && cut_countdown) {
+        cut_countdown -= count;
+    }
+
+    uint32_t us = op_delay_us(write, count);
+    bool fail = op_fails(write);
+
+    if (us) {
+        k_sleep(K_USEC(us));
+    }
+    stats.delay_ms += us / USEC_PER_MSEC;
+    stats.max_delay_us = MAX(stats.max_delay_us, us);
+
+    if (fail) {
+        stats.errors++;
+        ret = -EIO;
+    } else if (write) {
+        ret = disk_access_write(CONFIG_OMI_DISK_EMUL_BACKING, buf, sector, count);
+        stats.writes++;
+        stats.sectors_written += count;
+    } else {
+        ret = disk_access_read(CONFIG_OMI_DISK_EMUL_BACKING, buf, sector, count);
+        stats.reads++;
+        stats.sectors_read += count;
+    }
+
+    k_mutex_unlock(&card_lock);
+    return ret;
+}
+
+static int emul_init(struct disk_info *disk)
+{
+    ARG_UNUSED(disk);
+
+    if (powered_off) {
+        return -EIO;
+    }
+    if (profile->init_ms) {
+        k_msleep(profile->init_ms);
+    }
+    return disk_access_init(CONFIG_OMI_DISK_EMUL_BACKING);
+}
+
+static int emul_status(struct disk_info *disk)
+{
+    ARG_UNUSED(disk);
+
+    return disk_access_status(CONFIG_OMI_DISK_EMUL_BACKING);
+}
+
+static int emul_read(struct disk_info *disk, uint8_t *buf, uint32_t sector, uint32_t count)
+{
+    ARG_UNUSED(disk);
+
+    return card_op(false, buf, sector, count);
+}
+
+static int emul_write(struct disk_info *disk, const uint8_t *buf, uint32_t sector,
+                      uint32_t count)
+{
+    ARG_UNUSED(disk);
+
+    return card_op(true, (uint8_t *)buf, sector, count);
+}
+
+static int emul_ioctl(struct disk_info *disk, uint8_t cmd, void *buf)
+{
+    /* Power cycles are the emulated card's own: the backing disk stays up */
+    switch (cmd) {
+    case DISK_IOCTL_CTRL_INIT:
+        return emul_init(disk);
+    case DISK_IOCTL_CTRL_DEINIT:
+        return 0;
+    default:
+        return disk_access_ioctl(CONFIG_OMI_DISK_EMUL_BACKING, cmd, buf);
+    }
+}
+
+static const struct disk_operations emul_ops = {
+    .init = emul_init,
+    .status = emul_status,
+    .read = emul_read,
+    .write = emul_write,
+    .ioctl = emul_ioctl,
+};
+
+static struct disk_info emul_disk = {
+    .name = CONFIG_OMI_DISK_EMUL_NAME,
+    .ops = &emul_ops,
+};
+
+const struct disk_emul_profile *disk_emul_find_profile(const char *name)
+{
+    for (int i = 0; disk_emul_profiles[i] != NULL; i++) {
+        if (strcmp(disk_emul_profiles[i]->name, name) == 0) {
+            return disk_emul_profiles[i];
+        }
+    }
+    return NULL;
+}
+
+void disk_emul_set_profile(const struct disk_emul_profile *p)
+{
+    k_mutex_lock(&card_lock, K_FOREVER);
+    profile = p;
+    gc_written = 0;
+    k_mutex_unlock(&card_lock);
+}
+
+const struct disk_emul_profile *disk_emul_get_profile(void)
+{
+    return profile;
+}
+
+void disk_emul_inject_errors(bool write, uint32_t count)
+{
+    k_mutex_lock(&card_lock, K_FOREVER);
+    if (write) {
+        fail_writes = count;
+    } else {
+        fail_reads = count;
+    }
+    k_mutex_unlock(&card_lock);
+}
+
+void disk_emul_power_fail_arm(uint32_t sectors, bool tear)
+{
+    k_mutex_lock(&card_lock, K_FOREVER);
+    cut_countdown = sectors;
+    cut_tear = tear;
+    k_mutex_unlock(&card_lock);
+}
+
+bool disk_emul_power_failed(void)
+{
+    return powered_off;
+}
+
+void disk_emul_power_restore(void)
+{
+    k_mutex_lock(&card_lock, K_FOREVER);
+    powered_off = false;
+    cut_countdown = 0;
+    gc_written = 0;
+    k_mutex_unlock(&card_lock);
+}
+
+void disk_emul_get_stats(struct disk_emul_stats *out)
+{
+    k_mutex_lock(&card_lock, K_FOREVER);
+    *out = stats;
+    k_mutex_unlock(&card_lock);
+}
+
+void disk_emul_reset_stats(void)
+{
+    k_mutex_lock(&card_lock, K_FOREVER);
+    memset(&stats, 0, sizeof(stats));
+    k_mutex_unlock(&card_lock);
+}
+
+static int disk_emul_register(void)
+{
+    const struct disk_emul_profile *p = disk_emul_find_profile(CONFIG_OMI_DISK_EMUL_PROFILE);
+
+    if (p == NULL) {
+        LOG_WRN("Unknown card profile '%s', using ideal", CONFIG_OMI_DISK_EMUL_PROFILE);
+    } else {
+        profile = p;
+    }
+    LOG_INF("Emulated card \"%s\" on \"%s\", profile %s", CONFIG_OMI_DISK_EMUL_NAME,
+            CONFIG_OMI_DISK_EMUL_BACKING, profile->name);
+    return disk_access_register(&emul_disk);
+}
+
+SYS_INIT(disk_emul_register, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+
+static int cmd_diskemul_show(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    const struct disk_emul_profile *p = profile;
+    struct disk_emul_stats s;
+
+    disk_emul_get_stats(&s);
+    shell_print(shell, "Profile %s: read %u us + %u KiB/s, write %u us + %u KiB/s",
+                p->name, p->read_us, p->read_kbps, p->write_us, p->write_kbps);
+    shell_print(shell, "  tail %u/1000 up to %u us, GC %u ms every %u sectors, "
+                "init %u ms, errors %u/1000", p->tail_permille, p->tail_us, p->gc_ms,
+                p->gc_sectors, p->init_ms, p->error_permille);
+    shell_print(shell, "%u reads (%u sectors), %u writes (%u sectors)",
+                s.reads, s.sectors_read, s.writes, s.sectors_written);
+    shell_print(shell, "  %u tails, %u GC stalls, %u injected errors",
+                s.tails, s.gc_stalls, s.errors);
+    shell_print(shell, "  Delay: %u ms total, max %u us", s.delay_ms, s.max_delay_us);
+    shell_print(shell, "  Power: %s, %u cuts, %u torn sectors",
+                powered_off ? "off" : "on", s.power_cuts, s.torn_sectors);
+    return 0;
+}
+
+static int cmd_diskemul_profile(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+
+    const struct disk_emul_profile *p = disk_emul_find_profile(argv[1]);
+
+    if (p == NULL) {
+        shell_error(shell, "No profile '%s'; one of:", argv[1]);
+        for (int i = 0; disk_emul_profiles[i] != NULL; i++) {
+            shell_error(shell, "  %s", disk_emul_profiles[i]->name);
+        }
+        return -ENOENT;
+    }
+    disk_emul_set_profile(p);
+    return 0;
+}
+
+static int cmd_diskemul_fail(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(argc);
+
+    bool write = (strcmp(argv[1], "write") == 0);
+
+    if (!write && strcmp(argv[1], "read") != 0) {
+        shell_error(shell, "Operation is read or write");
+        return -EINVAL;
+    }
+    disk_emul_inject_errors(write, strtoul(argv[2], NULL, 10));
+    return 0;
+}
+
+static int cmd_diskemul_reset(const struct shell *shell, size_t argc, const char **argv)
+{
+    ARG_UNUSED(shell);
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    disk_emul_reset_stats();
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(diskemul_cmd,
+    SHELL_CMD(show, NULL, "Show the card profile and statistics", cmd_diskemul_show),
+    SHELL_CMD_ARG(profile, NULL, "Switch card profile: profile <ideal|typical|worst|flaky>",
+                  cmd_diskemul_profile, 2, 0),
+    SHELL_CMD_ARG(fail, NULL, "Fail the next operations: fail <read|write> <count>",
+                  cmd_diskemul_fail, 3, 0),
+    SHELL_CMD(reset, NULL, "Clear the statistics", cmd_diskemul_reset),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(diskemul, &diskemul_cmd, "Emulated SD card behavior", NULL);
+#endif /* CONFIG_SHELL */
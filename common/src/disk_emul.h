@@ -0,0 +1,101 @@
+/*
+ * Latency-injecting SD card emulator
+ * A disk named "SD" on top of a uniformly fast backing disk (the RAM disk
+ * on native_sim) that behaves like a card on the SPI bus: every operation
+ * waits for a command latency plus its transfer time at a capped
+ * bandwidth, a few take a long tail, and writes periodically stall for
+ * the card's internal garbage collection. Operations are serialized like
+ * a single card, so a stalled write also holds up the reads behind it.
+ *
+ * The caller's thread sleeps for the delay, as it does waiting on SPI
+ * DMA, so write-behind queues, the storage writer and the playback
+ * prefetcher see realistic stalls while the rest of the system runs.
+ * Delays come from a seeded generator and are reproducible run to run.
+ *
+ * Power can be cut at a chosen sector write: the sectors before it land,
+ * that one is optionally torn (a prefix of the new data over the old),
+ * and every operation fails until power is restored. The data persists,
+ * as on a card, so recovery can be exercised against it.
+ */
+
+#ifndef DISK_EMUL_H
+#define DISK_EMUL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct disk_emul_profile {
+    const char *name;
+    uint32_t read_us;           /* command latency per read */
+    uint32_t write_us;          /* ... per write, including the busy wait */
+    uint32_t read_kbps;         /* transfer bandwidth (KiB/s), 0 for unlimited */
+    uint32_t write_kbps;
+    uint16_t tail_permille;     /* operations that take a long tail */
+    uint32_t tail_us;           /* ... of up to this much extra, uniformly */
+    uint32_t gc_sectors;        /* a GC stall every this many sectors written, 0 for never */
+    uint32_t gc_ms;             /* ... lasting this long */
+    uint32_t init_ms;           /* card power-up and initialization */
+    uint16_t error_permille;    /* operations failing with -EIO */
+};
+
+struct disk_emul_stats {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t sectors_read;
+    uint32_t sectors_written;
+    uint32_t tails;             /* operations that took a long tail */
+    uint32_t gc_stalls;
+    uint32_t errors;            /* injected failures */
+    uint32_t delay_ms;          /* total injected delay */
+    uint32_t max_delay_us;
+    uint32_t power_cuts;
+    uint32_t torn_sectors;
+};
+
+/**
+ * @brief Built-in card profiles, NULL-terminated
+ */
+extern const struct disk_emul_profile *const disk_emul_profiles[];
+
+/**
+ * @brief Find a built-in profile by name
+ * @return Profile, or NULL if there is none by that name
+ */
+const struct disk_emul_profile *disk_emul_find_profile(const char *name);
+
+/**
+ * @brief Switch the card's behavior; takes effect from the next operation
+ */
+void disk_emul_set_profile(const struct disk_emul_profile *profile);
+
+const struct disk_emul_profile *disk_emul_get_profile(void);
+
+/**
+ * @brief Fail the next operations of one kind with -EIO
+ * @param write Writes if true, reads otherwise
+ * @param count Operations to fail
+ */
+void disk_emul_inject_errors(bool write, uint32_t count);
+
+/**
+ * @brief Cut power during a future write
+ * @param sectors Cut at this many sectors written from now (1: the next)
+ * @param tear Leave that sector torn instead of untouched
+ */
+void disk_emul_power_fail_arm(uint32_t sectors, bool tear);
+
+/**
+ * @brief Whether power has been cut (and not restored yet)
+ */
+bool disk_emul_power_failed(void);
+
+/**
+ * @brief Power the card back up; disarms a pending cut
+ */
+void disk_emul_power_restore(void);
+
+void disk_emul_get_stats(struct disk_emul_stats *stats);
+
+void disk_emul_reset_stats(void);
+
+#endif /* DISK_EMUL_H */
@@ -0,0 +1,49 @@
+/*
+ * OMI thread priority and stack plan
+ *
+ * Every thread in the OMI images takes its priority and stack size from
+ * this table so the whole plan can be reviewed in one place. All threads
+ * are preemptible; a lower number preempts a higher one.
+ *
+ * Ordering rationale:
+ *  - Producers that wait on hardware (DMIC DMA, SD sector reads, BLE
+ *    packets) run above the work they feed, so a short burst from them
+ *    preempts longer CPU work instead of queueing behind it.
+ *  - The stream engine only refills the sample-timer double buffer; a
+ *    block must be ready within one block period (16 ms). The audio work
+ *    queue shares its level: its items are a few GPIO/PWM writes.
+ *  - Storage writes and offload reads tolerate latency up to the depth of
+ *    their queues.
+ *  - Power management and benchmarks run last.
+ */
+
+#ifndef OMI_THREADS_H
+#define OMI_THREADS_H
+
+#include <zephyr/kernel.h>
+
+/* Priorities */
+#define OMI_PRIO_CAPTURE        1   /* DMIC block reads, one per DMA block */
+#define OMI_PRIO_PLAYER_FEED    2   /* SD prefetch into the audio pool */
+#define OMI_PRIO_HOST_RX        2   /* native_sim: host socket standing in for BT RX */
+#define OMI_PRIO_BLE_INGEST     3   /* speak() packets from the phone */
+#define OMI_PRIO_UI_SOUND       3   /* synthesized UI sounds into the pool */
+#define OMI_PRIO_AUDIO_OUT      4   /* PWM stream engine refill */
+#define OMI_PRIO_AUDIO_CTRL     4   /* audio work queue: amp bring-up steps */
+#define OMI_PRIO_STORAGE        5   /* recording writes, offload reads */
+#define OMI_PRIO_PM             6   /* deferred power transitions */
+#define OMI_PRIO_BENCH          K_LOWEST_APPLICATION_THREAD_PRIO
+
+/* Stack sizes */
+#define OMI_STACK_CAPTURE       1536
+#define OMI_STACK_PLAYER_FEED   2048
+#define OMI_STACK_BLE_INGEST    1536
+#define OMI_STACK_HOST_RX       1024
+#define OMI_STACK_UI_SOUND      1024
+#define OMI_STACK_AUDIO_OUT     1024
+#define OMI_STACK_AUDIO_CTRL    1024
+#define OMI_STACK_STORAGE       2048
+#define OMI_STACK_PM            1024
+#define OMI_STACK_BENCH         2048
+
+#endif /* OMI_THREADS_H */
@@ -0,0 +1,322 @@
+/*
+ * UI sound synthesizer
+ */
+
+#include "synth.h"
+#include "xorshift.h"
+
+#include <string.h>
+#include <zephyr/sys/util.h>
+
+#define ENV_FULL        (1 << 23)
+#define ENV_SUSTAIN_Q   (ENV_FULL / 255)
+
+enum env_stage {
+    ENV_IDLE,
+    ENV_ATTACK,
+    ENV_DECAY,
+    ENV_SUSTAIN,
+    ENV_RELEASE,
+};
+
+/* Generated from common/sounds/ by scripts/sndc.py: synth_sounds[] */
+#include "omi_sounds.inc"
+
+/* sin() over a quarter cycle, Q15; linear interpolation between entries */
+static const int16_t sine_quarter[65] = {
+    0, 804, 1608, 2410, 3212, 4011, 4808, 5602, 6393, 7179, 7962, 8739,
+    9512, 10278, 11039, 11793, 12539, 13279, 14010, 14732, 15446, 16151,
+    16846, 17530, 18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+    23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790, 27245, 27683,
+    28105, 28510, 28898, 29268, 29621, 29956, 30273, 30571, 30852, 31113,
+    31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521, 32609, 32678,
+    32728, 32757, 32767,
+};
+
+/* Phase increments at 16 kHz for C9..B9; lower octaves shift right */
+static const uint32_t top_octave_inc[12] = {
+    2247346494, 2380980670, 2522561148, 2672560440, 2831479154, 2999847666,
+    3178227890, 3367215155, 3567440188, 3779571220, 4004316221, 4242425254,
+};
+
+static uint32_t note_inc(uint8_t note)
+{
+    note = (note > SYNTH_NOTE_MAX) ? SYNTH_NOTE_MAX : note;
+    return top_octave_inc[note % 12] >> (10 - note / 12);
+}
+
+static int32_t sine(uint32_t phase)
+{
+    uint32_t pos = (phase >> 16) & 0x3fff;     /* 6-bit index, 8-bit fraction */
+
+    if (phase & (1U << 30)) {
+        pos = 0x4000 - pos;
+    }
+
+    uint32_t idx = pos >> 8;
+    int32_t v = sine_quarter[idx];
+
+    if (idx < 64) {
+        v += ((sine_quarter[idx + 1] - v) * (int32_t)(pos & 0xff)) >> 8;
+    }
+    return (phase & (1U << 31)) ? -v : v;
+}
+
+static int32_t oscillator(struct synth *synth, struct synth_voice *v)
+{
+    uint32_t phase = v->phase;
+
+    v->phase += v->inc;
+
+    switch (v->wave) {
+    case SYNTH_WAVE_SQUARE:
+        return (phase & (1U << 31)) ? -32767 : 32767;
+    case SYNTH_WAVE_TRIANGLE: {
+        int32_t t = phase >> 15;
+        return (t < 65536) ? t - 32768 : 98303 - t;
+    }
+    case SYNTH_WAVE_SAW:
+        return (int32_t)(phase >> 16) - 32768;
+    case SYNTH_WAVE_NOISE:
+        return (int16_t)(xorshift32(&synth->noise) >> 16);
+    default:
+        return sine(phase);
+    }
+}
+
+static void env_release(struct synth_voice *v)
+{
+    if (v->stage == ENV_IDLE) {
+        return;
+    }
+    if (v->release == 0) {
+        v->stage = ENV_IDLE;
+        return;
+    }
+    v->stage = ENV_RELEASE;
+    v->step = v->level / (v->release * SYNTH_TICK_SAMPLES) + 1;
+}
+
+static void env_enter_decay(struct synth_voice *v)
+{
+    int32_t sustain = v->sustain * ENV_SUSTAIN_Q;
+
+    if (v->decay == 0) {
+        v->level = sustain;
+        v->stage = (sustain > 0) ? ENV_SUSTAIN : ENV_IDLE;
+        return;
+    }
+    v->stage = ENV_DECAY;
+    v->step = (ENV_FULL - sustain) / (v->decay * SYNTH_TICK_SAMPLES) + 1;
+}
+
+static void env_advance(struct synth_voice *v)
+{
+    switch (v->stage) {
+    case ENV_ATTACK:
+        v->level += v->step;
+        if (v->level >= ENV_FULL) {
+            v->level = ENV_FULL;
+            env_enter_decay(v);
+        }
+        break;
+    case ENV_DECAY: {
+        int32_t sustain = v->sustain * ENV_SUSTAIN_Q;
+
+        v->level -= v->step;
+        if (v->level <= sustain) {
+            v->level = sustain;
+            v->stage = (sustain > 0) ? ENV_SUSTAIN : ENV_IDLE;
+        }
+        break;
+    }
+    case ENV_RELEASE:
+        v->level -= v->step;
+        if (v->level <= 0) {
+            v->level = 0;
+            v->stage = ENV_IDLE;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void note_on(struct synth_voice *v, uint8_t note, uint8_t velocity)
+{
+    v->inc = note_inc(note);
+    v->phase = 0;
+    v->velocity = (velocity > 127) ? 127 : velocity;
+    if (v->attack == 0) {
+        v->level = ENV_FULL;
+        env_enter_decay(v);
+    } else {
+        v->level = 0;
+        v->stage = ENV_ATTACK;
+        v->step = ENV_FULL / (v->attack * SYNTH_TICK_SAMPLES) + 1;
+    }
+}
+
+/* Execute opcodes until a wait or the end; malformed code ends the sound */
+static void run_program(struct synth *synth)
+{
+    while (synth->wait == 0 && !synth->program_done) {
+        if (synth->pc >= synth->end) {
+            goto end;
+        }
+
+        uint8_t op = *synth->pc & 0xf0;
+        uint8_t vi = *synth->pc & 0x0f;
+        size_t left = synth->end - synth->pc - 1;
+        const uint8_t *arg = synth->pc + 1;
+        struct synth_voice *v = &synth->voice[vi % SYNTH_VOICES];
+
+        switch (op) {
+        case SYNTH_OP_WAVE:
+            if (left < 1) {
+                goto end;
+            }
+            v->wave = arg[0];
+            synth->pc += 2;
+            break;
+        case SYNTH_OP_ENV:
+            if (left < 4) {
+                goto end;
+            }
+            v->attack = arg[0];
+            v->decay = arg[1];
+            v->sustain = arg[2];
+            v->release = arg[3];
+            synth->pc += 5;
+            break;
+        case SYNTH_OP_NOTE:
+            if (left < 2) {
+                goto end;
+            }
+            note_on(v, arg[0], arg[1]);
+            synth->pc += 3;
+            break;
+        case SYNTH_OP_OFF:
+            env_release(v);
+            synth->pc += 1;
+            break;
+        case SYNTH_OP_WAIT:
+            if (left < 1) {
+                goto end;
+            }
+            synth->wait = arg[0] * SYNTH_TICK_SAMPLES;
+            synth->pc += 2;
+            break;
+        case SYNTH_OP_GAIN:
+            if (left < 1) {
+                goto end;
+            }
+            synth->gain = arg[0];
+            synth->pc += 2;
+            break;
+        default:
+            goto end;
+        }
+    }
+    return;
+
+end:
+    /* Held notes fade out with their own release */
+    synth->program_done = true;
+    for (int i = 0; i < SYNTH_VOICES; i++) {
+        env_release(&synth->voice[i]);
+    }
+}
+
+void synth_start(struct synth *synth, const struct synth_sound *sound)
+{
+    memset(synth, 0, sizeof(*synth));
+    synth->pc = sound->code;
+    synth->end = sound->code + sound->size;
+    synth->gain = 64;
+    synth->noise = 0x1234567;
+}
+
+bool synth_done(const struct synth *synth)
+{
+    if (!synth->program_done) {
+        return false;
+    }
+    for (int i = 0; i < SYNTH_VOICES; i++) {
+        if (synth->voice[i].stage != ENV_IDLE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t synth_render(struct synth *synth, int16_t *out, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        run_program(synth);
+        if (synth_done(synth)) {
+            break;
+        }
+
+        int32_t mix = 0;
+
+        for (int vi = 0; vi < SYNTH_VOICES; vi++) {
+            struct synth_voice *v = &synth->voice[vi];
+
+            if (v->stage == ENV_IDLE) {
+                continue;
+            }
+            /* Envelope Q23 -> Q15, scaled by velocity (Q7) */
+            int32_t amp = ((v->level >> 8) * v->velocity) >> 7;
+
+            mix += (oscillator(synth, v) * amp) >> 15;
+            env_advance(v);
+        }
+
+        mix = (mix * synth->gain) >> 8;
+        out[i] = (int16_t)((mix > INT16_MAX) ? INT16_MAX : (mix < INT16_MIN) ? INT16_MIN : mix);
+
+        if (synth->wait > 0) {
+            synth->wait--;
+        }
+    }
+    return i;
+}
+
+const struct synth_sound *synth_find(const char *name)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(synth_sounds); i++) {
+        if (strcmp(synth_sounds[i].name, name) == 0) {
+            return &synth_sounds[i];
+        }
+    }
+    return NULL;
+}
+
+const struct synth_sound *synth_sound_at(size_t index)
+{
+    return (index < ARRAY_SIZE(synth_sounds)) ? &synth_sounds[index] : NULL;
+}
+
+#if defined(CONFIG_OMI_BENCH)
+#include "bench.h"
+
+static struct synth bench_synth;
+static int16_t bench_out[256];
+
+static void bench_synth_setup(void)
+{
+    synth_start(&bench_synth, &synth_sounds[0]);
+}
+
+static void bench_synth_render(void)
+{
+    if (synth_render(&bench_synth, bench_out, ARRAY_SIZE(bench_out)) < ARRAY_SIZE(bench_out)) {
+        bench_synth_setup();
+    }
+}
+
+BENCH_REGISTER(synth_render_256, bench_synth_setup, bench_synth_render, 64);
+#endif
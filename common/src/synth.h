@@ -0,0 +1,103 @@
+/*
+ * UI sound synthesizer
+ * Fixed-point DDS oscillators with ADSR envelopes, mixed to 16-bit
+ * samples at AUDIO_SAMPLE_RATE. Sounds are small bytecode programs
+ * compiled at build time by scripts/sndc.py from common/sounds/, so a
+ * sound costs a few dozen bytes of flash and is rendered block by block
+ * as it plays - nothing is pre-rendered into RAM.
+ *
+ * Bytecode (one opcode byte, low nibble = voice where noted):
+ *   0x00              end
+ *   0x1v wave         set waveform (SYNTH_WAVE_*)
+ *   0x2v a d s r      envelope: attack/decay/release in ticks, sustain 0-255
+ *   0x3v note vel     note on, MIDI note number, velocity 0-127
+ *   0x4v              note off (release)
+ *   0x50 ticks        wait
+ *   0x60 gain         master gain, Q8 per voice
+ * One tick is SYNTH_TICK_SAMPLES samples (4 ms).
+ */
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SYNTH_VOICES        4
+#define SYNTH_TICK_SAMPLES  64
+#define SYNTH_NOTE_MAX      119     /* B8; higher notes alias at 16 kHz */
+
+enum synth_op {
+    SYNTH_OP_END = 0x00,
+    SYNTH_OP_WAVE = 0x10,
+    SYNTH_OP_ENV = 0x20,
+    SYNTH_OP_NOTE = 0x30,
+    SYNTH_OP_OFF = 0x40,
+    SYNTH_OP_WAIT = 0x50,
+    SYNTH_OP_GAIN = 0x60,
+};
+
+enum synth_wave {
+    SYNTH_WAVE_SINE,
+    SYNTH_WAVE_SQUARE,
+    SYNTH_WAVE_TRIANGLE,
+    SYNTH_WAVE_SAW,
+    SYNTH_WAVE_NOISE,
+};
+
+/* A compiled sound, from the generated table */
+struct synth_sound {
+    const char *name;
+    const uint8_t *code;
+    uint16_t size;
+};
+
+struct synth_voice {
+    uint32_t phase;
+    uint32_t inc;                   /* DDS phase increment per sample */
+    int32_t level;                  /* envelope, Q23 */
+    int32_t step;                   /* envelope change per sample */
+    uint8_t wave;
+    uint8_t stage;
+    uint8_t velocity;
+    uint8_t attack, decay, sustain, release;
+};
+
+struct synth {
+    const uint8_t *pc;
+    const uint8_t *end;
+    uint32_t wait;                  /* samples until the next opcode */
+    uint32_t noise;
+    uint8_t gain;
+    bool program_done;
+    struct synth_voice voice[SYNTH_VOICES];
+};
+
+/**
+ * @brief Start playing a compiled sound
+ */
+void synth_start(struct synth *synth, const struct synth_sound *sound);
+
+/**
+ * @brief Render the next samples of the sound
+ * @return Samples written; less than n once the sound has finished
+ */
+size_t synth_render(struct synth *synth, int16_t *out, size_t n);
+
+/**
+ * @brief True once the program has ended and every voice is silent
+ */
+bool synth_done(const struct synth *synth);
+
+/**
+ * @brief Look up a built-in sound by name
+ */
+const struct synth_sound *synth_find(const char *name);
+
+/**
+ * @brief Built-in sound by index, NULL past the end
+ */
+const struct synth_sound *synth_sound_at(size_t index);
+
+#endif /* SYNTH_H */
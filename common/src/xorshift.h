@@ -0,0 +1,24 @@
+/*
+ * xorshift32 pseudo-random generator
+ * Cheap and reproducible: the same seed gives the same sequence on every
+ * run, which the card emulator's delays and the storage tests rely on.
+ * The state must never be zero.
+ */
+
+#ifndef XORSHIFT_H
+#define XORSHIFT_H
+
+#include <stdint.h>
+
+static inline uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+#endif /* XORSHIFT_H */
@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+#
+# Run the OMI microbenchmarks on native_sim and collect the results as JSON.
+#
+# Each application is built for native_sim with common/bench.conf and
+# CONFIG_OMI_BENCH_RUN_AT_BOOT=y, either directly with west or through
+# twister (--twister). The firmware prints one JSON object per benchmark
+# followed by BENCH_DONE; this script gathers those lines, tags them with
+# the current git commit and optionally compares against a previous run.
+#
+# Usage:
+#   scripts/bench_runner.py -o bench.json
+#   scripts/bench_runner.py --twister -o bench.json
+#   scripts/bench_runner.py -o new.json --compare old.json --threshold 10
+#
+
+import argparse
+import glob
+import json
+import os
+import subprocess
+import sys
+import time
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# app directory -> twister scenario name
+APPS = {
+    "PAM8403": "omi.pam8403.bench",
+    "SDHC_OMI": "omi.sdhc.bench",
+}
+
+DONE_MARKER = "BENCH_DONE"
+
+
+def git_commit():
+    try:
+        return subprocess.check_output(["git", "rev-parse", "HEAD"], cwd=REPO,
+                                       text=True).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def parse_lines(lines):
+    results = []
+    for line in lines:
+        line = line.strip()
+        start = line.find("{\"bench\"")
+        if start < 0:
+            continue
+        try:
+            results.append(json.loads(line[start:]))
+        except json.JSONDecodeError:
+            print(f"warning: malformed result line: {line}", file=sys.stderr)
+    return results
+
+
+def run_direct(app, build_root, timeout):
+    build_dir = os.path.join(build_root, f"bench-{app}")
+    subprocess.check_call([
+        "west", "build", "-p", "auto", "-b", "native_sim",
+        "-d", build_dir, os.path.join(REPO, app), "--",
+        "-DEXTRA_CONF_FILE=../common/bench.conf",
+        "-DCONFIG_OMI_BENCH_RUN_AT_BOOT=y",
+    ])
+
+    exe = os.path.join(build_dir, "zephyr", "zephyr.exe")
+    proc = subprocess.Popen([exe], stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                            text=True)
+    lines = []
+    deadline = time.monotonic() + timeout
+    try:
+        for line in proc.stdout:
+            lines.append(line)
+            if DONE_MARKER in line:
+                break
+            if time.monotonic() > deadline:
+                print(f"error: {app} timed out before {DONE_MARKER}", file=sys.stderr)
+                break
+    finally:
+        proc.kill()
+        proc.wait()
+    return parse_lines(lines)
+
+
+def run_twister(app, scenario, build_root):
+    outdir = os.path.join(build_root, f"twister-{app}")
+    subprocess.check_call([
+        "twister", "-p", "native_sim", "-T", os.path.join(REPO, app),
+        "-s", scenario, "-O", outdir, "--inline-logs",
+    ])
+    lines = []
+    for log in glob.glob(os.path.join(outdir, "**", "handler.log"), recursive=True):
+        with open(log, encoding="utf-8", errors="replace") as f:
+            lines.extend(f.readlines())
+    return parse_lines(lines)
+
+
+def compare(old, new, threshold):
+    """Print median deltas; return number of regressions above threshold %."""
+    regressions = 0
+    for app, benches in new["results"].items():
+        old_by_name = {b["bench"]: b for b in old.get("results", {}).get(app, [])}
+        for b in benches:
+            prev = old_by_name.get(b["bench"])
+            if prev is None or prev["median"] == 0:
+                continue
+            delta = 100.0 * (b["median"] - prev["median"]) / prev["median"]
+            flag = ""
+            if delta > threshold:
+                flag = "  REGRESSION"
+                regressions += 1
+            print(f"{app:10s} {b['bench']:28s} {prev['median']:>10} -> "
+                  f"{b['median']:>10} {b['unit']:6s} {delta:+7.1f}%{flag}")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Run OMI microbenchmarks on native_sim and emit JSON")
+    parser.add_argument("-o", "--output", help="write JSON results here (default: stdout)")
+    parser.add_argument("--twister", action="store_true", help="run through twister")
+    parser.add_argument("--apps", nargs="+", default=list(APPS), choices=list(APPS))
+    parser.add_argument("--build-root", default=os.path.join(REPO, "build"))
+    parser.add_argument("--timeout", type=float, default=120.0)
+    parser.add_argument("--compare", help="previous JSON result to compare medians against")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="median regression threshold in percent")
+    args = parser.parse_args()
+
+    report = {"commit": git_commit(), "platform": "native_sim", "results": {}}
+    for app in args.apps:
+        if args.twister:
+            report["results"][app] = run_twister(app, APPS[app], args.build_root)
+        else:
+            report["results"][app] = run_direct(app, args.build_root, args.timeout)
+
+    text = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, "w", encoding="utf-8") as f:
+            f.write(text + "\n")
+    else:
+        print(text)
+
+    if args.compare:
+        with open(args.compare, encoding="utf-8") as f:
+            old = json.load(f)
+        if compare(old, report, args.threshold):
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
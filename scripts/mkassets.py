@@ -0,0 +1,235 @@
+#!/usr/bin/env python3
+#
+# Build the flash sound asset bank (voice prompts) from a manifest.
+#
+# Each manifest line is "<id> <name> <source>". A source is a WAV file
+# (16-bit PCM, mono; resampled to 16 kHz if needed) relative to the
+# manifest, or "tone:<hz>:<ms>" for a generated test tone. Payloads are
+# IMA ADPCM in independently decodable 256-sample blocks, bit-exact with
+# common/src/adpcm.c.
+#
+# Bank layout (little endian), read by common/src/asset_bank.c:
+#   header  u32 magic "OMIA", u16 version, u16 count
+#   entry   u16 id, u8 codec, u8 reserved, u16 block_samples, u16 rate,
+#           u32 samples, u32 offset, u32 size, char name[12]
+#   payload blocks, offsets from the start of the bank
+#
+# Usage:
+#   scripts/mkassets.py -o omi_assets.inc common/assets/assets.txt
+#   scripts/mkassets.py --stats common/assets/assets.txt
+#
+
+import argparse
+import math
+import os
+import re
+import struct
+import sys
+import wave
+
+MAGIC = 0x41494D4F  # "OMIA"
+VERSION = 1
+RATE = 16000
+BLOCK_SAMPLES = 256
+NAME_LEN = 12
+HEADER = struct.Struct("<IHH")
+ENTRY = struct.Struct(f"<HBBHHIII{NAME_LEN}s")
+
+CODEC_PCM16 = 0
+CODEC_ADPCM = 1
+
+STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767,
+]
+INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8]
+
+
+class AssetError(Exception):
+    pass
+
+
+class Adpcm:
+    """IMA ADPCM encoder state, mirroring adpcm_step()/adpcm_encode_sample()."""
+
+    def __init__(self):
+        self.pred = 0
+        self.index = 0
+
+    def step(self, code):
+        step = STEP_TABLE[self.index]
+        diff = step >> 3
+        if code & 4:
+            diff += step
+        if code & 2:
+            diff += step >> 1
+        if code & 1:
+            diff += step >> 2
+        pred = self.pred - diff if code & 8 else self.pred + diff
+        self.pred = max(-32768, min(32767, pred))
+        self.index = max(0, min(88, self.index + INDEX_TABLE[code]))
+
+    def encode_sample(self, sample):
+        step = STEP_TABLE[self.index]
+        diff = sample - self.pred
+        code = 0
+        if diff < 0:
+            code = 8
+            diff = -diff
+        if diff >= step:
+            code |= 4
+            diff -= step
+        if diff >= step >> 1:
+            code |= 2
+            diff -= step >> 1
+        if diff >= step >> 2:
+            code |= 1
+        self.step(code)
+        return code
+
+    def encode_block(self, samples):
+        out = bytearray(struct.pack("<hBB", self.pred, self.index, 0))
+        for i in range(0, len(samples), 2):
+            lo = self.encode_sample(samples[i])
+            hi = self.encode_sample(samples[i + 1]) if i + 1 < len(samples) else 0
+            out.append(lo | (hi << 4))
+        return bytes(out)
+
+
+def resample(samples, rate):
+    if rate == RATE:
+        return samples
+    n = int(len(samples) * RATE / rate)
+    out = []
+    for i in range(n):
+        pos = i * rate / RATE
+        j = int(pos)
+        frac = pos - j
+        a = samples[j]
+        b = samples[min(j + 1, len(samples) - 1)]
+        out.append(int(round(a + (b - a) * frac)))
+    return out
+
+
+def load_wav(path):
+    with wave.open(path, "rb") as w:
+        if w.getnchannels() != 1 or w.getsampwidth() != 2:
+            raise AssetError(f"{path}: need 16-bit mono PCM")
+        rate = w.getframerate()
+        frames = w.readframes(w.getnframes())
+    samples = list(struct.unpack(f"<{len(frames) // 2}h", frames))
+    return resample(samples, rate)
+
+
+def tone(hz, ms):
+    n = RATE * ms // 1000
+    fade = min(n // 2, RATE // 100)     # 10 ms fades, no clicks
+    out = []
+    for i in range(n):
+        env = min(1.0, i / fade, (n - 1 - i) / fade) if fade else 1.0
+        out.append(int(round(16384 * env * math.sin(2 * math.pi * hz * i / RATE))))
+    return out
+
+
+def load_source(source, base):
+    m = re.fullmatch(r"tone:(\d+):(\d+)", source)
+    if m:
+        return tone(int(m.group(1)), int(m.group(2)))
+    return load_wav(os.path.join(base, source))
+
+
+def encode(samples):
+    enc = Adpcm()
+    payload = bytearray()
+    for i in range(0, len(samples), BLOCK_SAMPLES):
+        payload += enc.encode_block(samples[i:i + BLOCK_SAMPLES])
+    return bytes(payload)
+
+
+def parse_manifest(path):
+    assets = []
+    ids, names = set(), set()
+    base = os.path.dirname(path)
+    with open(path, encoding="utf-8") as f:
+        for lineno, line in enumerate(f, 1):
+            words = line.split("#", 1)[0].split()
+            if not words:
+                continue
+            try:
+                if len(words) != 3:
+                    raise AssetError("expected <id> <name> <source>")
+                asset_id, name, source = int(words[0], 0), words[1], words[2]
+                if not 0 < asset_id < 0x10000 or asset_id in ids:
+                    raise AssetError(f"bad or duplicate id {asset_id}")
+                if not re.fullmatch(r"[a-z_][a-z0-9_]*", name) or len(name) > NAME_LEN \
+                        or name in names:
+                    raise AssetError(f"bad or duplicate name '{name}' (max {NAME_LEN})")
+                samples = load_source(source, base)
+                if not samples:
+                    raise AssetError(f"'{source}' has no samples")
+            except (AssetError, ValueError, OSError, wave.Error) as e:
+                raise AssetError(f"{path}:{lineno}: {e}") from None
+            ids.add(asset_id)
+            names.add(name)
+            assets.append((asset_id, name, samples))
+    return assets
+
+
+def build_bank(assets):
+    table_size = HEADER.size + ENTRY.size * len(assets)
+    header = HEADER.pack(MAGIC, VERSION, len(assets))
+    entries = bytearray()
+    payloads = bytearray()
+    for asset_id, name, samples in assets:
+        payload = encode(samples)
+        offset = table_size + len(payloads)
+        entries += ENTRY.pack(asset_id, CODEC_ADPCM, 0, BLOCK_SAMPLES, RATE, len(samples),
+                              offset, len(payload), name.encode())
+        payloads += payload
+        payloads += bytes(-len(payloads) % 4)   # keep blocks word aligned
+    return header + bytes(entries) + bytes(payloads)
+
+
+def emit(bank, manifest):
+    out = [f"/* Generated by scripts/mkassets.py from {os.path.basename(manifest)}"
+           " - do not edit */", "",
+           f"static const uint8_t asset_bank_blob[{len(bank)}] __aligned(4) = {{"]
+    for i in range(0, len(bank), 16):
+        out.append("    " + " ".join(f"0x{b:02x}," for b in bank[i:i + 16]))
+    out.append("};")
+    return "\n".join(out) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build the ADPCM voice-prompt bank")
+    parser.add_argument("manifest", help="asset manifest")
+    parser.add_argument("-o", "--output", help="C include to write")
+    parser.add_argument("--stats", action="store_true", help="print per-asset sizes")
+    args = parser.parse_args()
+
+    try:
+        assets = parse_manifest(args.manifest)
+    except (AssetError, OSError) as e:
+        print(f"mkassets: {e}", file=sys.stderr)
+        return 1
+
+    bank = build_bank(assets)
+    if args.stats:
+        for asset_id, name, samples in assets:
+            print(f"{asset_id:5d} {name:12s} {len(samples) * 1000 // RATE:6d} ms "
+                  f"{len(encode(samples)):7d} bytes")
+        print(f"bank: {len(assets)} assets, {len(bank)} bytes")
+
+    if args.output:
+        with open(args.output, "w", encoding="utf-8") as f:
+            f.write(emit(bank, args.manifest))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
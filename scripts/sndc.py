@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+#
+# Compile UI sound descriptions (common/sounds/*.snd) into synth bytecode.
+#
+# The output is a C include read by common/src/synth.c: one byte array
+# per sound and the synth_sounds[] table. common/common.cmake runs this
+# at build time; run it by hand to check sizes or syntax.
+#
+# Format, one statement per line, '#' starts a comment:
+#   sound <name>                      start a new sound
+#   gain <0-255>                      master gain, Q8 per voice (default 64)
+#   voice <v> <wave> [attack=ms] [decay=ms] [sustain=0-100] [release=ms]
+#                                     wave: sine square triangle saw noise
+#   note <v> <note> [velocity]        note: C5, F#4, Bb3 or a MIDI number
+#   off <v>                           release a voice
+#   wait <ms>                         let the voices play
+# Times are rounded to 4 ms ticks; envelope times are limited to 1020 ms.
+#
+# Usage:
+#   scripts/sndc.py -o omi_sounds.inc common/sounds/*.snd
+#   scripts/sndc.py --stats common/sounds/*.snd
+#
+
+import argparse
+import os
+import re
+import sys
+
+TICK_MS = 4
+VOICES = 4
+NOTE_MAX = 119
+
+OP_END = 0x00
+OP_WAVE = 0x10
+OP_ENV = 0x20
+OP_NOTE = 0x30
+OP_OFF = 0x40
+OP_WAIT = 0x50
+OP_GAIN = 0x60
+
+WAVES = {"sine": 0, "square": 1, "triangle": 2, "saw": 3, "noise": 4}
+NOTE_NAMES = {"C": 0, "D": 2, "E": 4, "F": 5, "G": 7, "A": 9, "B": 11}
+
+
+class SndError(Exception):
+    pass
+
+
+def ticks(ms, limit=255):
+    t = int(round(float(ms) / TICK_MS))
+    if t < 0 or t > limit:
+        raise SndError(f"time {ms} ms out of range (max {limit * TICK_MS} ms)")
+    return t
+
+
+def parse_note(text):
+    if text.isdigit():
+        note = int(text)
+    else:
+        m = re.fullmatch(r"([A-Ga-g])([#b]?)(-?\d)", text)
+        if not m:
+            raise SndError(f"bad note '{text}'")
+        note = NOTE_NAMES[m.group(1).upper()] + 12 * (int(m.group(3)) + 1)
+        note += {"#": 1, "b": -1, "": 0}[m.group(2)]
+    if not 0 <= note <= NOTE_MAX:
+        raise SndError(f"note '{text}' out of range (max B8)")
+    return note
+
+
+def parse_voice(text):
+    v = int(text)
+    if not 0 <= v < VOICES:
+        raise SndError(f"voice {v} out of range (0-{VOICES - 1})")
+    return v
+
+
+def compile_voice(args):
+    if len(args) < 2 or args[1] not in WAVES:
+        raise SndError("usage: voice <v> <wave> [attack=ms] [decay=ms] [sustain=%] [release=ms]")
+    v = parse_voice(args[0])
+    env = {"attack": 0, "decay": 0, "sustain": 100, "release": 0}
+    for kv in args[2:]:
+        key, _, value = kv.partition("=")
+        if key not in env or not value:
+            raise SndError(f"bad envelope parameter '{kv}'")
+        env[key] = float(value)
+    sustain = int(round(env["sustain"] * 255 / 100))
+    if not 0 <= sustain <= 255:
+        raise SndError("sustain is a percentage")
+    return [OP_WAVE | v, WAVES[args[1]],
+            OP_ENV | v, ticks(env["attack"]), ticks(env["decay"]), sustain,
+            ticks(env["release"])]
+
+
+def compile_wait(ms):
+    code = []
+    t = ticks(ms, limit=1 << 16)
+    while t > 0:
+        step = min(t, 255)
+        code += [OP_WAIT, step]
+        t -= step
+    return code
+
+
+def compile_statement(words):
+    cmd, args = words[0], words[1:]
+    if cmd == "gain":
+        g = int(args[0])
+        if not 0 <= g <= 255:
+            raise SndError("gain is 0-255")
+        return [OP_GAIN, g]
+    if cmd == "voice":
+        return compile_voice(args)
+    if cmd == "note":
+        if len(args) not in (2, 3):
+            raise SndError("usage: note <v> <note> [velocity]")
+        vel = int(args[2]) if len(args) == 3 else 127
+        if not 0 <= vel <= 127:
+            raise SndError("velocity is 0-127")
+        return [OP_NOTE | parse_voice(args[0]), parse_note(args[1]), vel]
+    if cmd == "off":
+        return [OP_OFF | parse_voice(args[0])]
+    if cmd == "wait":
+        return compile_wait(args[0])
+    raise SndError(f"unknown statement '{cmd}'")
+
+
+def compile_file(path, sounds):
+    name = None
+    with open(path, encoding="utf-8") as f:
+        for lineno, line in enumerate(f, 1):
+            words = line.split("#", 1)[0].split()
+            if not words:
+                continue
+            try:
+                if words[0] == "sound":
+                    if len(words) != 2 or not re.fullmatch(r"[a-z_][a-z0-9_]*", words[1]):
+                        raise SndError("usage: sound <name> (lower-case identifier)")
+                    name = words[1]
+                    if name in sounds:
+                        raise SndError(f"duplicate sound '{name}'")
+                    sounds[name] = []
+                elif name is None:
+                    raise SndError("statement before the first 'sound'")
+                else:
+                    sounds[name] += compile_statement(words)
+            except (SndError, ValueError, IndexError) as e:
+                raise SndError(f"{path}:{lineno}: {e}") from None
+
+
+def emit(sounds, sources):
+    out = ["/* Generated by scripts/sndc.py from "
+           + ", ".join(os.path.basename(s) for s in sources) + " - do not edit */", ""]
+    for name, code in sounds.items():
+        code = code + [OP_END]
+        out.append(f"static const uint8_t sound_{name}[{len(code)}] = {{")
+        for i in range(0, len(code), 12):
+            out.append("    " + " ".join(f"0x{b:02x}," for b in code[i:i + 12]))
+        out.append("};")
+        out.append("")
+    out.append("static const struct synth_sound synth_sounds[] = {")
+    for name in sounds:
+        out.append(f"    {{ \"{name}\", sound_{name}, sizeof(sound_{name}) }},")
+    out.append("};")
+    return "\n".join(out) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compile UI sounds into synth bytecode")
+    parser.add_argument("sources", nargs="+", help=".snd files")
+    parser.add_argument("-o", "--output", help="C include to write")
+    parser.add_argument("--stats", action="store_true", help="print bytecode size per sound")
+    args = parser.parse_args()
+
+    sounds = {}
+    try:
+        for path in sorted(args.sources):
+            compile_file(path, sounds)
+    except (OSError, SndError) as e:
+        print(f"sndc: {e}", file=sys.stderr)
+        return 1
+    if not sounds:
+        print("sndc: no sounds defined", file=sys.stderr)
+        return 1
+
+    if args.stats:
+        total = 0
+        for name, code in sounds.items():
+            print(f"{name:16s} {len(code) + 1:4d} bytes")
+            total += len(code) + 1
+        print(f"{'total':16s} {total:4d} bytes")
+
+    if args.output:
+        with open(args.output, "w", encoding="utf-8") as f:
+            f.write(emit(sounds, sorted(args.sources)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+#
+# Replay a WAV file as the phone's speak() packet stream, for load tests
+# of BLE ingest and playback on native_sim without a phone or a radio.
+#
+# The phone sends one 4-byte little-endian header with the transfer length
+# in bytes, then the 8 kHz 16-bit mono samples in PACKET_SIZE (400-byte,
+# 25 ms) packets. This script produces that stream and sends it to a
+# native_sim build with CONFIG_OMI_INGEST_HOST=y, where
+# OMI_APP/src/ingest_host.c passes each packet to ingest_submit(). On the
+# socket every packet is framed as a little-endian u16 length plus payload.
+#
+# Timing faults are seeded so runs are reproducible:
+#   --burst N      deliver N packets back to back every N intervals, as
+#                  when several packets share one connection event
+#   --jitter MS    delay each delivery by a random 0..MS ms
+#   --loss PCT     drop data packets, in runs of --loss-run packets
+#   --speed X      send X times faster than real time (throughput tests)
+# The "ingest" shell command then shows drops, queue depth, queue wait
+# and playback underruns.
+#
+# Usage:
+#   west build -b native_sim OMI_APP -- -DCONFIG_OMI_INGEST_HOST=y
+#   scripts/speak_replay.py speech.wav --jitter 40 --burst 3
+#   scripts/speak_replay.py tone:440:10000 --loss 2 --loss-run 3 --seed 7
+#   scripts/speak_replay.py speech.wav -o stream.bin     # framed stream to a file
+#
+
+import argparse
+import math
+import random
+import re
+import socket
+import struct
+import sys
+import time
+import wave
+
+RATE = 8000
+PACKET_SIZE = 400
+DEFAULT_PORT = 5590
+FRAME = struct.Struct("<H")
+
+
+class ReplayError(Exception):
+    pass
+
+
+def resample(samples, rate):
+    if rate == RATE:
+        return samples
+    n = int(len(samples) * RATE / rate)
+    out = []
+    for i in range(n):
+        pos = i * rate / RATE
+        j = int(pos)
+        frac = pos - j
+        a = samples[j]
+        b = samples[min(j + 1, len(samples) - 1)]
+        out.append(int(round(a + (b - a) * frac)))
+    return out
+
+
+def load_wav(path):
+    with wave.open(path, "rb") as w:
+        channels = w.getnchannels()
+        if w.getsampwidth() != 2:
+            raise ReplayError(f"{path}: need 16-bit PCM")
+        rate = w.getframerate()
+        frames = w.readframes(w.getnframes())
+    samples = struct.unpack(f"<{len(frames) // 2}h", frames)
+    # Mix down to mono
+    mono = [sum(samples[i:i + channels]) // channels for i in range(0, len(samples), channels)]
+    return resample(mono, rate)
+
+
+def tone(hz, ms):
+    n = RATE * ms // 1000
+    return [int(round(16384 * math.sin(2 * math.pi * hz * i / RATE))) for i in range(n)]
+
+
+def load_source(source):
+    m = re.fullmatch(r"tone:(\d+):(\d+)", source)
+    if m:
+        return tone(int(m.group(1)), int(m.group(2)))
+    return load_wav(source)
+
+
+def packets(samples, packet_size):
+    """The speak() transfer: length header, then the PCM in packets.
+
+    speak() takes any 4-byte packet for a header, so a 4-byte tail goes
+    out as two 2-byte packets.
+    """
+    pcm = struct.pack(f"<{len(samples)}h", *samples)
+    yield struct.pack("<I", len(pcm))
+    for i in range(0, len(pcm), packet_size):
+        pkt = pcm[i:i + packet_size]
+        if len(pkt) == 4:
+            yield pkt[:2]
+            yield pkt[2:]
+        else:
+            yield pkt
+
+
+class Schedule:
+    """Send times and losses for a packet sequence, from a seeded RNG."""
+
+    def __init__(self, args, transfer):
+        self.rng = random.Random(args.seed * 1000 + transfer)
+        self.interval = args.packet_size / 2 / RATE / args.speed
+        self.burst = max(1, args.burst)
+        self.jitter = args.jitter / 1000.0
+        self.loss = args.loss / 100.0
+        self.loss_run = max(1, args.loss_run)
+        self.losing = 0
+        self.last = 0.0
+
+    def send_time(self, index):
+        # A burst goes out when its last packet would have been due
+        slot = (index // self.burst + 1) * self.burst - 1
+        t = slot * self.interval + self.rng.uniform(0, self.jitter)
+        self.last = max(self.last, t)           # the link never reorders
+        return self.last
+
+    def lost(self, is_header):
+        if is_header:
+            return False
+        if self.losing == 0 and self.rng.random() < self.loss / self.loss_run:
+            self.losing = self.loss_run
+        if self.losing:
+            self.losing -= 1
+            return True
+        return False
+
+
+class SocketOut:
+    """Unbuffered writes, so each packet leaves at its scheduled time."""
+
+    def __init__(self, sock):
+        self.sock = sock
+
+    def write(self, data):
+        self.sock.sendall(data)
+
+    def flush(self):
+        pass
+
+
+def replay(args, samples, out):
+    stats = {"packets": 0, "lost": 0, "bytes": 0, "max_late_ms": 0.0}
+    for rep in range(args.repeat):
+        sched = Schedule(args, rep)
+        start = time.monotonic()
+        for index, pkt in enumerate(packets(samples, args.packet_size)):
+            due = start + sched.send_time(index)
+            if sched.lost(index == 0):
+                stats["lost"] += 1
+                continue
+            if args.output is None:
+                delay = due - time.monotonic()
+                if delay > 0:
+                    time.sleep(delay)
+                stats["max_late_ms"] = max(stats["max_late_ms"],
+                                           (time.monotonic() - due) * 1000)
+            out.write(FRAME.pack(len(pkt)) + pkt)
+            stats["packets"] += 1
+            stats["bytes"] += len(pkt)
+        out.flush()
+        if rep + 1 < args.repeat and args.output is None:
+            time.sleep(args.gap / 1000.0)
+    return stats
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Replay a WAV file as speak() packets")
+    parser.add_argument("source", help="WAV file (16-bit PCM) or tone:<hz>:<ms>")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=DEFAULT_PORT,
+                        help=f"CONFIG_OMI_INGEST_HOST_PORT (default {DEFAULT_PORT})")
+    parser.add_argument("-o", "--output", help="write the framed stream here instead "
+                        "of sending it (no timing; '-' for stdout)")
+    parser.add_argument("--packet-size", type=int, default=PACKET_SIZE,
+                        help=f"data packet bytes, at most {PACKET_SIZE}")
+    parser.add_argument("--speed", type=float, default=1.0, help="real-time multiple")
+    parser.add_argument("--burst", type=int, default=1, help="packets per delivery")
+    parser.add_argument("--jitter", type=float, default=0.0, help="max extra delay (ms)")
+    parser.add_argument("--loss", type=float, default=0.0, help="data packets lost (%%)")
+    parser.add_argument("--loss-run", type=int, default=1, help="consecutive packets per loss")
+    parser.add_argument("--repeat", type=int, default=1, help="transfers to send")
+    parser.add_argument("--gap", type=float, default=500.0, help="pause between transfers (ms)")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    if not 2 <= args.packet_size <= PACKET_SIZE or args.packet_size % 2:
+        parser.error(f"--packet-size must be even and 2..{PACKET_SIZE}")
+    if args.packet_size == 4:
+        parser.error("4-byte packets would be taken for length headers")
+    if args.speed <= 0:
+        parser.error("--speed must be positive")
+
+    try:
+        samples = load_source(args.source)
+        if args.output == "-":
+            stats = replay(args, samples, sys.stdout.buffer)
+        elif args.output:
+            with open(args.output, "wb") as f:
+                stats = replay(args, samples, f)
+        else:
+            with socket.create_connection((args.host, args.port)) as sock:
+                sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+                stats = replay(args, samples, SocketOut(sock))
+    except (ReplayError, OSError, wave.Error) as e:
+        print(f"speak_replay: {e}", file=sys.stderr)
+        return 1
+
+    seconds = len(samples) * args.repeat / RATE
+    print(f"speak_replay: {args.repeat} x {seconds / args.repeat:.2f} s, "
+          f"{stats['packets']} packets ({stats['bytes']} bytes) sent, {stats['lost']} lost, "
+          f"max {stats['max_late_ms']:.1f} ms late", file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
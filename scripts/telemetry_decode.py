@@ -0,0 +1,215 @@
+#!/usr/bin/env python3
+#
+# Decode OMI binary telemetry records (OMI_APP/src/telemetry.h).
+#
+# Records come from the "telemetry" shell command, which prints one
+# "TLM <hex>" line, or from the telemetry GATT characteristic as raw
+# bytes. Input lines may be bare hex or any log line containing
+# "TLM <hex>", so a whole console capture can be piped in. Every field
+# is cumulative since boot; with --delta, consecutive records are
+# differenced to give per-interval rates. Estimated charge per subsystem
+# (an appended section) is turned into average current, i.e. uAh/hour.
+# Audio path latency percentiles follow in a second appended section.
+#
+# Usage:
+#   scripts/telemetry_decode.py console.log
+#   scripts/telemetry_decode.py --bin record.bin
+#   scripts/telemetry_decode.py --json --delta console.log > fleet.jsonl
+#
+
+import argparse
+import json
+import re
+import struct
+import sys
+
+VERSION = 1
+HEADER = struct.Struct("<BBHI")
+AUDIO = struct.Struct("<IIIIHH")
+CPU = struct.Struct("<II")
+IO = struct.Struct("<9I")
+TAIL = struct.Struct("<I")
+# Appended sections, decoded when the record's size covers them
+ENERGY = struct.Struct("<4I")
+LATENCY = struct.Struct("<5I")
+
+IO_NAMES = ("sd_read", "sd_write")
+ENERGY_NAMES = ("cpu", "amp", "pwm", "sd")
+LATENCY_NAMES = ("ingest",)
+LATENCY_FIELDS = ("count", "p50_us", "p90_us", "p99_us", "max_us")
+IO_FIELDS = ("ops", "errors", "bytes", "busy_ms", "stalls", "p50_us", "p90_us", "p99_us",
+             "max_us")
+RECORD_SIZE = HEADER.size + AUDIO.size + CPU.size + IO.size * len(IO_NAMES) + TAIL.size
+FREE_UNKNOWN = 0xFFFFFFFF
+
+# Counters that only grow; --delta reports their increase per interval
+COUNTERS = ("blocks_played", "underruns", "ingest_dropped", "cpu_busy_ms", "cpu_total_ms")
+IO_COUNTERS = ("ops", "errors", "bytes", "busy_ms", "stalls")
+
+TLM_LINE = re.compile(r"(?:^|TLM\s+)([0-9a-fA-F]{16,})\s*$")
+
+
+class TelemetryError(Exception):
+    pass
+
+
+def decode(data):
+    if len(data) < HEADER.size:
+        raise TelemetryError(f"record too short ({len(data)} bytes)")
+    version, _, size, uptime_s = HEADER.unpack_from(data)
+    if version != VERSION:
+        raise TelemetryError(f"unsupported version {version}")
+    if size < RECORD_SIZE or len(data) < RECORD_SIZE:
+        raise TelemetryError(f"record is {len(data)} bytes, header says {size}, "
+                             f"version {VERSION} needs {RECORD_SIZE}")
+
+    rec = {"version": version, "size": size, "uptime_s": uptime_s}
+    off = HEADER.size
+    (rec["blocks_played"], rec["underruns"], rec["ingest_dropped"], rec["capture_dropped"],
+     rec["pool_min_free"], _) = AUDIO.unpack_from(data, off)
+    off += AUDIO.size
+    rec["cpu_busy_ms"], rec["cpu_total_ms"] = CPU.unpack_from(data, off)
+    off += CPU.size
+    for name in IO_NAMES:
+        rec[name] = dict(zip(IO_FIELDS, IO.unpack_from(data, off)))
+        off += IO.size
+    (free_kb,) = TAIL.unpack_from(data, off)
+    rec["sd_free_kb"] = None if free_kb == FREE_UNKNOWN else free_kb
+    off += TAIL.size
+    if size >= off + ENERGY.size and len(data) >= off + ENERGY.size:
+        rec["charge_uah"] = dict(zip(ENERGY_NAMES, ENERGY.unpack_from(data, off)))
+        off += ENERGY.size
+    latency_size = LATENCY.size * len(LATENCY_NAMES)
+    if "charge_uah" in rec and size >= off + latency_size and len(data) >= off + latency_size:
+        rec["latency"] = {}
+        for name in LATENCY_NAMES:
+            rec["latency"][name] = dict(zip(LATENCY_FIELDS, LATENCY.unpack_from(data, off)))
+            off += LATENCY.size
+    # Fields appended by newer firmware of the same version are skipped
+    return rec
+
+
+def derive(rec):
+    """Rates computed from one record (since boot) or one delta (per interval)."""
+    out = {}
+    if rec["cpu_total_ms"]:
+        out["cpu_load_pct"] = round(100.0 * rec["cpu_busy_ms"] / rec["cpu_total_ms"], 1)
+    for name in IO_NAMES:
+        io = rec[name]
+        if io["busy_ms"]:
+            out[f"{name}_kib_s"] = round(io["bytes"] / 1.024 / io["busy_ms"], 1)
+    seconds = rec.get("interval_s", rec["uptime_s"])
+    if "charge_uah" in rec and seconds:
+        # uAh per hour is the average current in uA
+        out["avg_ua"] = {k: round(v * 3600 / seconds) for k, v in rec["charge_uah"].items()}
+    return out
+
+
+def delta(prev, cur):
+    if cur["uptime_s"] < prev["uptime_s"]:
+        return None                             # the device rebooted in between
+    d = {"uptime_s": cur["uptime_s"], "interval_s": cur["uptime_s"] - prev["uptime_s"]}
+    for key in COUNTERS:
+        d[key] = (cur[key] - prev[key]) & 0xFFFFFFFF
+    for name in IO_NAMES:
+        d[name] = {key: (cur[name][key] - prev[name][key]) & 0xFFFFFFFF for key in IO_COUNTERS}
+    if "charge_uah" in cur and "charge_uah" in prev:
+        d["charge_uah"] = {k: (cur["charge_uah"][k] - prev["charge_uah"][k]) & 0xFFFFFFFF
+                           for k in ENERGY_NAMES}
+    return d
+
+
+def read_records(args):
+    if args.bin:
+        for path in args.bin:
+            with open(path, "rb") as f:
+                yield path, f.read()
+        return
+    files = args.input or ["-"]
+    for path in files:
+        f = sys.stdin if path == "-" else open(path, encoding="utf-8", errors="replace")
+        with f:
+            for lineno, line in enumerate(f, 1):
+                m = TLM_LINE.search(line.strip())
+                if m and len(m.group(1)) % 2 == 0:
+                    yield f"{path}:{lineno}", bytes.fromhex(m.group(1))
+
+
+def print_record(rec, where):
+    free = "unknown" if rec["sd_free_kb"] is None else f"{rec['sd_free_kb'] // 1024} MiB"
+    print(f"{where}: v{rec['version']}, up {rec['uptime_s']} s")
+    print(f"  audio: {rec['blocks_played']} blocks, {rec['underruns']} underruns, "
+          f"{rec['ingest_dropped']} BLE drops, {rec['capture_dropped']} capture drops, "
+          f"pool low-water {rec['pool_min_free']}")
+    rates = derive(rec)
+    print(f"  cpu: {rates.get('cpu_load_pct', 0.0)}% since boot")
+    for name in IO_NAMES:
+        io = rec[name]
+        print(f"  {name}: {io['ops']} ops, {io['errors']} errors, {io['stalls']} stalls, "
+              f"p50/p90/p99/max {io['p50_us']}/{io['p90_us']}/{io['p99_us']}/"
+              f"{io['max_us']} us, {rates.get(f'{name}_kib_s', 0.0)} KiB/s")
+    print(f"  sd free: {free}")
+    if "charge_uah" in rec:
+        print_energy(rec, rates)
+    for name, lat in rec.get("latency", {}).items():
+        print(f"  {name} latency: {lat['count']} samples, p50/p90/p99/max {lat['p50_us']}/"
+              f"{lat['p90_us']}/{lat['p99_us']}/{lat['max_us']} us")
+
+
+def print_energy(rec, rates):
+    avg = rates.get("avg_ua", {})
+    parts = [f"{k} {v} uAh ({avg.get(k, 0)} uA)" for k, v in rec["charge_uah"].items()]
+    print("  energy: " + ", ".join(parts) + f"; total {sum(avg.values())} uA average")
+
+
+def print_delta(d):
+    rates = derive(d)
+    parts = [f"+{d['interval_s']} s", f"cpu {rates.get('cpu_load_pct', 0.0)}%",
+             f"{d['underruns']} underruns", f"{d['ingest_dropped']} BLE drops"]
+    for name in IO_NAMES:
+        parts.append(f"{name} {d[name]['ops']} ops/{d[name]['stalls']} stalls/"
+                     f"{rates.get(f'{name}_kib_s', 0.0)} KiB/s")
+    print("  delta: " + ", ".join(parts))
+    if "charge_uah" in d:
+        print_energy(d, rates)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode OMI binary telemetry records")
+    parser.add_argument("input", nargs="*", help="log files with TLM lines (default stdin)")
+    parser.add_argument("--bin", nargs="+", metavar="FILE", help="raw records, e.g. GATT reads")
+    parser.add_argument("--json", action="store_true", help="one JSON object per record")
+    parser.add_argument("--delta", action="store_true",
+                        help="difference consecutive records of one device")
+    args = parser.parse_args()
+
+    prev = None
+    count = 0
+    try:
+        for where, data in read_records(args):
+            try:
+                rec = decode(data)
+            except TelemetryError as e:
+                print(f"telemetry_decode: {where}: {e}", file=sys.stderr)
+                continue
+            count += 1
+            d = delta(prev, rec) if args.delta and prev is not None else None
+            if args.json:
+                rec["derived"] = derive(rec)
+                if d is not None:
+                    d["derived"] = derive(d)
+                    rec["delta"] = d
+                print(json.dumps(rec))
+            else:
+                print_record(rec, where)
+                if d is not None:
+                    print_delta(d)
+            prev = rec
+    except OSError as e:
+        print(f"telemetry_decode: {e}", file=sys.stderr)
+        return 1
+    return 0 if count else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())